@@ -0,0 +1,103 @@
+/*!
+    @file acpi.h
+
+    @brief Access to the ACPI tables.
+
+    Validates the RSDP provided by the bootloader and finds tables by their signature using the XSDT (or RSDT on ACPI 1.0 systems).
+    Tables are accessed through the higher half direct map, nothing is copied.
+    Only memory that Limine maps into the HHDM is read, see acpi_init().
+
+    @note The tables are stored in ACPI reclaimable memory, so they have to be read before that memory is reclaimed by the PMM.
+          acpi_release() has to be called before.
+
+    @author frischerZucker
+*/
+
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <limine.h>
+
+/*!
+    @brief Error codes used by this module.
+*/
+typedef enum
+{
+    ACPI_OK = 0,
+    ACPI_ERROR_INVALID_RSDP,
+    ACPI_ERROR_INVALID_TABLE,
+    ACPI_ERROR_NOT_INITIALIZED,
+    ACPI_ERROR_NOT_MAPPED
+} acpi_error_codes_t;
+
+/*!
+    @brief Root System Description Pointer.
+
+    The fields behind revision are only valid for ACPI 2.0 and newer.
+*/
+struct acpi_rsdp_t
+{
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed));
+
+/*!
+    @brief Header every System Description Table starts with.
+*/
+struct acpi_sdt_header_t
+{
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed));
+
+/*!
+    @brief Validates the RSDP and remembers the root table.
+
+    Uses the XSDT if the RSDP is revision 2 or newer, the RSDT otherwise.
+    With base revision 3, Limine doesn't map reserved memory into the HHDM, and on BIOS systems the RSDP usually lies there (0xe0000 - 0xfffff).
+    So the memory map is checked before anything is read, memory that is not mapped is left alone instead of faulting.
+
+    @param rsdp_phys Physical address of the RSDP.
+    @param hhdm_offset Offset used by the higher half direct map.
+    @param memmap Limines memory map. Is used until acpi_release() is called.
+    @returns ACPI_OK on success, ACPI_ERROR_INVALID_RSDP if the RSDP or root table is invalid,
+             ACPI_ERROR_NOT_MAPPED if one of them is not covered by the HHDM.
+*/
+acpi_error_codes_t acpi_init(uintptr_t rsdp_phys, ptrdiff_t hhdm_offset, struct limine_memmap_response *memmap);
+
+/*!
+    @brief Searches a table by its signature.
+
+    Only tables with a valid checksum that are covered by the HHDM are returned.
+
+    @param signature Signature of the table, e.g. "SRAT".
+    @returns Pointer (virtual address) to the tables header, or NULL if there is no such table or acpi_release() was called.
+*/
+struct acpi_sdt_header_t * acpi_find_table(const char signature[4]);
+
+/*!
+    @brief Forgets the root table, the memory map and the SRAT (see srat_release()).
+
+    Must be called before ACPI reclaimable or bootloader reclaimable memory is reclaimed by the PMM,
+    as the pointers would point into memory that might be handed out again. acpi_find_table() returns NULL afterwards.
+*/
+void acpi_release();
+
+#endif // ACPI_H
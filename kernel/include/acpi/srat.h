@@ -0,0 +1,69 @@
+/*!
+    @file srat.h
+
+    @brief Parser for the ACPI System Resource Affinity Table (SRAT).
+
+    The SRAT tells which proximity domain (NUMA node) each range of memory and each CPU belongs to.
+    Memory ranges are handed to the PMM (see pmm_set_node_ranges()), so it can prefer memory close to the allocating CPU.
+
+    @author frischerZucker
+*/
+
+#ifndef SRAT_H
+#define SRAT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "acpi/acpi.h"
+#include "memory/pmm.h"
+
+/*!
+    @brief SRAT entry types.
+*/
+typedef enum
+{
+    SRAT_ENTRY_CPU_AFFINITY = 0,
+    SRAT_ENTRY_MEMORY_AFFINITY = 1,
+    SRAT_ENTRY_X2APIC_AFFINITY = 2
+} srat_entry_types_t;
+
+/// @brief Entry is enabled, disabled entries must be ignored.
+#define SRAT_FLAG_ENABLED (1 << 0)
+
+/*!
+    @brief Searches the SRAT.
+
+    @returns ACPI_OK if a valid SRAT was found, ACPI_ERROR_INVALID_TABLE if there is none (e.g. on non-NUMA systems).
+*/
+acpi_error_codes_t srat_init();
+
+/*!
+    @brief Gets the enabled memory ranges and their proximity domains.
+
+    @param ranges Array where the ranges should be stored.
+    @param max_ranges Number of ranges that fit into the array. Further ranges are ignored.
+    @returns Number of ranges stored in the array, 0 if there is no SRAT.
+*/
+size_t srat_get_memory_ranges(struct pmm_node_range_t *ranges, size_t max_ranges);
+
+/*!
+    @brief Gets the proximity domain of a CPU.
+
+    Looks at both local APIC and x2APIC affinity entries.
+
+    @param apic_id APIC ID of the CPU.
+    @param node Pointer to the variable where the proximity domain should be stored.
+    @returns true if the CPU was found, false if not.
+*/
+bool srat_get_cpu_node(uint32_t apic_id, uint32_t *node);
+
+/*!
+    @brief Forgets the SRAT, called by acpi_release().
+
+    srat_get_memory_ranges() and srat_get_cpu_node() find nothing afterwards.
+*/
+void srat_release();
+
+#endif // SRAT_H
@@ -0,0 +1,29 @@
+/*!
+    @file benchmark.h
+
+    @brief In-kernel benchmarks.
+
+    Provides benchmarks for kernel subsystems that run inside the (QEMU) guest, as they need the real hardware / memory map.
+    Timing is done with the time stamp counter, so all results are given in CPU cycles.
+    Results are logged with LOG_INFO.
+
+    The benchmarks are only compiled in if BENCHMARKS is set to 1 in kernel/GNUmakefile.
+
+    @author frischerZucker
+*/
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <stddef.h>
+
+/*!
+    @brief Runs all benchmarks.
+
+    Must be called after the PMM, kmalloc() and the VMM are initialized.
+
+    @param hhdm_offset Offset used by the higher half direct map.
+*/
+void benchmark_run_all(ptrdiff_t hhdm_offset);
+
+#endif // BENCHMARK_H
@@ -0,0 +1,207 @@
+/*!
+    @file cpu.h
+
+    @brief Per-CPU helpers.
+
+    Provides the number of the CPU the code is running on, so that per-CPU data can be indexed by it,
+    and functions to keep interrupt handlers from interrupting accesses to per-CPU data.
+
+    @note Only the bootstrap processor is running for now, so cpu_get_id() always returns 0.
+          Once the other cores are brought up, it has to return their real number.
+
+    @author frischerZucker
+*/
+
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// @brief Maximum number of CPUs that per-CPU data is reserved for.
+#define CPU_MAX_CPUS 16
+
+/// @brief Size of a cache line in byte. Per-CPU data is aligned to it, so CPUs don't fight over the same line.
+#define CPU_CACHE_LINE_SIZE 64
+
+/// @brief Interrupt flag in RFLAGS.
+#define CPU_RFLAGS_IF (1 << 9)
+
+/// @brief CPUID leaf with the basic feature flags.
+#define CPU_CPUID_FEATURES 0x1
+/// @brief Bit in EDX of CPU_CPUID_FEATURES that is set if global pages are supported.
+#define CPU_CPUID_EDX_PGE (1 << 13)
+/// @brief Bit in ECX of CPU_CPUID_FEATURES that is set if process-context identifiers are supported.
+#define CPU_CPUID_ECX_PCID (1 << 17)
+/// @brief CPUID leaf returning the highest extended leaf.
+#define CPU_CPUID_EXTENDED_MAX 0x80000000
+/// @brief CPUID leaf with the extended feature flags.
+#define CPU_CPUID_EXTENDED_FEATURES 0x80000001
+/// @brief Bit in EDX of CPU_CPUID_EXTENDED_FEATURES that is set if the execute-disable bit is supported.
+#define CPU_CPUID_EDX_NX (1 << 20)
+/// @brief Bit in EDX of CPU_CPUID_EXTENDED_FEATURES that is set if 1 GB pages are supported.
+#define CPU_CPUID_EDX_PAGE_1GB (1 << 26)
+
+/*!
+    @brief Gets the number of the CPU the code is running on.
+
+    @returns Number of the current CPU, between 0 and CPU_MAX_CPUS - 1.
+*/
+static inline uint32_t cpu_get_id(void)
+{
+    return 0;
+}
+
+/*!
+    @brief Executes CPUID.
+
+    @param leaf Value of EAX, selects the information to return.
+    @param subleaf Value of ECX, only used by some leaves.
+    @param eax Pointer to where EAX is stored.
+    @param ebx Pointer to where EBX is stored.
+    @param ecx Pointer to where ECX is stored.
+    @param edx Pointer to where EDX is stored.
+*/
+static inline void cpu_cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
+{
+    asm volatile (
+        "cpuid"
+        : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+        : "a"(leaf), "c"(subleaf)
+    );
+}
+
+/*!
+    @brief Gets the initial APIC ID of the CPU the code is running on.
+
+    Read from CPUID leaf 1, used to look up the CPU in ACPI tables.
+
+    @returns APIC ID of the current CPU.
+*/
+static inline uint32_t cpu_get_apic_id(void)
+{
+    uint32_t eax;
+    uint32_t ebx;
+    uint32_t ecx;
+    uint32_t edx;
+
+    cpu_cpuid(CPU_CPUID_FEATURES, 0, &eax, &ebx, &ecx, &edx);
+
+    return ebx >> 24;
+}
+
+/*!
+    @brief Checks if the CPU supports process-context identifiers (PCIDs).
+
+    @returns true if CR4.PCIDE can be set.
+*/
+static inline bool cpu_has_pcid(void)
+{
+    uint32_t eax;
+    uint32_t ebx;
+    uint32_t ecx;
+    uint32_t edx;
+
+    cpu_cpuid(CPU_CPUID_FEATURES, 0, &eax, &ebx, &ecx, &edx);
+
+    return (ecx & CPU_CPUID_ECX_PCID) != 0;
+}
+
+/*!
+    @brief Checks if the CPU supports global pages.
+
+    @returns true if CR4.PGE can be set.
+*/
+static inline bool cpu_has_global_pages(void)
+{
+    uint32_t eax;
+    uint32_t ebx;
+    uint32_t ecx;
+    uint32_t edx;
+
+    cpu_cpuid(CPU_CPUID_FEATURES, 0, &eax, &ebx, &ecx, &edx);
+
+    return (edx & CPU_CPUID_EDX_PGE) != 0;
+}
+
+/*!
+    @brief Reads EDX of the extended feature leaf.
+
+    @returns EDX of CPU_CPUID_EXTENDED_FEATURES, 0 if the leaf doesn't exist.
+*/
+static inline uint32_t cpu_get_extended_features(void)
+{
+    uint32_t eax;
+    uint32_t ebx;
+    uint32_t ecx;
+    uint32_t edx;
+
+    cpu_cpuid(CPU_CPUID_EXTENDED_MAX, 0, &eax, &ebx, &ecx, &edx);
+    if (eax < CPU_CPUID_EXTENDED_FEATURES)
+    {
+        return 0;
+    }
+
+    cpu_cpuid(CPU_CPUID_EXTENDED_FEATURES, 0, &eax, &ebx, &ecx, &edx);
+
+    return edx;
+}
+
+/*!
+    @brief Checks if the CPU supports the execute-disable bit.
+
+    @returns true if EFER.NXE can be set.
+*/
+static inline bool cpu_has_nx(void)
+{
+    return (cpu_get_extended_features() & CPU_CPUID_EDX_NX) != 0;
+}
+
+/*!
+    @brief Checks if the CPU supports 1 GB pages.
+
+    @returns true if PDPR entries can map 1 GB pages.
+*/
+static inline bool cpu_has_1gb_pages(void)
+{
+    return (cpu_get_extended_features() & CPU_CPUID_EDX_PAGE_1GB) != 0;
+}
+
+/*!
+    @brief Disables interrupts and returns the previous RFLAGS.
+
+    Used to protect per-CPU data from interrupt handlers running on the same CPU.
+    Pass the returned value to cpu_restore_interrupts() when done.
+
+    @returns RFLAGS before interrupts were disabled.
+*/
+static inline uint64_t cpu_disable_interrupts(void)
+{
+    uint64_t rflags;
+
+    asm volatile (
+        "pushfq\n"
+        "pop %0\n"
+        "cli"
+        : "=r"(rflags)
+        :
+        : "memory"
+    );
+
+    return rflags;
+}
+
+/*!
+    @brief Enables interrupts again if they were enabled before cpu_disable_interrupts() was called.
+
+    @param rflags RFLAGS returned by cpu_disable_interrupts().
+*/
+static inline void cpu_restore_interrupts(uint64_t rflags)
+{
+    if (rflags & CPU_RFLAGS_IF)
+    {
+        asm volatile ("sti" : : : "memory");
+    }
+}
+
+#endif // CPU_H
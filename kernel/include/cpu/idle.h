@@ -0,0 +1,21 @@
+/*!
+    @file idle.h
+
+    @brief Idle loop that is run when there is nothing else to do.
+
+    @author frischerZucker
+*/
+
+#ifndef IDLE_H
+#define IDLE_H
+
+/*!
+    @brief Idle loop.
+
+    Uses the time the CPU would otherwise spend halted for background work, like refilling the PMMs zeroed page pool.
+    Halts until the next interrupt once there is nothing left to do.
+    Interrupts must be enabled, otherwise the CPU would never wake up again.
+*/
+void idle(void);
+
+#endif // IDLE_H
@@ -356,6 +356,9 @@ struct interrupt_stack_frame
       prints a predefined error message and halts the system.
     - For exceptions with error codes (e.g. page fault),
       prints the description and the error code and halts.
+    - Page faults on pages that are not present are passed to vmm_handle_page_fault(), which resolves them inside of ranges allocated with VMM_FLAG_LAZY.
+      Faults on present pages are passed to paging_handle_cow_fault(), which resolves writes to copy-on-write pages.
+      All other page faults are printed and halt.
     - For external interrupts 0 to 15 (from the PIC), prints the IRQs number
       and sends an End-Of-Interrupt command.
     - For unknown / unhandled interrupts, prints a generic message 
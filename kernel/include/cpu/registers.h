@@ -31,13 +31,83 @@ static inline uint64_t read_cr3()
 
 static inline void set_cr3(uint64_t value)
 {
-    LOG_DEBUG("1");
-    asm(
+    asm volatile(
         "mov %0, %%cr3"
         :
         :"r"(value)
+        : "memory"
+    );
+}
+
+static inline uint64_t read_cr4()
+{
+    uint64_t cr4;
+
+    asm volatile(
+        "mov %%cr4, %0"
+        : "=r"(cr4)
+    );
+
+    return cr4;
+}
+
+static inline void set_cr4(uint64_t value)
+{
+    asm volatile(
+        "mov %0, %%cr4"
+        :
+        :"r"(value)
+        : "memory"
+    );
+}
+
+static inline uint64_t read_rsp()
+{
+    uint64_t rsp;
+
+    asm volatile(
+        "mov %%rsp, %0"
+        : "=r"(rsp)
     );
-    LOG_DEBUG("2");
+
+    return rsp;
+}
+
+static inline uint64_t read_msr(uint32_t msr)
+{
+    uint32_t low;
+    uint32_t high;
+
+    asm volatile(
+        "rdmsr"
+        : "=a"(low), "=d"(high)
+        : "c"(msr)
+    );
+
+    return ((uint64_t)high << 32) | low;
+}
+
+static inline void write_msr(uint32_t msr, uint64_t value)
+{
+    asm volatile(
+        "wrmsr"
+        :
+        : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32))
+        : "memory"
+    );
+}
+
+static inline uint64_t read_tsc()
+{
+    uint32_t low;
+    uint32_t high;
+
+    asm volatile(
+        "rdtsc"
+        : "=a"(low), "=d"(high)
+    );
+
+    return ((uint64_t)high << 32) | low;
 }
 
 #endif // REGISTERS_H
\ No newline at end of file
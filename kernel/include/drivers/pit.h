@@ -31,6 +31,9 @@
 #define PIT_MODE_SOFTWARE_TRIG_STROBE (1 << 3)
 #define PIT_MODE_HARDWARE_TRIG_STROBE ((1 << 3) | (1 << 1))
 
+// Time channel 2 counts down for when measuring the TSC frequency.
+#define PIT_TSC_CALIBRATION_MS 10
+
 /*!
     @brief Error codes used by the driver.
 */
@@ -61,4 +64,15 @@ typedef enum pit_error_codes
 */
 pit_error_codes pit_init_channel(uint8_t channel, uint64_t frequency, uint8_t mode);
 
+/*!
+    @brief Measures the frequency of the time stamp counter (TSC) using channel 2 of the PIT.
+
+    Lets channel 2 count down for PIT_TSC_CALIBRATION_MS milliseconds and reads the TSC before and after.
+    Channel 2 only drives the PC speaker, which is kept disabled, so this doesn't interfere with the timer interrupt on channel 0.
+    Takes PIT_TSC_CALIBRATION_MS milliseconds and busy waits the whole time.
+
+    @returns Frequency of the TSC in Hz.
+*/
+uint64_t pit_measure_tsc_frequency();
+
 #endif // PIT_H
\ No newline at end of file
@@ -0,0 +1,128 @@
+/*!
+    @file arena.h
+
+    @brief Arena (bump) allocator for memory that is freed all at once.
+
+    An arena hands out memory by moving a pointer through chunks of physically contiguous pages taken from the PMM,
+    accessed through the higher half direct map. Single allocations can't be freed.
+    Instead the whole arena is reset, or rewound to a mark taken earlier, which frees everything allocated after it.
+
+    This fits data that is set up once and never freed (e.g. during boot), as well as scratch memory of a single operation,
+    without fragmenting kmalloc() and the slab caches.
+
+    An arena is not protected against concurrent use, its owner has to make sure only one CPU uses it at a time.
+
+    @author frischerZucker
+*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// @brief Alignment used by arena_alloc() if no alignment is given.
+#define ARENA_DEFAULT_ALIGNMENT 16
+
+/*!
+    @brief Error codes used by this module.
+*/
+typedef enum
+{
+    ARENA_OK = 0,
+    ARENA_ERROR_INVALID_ARGUMENT
+} arena_error_codes_t;
+
+/*!
+    @brief Header of a chunk of an arena, stored at the start of the chunks first page.
+*/
+struct arena_chunk_t {
+    /// @brief Chunk that was allocated before this one, NULL for the first chunk.
+    struct arena_chunk_t *previous;
+    /// @brief Number of pages of the chunk.
+    size_t pages;
+};
+
+/*!
+    @brief An arena. Can be stored anywhere, e.g. as a static variable or on the stack, and is set up with arena_init().
+*/
+struct arena_t {
+    /// @brief Chunk that is currently allocated from, NULL if the arena has no memory yet.
+    struct arena_chunk_t *chunk;
+    /// @brief Next free byte of the current chunk.
+    uintptr_t next;
+    /// @brief End of the current chunk.
+    uintptr_t end;
+    /// @brief Minimum number of pages of a new chunk.
+    size_t chunk_pages;
+    ptrdiff_t hhdm_offset;
+};
+
+/*!
+    @brief A position inside of an arena, see arena_get_mark() and arena_rewind().
+*/
+struct arena_mark_t {
+    struct arena_chunk_t *chunk;
+    uintptr_t next;
+};
+
+/*!
+    @brief Sets up an empty arena.
+
+    No memory is allocated until the first call to arena_alloc().
+
+    @param arena The arena.
+    @param chunk_pages Minimum number of pages taken from the PMM whenever the arena needs more memory.
+    @param hhdm_offset Offset used by the higher half direct map.
+    @returns ARENA_OK on success, ARENA_ERROR_INVALID_ARGUMENT if chunk_pages is 0.
+*/
+arena_error_codes_t arena_init(struct arena_t *arena, size_t chunk_pages, ptrdiff_t hhdm_offset);
+
+/*!
+    @brief Allocates memory from an arena.
+
+    Moves the arenas pointer forward by size byte (plus padding for alignment), so this takes constant time.
+    If the current chunk is too small, a new chunk of at least chunk_pages pages is allocated and the rest of the old one is left unused.
+
+    @param arena The arena.
+    @param size Number of bytes to allocate.
+    @param alignment Alignment of the memory in byte. Must be 0 or a power of two up to the page size. 0 means ARENA_DEFAULT_ALIGNMENT.
+    @returns Pointer (virtual address) to the memory, or NULL if the arguments are invalid or no memory is left.
+*/
+[[nodiscard("It will be quite hard to use memory if u don't remember its address.")]] void * arena_alloc(struct arena_t *arena, size_t size, size_t alignment);
+
+/*!
+    @brief Gets the current position of an arena.
+
+    @param arena The arena.
+    @returns Mark that can be passed to arena_rewind().
+*/
+struct arena_mark_t arena_get_mark(struct arena_t *arena);
+
+/*!
+    @brief Frees everything that was allocated from an arena after a mark was taken.
+
+    Chunks that were added after the mark are given back to the PMM.
+
+    @param arena The arena.
+    @param mark Mark returned by arena_get_mark() on the same arena. Marks taken after it become invalid.
+*/
+void arena_rewind(struct arena_t *arena, struct arena_mark_t mark);
+
+/*!
+    @brief Frees everything that was allocated from an arena.
+
+    The first chunk is kept, so the arena can be used again without asking the PMM for memory.
+
+    @param arena The arena.
+*/
+void arena_reset(struct arena_t *arena);
+
+/*!
+    @brief Frees everything that was allocated from an arena and gives all of its chunks back to the PMM.
+
+    @param arena The arena.
+*/
+void arena_destroy(struct arena_t *arena);
+
+#endif // ARENA_H
@@ -0,0 +1,83 @@
+/*!
+    @file kmalloc.h
+
+    @brief General purpose allocator for variable-sized kernel data.
+
+    Small allocations (up to KMALLOC_MAX_SMALL_SIZE byte) are rounded up to the next power of two
+    and served from one slab cache per size class (see slab.h).
+    Larger allocations get physically contiguous pages from the PMM, accessed through the higher half direct map.
+
+    Allocations have no header. kfree() and ksize() find out how large an allocation is from the struct page_t of its first page,
+    so there is no per-allocation overhead besides rounding up to the size class.
+
+    @author frischerZucker
+*/
+
+#ifndef KMALLOC_H
+#define KMALLOC_H
+
+#include <stddef.h>
+
+/// @brief Smallest size class in byte.
+#define KMALLOC_MIN_SIZE 16
+/// @brief Largest size class in byte. Larger allocations get whole pages.
+#define KMALLOC_MAX_SMALL_SIZE 2048
+/// @brief Number of size classes, one for each power of two from KMALLOC_MIN_SIZE to KMALLOC_MAX_SMALL_SIZE.
+#define KMALLOC_NUM_SIZE_CLASSES 8
+
+/*!
+    @brief Error codes used by this module.
+*/
+typedef enum
+{
+    KMALLOC_OK = 0,
+    KMALLOC_ERROR_NOT_INITIALIZED,
+    KMALLOC_ERROR_INVALID_POINTER
+} kmalloc_error_codes_t;
+
+/*!
+    @brief Initializes kmalloc() by creating a slab cache for each size class.
+
+    Must be called after slab_init().
+
+    @param hhdm_offset Offset used by the higher half direct map.
+    @returns KMALLOC_OK on success, KMALLOC_ERROR_NOT_INITIALIZED if a cache could not be created.
+*/
+kmalloc_error_codes_t kmalloc_init(ptrdiff_t hhdm_offset);
+
+/*!
+    @brief Allocates memory.
+
+    Sizes up to KMALLOC_MAX_SMALL_SIZE are taken from the slab cache of the next larger size class.
+    Larger sizes are rounded up to whole pages, allocated with pmm_alloc_pages().
+    Their first page is tagged with PAGE_OWNER_KMALLOC and remembers the number of pages.
+    Small allocations are aligned to their size class, but at most to a cache line. Large allocations are page aligned.
+
+    @param size Number of bytes to allocate.
+    @returns Pointer (virtual address) to the memory, or NULL if size is 0 or no memory is left.
+*/
+[[nodiscard("It will be quite hard to free memory if u don't remember its address.")]] void * kmalloc(size_t size);
+
+/*!
+    @brief Frees memory allocated by kmalloc().
+
+    The size of the allocation is looked up in the struct page_t of its first page:
+    Pages of slabs lead to the cache of the size class, large allocations store their number of pages.
+    Freeing NULL does nothing.
+
+    @param ptr Pointer (virtual address) returned by kmalloc().
+    @returns KMALLOC_OK on success, KMALLOC_ERROR_INVALID_POINTER if ptr was not returned by kmalloc().
+*/
+kmalloc_error_codes_t kfree(void *ptr);
+
+/*!
+    @brief Gets the usable size of an allocation.
+
+    This is the size of its size class or the size of its pages, so it can be larger than the requested size.
+
+    @param ptr Pointer (virtual address) returned by kmalloc().
+    @returns Usable size in byte, 0 if ptr was not returned by kmalloc().
+*/
+size_t ksize(void *ptr);
+
+#endif // KMALLOC_H
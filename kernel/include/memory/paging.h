@@ -5,8 +5,13 @@
 
     Provides data structures, constants and functions for managing 4-level x84_64 page tables.
     Supports mapping and unmapping of 4 kB, 2 MB and 1 GB pages, resolving virtual addresses, cloning page tables.
+    Mappings in the higher half are global, so they survive switching address spaces, and only the kernels .text is executable.
     Also includes a function for dumping page tables for debugging.
 
+    Tables are accessed through the HHDM. With PAGING_RECURSIVE set in kernel/GNUmakefile, every PML4 points to itself in PAGING_RECURSIVE_SLOT,
+    so the tables of the active address space also show up at fixed virtual addresses. paging_map_page(), paging_unmap_page()
+    and paging_resolve_virtual_address() use them for the active address space instead of following every entry through the HHDM.
+
     @author frischerZucker
 */
 
@@ -35,9 +40,88 @@ typedef enum
 #define PAGING_FLAG_USER_LEVEL (1 << 2)
 #define PAGING_FLAG_PWT (1 << 3)
 #define PAGING_FLAG_PCD (1 << 4)
+/// @brief Set by the CPU when the page is accessed.
+#define PAGING_FLAG_ACCESSED (1 << 5)
+/// @brief Set by the CPU when the page is written to. Only used in leaves.
+#define PAGING_FLAG_DIRTY (1 << 6)
 #define PAGING_FLAG_PAGE_SIZE (1 << 7)
 #define PAGING_FLAG_GLOBAL (1 << 8)
-#define PAGING_FLAG_DISABLE_EXECUTION (1 << 63)
+/// @brief Ignored by the CPU. Marks reference counted pages that are copied on write while shared, see paging_fork_address_space().
+#define PAGING_FLAG_COW (1 << 9)
+#define PAGING_FLAG_DISABLE_EXECUTION ((uint64_t)1 << 63)
+
+/// @brief Start of the higher half, where the kernel lives in every address space.
+#define PAGING_HIGHER_HALF_START 0xffff800000000000
+
+#ifndef PAGING_RECURSIVE
+    #define PAGING_RECURSIVE 0
+#endif
+
+/// @brief PML4 entry that points to the PML4 itself if PAGING_RECURSIVE is set. Lies between the VMM and the kernel.
+#define PAGING_RECURSIVE_SLOT 510
+/// @brief Virtual address at which PAGING_RECURSIVE_SLOT maps the page tables of the active address space.
+#define PAGING_RECURSIVE_BASE 0xffffff0000000000
+
+/// @brief CR4 bit that enables global pages.
+#define PAGING_CR4_PGE (1 << 7)
+/// @brief Model specific register containing the NXE bit.
+#define PAGING_MSR_EFER 0xc0000080
+/// @brief EFER bit that enables the execute-disable bit in page table entries.
+#define PAGING_EFER_NXE (1 << 11)
+
+/// @brief Number of addresses a struct paging_tlb_batch_t can hold. If more pages are added, the whole TLB is flushed instead.
+#define PAGING_TLB_BATCH_SIZE 32
+
+/// @brief Number of 2 MB windows paging_resolve_virtual_address() remembers. Must be a power of two.
+#define PAGING_TRANSLATION_CACHE_SIZE 64
+
+/*!
+    @brief Statistics of the translation cache of paging_resolve_virtual_address(), see paging_get_translation_cache_stats().
+*/
+struct paging_translation_cache_stats_t {
+    /// @brief Lookups whose 2 MB window was cached, so at most the PT had to be read.
+    size_t hits;
+    /// @brief Lookups that had to walk the page table hierarchy.
+    size_t misses;
+    /// @brief Number of times the whole cache was invalidated.
+    size_t invalidations;
+};
+
+/*!
+    @brief Physically contiguous part of a virtual range, see paging_resolve_range().
+*/
+struct paging_extent_t {
+    uintptr_t virt;
+    uintptr_t phys;
+    /// @brief Length in byte, a multiple of 4 kB.
+    size_t length;
+};
+
+/*!
+    @brief Statistics of automatic huge page promotion and demotion, see paging_get_huge_page_stats().
+*/
+struct paging_huge_page_stats_t {
+    /// @brief Number of PTs that were replaced by a 2 MB page.
+    size_t promotions;
+    /// @brief Number of 2 MB and 1 GB pages that were split into smaller pages.
+    size_t demotions;
+};
+
+/*!
+    @brief Collects virtual addresses whose TLB entries have to be invalidated, so they can be flushed at once.
+
+    Executing invlpg for every single page is slower than reloading CR3 once a lot of pages were changed.
+    Up to PAGING_TLB_BATCH_SIZE addresses are flushed one by one, above that the whole TLB is flushed.
+*/
+struct paging_tlb_batch_t
+{
+    uintptr_t addresses[PAGING_TLB_BATCH_SIZE];
+    size_t count;
+    /// @brief Set once more than PAGING_TLB_BATCH_SIZE addresses were added.
+    bool flush_all;
+    /// @brief Set if a non-global page of the shared higher half was removed, which other address spaces might still have cached.
+    bool shared;
+};
 
 struct paging_flags_t
 {
@@ -209,12 +293,21 @@ union page_table_entry_t
 };
 
 /*!
-    @brief Initializes the global HHDM offset.
+    @brief Initializes the global HHDM offset and enables global pages and the execute-disable bit.
+
+    Sets CR4.PGE and EFER.NXE if the CPU supports them. Must be called before paging_clone_page_table().
 
     @param hhdm_offset HHDM offset used for address translation.
 */
 void paging_init(ptrdiff_t hhdm_offset);
 
+/*!
+    @brief Gets the flags that kernel data mappings in the higher half should have.
+
+    @returns PAGING_FLAG_GLOBAL and PAGING_FLAG_DISABLE_EXECUTION, if they are supported by the CPU.
+*/
+uint64_t paging_get_kernel_flags();
+
 /*!
     @brief Recursively traverse and log the structure of a page table.
 
@@ -234,6 +327,34 @@ void paging_init(ptrdiff_t hhdm_offset);
 */
 void paging_dump_page_table(union page_table_entry_t *page_table, page_table_level_t level);
 
+/*!
+    @brief Sets up an empty TLB flush batch.
+
+    @param batch The batch.
+*/
+void paging_tlb_batch_init(struct paging_tlb_batch_t *batch);
+
+/*!
+    @brief Adds a virtual address whose TLB entry has to be invalidated to a batch.
+
+    Once the batch is full, further addresses are not stored, but the whole TLB is flushed by paging_tlb_batch_flush().
+
+    @param batch The batch.
+    @param virt Virtual address of the page.
+*/
+void paging_tlb_batch_add(struct paging_tlb_batch_t *batch, uintptr_t virt);
+
+/*!
+    @brief Invalidates the TLB entries of all addresses in a batch and empties it.
+
+    Uses invlpg for every address, or reloads CR3 if there were more than PAGING_TLB_BATCH_SIZE addresses.
+    If shared is set, the PCIDs of all other address spaces are flushed the next time they are switched to.
+    Must be called before the physical pages that were unmapped are reused.
+
+    @param batch The batch.
+*/
+void paging_tlb_batch_flush(struct paging_tlb_batch_t *batch);
+
 /*!
     @brief Map a virtual address to a physical address in the page table and invalidates its TLB entry.
 
@@ -274,9 +395,15 @@ paging_error_codes_t paging_unmap_page(union page_table_entry_t *pml4, uintptr_t
 /*!
     @brief Resolve a virtual address to a physical address.
 
-    Walks through the page table hierarchy until a leaf is reached and returns the base address of it.
+    Walks through the page table hierarchy until a leaf is reached and returns the address of the 4 kB page containing virt.
+    Inside of 2 MB and 1 GB pages, the offset of that 4 kB page is added to the base address of the leaf,
+    so the result doesn't change when pages are promoted or demoted.
     Returns NULL if an entry along the way is not present .
 
+    The PT (or the large page) of the last PAGING_TRANSLATION_CACHE_SIZE 2 MB windows that were looked up is cached,
+    so further lookups in the same window only read a single entry of the PT instead of walking all four levels.
+    Mapping and unmapping 4 kB pages doesn't affect the cache, it is invalidated when a table is freed or a large page is removed or split.
+
     @param pml4 Page table from that the physical address should be retrieved.
     @param virt Virtual address to translate.
     
@@ -284,12 +411,38 @@ paging_error_codes_t paging_unmap_page(union page_table_entry_t *pml4, uintptr_t
 */
 uintptr_t paging_resolve_virtual_address(union page_table_entry_t *pml4, uintptr_t virt);
 
+/*!
+    @brief Resolves a whole virtual range into physically contiguous extents.
+
+    Walks the page table hierarchy once for the whole range, like paging_map_range(), instead of once per page.
+    Neighbouring pages that are contiguous in virtual and physical memory are merged into one extent,
+    parts of the range that aren't mapped end the current extent and are left out.
+
+    @param pml4 Page table containing the range.
+    @param virt Virtual address of the range. Must be 4 kB aligned.
+    @param length Length of the range in byte. Must be a multiple of 4 kB.
+    @param extents Array the extents are stored in, sorted by address.
+    @param max_extents Size of the array. If the range has more extents, only the first max_extents are stored.
+
+    @returns Number of extents stored, 0 if the arguments are not aligned or nothing in the range is mapped.
+*/
+size_t paging_resolve_range(union page_table_entry_t *pml4, uintptr_t virt, size_t length, struct paging_extent_t *extents, size_t max_extents);
+
+/*!
+    @brief Gets the statistics of the translation cache of paging_resolve_virtual_address().
+
+    @param stats Pointer to the struct the statistics should be copied to.
+*/
+void paging_get_translation_cache_stats(struct paging_translation_cache_stats_t *stats);
+
 /*!
     @brief Recursively walk a page table and clone mapped pages to another page table.
 
     Recursively walks through all entries of a given page table (PML4, PDPR, PD or PT).
     If a leaf is reached, its flags and the physical address are retrieved and the virtual address is calculated from the indices.
     Maps the page in another page table WITHOUT invalidating its TLB entry.
+    Leaves in the higher half are made global. Pages of the kernels .text are made read-only and executable,
+    pages of .rodata read-only and all other pages in the higher half not executable.
 
     @param old_page_table Pointer to the current level of page table that should be cloned.
     @param new_pml4 Pointer to the PML4 of the page table that the entries should be cloned to.
@@ -299,4 +452,178 @@ uintptr_t paging_resolve_virtual_address(union page_table_entry_t *pml4, uintptr
 */
 paging_error_codes_t paging_clone_page_table(union page_table_entry_t *old_pml4, union page_table_entry_t **new_pml4, page_table_level_t level);
 
+/*!
+    @brief Map a range of virtual memory to a list of physical pages.
+
+    Maps count 4 kB pages starting at virt, the i-th one to pages[i].
+    The page table hierarchy is only walked for the first page and whenever the range crosses into the next PT,
+    instead of once per page like calling paging_map_page() count times.
+    Creates entries and allocates memory for page tables as needed.
+    The entries weren't present before, so they can't be cached in the TLB and nothing has to be invalidated.
+
+    If an error occurs, the pages that were mapped up to that point stay mapped.
+
+    @param pml4 PML4 in which the pages should be mapped.
+    @param virt Virtual address of the first page. Must be 4 kB aligned.
+    @param pages Array of physical addresses of the pages.
+    @param count Number of pages to map.
+    @param flags Flags for the pages.
+
+    @returns PAGING_OK on success, PAGING_ERROR if allocating memory failed, a page is already mapped or a large page is in the way.
+*/
+paging_error_codes_t paging_map_pages(union page_table_entry_t *pml4, uintptr_t virt, void **pages, size_t count, uint64_t flags);
+
+/*!
+    @brief Unmap a range of virtual memory and invalidate its TLB entries.
+
+    Unmaps count 4 kB pages starting at virt.
+    Like paging_map_pages(), the page table hierarchy is only walked once per PT.
+    Whenever the range leaves a PT, the PT and its parents are checked for emptiness and deleted if they are no longer required.
+    The TLB entries are collected in a struct paging_tlb_batch_t and flushed at once before returning.
+
+    @param pml4 Page table in which the pages should be unmapped.
+    @param virt Virtual address of the first page. Must be 4 kB aligned.
+    @param count Number of pages to unmap.
+    @param pages Array where the physical addresses of the unmapped pages are stored, NULL for pages that weren't mapped. Can be NULL if they are not needed.
+
+    @returns PAGING_OK on success, PAGING_ERROR if some of the pages weren't mapped by a PT.
+*/
+paging_error_codes_t paging_unmap_pages(union page_table_entry_t *pml4, uintptr_t virt, size_t count, void **pages);
+
+/*!
+    @brief Map a physically contiguous range.
+
+    Walks the page table hierarchy once for the whole range instead of once per page:
+    Consecutive entries of a table are filled one after another and every table is only visited once.
+    The page size is picked automatically. Wherever virt and phys are aligned to 1 GB or 2 MB and the rest of the range is large enough,
+    a 1 GB (if supported by the CPU) or 2 MB page is used, 4 kB pages everywhere else.
+    Creates entries and allocates memory for page tables as needed.
+    The entries weren't present before, so nothing has to be invalidated in the TLB.
+
+    If an error occurs, the part of the range that was mapped up to that point stays mapped.
+
+    @param pml4 PML4 in which the range should be mapped.
+    @param phys Physical address of the range. Must be 4 kB aligned.
+    @param virt Virtual address of the range. Must be 4 kB aligned.
+    @param length Length of the range in byte. Must be a multiple of 4 kB.
+    @param flags Flags for the pages. PAGING_FLAG_PAGE_SIZE is set or cleared depending on the page size.
+
+    @returns PAGING_OK on success, PAGING_ERROR if the arguments are not aligned, allocating memory failed or a part of the range is already mapped.
+*/
+paging_error_codes_t paging_map_range(union page_table_entry_t *pml4, uintptr_t phys, uintptr_t virt, size_t length, uint64_t flags);
+
+/*!
+    @brief Unmap a range and invalidate its TLB entries.
+
+    Like paging_map_range(), the page table hierarchy is only walked once for the whole range.
+    4 kB, 2 MB and 1 GB pages inside the range are unmapped, parts of the range that aren't mapped are skipped.
+    Tables are checked for emptiness once, after the part of the range inside of them has been unmapped,
+    instead of up to three times for every page like paging_unmap_page() does.
+    The TLB entries are collected in a struct paging_tlb_batch_t and flushed at once before returning.
+
+    @param pml4 Page table in which the range should be unmapped.
+    @param virt Virtual address of the range. Must be 4 kB aligned.
+    @param length Length of the range in byte. Must be a multiple of 4 kB.
+
+    2 MB and 1 GB pages that are only partially inside of the range are split first.
+
+    @returns PAGING_OK on success, PAGING_ERROR if the arguments are not aligned or a large page that is only partially inside of the range couldn't be split.
+*/
+paging_error_codes_t paging_unmap_range(union page_table_entry_t *pml4, uintptr_t virt, size_t length);
+
+/*!
+    @brief Changes the flags of all pages inside of a range and invalidates their TLB entries.
+
+    Parts of the range that aren't mapped are skipped. 2 MB and 1 GB pages that are only partially inside of the range are split first.
+    Afterwards, PTs whose pages all ended up with the same flags are replaced by 2 MB pages if possible.
+    Copy-on-write pages keep PAGING_FLAG_COW and stay read-only.
+
+    @param pml4 Page table containing the range.
+    @param virt Virtual address of the range. Must be 4 kB aligned.
+    @param length Length of the range in byte. Must be a multiple of 4 kB.
+    @param flags New flags for the pages. PAGING_FLAG_PRESENT is always set, PAGING_FLAG_PAGE_SIZE is set or cleared depending on the page size.
+
+    @returns PAGING_OK on success, PAGING_ERROR if the arguments are not aligned or a large page that is only partially inside of the range couldn't be split.
+*/
+paging_error_codes_t paging_protect_range(union page_table_entry_t *pml4, uintptr_t virt, size_t length, uint64_t flags);
+
+/*!
+    @brief Gets the number of huge pages that were created and split so far.
+
+    PTs of the higher half are replaced by a 2 MB page as soon as their 512 pages map contiguous, 2 MB aligned memory with the same flags,
+    2 MB and 1 GB pages are split when a part of them is unmapped or changes its flags.
+
+    @param stats Pointer to the struct the statistics should be copied to.
+*/
+void paging_get_huge_page_stats(struct paging_huge_page_stats_t *stats);
+
+/*!
+    @brief Prepares the higher half of a PML4 to be shared by all address spaces.
+
+    With PAGING_RECURSIVE, PAGING_RECURSIVE_SLOT is pointed to the PML4 itself first.
+    Allocates an empty PDPR for every entry of the higher half that isn't present yet,
+    so the higher half entries of the PML4 never change again and can simply be copied by paging_create_address_space().
+    From now on, PDPRs of the higher half are not deleted when they become empty.
+    This costs up to 256 pages (1 MB) once.
+
+    @param pml4 PML4 of the kernel. Must be the PML4 all address spaces are created from.
+
+    @returns PAGING_OK on success, PAGING_ERROR if allocating memory for a PDPR failed or the recursive slot is already in use.
+*/
+paging_error_codes_t paging_init_kernel_half(union page_table_entry_t *pml4);
+
+/*!
+    @brief Creates a new address space that shares the kernels higher half.
+
+    Allocates a PML4 and copies the 256 higher half entries of the kernels PML4, so all tables below them are shared.
+    The lower half starts out empty. This takes constant time, no matter how much memory the kernel has mapped.
+    With PAGING_RECURSIVE, the copied PAGING_RECURSIVE_SLOT is pointed to the new PML4.
+
+    @param new_pml4 Pointer to where the pointer (virtual address) to the new PML4 is stored.
+
+    @returns PAGING_OK on success, PAGING_ERROR if paging_init_kernel_half() wasn't called or allocating memory for the PML4 failed.
+*/
+paging_error_codes_t paging_create_address_space(union page_table_entry_t **new_pml4);
+
+/*!
+    @brief Destroys an address space created by paging_create_address_space().
+
+    Frees all page tables of the lower half and the PML4 and gives up the address spaces PCIDs.
+    The shared higher half is left alone. Pages mapped with PAGING_FLAG_COW lose a reference and are freed with the last one,
+    other pages that are still mapped in the lower half are not freed, that is up to their owner.
+
+    @param pml4 PML4 of the address space. Must not be loaded.
+*/
+void paging_destroy_address_space(union page_table_entry_t *pml4);
+
+/*!
+    @brief Creates a copy of an address space that shares its pages copy-on-write.
+
+    The child gets its own lower half tables, but no page is copied up front. Writable pages of the lower half are made read-only
+    in both address spaces and marked with PAGING_FLAG_COW, and their reference count (refcount of their struct page_t) is incremented.
+    The first write to such a page is resolved by paging_handle_cow_fault(). From now on the pages belong to their reference counts,
+    see paging_destroy_address_space().
+    Read-only pages and pages not managed by the PMM are simply shared.
+
+    @param parent_pml4 PML4 of the address space to fork. Created by paging_create_address_space().
+    @param child_pml4 Pointer to where the pointer (virtual address) to the PML4 of the child is stored.
+
+    @returns PAGING_OK on success, PAGING_ERROR if allocating memory for a table failed. The child is destroyed in that case.
+*/
+paging_error_codes_t paging_fork_address_space(union page_table_entry_t *parent_pml4, union page_table_entry_t **child_pml4);
+
+/*!
+    @brief Resolves a write to a copy-on-write page of the active address space.
+
+    Called by the page fault handler. If the page is still shared, it is copied to a new page that replaces it in this address space.
+    If this address space is its last user, the page is simply made writable again.
+
+    @param address The faulting address (CR2).
+    @param error_code Error code pushed by the CPU for the page fault.
+
+    @returns PAGING_OK if the faulting instruction can be restarted,
+             PAGING_ERROR if the fault wasn't a write to a copy-on-write page or copying failed.
+*/
+paging_error_codes_t paging_handle_cow_fault(uintptr_t address, uint64_t error_code);
+
 #endif // PAGING_H
\ No newline at end of file
@@ -0,0 +1,108 @@
+/*!
+    @file pcid.h
+
+    @brief Process-context identifiers (PCIDs), so switching address spaces doesn't flush the TLB.
+
+    Without PCIDs, every write to CR3 throws away all TLB entries that aren't global.
+    With CR4.PCIDE set, TLB entries are tagged with the PCID in the lower 12 bits of CR3,
+    and setting bit 63 of the new CR3 value keeps the entries of the PCID that is switched to.
+
+    Every CPU has PCID_NUM_SLOTS slots, each of them gives its PCID to one address space (identified by the physical address of its PML4).
+    If all slots are in use, the least recently used address space loses its PCID, and its TLB entries are flushed
+    when the PCID is given to the next address space.
+
+    @note invlpg and CR3 reloads only affect the current PCID. If an address space that isn't active loses mappings,
+          pcid_invalidate() makes sure its old TLB entries are thrown away the next time it is switched to.
+
+    @author frischerZucker
+*/
+
+#ifndef PCID_H
+#define PCID_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// @brief Number of PCIDs handed out per CPU. PCID 0 is used before pcid_init() and is not part of them.
+#define PCID_NUM_SLOTS 32
+
+/// @brief CR4 bit that enables PCIDs.
+#define PCID_CR4_PCIDE (1 << 17)
+/// @brief Bit of a CR3 value that keeps the TLB entries of its PCID when it is written.
+#define PCID_CR3_NO_FLUSH ((uint64_t)1 << 63)
+
+/*!
+    @brief Statistics of address space switches, see pcid_get_stats().
+*/
+struct pcid_stats_t {
+    /// @brief Number of calls to pcid_switch().
+    size_t switches;
+    /// @brief Switches to an address space that still had its PCID, so the TLB was kept.
+    size_t hits;
+    /// @brief Switches that had to flush the TLB entries of the PCID.
+    size_t misses;
+    /// @brief Number of times a PCID was taken away from the least recently used address space.
+    size_t recycles;
+};
+
+/*!
+    @brief Enables PCIDs if the CPU supports them.
+
+    Must be called while CR3 holds PCID 0, i.e. before the first call to pcid_switch().
+    Without support, pcid_switch() simply writes CR3.
+
+    @returns true if PCIDs are enabled.
+*/
+bool pcid_init();
+
+/*!
+    @brief Checks if PCIDs are enabled.
+
+    @returns true if pcid_init() enabled PCIDs.
+*/
+bool pcid_is_enabled();
+
+/*!
+    @brief Switches to another address space.
+
+    If the address space still has a PCID on this CPU, CR3 is written with PCID_CR3_NO_FLUSH, so its TLB entries are kept.
+    Otherwise it gets a free PCID or the least recently used one, whose old entries are flushed.
+
+    @param pml4_phys Physical address of the PML4 of the address space.
+*/
+void pcid_switch(uintptr_t pml4_phys);
+
+/*!
+    @brief Marks the TLB entries of an address space as stale.
+
+    The next switch to the address space flushes its PCID. Used when mappings of an address space change while it isn't active.
+
+    @param pml4_phys Physical address of the PML4 of the address space.
+*/
+void pcid_invalidate(uintptr_t pml4_phys);
+
+/*!
+    @brief Marks the TLB entries of all address spaces but the active one as stale.
+
+    Used when a non-global mapping of the shared higher half was removed, which all address spaces might have cached.
+    The active address space has to invalidate the mapping itself, e.g. with invlpg.
+*/
+void pcid_invalidate_others();
+
+/*!
+    @brief Takes the PCIDs of an address space away, e.g. before its PML4 is freed.
+
+    @param pml4_phys Physical address of the PML4 of the address space. Must not be active.
+*/
+void pcid_release(uintptr_t pml4_phys);
+
+/*!
+    @brief Gets the address space switch statistics of a CPU.
+
+    @param cpu Number of the CPU.
+    @param stats Pointer to the struct the statistics should be copied to.
+*/
+void pcid_get_stats(uint32_t cpu, struct pcid_stats_t *stats);
+
+#endif // PCID_H
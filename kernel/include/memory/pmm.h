@@ -6,10 +6,11 @@
     Provides an interface for managing physical memory regions discovered through the Limine memory map.
     Tracks usable and reserved memory, maintains bitmaps for page allocation, and exposes functions for:
     - initializing the PMM and its metadata structures
-    - allocating and freeing pages
+    - allocating and freeing pages, either single ones or physically contiguous runs with a given alignment
     - checking the status of a page (free/used)
     
     It operates on 4 kB pages and uses a higher-half direct map offset for phys-to-virt translation when accessing its own metadata.
+    Which pages are handed out is decided by an allocation backend selected at build time (bitmap or buddy, see pmm_backend.h).
 
     @author frischerZucker
 */
@@ -19,9 +20,26 @@
 
 #include <limine.h>
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+/// @brief Number of pages a magazine is refilled with / drained by at once.
+#define PMM_MAGAZINE_BATCH 32
+/// @brief Number of pages a magazine can hold.
+#define PMM_MAGAZINE_SIZE (2 * PMM_MAGAZINE_BATCH)
+
+/// @brief Number of pre-zeroed pages kept for pmm_alloc_zeroed().
+#define PMM_ZERO_POOL_SIZE 64
+
+/// @brief Maximum number of memory ranges that can be assigned to NUMA nodes.
+#define PMM_MAX_NODE_RANGES 64
+
+/// @brief Alignment for pages that can be mapped as 2 MB pages.
+#define PMM_ALIGNMENT_2MB 0x200000
+/// @brief Alignment for pages that can be mapped as 1 GB pages.
+#define PMM_ALIGNMENT_1GB 0x40000000
+
 /*!
     @brief Available types of memory
 */
@@ -42,9 +60,82 @@ typedef enum{
 typedef enum{
     PMM_OK = 0,
     PMM_ERROR_INIT_FAILED,
-    PMM_ERROR_ADDRESS_NOT_FOUND
+    PMM_ERROR_ADDRESS_NOT_FOUND,
+    PMM_ERROR_INVALID_CPU,
+    PMM_ERROR_ALREADY_FREE
 } pmm_error_codes_t;
 
+/*!
+    @brief Statistics of a per-CPU page magazine, used to find a good magazine size.
+*/
+struct pmm_magazine_stats_t {
+    /// @brief Allocations that were served from the magazine.
+    size_t hits;
+    /// @brief Allocations that found the magazine empty.
+    size_t misses;
+    /// @brief Number of times the magazine was refilled from the regions.
+    size_t refills;
+    /// @brief Number of times pages of a full magazine were given back to the regions.
+    size_t drains;
+};
+
+/*!
+    @brief Flags of a struct page_t.
+*/
+typedef enum {
+    /// @brief The page is not managed by the allocator, e.g. PMM metadata or memory that wasn't reclaimed yet.
+    PAGE_FLAG_RESERVED = (1 << 0),
+    /// @brief First page of a contiguous allocation. Its order field holds log2 of the allocations size (rounded up).
+    PAGE_FLAG_HEAD = (1 << 1),
+    /// @brief The page holds a page table.
+    PAGE_FLAG_PAGE_TABLE = (1 << 2)
+} page_flags_t;
+
+/*!
+    @brief Tags telling which part of the kernel a page belongs to.
+*/
+typedef enum {
+    PAGE_OWNER_NONE = 0,
+    PAGE_OWNER_PMM,
+    PAGE_OWNER_PAGING,
+    PAGE_OWNER_KERNEL,
+    /// @brief The page is part of a slab (see slab.h). Its private field points to the slabs header.
+    PAGE_OWNER_SLAB,
+    /// @brief The page belongs to a large kmalloc() allocation (see kmalloc.h). The private field of the first page holds its number of pages.
+    PAGE_OWNER_KMALLOC
+} page_owner_t;
+
+/*!
+    @brief Metadata of a single physical page (page frame).
+
+    There is one struct for every page of every region, stored next to the regions bitmap.
+    It is kept at 16 bytes, so the whole array only takes 0.4 % of the memory it describes.
+    Use pfn_to_page() / phys_to_page() to get the struct of a page and page_to_phys() to get back to the address.
+*/
+struct page_t {
+    /// @brief Combination of page_flags_t.
+    uint16_t flags;
+    /// @brief Number of users of the page. 0 for free pages.
+    uint16_t refcount;
+    /// @brief Index of the region the page belongs to.
+    uint16_t region;
+    /// @brief Order of the allocation, only valid if PAGE_FLAG_HEAD is set.
+    uint8_t order;
+    /// @brief Owner of the page (page_owner_t).
+    uint8_t owner;
+    /// @brief Free for use by the owner.
+    uint64_t private;
+};
+
+/*!
+    @brief Range of physical memory that belongs to a NUMA node (proximity domain).
+*/
+struct pmm_node_range_t {
+    uintptr_t base;
+    size_t length;
+    uint32_t node;
+};
+
 typedef enum {
     PMM_PAGE_FREE = 0,
     PMM_PAGE_USED = 1,
@@ -71,10 +162,11 @@ pmm_error_codes_t pmm_init(struct limine_memmap_response *memmap, uint64_t hhdm_
 /*!
     @brief Checks if a page is currently free or in use.
 
-    Searches through all regions to find the region that includes the addresses page.
-    If it is found, calculates the page number corresponding page.
-    Checks its status in the bitmap and returns it.
-    If no matching region is found, a special page status is returned.
+    Looks up the region that includes the addresses page in the section table.
+    If it is found, the status is taken from the pages struct page_t: pages with a refcount of 0 are free,
+    just like the pages of the zeroed page pool, which belong to the PMM (PAGE_OWNER_PMM). Reserved pages are always used.
+    That way pages cached in a magazine or the zeroed page pool are reported as free, although their bitmap bit is still set.
+    If no matching region is found (e.g. for reserved memory, which has no region), a special page status is returned.
 
     @param ptr Pointer (physical address) to the page to check.
     @returns PMM_PAGE_FREE if the page is free, PMM_PAGE_USED if it is used and PMM_PAGE_NOT_FOUND if no region matching the address is found.
@@ -84,13 +176,11 @@ pmm_page_status_t pmm_check_page(void *ptr);
 /*!
     @brief Allocates a single free physical memory page.
 
-    Searches through all memory regions managed by the PMM to find a free page.
-    The search is optimized by using static caches (region_cache, bitmap_cache)
-    to reduce iteration overhead by starting from the last successful allocated page.
+    Takes the page from the magazine of the current CPU, so the common case only touches CPU-local data and needs no lock.
+    Only if the magazine is empty, it is refilled with PMM_MAGAZINE_BATCH pages from the regions.
+    Interrupts are disabled while the magazine is accessed, so allocating from interrupt handlers is safe.
 
-    The function scans each regions bitmap for a free bit (representing a free page),
-    marks the page as used, and returns its physical address.
-    If no free page is found across all regions, NULL is returned.
+    If no free page is left, NULL is returned.
 
     @returns Pointer to the allocated physical page, or NULL if no free page was found.
 */
@@ -99,13 +189,235 @@ pmm_page_status_t pmm_check_page(void *ptr);
 /*!
     @brief Frees a single physical memory page.
 
-    Uses binary search to find the region that includes the page.
-    If it is found, the page is marked as free.
-    If none is found, an error is returned.
+    Uses the section table to check that the page belongs to a usable region.
+    If it does, the page is put into the magazine of the current CPU, so it can be handed out again without touching the regions.
+    If the magazine is full, PMM_MAGAZINE_BATCH pages are given back to the regions first.
+    If no usable region contains the page, an error is returned.
+    Pages that are already free (refcount 0 in their struct page_t) are rejected, so a double free can't put a page into a magazine twice.
+
+    @note Pages cached in a magazine are still marked as used in the regions, but their struct page_t is reset (refcount 0) right away,
+    so pmm_check_page() reports them as free.
 
     @param ptr Pointer (physical address) to the page to free.
-    @returns PMM_OK on success, PMM_ERROR_ADDRESS_NOT_FOUND if no region that contains the pages address was found.
+    @returns PMM_OK on success, PMM_ERROR_ADDRESS_NOT_FOUND if no usable region that contains the pages address was found,
+             PMM_ERROR_ALREADY_FREE if the page is already free.
 */
 pmm_error_codes_t pmm_free(void *ptr);
 
+/*!
+    @brief Allocates up to count single pages at once.
+
+    Takes pages from the magazine of the current CPU first.
+    The rest is allocated from the regions in one pass per region, handing out runs of neighbouring pages where possible.
+    This is a lot cheaper than calling pmm_alloc() count times if the magazine can't serve all pages.
+
+    @param pages Array where the physical addresses of the pages are stored.
+    @param count Number of pages wanted.
+    @returns Number of pages that were allocated, less than count if the PMM ran out of free pages.
+*/
+size_t pmm_alloc_batch(void **pages, size_t count);
+
+/*!
+    @brief Frees an array of single pages at once.
+
+    Sorts the array and groups the pages by region, so each region is only searched once
+    and neighbouring pages are freed as a single run.
+    The pages bypass the magazines and go straight back to the regions.
+    Pages that are not inside a usable region or already free (e.g. sitting in a magazine after pmm_free()) are skipped, all others are freed.
+
+    @param pages Array of physical page addresses. Gets sorted in place.
+    @param count Number of pages in the array.
+    @returns PMM_OK on success, PMM_ERROR_ADDRESS_NOT_FOUND if at least one page could not be freed,
+             PMM_ERROR_ALREADY_FREE if at least one page was already free.
+*/
+pmm_error_codes_t pmm_free_batch(void **pages, size_t count);
+
+/*!
+    @brief Allocates up to count pages that are filled with zeros.
+
+    Takes already cleared pages from the zeroed page pool first.
+    If the pool runs empty, the remaining pages are allocated with pmm_alloc_batch() and cleared right away.
+
+    @param pages Array where the physical addresses of the pages are stored.
+    @param count Number of pages wanted.
+    @returns Number of pages that were allocated, less than count if the PMM ran out of free pages.
+*/
+size_t pmm_alloc_zeroed_batch(void **pages, size_t count);
+
+/*!
+    @brief Allocates a single page that is filled with zeros.
+
+    Takes an already cleared page from the zeroed page pool, so the page doesn't need to be cleared on the callers hot path.
+    If the pool is empty, a page is allocated with pmm_alloc() and cleared synchronously.
+
+    @returns Pointer to the allocated physical page, or NULL if no free page was found.
+*/
+[[nodiscard("It will be quite hard to free memory if u don't remember its address.")]] void * pmm_alloc_zeroed();
+
+/*!
+    @brief Clears a single page and adds it to the zeroed page pool.
+
+    Meant to be called while the CPU has nothing else to do, e.g. in the idle loop before halting.
+    Only one page is cleared per call, so pending work isn't delayed for long.
+    Interrupts stay enabled while the page is cleared.
+
+    @returns true if a page was added to the pool, false if the pool is full or no free page is left.
+*/
+bool pmm_zero_pool_refill_page();
+
+/*!
+    @brief Allocates physically contiguous pages.
+
+    Searches all regions for a run of count free pages whose first page is aligned to alignment.
+    The run is picked by the allocation backend (see pmm_backend.h).
+    With the buddy backend, at most 2^PMM_BUDDY_MAX_ORDER pages (1 GiB) can be allocated at once.
+    All pages of the run are marked as used.
+    If no run is found, the magazine of the current CPU is flushed and the search is repeated once.
+
+    @param count Number of contiguous pages to allocate.
+    @param alignment Alignment of the physical address in byte, e.g. PMM_ALIGNMENT_2MB. Must be a power of two. Values below the page size are treated as the page size.
+    @returns Pointer (physical address) to the first page, or NULL if no matching run of free pages was found.
+*/
+[[nodiscard("It will be quite hard to free memory if u don't remember its address.")]] void * pmm_alloc_pages(size_t count, size_t alignment);
+
+/*!
+    @brief Frees physically contiguous pages.
+
+    Uses the section table to find the region that includes the pages and lets the backend free all of them.
+    The pages must be inside a single region, as they are when allocated by pmm_alloc_pages().
+    Nothing is freed if any of the pages is already free.
+
+    @param ptr Pointer (physical address) to the first page.
+    @param count Number of pages to free.
+    @returns PMM_OK on success, PMM_ERROR_ADDRESS_NOT_FOUND if no region containing all the pages was found,
+             PMM_ERROR_ALREADY_FREE if one of the pages is already free.
+*/
+pmm_error_codes_t pmm_free_pages(void *ptr, size_t count);
+
+/*!
+    @brief Reclaims all memory regions of a type, so their pages can be allocated.
+
+    Meant for BOOTLOADER_RECLAIMABLE and ACPI_RECLAIMABLE memory once the data stored there is no longer needed,
+    e.g. Limines responses and page tables or the ACPI tables.
+    The regions become usable and their pages are freed by the allocation backend.
+    Pages inside [keep_base, keep_base + keep_length) are left as used, e.g. for the stack the kernel is still running on.
+
+    @param type Type of the regions to reclaim. Must not be MEMMAP_TYPE_USABLE.
+    @param keep_base Physical address of memory that must not be reclaimed.
+    @param keep_length Length of the memory that must not be reclaimed in byte. 0 if everything can be reclaimed.
+    @returns Number of pages that were reclaimed.
+*/
+size_t pmm_reclaim_memory(pmm_memory_types_t type, uintptr_t keep_base, size_t keep_length);
+
+/*!
+    @brief Gets the number of free pages.
+
+    Sums up the free pages of all regions and the pages cached in the magazines and the zeroed page pool.
+
+    @returns Number of free pages.
+*/
+size_t pmm_get_free_pages();
+
+/*!
+    @brief Gets the statistics of a CPUs page magazine.
+
+    @param cpu Number of the CPU.
+    @param stats Pointer to the struct the statistics should be copied to.
+    @returns PMM_OK on success, PMM_ERROR_INVALID_CPU if there is no magazine for the CPU.
+*/
+pmm_error_codes_t pmm_get_magazine_stats(uint32_t cpu, struct pmm_magazine_stats_t *stats);
+
+/*!
+    @brief Gets the metadata of a page by its page frame number.
+
+    @param pfn Page frame number (physical address / page size).
+    @returns Pointer to the pages struct, or NULL if the page isn't inside a region.
+*/
+struct page_t * pfn_to_page(uintptr_t pfn);
+
+/*!
+    @brief Gets the metadata of the page containing a physical address.
+
+    @param phys Physical address.
+    @returns Pointer to the pages struct, or NULL if the page isn't inside a region.
+*/
+struct page_t * phys_to_page(uintptr_t phys);
+
+/*!
+    @brief Gets the physical address of a page from its metadata.
+
+    @param page Pointer to the pages struct.
+    @returns Physical address of the page.
+*/
+uintptr_t page_to_phys(struct page_t *page);
+
+/*!
+    @brief Sets the NUMA node of physical memory ranges, e.g. from the ACPI SRAT.
+
+    Must be called before pmm_init(), so the regions can be split at node boundaries.
+    The ranges are copied. Memory that isn't covered by any range belongs to node 0.
+
+    @param ranges Array of memory ranges.
+    @param count Number of ranges in the array.
+    @returns PMM_OK on success, PMM_ERROR_INIT_FAILED if there are more than PMM_MAX_NODE_RANGES ranges.
+*/
+pmm_error_codes_t pmm_set_node_ranges(const struct pmm_node_range_t *ranges, size_t count);
+
+/*!
+    @brief Sets the NUMA node of a CPU.
+
+    Single page allocations of the CPU prefer memory of this node. All CPUs start out in node 0.
+
+    @param cpu Number of the CPU.
+    @param node NUMA node of the CPU.
+    @returns PMM_OK on success, PMM_ERROR_INVALID_CPU if there is no such CPU.
+*/
+pmm_error_codes_t pmm_set_cpu_node(uint32_t cpu, uint32_t node);
+
+/*!
+    @brief Gets the NUMA node of a CPU.
+
+    @param cpu Number of the CPU.
+    @returns NUMA node of the CPU, 0 if there is no such CPU.
+*/
+uint32_t pmm_get_cpu_node(uint32_t cpu);
+
+/*!
+    @brief Allocates a single page, preferring memory of a NUMA node.
+
+    Pages of the current CPUs node are taken from its magazine like in pmm_alloc().
+    For other nodes, the regions of that node are searched directly.
+    If the node has no free memory left, the page is taken from any other node.
+
+    @param node Preferred NUMA node.
+    @returns Pointer to the allocated physical page, or NULL if no free page was found.
+*/
+[[nodiscard("It will be quite hard to free memory if u don't remember its address.")]] void * pmm_alloc_node(uint32_t node);
+
+/*!
+    @brief Gets the NUMA node of a page.
+
+    @param ptr Pointer (physical address) to the page.
+    @param node Pointer to the variable where the node should be stored.
+    @returns PMM_OK on success, PMM_ERROR_ADDRESS_NOT_FOUND if no region contains the page.
+*/
+pmm_error_codes_t pmm_get_page_node(void *ptr, uint32_t *node);
+
+/*!
+    @brief Gets the number of free pages of a NUMA node.
+
+    Only counts the pages in the regions, not the ones cached in magazines.
+
+    @param node NUMA node.
+    @returns Number of free pages.
+*/
+size_t pmm_get_node_free_pages(uint32_t node);
+
+/*!
+    @brief Gets the number of NUMA nodes.
+
+    @returns Highest node that has a region plus one.
+*/
+uint32_t pmm_get_num_nodes();
+
 #endif // PMM_H
\ No newline at end of file
@@ -0,0 +1,97 @@
+/*!
+    @file pmm_backend.h
+
+    @brief Interface between the physical memory manager and its allocation backends.
+
+    The PMM (pmm.c) owns the regions, their bitmaps and the public API, while a backend decides which pages of a region are handed out.
+    The backend is selected at build time with PMM_BACKEND in kernel/GNUmakefile:
+    - PMM_BACKEND_BITMAP: Searches the regions bitmaps and their summary levels directly (pmm_bitmap.c).
+    - PMM_BACKEND_BUDDY: Buddy system with free lists for blocks of 2^0 to 2^PMM_BUDDY_MAX_ORDER pages (pmm_buddy.c).
+
+    Both backends keep the regions bitmaps up to date, so checking the status of a page works the same for both of them.
+
+    @author frischerZucker
+*/
+
+#ifndef PMM_BACKEND_H
+#define PMM_BACKEND_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memory/pmm_region.h"
+
+#define PMM_BACKEND_BITMAP 0
+#define PMM_BACKEND_BUDDY 1
+
+#ifndef PMM_BACKEND
+    #define PMM_BACKEND PMM_BACKEND_BITMAP
+#endif
+
+/// @brief Largest block of the buddy allocator: 2^18 pages = 1 GiB.
+#define PMM_BUDDY_MAX_ORDER 18
+
+/*!
+    @brief Name of the selected backend, used for diagnostic output.
+*/
+extern const char *pmm_backend_name;
+
+/*!
+    @brief Calculates how many bytes of metadata the backend needs for a region.
+
+    @param region_length The regions length in byte.
+    @returns Number of bytes needed, a multiple of 8.
+*/
+size_t pmm_backend_get_metadata_size(ptrdiff_t region_length);
+
+/*!
+    @brief Sets up the backends data for a region.
+
+    Called after the regions bitmap is initialized and the pages used by the PMM itself are marked as used.
+
+    @param region Pointer to the regions struct.
+    @param metadata Pointer (virtual address) to pmm_backend_get_metadata_size() bytes reserved for the backend.
+    @param offset Offset used by the higher half direct map.
+*/
+void pmm_backend_init_region(struct pmm_region_t *region, void *metadata, ptrdiff_t offset);
+
+/*!
+    @brief Allocates physically contiguous pages from a region.
+
+    The pages are marked as used in the regions bitmap.
+
+    @param region Pointer to the regions struct.
+    @param count Number of pages.
+    @param alignment Alignment of the physical address in byte. Must be a power of two and at least the page size.
+    @param phys Pointer to the variable where the physical address of the first page should be stored.
+    @returns true on success, false if the region has no matching free pages.
+*/
+bool pmm_backend_alloc_pages(struct pmm_region_t *region, size_t count, size_t alignment, uintptr_t *phys);
+
+/*!
+    @brief Allocates up to count single pages from a region in one pass.
+
+    The pages don't need to be contiguous, but the backend hands out runs of neighbouring pages where possible.
+    The pages are marked as used in the regions bitmap.
+
+    @param region Pointer to the regions struct.
+    @param pages Array where the physical addresses of the pages are stored.
+    @param count Number of pages wanted.
+    @returns Number of pages that were allocated, less than count if the region ran out of free pages.
+*/
+size_t pmm_backend_alloc_batch(struct pmm_region_t *region, void **pages, size_t count);
+
+/*!
+    @brief Frees physically contiguous pages of a region.
+
+    The pages are marked as free in the regions bitmap.
+
+    @param region Pointer to the regions struct.
+    @param phys Physical address of the first page.
+    @param count Number of pages.
+    @returns PMM_REGION_OK on success, PMM_REGION_ERROR if the pages are not inside the region.
+*/
+pmm_region_error_codes_t pmm_backend_free_pages(struct pmm_region_t *region, uintptr_t phys, size_t count);
+
+#endif // PMM_BACKEND_H
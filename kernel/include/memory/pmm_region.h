@@ -4,7 +4,8 @@
     @brief Region-level physical memory management using bitmap tracking.
 
     Defines data structures and functions for managing memory regions in a physical memory manager.
-    Each region tracks it pages via a bitmap, allowing efficient marking of free and used pages.
+    Each region tracks it pages via a bitmap of 64-bit words, allowing efficient marking of free and used pages.
+    On top of the bitmap sits a hierarchy of summary bitmaps, so that finding a free page only takes a few word operations instead of a linear scan.
     Initialization sets up metadata and marks pages based on memory type (usable or some kind of reserved).
 
     This module assumes 4 kiB page granularity and provides error-checked functions for updating page status based on physical addresses.
@@ -15,10 +16,19 @@
 #ifndef PMM_REGION_H
 #define PMM_REGION_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 #include "memory/pmm.h"
 
+/*!
+    @brief Number of summary levels on top of a regions bitmap.
+
+    Each level reduces the number of words to look at by a factor of 64.
+    With three levels a single top level word covers 64^4 pages (1 TiB), so a search for a free page only needs a handful of word operations.
+*/
+#define PMM_REGION_SUMMARY_LEVELS 3
+
 /*!
     @brief Error codes used by this module.
 */
@@ -40,11 +50,23 @@ typedef enum {
     @brief Struct for a memory region.
 
     Contains a bitmap, where each bit represents a page of the region and some metadata.
+    
+    The bitmap is summarized by PMM_REGION_SUMMARY_LEVELS levels of summary bitmaps:
+    A set bit in level 0 means that the corresponding 64-bit word of the bitmap is full (all pages used),
+    a set bit in level n means that the corresponding word of level n - 1 is full.
+    Bits that don't correspond to a page / word are always set, so they are never picked by a search.
 */
 struct pmm_region_t {
-    uint8_t *bitmap;
+    /// @brief One bit per page, stored in 64-bit words so that one comparison covers 64 pages.
+    uint64_t *bitmap;
+    /// @brief Number of 64-bit words in the bitmap.
     size_t bitmap_size;
 
+    /// @brief Summary bitmaps. Level 0 summarizes the bitmap, level n summarizes level n - 1.
+    uint64_t *summary[PMM_REGION_SUMMARY_LEVELS];
+    /// @brief Number of 64-bit words in each summary level.
+    size_t summary_size[PMM_REGION_SUMMARY_LEVELS];
+
     /// @brief Can be used for sanity checks of addresses.
     uintptr_t base;
     ptrdiff_t length;
@@ -54,18 +76,38 @@ struct pmm_region_t {
 
     /// @brief Allows categorization of regions, so that unsusable regions can be skipped when searching for free pages.
     pmm_memory_types_t type;
+
+    /// @brief Data of the allocation backend (see pmm_backend.h), e.g. the free lists of the buddy allocator.
+    void *backend;
+
+    /// @brief Metadata of each page of the region (see struct page_t).
+    struct page_t *pages;
+
+    /// @brief NUMA node (proximity domain) the regions memory belongs to.
+    uint32_t node;
 };
 
+/*!
+    @brief Calculates how many bytes of metadata (bitmap and summary levels) a region needs.
+
+    @param region_length The regions length in byte.
+    @returns Number of bytes needed to store the regions bitmap and its summary levels.
+*/
+size_t pmm_region_get_metadata_size(ptrdiff_t region_length);
+
 /*!
     @brief Initialize a struct for a region.
 
+    The regions bitmap is placed at bitmap_base, its summary levels are placed directly behind it.
+    Use pmm_region_get_metadata_size() to find out how much space is needed.
+
     @param region Pointer to the region struct.
-    @param bitmap_base Pointer where the regions bitmap should be stored.
+    @param bitmap_base Pointer where the regions bitmap and summary levels should be stored.
     @param region_base Physical base address of the region.
     @param region_length The regions lenght in byte.
     @param region_type Type of memory the region consists of.
 */
-void pmm_region_init(struct pmm_region_t *region, uint8_t *bitmap_base, uintptr_t region_base, ptrdiff_t region_length, pmm_memory_types_t type);
+void pmm_region_init(struct pmm_region_t *region, uint64_t *bitmap_base, uintptr_t region_base, ptrdiff_t region_length, pmm_memory_types_t type);
 
 /*!
     @brief Mark a page corresponding to a physical address as free.
@@ -89,4 +131,81 @@ pmm_region_error_codes_t pmm_region_mark_page_free(struct pmm_region_t *region,
 */
 pmm_region_error_codes_t pmm_region_mark_page_used(struct pmm_region_t *region, uintptr_t phys_address);
 
+/*!
+    @brief Search a free page in a region.
+
+    Descends the summary levels, starting at the top, always following the first word that is not full.
+    Uses find-first-zero bit operations, so the search takes O(log n) word operations instead of a linear scan over the bitmap.
+    The page is NOT marked as used.
+
+    @param region Pointer to the regions struct.
+    @param page Pointer to the variable where the index of the free page in the region should be stored.
+    @returns true if a free page was found, false if the region is full.
+*/
+bool pmm_region_find_free_page(struct pmm_region_t *region, size_t *page);
+
+/*!
+    @brief Mark a range of pages as used.
+
+    Sets the bits of all pages in the range word by word and decrements the number of free pages by the number of pages that were free before.
+
+    @param region Pointer to the regions struct.
+    @param phys_address Physical address of the first page.
+    @param count Number of pages.
+    @returns PMM_REGION_ERROR if the range is not completely inside the region, otherwise PMM_REGION_OK.
+*/
+pmm_region_error_codes_t pmm_region_mark_range_used(struct pmm_region_t *region, uintptr_t phys_address, size_t count);
+
+/*!
+    @brief Mark a range of pages as free.
+
+    Clears the bits of all pages in the range word by word and increments the number of free pages by the number of pages that were used before.
+
+    @param region Pointer to the regions struct.
+    @param phys_address Physical address of the first page.
+    @param count Number of pages.
+    @returns PMM_REGION_ERROR if the range is not completely inside the region, otherwise PMM_REGION_OK.
+*/
+pmm_region_error_codes_t pmm_region_mark_range_free(struct pmm_region_t *region, uintptr_t phys_address, size_t count);
+
+/*!
+    @brief Checks if all pages of a range are marked as used.
+
+    Works word by word like pmm_region_mark_range_used(), so a free page anywhere in the range is found without checking every bit on its own.
+
+    @param region Pointer to the regions struct.
+    @param phys_address Physical address of the first page.
+    @param count Number of pages.
+    @returns true if the range is completely inside the region and all of its pages are used, false if not.
+*/
+bool pmm_region_is_range_used(struct pmm_region_t *region, uintptr_t phys_address, size_t count);
+
+/*!
+    @brief Search a range of contiguous free pages in a region.
+
+    Works on whole bitmap words: Full words are skipped using the first summary level,
+    and if a candidate range contains a used page, the search continues behind the last used page of the range.
+    The pages are NOT marked as used.
+
+    @param region Pointer to the regions struct.
+    @param count Number of contiguous pages needed.
+    @param alignment Alignment of the first pages physical address in byte. Must be a power of two and at least the page size.
+    @param page Pointer to the variable where the index of the first page of the range should be stored.
+    @returns true if a free range was found, false if not.
+*/
+bool pmm_region_find_free_range(struct pmm_region_t *region, size_t count, size_t alignment, size_t *page);
+
+/*!
+    @brief Search the next run of free pages at or behind a page.
+
+    Finds the first free page at or behind from and counts the free pages directly following it.
+
+    @param region Pointer to the regions struct.
+    @param from Index of the page where the search starts.
+    @param first Pointer to the variable where the index of the runs first page should be stored.
+    @param count Pointer to the variable where the number of pages in the run should be stored.
+    @returns true if a run was found, false if there are no free pages behind from.
+*/
+bool pmm_region_find_free_run(struct pmm_region_t *region, size_t from, size_t *first, size_t *count);
+
 #endif // PMM_REGION_H
\ No newline at end of file
@@ -0,0 +1,137 @@
+/*!
+    @file slab.h
+
+    @brief Slab allocator for fixed-size kernel objects.
+
+    Objects of the same size are grouped in caches (struct kmem_cache_t).
+    A cache carves slabs, runs of physically contiguous pages taken from the PMM, into equally sized objects
+    and accesses them through the higher half direct map.
+    Free objects are chained into lists stored inside of the objects themselves,
+    so allocating and freeing takes constant time and memory of a cache never gets fragmented.
+
+    Every CPU has a free list of its own in each cache, so the common case only touches CPU-local data.
+    Objects are aligned to the cache line size by default, so hot objects don't share lines with their neighbours.
+
+    @author frischerZucker
+*/
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// @brief Number of objects moved between a CPUs free list and the slabs at once.
+#define SLAB_CPU_LIST_BATCH 16
+/// @brief Maximum number of objects in a CPUs free list. If it is reached, SLAB_CPU_LIST_BATCH objects are given back to their slabs.
+#define SLAB_CPU_LIST_SIZE (2 * SLAB_CPU_LIST_BATCH)
+/// @brief Maximum number of pages of a single slab.
+#define SLAB_MAX_PAGES 8
+/// @brief Number of completely free slabs a cache keeps. Slabs that become free beyond that are given back to the PMM.
+#define SLAB_MAX_EMPTY_SLABS 1
+
+/*!
+    @brief Error codes used by this module.
+*/
+typedef enum
+{
+    SLAB_OK = 0,
+    SLAB_ERROR_NOT_INITIALIZED,
+    SLAB_ERROR_INVALID_OBJECT
+} slab_error_codes_t;
+
+/*!
+    @brief A cache of objects of the same size. Created by kmem_cache_create(), its layout is private to the slab allocator.
+*/
+struct kmem_cache_t;
+
+/*!
+    @brief Statistics of a cache.
+*/
+struct kmem_cache_stats_t {
+    /// @brief Size of an object including padding for alignment.
+    size_t object_size;
+    /// @brief Number of pages of a slab.
+    size_t slab_pages;
+    /// @brief Number of objects per slab.
+    size_t objects_per_slab;
+    /// @brief Number of slabs the cache has.
+    size_t slabs;
+    /// @brief Number of objects that are allocated, not counting the ones cached in the CPUs free lists.
+    size_t objects_in_use;
+};
+
+/*!
+    @brief Initializes the slab allocator.
+
+    Must be called after pmm_init().
+
+    @param hhdm_offset Offset used by the higher half direct map.
+    @returns SLAB_OK on success.
+*/
+slab_error_codes_t slab_init(ptrdiff_t hhdm_offset);
+
+/*!
+    @brief Creates a cache for objects of a fixed size.
+
+    The objects are aligned to align. If align is 0, they are aligned to the cache line size,
+    or to the next power of two of their size if they are smaller than half a cache line, so small objects are still packed tightly.
+    The slab size is picked so that at most an eighth of a slab is wasted, up to SLAB_MAX_PAGES pages.
+
+    @param size Size of an object in byte.
+    @param align Alignment of the objects in byte. Must be 0 or a power of two up to the page size.
+    @returns Pointer to the new cache, or NULL if the arguments are invalid or no memory is left.
+*/
+struct kmem_cache_t * kmem_cache_create(size_t size, size_t align);
+
+/*!
+    @brief Allocates an object from a cache.
+
+    Takes the object from the free list of the current CPU.
+    Only if it is empty, it is refilled with SLAB_CPU_LIST_BATCH objects from the caches slabs, creating a new slab if all of them are full.
+    Interrupts are disabled while the free list is accessed, so allocating from interrupt handlers is safe.
+
+    @param cache Cache to allocate from.
+    @returns Pointer (virtual address) to the object, or NULL if no memory is left.
+*/
+[[nodiscard("It will be quite hard to free memory if u don't remember its address.")]] void * kmem_cache_alloc(struct kmem_cache_t *cache);
+
+/*!
+    @brief Frees an object that was allocated from a cache.
+
+    Pushes the object onto the free list of the current CPU.
+    If the list is full, SLAB_CPU_LIST_BATCH objects are given back to their slabs first.
+
+    @param cache Cache the object was allocated from.
+    @param object Pointer (virtual address) to the object.
+    @returns SLAB_OK on success, SLAB_ERROR_INVALID_OBJECT if the object doesn't belong to the cache.
+*/
+slab_error_codes_t kmem_cache_free(struct kmem_cache_t *cache, void *object);
+
+/*!
+    @brief Finds the cache an object belongs to.
+
+    Uses the struct page_t of the objects page, so it takes constant time.
+
+    @param object Pointer (virtual address) to the object.
+    @returns Pointer to the cache, or NULL if the object isn't part of any slab.
+*/
+struct kmem_cache_t * kmem_cache_find(void *object);
+
+/*!
+    @brief Gets the size of the objects of a cache.
+
+    @param cache The cache.
+    @returns Size of an object including padding for alignment, so all of it can be used.
+*/
+size_t kmem_cache_get_object_size(struct kmem_cache_t *cache);
+
+/*!
+    @brief Gets statistics of a cache.
+
+    @param cache The cache.
+    @param stats Pointer to the struct where the statistics should be stored.
+*/
+void kmem_cache_get_stats(struct kmem_cache_t *cache, struct kmem_cache_stats_t *stats);
+
+#endif // SLAB_H
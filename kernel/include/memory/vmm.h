@@ -0,0 +1,152 @@
+/*!
+    @file vmm.h
+
+    @brief Virtual memory manager (VMM) for the kernels virtual address space.
+
+    Hands out ranges of virtual addresses inside [VMM_KERNEL_BASE, VMM_KERNEL_END), so nobody has to pick addresses by hand.
+    Free ranges are kept in an AVL tree sorted by address, where every node also knows the largest free range in its subtree.
+    That way the lowest free range that is large enough is found in O(log n), without looking at ranges that are too small.
+    Reserved ranges are kept in a second tree, so vmm_free() can look up their size.
+
+    vmm_alloc() reserves a range, backs it with pages from the PMM and maps them with paging_map_pages(),
+    which walks the page table hierarchy once per page table instead of once per page.
+    With VMM_FLAG_LAZY nothing is mapped up front. Instead vmm_handle_page_fault() maps a zeroed page on the first access to it,
+    so large, sparsely used ranges only cost memory for the pages that are actually touched.
+
+    @author frischerZucker
+*/
+
+#ifndef VMM_H
+#define VMM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memory/paging.h"
+
+/// @brief Start of the virtual address space managed by the VMM. Lies between the HHDM and the kernel.
+#define VMM_KERNEL_BASE 0xffffc00000000000
+/// @brief End of the virtual address space managed by the VMM (32 TiB after VMM_KERNEL_BASE).
+#define VMM_KERNEL_END 0xffffe00000000000
+
+/// @brief Number of pages vmm_alloc() and vmm_free() pass to the PMM and the paging code at once.
+#define VMM_BATCH_SIZE 64
+
+/// @brief Map the range writable.
+#define VMM_FLAG_WRITABLE (1 << 0)
+/// @brief Clear the memory before it is mapped.
+#define VMM_FLAG_ZERO (1 << 1)
+/// @brief Don't back the range up front, but map zeroed pages on the first access (demand paging). Implies VMM_FLAG_ZERO.
+#define VMM_FLAG_LAZY (1 << 2)
+
+/*!
+    @brief Error codes used by this module.
+*/
+typedef enum
+{
+    VMM_OK = 0,
+    VMM_ERROR_NOT_INITIALIZED,
+    VMM_ERROR_INVALID_ADDRESS,
+    VMM_ERROR_OUT_OF_MEMORY
+} vmm_error_codes_t;
+
+/*!
+    @brief Statistics of the page faults handled by vmm_handle_page_fault().
+
+    Latencies are measured in TSC cycles from entering vmm_handle_page_fault() until the page is mapped.
+*/
+struct vmm_fault_stats_t {
+    /// @brief Faults that were resolved by mapping a page.
+    size_t handled;
+    /// @brief Faults that were not inside a lazy range, or couldn't be resolved because the PMM was out of memory.
+    size_t unhandled;
+    /// @brief Sum of the latencies of all handled faults.
+    uint64_t total_cycles;
+    uint64_t min_cycles;
+    uint64_t max_cycles;
+};
+
+/*!
+    @brief Initializes the VMM.
+
+    The whole range from VMM_KERNEL_BASE to VMM_KERNEL_END starts out free.
+    Must be called after slab_init(), as the nodes of the trees are allocated from a slab cache.
+
+    @param pml4 Pointer (virtual address) to the PML4 that ranges are mapped in.
+    @returns VMM_OK on success, VMM_ERROR_NOT_INITIALIZED if memory for the trees could not be allocated.
+*/
+vmm_error_codes_t vmm_init(union page_table_entry_t *pml4);
+
+/*!
+    @brief Reserves a range of virtual addresses without mapping anything.
+
+    Takes the lowest free range that is large enough (first fit).
+
+    @param size Size of the range in byte. Is rounded up to whole pages.
+    @param alignment Alignment of the range in byte. Must be 0 or a power of two. Values below the page size are treated as the page size.
+    @returns Virtual address of the range, or NULL if no free range is large enough.
+*/
+[[nodiscard("It will be quite hard to free memory if u don't remember its address.")]] void * vmm_reserve(size_t size, size_t alignment);
+
+/*!
+    @brief Reserves a range of virtual addresses, backs it with physical pages and maps them.
+
+    The pages are taken from the PMM in batches of VMM_BATCH_SIZE and mapped with paging_map_pages().
+    They don't need to be physically contiguous.
+    Like all kernel data, the range is mapped global and not executable (see paging_get_kernel_flags()).
+    If something goes wrong, everything allocated so far is given back.
+    With VMM_FLAG_LAZY only the range is reserved, its pages are mapped by vmm_handle_page_fault() when they are first accessed.
+
+    @param size Size of the range in byte. Is rounded up to whole pages.
+    @param flags Combination of VMM_FLAG_* flags.
+    @returns Virtual address of the range, or NULL if no free range is large enough or the PMM is out of memory.
+*/
+[[nodiscard("It will be quite hard to free memory if u don't remember its address.")]] void * vmm_alloc(size_t size, uint32_t flags);
+
+/*!
+    @brief Frees a range returned by vmm_reserve() or vmm_alloc().
+
+    Pages of ranges from vmm_alloc() are unmapped and given back to the PMM. For lazy ranges, only pages that were touched are mapped.
+    The range is merged with its free neighbours.
+
+    @param virt Virtual address of the range.
+    @returns VMM_OK on success, VMM_ERROR_INVALID_ADDRESS if virt is not the start of a reserved range.
+*/
+vmm_error_codes_t vmm_free(void *virt);
+
+/*!
+    @brief Gets the size of a reserved range.
+
+    @param virt Virtual address of the range.
+    @returns Size of the range in byte, 0 if virt is not the start of a reserved range.
+*/
+size_t vmm_get_size(void *virt);
+
+/*!
+    @brief Gets the amount of free virtual address space.
+
+    @returns Number of free bytes inside [VMM_KERNEL_BASE, VMM_KERNEL_END).
+*/
+size_t vmm_get_free_size();
+
+/*!
+    @brief Resolves a page fault inside a range allocated with VMM_FLAG_LAZY.
+
+    Called by the page fault handler. If the faulting address lies inside a lazy range and its page is not present,
+    a zeroed page is taken from the PMM with pmm_alloc_zeroed() and mapped there, so the faulting instruction can be restarted.
+
+    @param address The faulting address (CR2).
+    @param error_code Error code pushed by the CPU for the page fault.
+    @returns VMM_OK if the page was mapped, VMM_ERROR_INVALID_ADDRESS if the fault is not caused by a lazy range,
+             VMM_ERROR_OUT_OF_MEMORY if no page or page table could be allocated.
+*/
+vmm_error_codes_t vmm_handle_page_fault(uintptr_t address, uint64_t error_code);
+
+/*!
+    @brief Gets the statistics of the page faults handled so far.
+
+    @param stats Pointer to the struct the statistics should be copied to.
+*/
+void vmm_get_fault_stats(struct vmm_fault_stats_t *stats);
+
+#endif // VMM_H
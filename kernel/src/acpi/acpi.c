@@ -0,0 +1,249 @@
+#include "acpi/acpi.h"
+
+#include <stdbool.h>
+
+#include "string.h"
+
+#include "acpi/srat.h"
+#include "logging.h"
+
+static ptrdiff_t acpi_hhdm_offset = 0;
+// Used to check which memory is covered by the HHDM, until acpi_release() is called.
+static struct limine_memmap_response *acpi_memmap = NULL;
+
+// Root table, either the XSDT or the RSDT.
+static struct acpi_sdt_header_t *acpi_root_table = NULL;
+// Size of the root tables entries, 8 byte for the XSDT and 4 byte for the RSDT.
+static size_t acpi_root_entry_size = 0;
+
+/*!
+    @brief Checks that all bytes of a structure add up to 0.
+
+    @param data Pointer to the structure.
+    @param length Length of the structure in byte.
+    @returns true if the checksum is valid, false if not.
+*/
+static bool acpi_checksum_valid(const void *data, size_t length)
+{
+    uint8_t sum = 0;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        sum = sum + ((const uint8_t *)data)[i];
+    }
+
+    return sum == 0;
+}
+
+/*!
+    @brief Checks if a physical range can be read through the HHDM.
+
+    Since base revision 3, Limine only maps usable, bootloader reclaimable, ACPI reclaimable, kernel and framebuffer memory into the HHDM.
+    The range has to lie inside of a single memory map entry of one of these types.
+
+    @param phys Physical address of the range.
+    @param length Length of the range in byte.
+    @returns true if the range can be read, false if not.
+*/
+static bool acpi_is_mapped(uintptr_t phys, size_t length)
+{
+    if (acpi_memmap == NULL)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < acpi_memmap->entry_count; i++)
+    {
+        struct limine_memmap_entry *entry = acpi_memmap->entries[i];
+
+        switch (entry->type)
+        {
+        case LIMINE_MEMMAP_USABLE:
+        case LIMINE_MEMMAP_BOOTLOADER_RECLAIMABLE:
+        case LIMINE_MEMMAP_ACPI_RECLAIMABLE:
+        case LIMINE_MEMMAP_EXECUTABLE_AND_MODULES:
+        case LIMINE_MEMMAP_FRAMEBUFFER:
+            if (phys >= entry->base && length <= entry->length && phys - entry->base <= entry->length - length)
+            {
+                return true;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    return false;
+}
+
+/*!
+    @brief Checks if a whole table can be read through the HHDM, first its header and then the length it claims.
+
+    Tables that claim to be shorter than their header are rejected as well, as their length can't be trusted.
+
+    @param table_phys Physical address of the table.
+    @returns true if the table can be read, false if not.
+*/
+static bool acpi_is_table_mapped(uintptr_t table_phys)
+{
+    if (!acpi_is_mapped(table_phys, sizeof(struct acpi_sdt_header_t)))
+    {
+        return false;
+    }
+
+    struct acpi_sdt_header_t *table = (struct acpi_sdt_header_t *)(table_phys + acpi_hhdm_offset);
+
+    return table->length >= sizeof(struct acpi_sdt_header_t) && acpi_is_mapped(table_phys, table->length);
+}
+
+/*!
+    @brief Validates the RSDP and remembers the root table.
+
+    Uses the XSDT if the RSDP is revision 2 or newer, the RSDT otherwise.
+    With base revision 3, Limine doesn't map reserved memory into the HHDM, and on BIOS systems the RSDP usually lies there (0xe0000 - 0xfffff).
+    So the memory map is checked before anything is read, memory that is not mapped is left alone instead of faulting.
+
+    @param rsdp_phys Physical address of the RSDP.
+    @param hhdm_offset Offset used by the higher half direct map.
+    @param memmap Limines memory map. Is used until acpi_release() is called.
+    @returns ACPI_OK on success, ACPI_ERROR_INVALID_RSDP if the RSDP or root table is invalid,
+             ACPI_ERROR_NOT_MAPPED if one of them is not covered by the HHDM.
+*/
+acpi_error_codes_t acpi_init(uintptr_t rsdp_phys, ptrdiff_t hhdm_offset, struct limine_memmap_response *memmap)
+{
+    acpi_hhdm_offset = hhdm_offset;
+    acpi_memmap = memmap;
+    // Only set once the root table passed all checks.
+    acpi_root_table = NULL;
+
+    // The extended fields are only read for revision 2 and newer, so the ACPI 1.0 part is checked first.
+    if (!acpi_is_mapped(rsdp_phys, 20))
+    {
+        LOG_WARNING("RSDP at %p is not covered by the HHDM, ACPI tables are not used.", rsdp_phys);
+        return ACPI_ERROR_NOT_MAPPED;
+    }
+
+    struct acpi_rsdp_t *rsdp = (struct acpi_rsdp_t *)(rsdp_phys + hhdm_offset);
+
+    // The first 20 bytes are the ACPI 1.0 RSDP, which has its own checksum.
+    if (memcmp(rsdp->signature, "RSD PTR ", 8) != 0 || !acpi_checksum_valid(rsdp, 20))
+    {
+        LOG_ERROR("Invalid RSDP at %p.", rsdp_phys);
+        return ACPI_ERROR_INVALID_RSDP;
+    }
+
+    uintptr_t root_phys;
+    if (rsdp->revision >= 2 && acpi_is_mapped(rsdp_phys, sizeof(struct acpi_rsdp_t)) && rsdp->xsdt_address != 0)
+    {
+        if (!acpi_is_mapped(rsdp_phys, rsdp->length) || !acpi_checksum_valid(rsdp, rsdp->length))
+        {
+            LOG_ERROR("Invalid extended RSDP checksum.");
+            return ACPI_ERROR_INVALID_RSDP;
+        }
+
+        root_phys = rsdp->xsdt_address;
+        acpi_root_entry_size = sizeof(uint64_t);
+    }
+    else
+    {
+        root_phys = rsdp->rsdt_address;
+        acpi_root_entry_size = sizeof(uint32_t);
+    }
+
+    if (!acpi_is_mapped(root_phys, sizeof(struct acpi_sdt_header_t)))
+    {
+        LOG_WARNING("Root table at %p is not covered by the HHDM, ACPI tables are not used.", root_phys);
+        return ACPI_ERROR_NOT_MAPPED;
+    }
+
+    // acpi_find_table() computes the number of entries from the length, which must not underflow.
+    if (((struct acpi_sdt_header_t *)(root_phys + hhdm_offset))->length < sizeof(struct acpi_sdt_header_t))
+    {
+        LOG_ERROR("Root table at %p is shorter than its header.", root_phys);
+        return ACPI_ERROR_INVALID_RSDP;
+    }
+
+    if (!acpi_is_table_mapped(root_phys))
+    {
+        LOG_WARNING("Root table at %p is not covered by the HHDM, ACPI tables are not used.", root_phys);
+        return ACPI_ERROR_NOT_MAPPED;
+    }
+
+    acpi_root_table = (struct acpi_sdt_header_t *)(root_phys + hhdm_offset);
+
+    if (!acpi_checksum_valid(acpi_root_table, acpi_root_table->length))
+    {
+        LOG_ERROR("Invalid root table checksum.");
+        acpi_root_table = NULL;
+        return ACPI_ERROR_INVALID_RSDP;
+    }
+
+    LOG_INFO("ACPI revision %u, root table %c%c%c%c.", rsdp->revision,
+        acpi_root_table->signature[0], acpi_root_table->signature[1], acpi_root_table->signature[2], acpi_root_table->signature[3]);
+
+    return ACPI_OK;
+}
+
+/*!
+    @brief Searches a table by its signature.
+
+    Only tables with a valid checksum that are covered by the HHDM are returned.
+
+    @param signature Signature of the table, e.g. "SRAT".
+    @returns Pointer (virtual address) to the tables header, or NULL if there is no such table or acpi_release() was called.
+*/
+struct acpi_sdt_header_t * acpi_find_table(const char signature[4])
+{
+    if (acpi_root_table == NULL)
+    {
+        return NULL;
+    }
+
+    size_t num_entries = (acpi_root_table->length - sizeof(struct acpi_sdt_header_t)) / acpi_root_entry_size;
+    uint8_t *entries = (uint8_t *)acpi_root_table + sizeof(struct acpi_sdt_header_t);
+
+    for (size_t i = 0; i < num_entries; i++)
+    {
+        // The entries are not necessarily aligned, so they are read byte wise.
+        uint64_t table_phys = 0;
+        memcpy(&table_phys, &entries[i * acpi_root_entry_size], acpi_root_entry_size);
+
+        if (!acpi_is_table_mapped(table_phys))
+        {
+            LOG_WARNING("Table at %p is not covered by the HHDM or shorter than its header and is skipped.", table_phys);
+            continue;
+        }
+
+        struct acpi_sdt_header_t *table = (struct acpi_sdt_header_t *)(table_phys + acpi_hhdm_offset);
+
+        if (memcmp(table->signature, signature, 4) != 0)
+        {
+            continue;
+        }
+
+        if (!acpi_checksum_valid(table, table->length))
+        {
+            LOG_WARNING("Table %c%c%c%c has an invalid checksum.", signature[0], signature[1], signature[2], signature[3]);
+            continue;
+        }
+
+        return table;
+    }
+
+    return NULL;
+}
+
+/*!
+    @brief Forgets the root table, the memory map and the SRAT (see srat_release()).
+
+    Must be called before ACPI reclaimable or bootloader reclaimable memory is reclaimed by the PMM,
+    as the pointers would point into memory that might be handed out again. acpi_find_table() returns NULL afterwards.
+*/
+void acpi_release()
+{
+    srat_release();
+
+    acpi_root_table = NULL;
+    acpi_root_entry_size = 0;
+    acpi_memmap = NULL;
+}
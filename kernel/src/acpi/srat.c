@@ -0,0 +1,220 @@
+#include "acpi/srat.h"
+
+#include "logging.h"
+
+/*!
+    @brief SRAT header, the entries follow directly behind it.
+*/
+struct srat_t
+{
+    struct acpi_sdt_header_t header;
+    uint32_t reserved_1;
+    uint64_t reserved_2;
+} __attribute__((packed));
+
+/*!
+    @brief Header shared by all SRAT entries.
+*/
+struct srat_entry_header_t
+{
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed));
+
+/*!
+    @brief Local APIC affinity entry.
+*/
+struct srat_cpu_affinity_t
+{
+    struct srat_entry_header_t header;
+    uint8_t proximity_domain_low;
+    uint8_t apic_id;
+    uint32_t flags;
+    uint8_t sapic_eid;
+    uint8_t proximity_domain_high[3];
+    uint32_t clock_domain;
+} __attribute__((packed));
+
+/*!
+    @brief Memory affinity entry.
+*/
+struct srat_memory_affinity_t
+{
+    struct srat_entry_header_t header;
+    uint32_t proximity_domain;
+    uint16_t reserved_1;
+    uint32_t base_low;
+    uint32_t base_high;
+    uint32_t length_low;
+    uint32_t length_high;
+    uint32_t reserved_2;
+    uint32_t flags;
+    uint64_t reserved_3;
+} __attribute__((packed));
+
+/*!
+    @brief x2APIC affinity entry.
+*/
+struct srat_x2apic_affinity_t
+{
+    struct srat_entry_header_t header;
+    uint16_t reserved_1;
+    uint32_t proximity_domain;
+    uint32_t x2apic_id;
+    uint32_t flags;
+    uint32_t clock_domain;
+    uint32_t reserved_2;
+} __attribute__((packed));
+
+static struct srat_t *srat = NULL;
+
+/*!
+    @brief Gets the next entry of the SRAT.
+
+    @param entry Current entry, or NULL to get the first one.
+    @returns Pointer to the next entry, or NULL if the end of the table is reached.
+*/
+static struct srat_entry_header_t * srat_next_entry(struct srat_entry_header_t *entry)
+{
+    uint8_t *table_end = (uint8_t *)srat + srat->header.length;
+
+    uint8_t *next;
+    if (entry == NULL)
+    {
+        next = (uint8_t *)srat + sizeof(struct srat_t);
+    }
+    else
+    {
+        next = (uint8_t *)entry + entry->length;
+    }
+
+    // Stop at the end of the table and at broken entries, which would make us loop forever.
+    if (next + sizeof(struct srat_entry_header_t) > table_end || ((struct srat_entry_header_t *)next)->length < sizeof(struct srat_entry_header_t))
+    {
+        return NULL;
+    }
+
+    return (struct srat_entry_header_t *)next;
+}
+
+/*!
+    @brief Searches the SRAT.
+
+    @returns ACPI_OK if a valid SRAT was found, ACPI_ERROR_INVALID_TABLE if there is none (e.g. on non-NUMA systems).
+*/
+acpi_error_codes_t srat_init()
+{
+    srat = (struct srat_t *)acpi_find_table("SRAT");
+    if (srat == NULL)
+    {
+        LOG_INFO("No SRAT found, all memory belongs to node 0.");
+        return ACPI_ERROR_INVALID_TABLE;
+    }
+
+    return ACPI_OK;
+}
+
+/*!
+    @brief Gets the enabled memory ranges and their proximity domains.
+
+    @param ranges Array where the ranges should be stored.
+    @param max_ranges Number of ranges that fit into the array. Further ranges are ignored.
+    @returns Number of ranges stored in the array, 0 if there is no SRAT.
+*/
+size_t srat_get_memory_ranges(struct pmm_node_range_t *ranges, size_t max_ranges)
+{
+    if (srat == NULL)
+    {
+        return 0;
+    }
+
+    size_t num_ranges = 0;
+
+    for (struct srat_entry_header_t *entry = srat_next_entry(NULL); entry != NULL; entry = srat_next_entry(entry))
+    {
+        if (entry->type != SRAT_ENTRY_MEMORY_AFFINITY)
+        {
+            continue;
+        }
+
+        struct srat_memory_affinity_t *memory = (struct srat_memory_affinity_t *)entry;
+        if ((memory->flags & SRAT_FLAG_ENABLED) == 0)
+        {
+            continue;
+        }
+
+        if (num_ranges >= max_ranges)
+        {
+            LOG_WARNING("Too many memory ranges in the SRAT, ignoring the rest.");
+            break;
+        }
+
+        ranges[num_ranges].base = ((uint64_t)memory->base_high << 32) | memory->base_low;
+        ranges[num_ranges].length = ((uint64_t)memory->length_high << 32) | memory->length_low;
+        ranges[num_ranges].node = memory->proximity_domain;
+
+        LOG_DEBUG("SRAT: memory %p - %p is in node %u.", ranges[num_ranges].base, ranges[num_ranges].base + ranges[num_ranges].length, ranges[num_ranges].node);
+
+        num_ranges = num_ranges + 1;
+    }
+
+    return num_ranges;
+}
+
+/*!
+    @brief Gets the proximity domain of a CPU.
+
+    Looks at both local APIC and x2APIC affinity entries.
+
+    @param apic_id APIC ID of the CPU.
+    @param node Pointer to the variable where the proximity domain should be stored.
+    @returns true if the CPU was found, false if not.
+*/
+bool srat_get_cpu_node(uint32_t apic_id, uint32_t *node)
+{
+    if (srat == NULL)
+    {
+        return false;
+    }
+
+    for (struct srat_entry_header_t *entry = srat_next_entry(NULL); entry != NULL; entry = srat_next_entry(entry))
+    {
+        if (entry->type == SRAT_ENTRY_CPU_AFFINITY)
+        {
+            struct srat_cpu_affinity_t *cpu = (struct srat_cpu_affinity_t *)entry;
+            if ((cpu->flags & SRAT_FLAG_ENABLED) == 0 || cpu->apic_id != apic_id)
+            {
+                continue;
+            }
+
+            *node = cpu->proximity_domain_low
+                | ((uint32_t)cpu->proximity_domain_high[0] << 8)
+                | ((uint32_t)cpu->proximity_domain_high[1] << 16)
+                | ((uint32_t)cpu->proximity_domain_high[2] << 24);
+            return true;
+        }
+        else if (entry->type == SRAT_ENTRY_X2APIC_AFFINITY)
+        {
+            struct srat_x2apic_affinity_t *cpu = (struct srat_x2apic_affinity_t *)entry;
+            if ((cpu->flags & SRAT_FLAG_ENABLED) == 0 || cpu->x2apic_id != apic_id)
+            {
+                continue;
+            }
+
+            *node = cpu->proximity_domain;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*!
+    @brief Forgets the SRAT, called by acpi_release().
+
+    srat_get_memory_ranges() and srat_get_cpu_node() find nothing afterwards.
+*/
+void srat_release()
+{
+    srat = NULL;
+}
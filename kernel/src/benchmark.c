@@ -0,0 +1,1310 @@
+#include "benchmark.h"
+
+#include <stdint.h>
+
+#include "string.h"
+
+#include "cpu/cpu.h"
+#include "cpu/registers.h"
+#include "drivers/pit.h"
+#include "logging.h"
+#include "memory/arena.h"
+#include "memory/kmalloc.h"
+#include "memory/paging.h"
+#include "memory/pcid.h"
+#include "memory/pmm.h"
+#include "memory/pmm_backend.h"
+#include "memory/vmm.h"
+
+#if BENCHMARKS_ENABLED
+
+#define PAGE_SIZE_BYTE 4096
+
+#define BENCHMARK_PMM_ALLOCATIONS 256
+
+#define BENCHMARK_PMM_SLOTS 512
+#define BENCHMARK_PMM_OPERATIONS 100000
+
+#define BENCHMARK_NUMA_PAGES 256
+
+#define BENCHMARK_KMALLOC_SLOTS 1024
+#define BENCHMARK_KMALLOC_OPERATIONS 200000
+// Every BENCHMARK_KMALLOC_LARGE_RATIO-th allocation is larger than KMALLOC_MAX_SMALL_SIZE.
+#define BENCHMARK_KMALLOC_LARGE_RATIO 32
+#define BENCHMARK_KMALLOC_MAX_LARGE_SIZE (64 * 1024)
+
+#define BENCHMARK_ARENA_ALLOCATIONS 4096
+#define BENCHMARK_ARENA_CHUNK_PAGES 16
+
+#define BENCHMARK_VMM_PAGES 512
+
+// Size of the lazy range in pages and distance between the pages that are touched.
+#define BENCHMARK_LAZY_PAGES 4096
+#define BENCHMARK_LAZY_STRIDE 16
+
+#define BENCHMARK_MAP_RANGE_SIZE (1024 * 1024 * 1024ul)
+
+// Largest number of pages unmapped at once, also the total number of pages unmapped for each size.
+#define BENCHMARK_UNMAP_MAX_PAGES 4096
+
+#define BENCHMARK_SWITCH_ITERATIONS 10000
+// Number of pages touched after every address space switch.
+#define BENCHMARK_SWITCH_PAGES 64
+
+#define BENCHMARK_ADDRESS_SPACES 1000
+
+// Pages mapped into the address space that is forked, every BENCHMARK_FORK_STRIDE-th of them is written afterwards.
+#define BENCHMARK_FORK_PAGES 1024
+#define BENCHMARK_FORK_STRIDE 16
+// Where the pages are mapped in the lower half.
+#define BENCHMARK_FORK_BASE 0x40000000
+
+// Size of the buffer that is strided over, larger than what the TLB can hold with 4 kB pages, and the number of passes over it.
+#define BENCHMARK_HUGE_SIZE (32 * 1024 * 1024ul)
+#define BENCHMARK_HUGE_ROUNDS 16
+
+// Size of the range that is resolved, mapped with 4 kB pages. Covers more 2 MB windows than the translation cache holds.
+#define BENCHMARK_RESOLVE_SIZE (256 * 1024 * 1024ul)
+#define BENCHMARK_RESOLVE_EXTENTS 16
+
+// Pages mapped one by one to compare the recursive slot with the HHDM, one per 2 MB window, so every page needs its own PT.
+#define BENCHMARK_RECURSIVE_PAGES 1024
+// Where the pages are mapped in the lower half.
+#define BENCHMARK_RECURSIVE_BASE 0x80000000
+
+/*!
+    @brief Simple xorshift pseudo random number generator.
+
+    Good enough to spread allocations over memory, no need for anything fancy here.
+
+    @param state Pointer to the generators state. Must not be 0.
+    @returns Next pseudo random number.
+*/
+static uint64_t benchmark_random(uint64_t *state)
+{
+    *state = *state ^ (*state << 13);
+    *state = *state ^ (*state >> 7);
+    *state = *state ^ (*state << 17);
+    return *state;
+}
+
+/*!
+    @brief Measures the latency of pmm_alloc() at different levels of memory occupancy.
+
+    For each occupancy level, all free pages are allocated and then randomly freed again until the wanted occupancy is reached.
+    This leaves the free pages spread over the whole memory, which is the worst case for searching them.
+    The allocated pages are chained into a list stored in the pages themselves, so no extra memory is needed to remember them.
+    Then the time for BENCHMARK_PMM_ALLOCATIONS calls to pmm_alloc() is measured.
+
+    Run with "-m 4G" in QEMU_ARGS to get comparable results.
+
+    @param hhdm_offset Offset used by the higher half direct map.
+*/
+static void benchmark_pmm_alloc_occupancy(ptrdiff_t hhdm_offset)
+{
+    // Occupancy levels in per mille.
+    static const size_t occupancies[] = {100, 900, 999};
+
+    uint64_t random_state = 0x4a6f65;
+
+    LOG_INFO("Benchmark: pmm_alloc() latency, %u free pages.", pmm_get_free_pages());
+
+    for (size_t i = 0; i < sizeof(occupancies) / sizeof(occupancies[0]); i++)
+    {
+        // Allocate every free page and chain them into a list.
+        uintptr_t allocated = (uintptr_t)NULL;
+        void *page;
+        while ((page = pmm_alloc()) != NULL)
+        {
+            *(uintptr_t *)((uintptr_t)page + hhdm_offset) = allocated;
+            allocated = (uintptr_t)page;
+        }
+
+        // Randomly free pages, so that the wanted occupancy is reached.
+        uintptr_t kept = (uintptr_t)NULL;
+        while (allocated != (uintptr_t)NULL)
+        {
+            uintptr_t next = *(uintptr_t *)(allocated + hhdm_offset);
+
+            if (benchmark_random(&random_state) % 1000 < occupancies[i])
+            {
+                *(uintptr_t *)(allocated + hhdm_offset) = kept;
+                kept = allocated;
+            }
+            else
+            {
+                pmm_free((void *)allocated);
+            }
+
+            allocated = next;
+        }
+
+        // Measure.
+        void *pages[BENCHMARK_PMM_ALLOCATIONS];
+        size_t num_allocated = 0;
+        uint64_t cycles = 0;
+        for (size_t j = 0; j < BENCHMARK_PMM_ALLOCATIONS; j++)
+        {
+            uint64_t start = read_tsc();
+            pages[num_allocated] = pmm_alloc();
+            cycles = cycles + (read_tsc() - start);
+
+            if (pages[num_allocated] != NULL)
+            {
+                num_allocated = num_allocated + 1;
+            }
+        }
+
+        LOG_INFO("Occupancy %u.%u%%: %u cycles per pmm_alloc() (%u allocations).", occupancies[i] / 10, occupancies[i] % 10, cycles / BENCHMARK_PMM_ALLOCATIONS, num_allocated);
+
+        // Clean up.
+        for (size_t j = 0; j < num_allocated; j++)
+        {
+            pmm_free(pages[j]);
+        }
+        while (kept != (uintptr_t)NULL)
+        {
+            uintptr_t next = *(uintptr_t *)(kept + hhdm_offset);
+            pmm_free((void *)kept);
+            kept = next;
+        }
+    }
+}
+
+/*!
+    @brief Measures pmm_alloc_pages() and pmm_free_pages() under a random workload.
+
+    Keeps BENCHMARK_PMM_SLOTS slots of allocations. Each operation picks a random slot:
+    If it is empty, 1 to max_pages pages are allocated into it, otherwise its pages are freed.
+    This mixes allocations and frees of different sizes, so memory gets fragmented over time.
+
+    The backend is selected at build time, so build once with each PMM_BACKEND to compare them.
+
+    @param max_pages Largest number of pages per allocation.
+*/
+static void benchmark_pmm_random_workload(size_t max_pages)
+{
+    static void *slots[BENCHMARK_PMM_SLOTS];
+    static size_t slot_pages[BENCHMARK_PMM_SLOTS];
+
+    uint64_t random_state = 0x6a6f6573;
+
+    uint64_t alloc_cycles = 0;
+    uint64_t free_cycles = 0;
+    size_t allocs = 0;
+    size_t frees = 0;
+    size_t failures = 0;
+
+    for (size_t i = 0; i < BENCHMARK_PMM_OPERATIONS; i++)
+    {
+        size_t slot = benchmark_random(&random_state) % BENCHMARK_PMM_SLOTS;
+
+        if (slots[slot] == NULL)
+        {
+            slot_pages[slot] = 1 + benchmark_random(&random_state) % max_pages;
+
+            uint64_t start = read_tsc();
+            slots[slot] = pmm_alloc_pages(slot_pages[slot], 0);
+            alloc_cycles = alloc_cycles + (read_tsc() - start);
+
+            allocs = allocs + 1;
+            if (slots[slot] == NULL)
+            {
+                failures = failures + 1;
+            }
+        }
+        else
+        {
+            uint64_t start = read_tsc();
+            pmm_free_pages(slots[slot], slot_pages[slot]);
+            free_cycles = free_cycles + (read_tsc() - start);
+
+            frees = frees + 1;
+            slots[slot] = NULL;
+        }
+    }
+
+    // Clean up.
+    for (size_t slot = 0; slot < BENCHMARK_PMM_SLOTS; slot++)
+    {
+        if (slots[slot] != NULL)
+        {
+            pmm_free_pages(slots[slot], slot_pages[slot]);
+            slots[slot] = NULL;
+        }
+    }
+
+    LOG_INFO("%s backend, 1-%u pages: %u cycles per alloc, %u cycles per free, %u of %u allocations failed.", pmm_backend_name, max_pages, alloc_cycles / allocs, free_cycles / frees, failures, allocs);
+}
+
+/*!
+    @brief Measures placement and access latency of node local and remote allocations.
+
+    For each NUMA node, BENCHMARK_NUMA_PAGES pages are allocated with pmm_alloc_node() and written to once.
+    Counts how many of them actually ended up in the requested node and how long allocating and touching them took.
+    The pages are chained into a list stored in the pages themselves, so no extra memory is needed to remember them.
+
+    Run with "-smp 2 -numa node,cpus=0,memid=... -numa node,cpus=1,memid=..." or similar in QEMU_ARGS to get more than one node.
+
+    @param hhdm_offset Offset used by the higher half direct map.
+*/
+static void benchmark_pmm_numa(ptrdiff_t hhdm_offset)
+{
+    uint32_t local_node = pmm_get_cpu_node(cpu_get_id());
+
+    LOG_INFO("Benchmark: NUMA allocation, %u nodes, running in node %u.", pmm_get_num_nodes(), local_node);
+
+    for (uint32_t node = 0; node < pmm_get_num_nodes(); node++)
+    {
+        if (pmm_get_node_free_pages(node) == 0)
+        {
+            continue;
+        }
+
+        uintptr_t allocated = (uintptr_t)NULL;
+        size_t num_allocated = 0;
+        size_t num_placed = 0;
+        uint64_t alloc_cycles = 0;
+        uint64_t touch_cycles = 0;
+
+        for (size_t i = 0; i < BENCHMARK_NUMA_PAGES; i++)
+        {
+            uint64_t start = read_tsc();
+            void *page = pmm_alloc_node(node);
+            alloc_cycles = alloc_cycles + (read_tsc() - start);
+
+            if (page == NULL)
+            {
+                break;
+            }
+
+            // Writing the list link touches the page.
+            start = read_tsc();
+            *(uintptr_t *)((uintptr_t)page + hhdm_offset) = allocated;
+            touch_cycles = touch_cycles + (read_tsc() - start);
+
+            allocated = (uintptr_t)page;
+            num_allocated = num_allocated + 1;
+
+            uint32_t page_node;
+            if (pmm_get_page_node(page, &page_node) == PMM_OK && page_node == node)
+            {
+                num_placed = num_placed + 1;
+            }
+        }
+
+        // Free the pages again.
+        while (allocated != (uintptr_t)NULL)
+        {
+            uintptr_t next = *(uintptr_t *)(allocated + hhdm_offset);
+            pmm_free((void *)allocated);
+            allocated = next;
+        }
+
+        if (num_allocated == 0)
+        {
+            LOG_WARNING("Node %u: no pages could be allocated.", node);
+            continue;
+        }
+
+        LOG_INFO("Node %u (%s): %u of %u pages placed in node, %u cycles per alloc, %u cycles per touch.", node, node == local_node ? "local" : "remote", num_placed, num_allocated, alloc_cycles / num_allocated, touch_cycles / num_allocated);
+    }
+}
+
+/*!
+    @brief Stress test for kmalloc() / kfree() reporting throughput and fragmentation.
+
+    Randomly allocates and frees memory in BENCHMARK_KMALLOC_SLOTS slots.
+    Sizes are spread evenly over the size classes, with some allocations larger than KMALLOC_MAX_SMALL_SIZE in between.
+    Every allocation is written to, so broken allocations show up as overlapping data.
+    At the end, the memory that is still allocated is compared to the requested sizes (internal fragmentation, from rounding up to size classes)
+    and to the pages taken from the PMM (overall overhead, including partially used slabs).
+    The bookkeeping arrays are taken from a scratch arena, so they don't show up in the numbers of kmalloc().
+
+    @param scratch Arena for scratch memory. Everything allocated from it is freed before returning.
+    @param tsc_frequency Frequency of the TSC in Hz, used to convert cycles to allocations per second.
+*/
+static void benchmark_kmalloc_stress(struct arena_t *scratch, uint64_t tsc_frequency)
+{
+    struct arena_mark_t mark = arena_get_mark(scratch);
+
+    uint8_t **slots = arena_alloc(scratch, BENCHMARK_KMALLOC_SLOTS * sizeof(uint8_t *), 0);
+    size_t *slot_sizes = arena_alloc(scratch, BENCHMARK_KMALLOC_SLOTS * sizeof(size_t), 0);
+    if (slots == NULL || slot_sizes == NULL)
+    {
+        LOG_ERROR("Could not allocate scratch memory.");
+        arena_rewind(scratch, mark);
+        return;
+    }
+
+    for (size_t slot = 0; slot < BENCHMARK_KMALLOC_SLOTS; slot++)
+    {
+        slots[slot] = NULL;
+    }
+
+    uint64_t random_state = 0x6b6d616c6c6f63;
+    size_t free_pages_before = pmm_get_free_pages();
+
+    uint64_t alloc_cycles = 0;
+    uint64_t free_cycles = 0;
+    size_t allocs = 0;
+    size_t frees = 0;
+    size_t failures = 0;
+    size_t corruptions = 0;
+
+    LOG_INFO("Benchmark: kmalloc() stress test, %u operations on %u slots.", BENCHMARK_KMALLOC_OPERATIONS, BENCHMARK_KMALLOC_SLOTS);
+
+    for (size_t i = 0; i < BENCHMARK_KMALLOC_OPERATIONS; i++)
+    {
+        size_t slot = benchmark_random(&random_state) % BENCHMARK_KMALLOC_SLOTS;
+
+        if (slots[slot] == NULL)
+        {
+            size_t size;
+            if (benchmark_random(&random_state) % BENCHMARK_KMALLOC_LARGE_RATIO == 0)
+            {
+                size = KMALLOC_MAX_SMALL_SIZE + 1 + benchmark_random(&random_state) % (BENCHMARK_KMALLOC_MAX_LARGE_SIZE - KMALLOC_MAX_SMALL_SIZE);
+            }
+            else
+            {
+                // Pick a size class first, so small sizes are as common as large ones.
+                size_t max_size = (size_t)KMALLOC_MIN_SIZE << (benchmark_random(&random_state) % KMALLOC_NUM_SIZE_CLASSES);
+                size = 1 + benchmark_random(&random_state) % max_size;
+            }
+
+            uint64_t start = read_tsc();
+            slots[slot] = kmalloc(size);
+            alloc_cycles = alloc_cycles + (read_tsc() - start);
+
+            allocs = allocs + 1;
+            if (slots[slot] == NULL)
+            {
+                failures = failures + 1;
+                continue;
+            }
+
+            slot_sizes[slot] = size;
+            slots[slot][0] = (uint8_t)slot;
+            slots[slot][size - 1] = (uint8_t)slot;
+        }
+        else
+        {
+            if (slots[slot][0] != (uint8_t)slot || slots[slot][slot_sizes[slot] - 1] != (uint8_t)slot)
+            {
+                corruptions = corruptions + 1;
+            }
+
+            uint64_t start = read_tsc();
+            kfree(slots[slot]);
+            free_cycles = free_cycles + (read_tsc() - start);
+
+            frees = frees + 1;
+            slots[slot] = NULL;
+        }
+    }
+
+    // Measure fragmentation of what is still allocated.
+    size_t requested_bytes = 0;
+    size_t usable_bytes = 0;
+    for (size_t slot = 0; slot < BENCHMARK_KMALLOC_SLOTS; slot++)
+    {
+        if (slots[slot] != NULL)
+        {
+            requested_bytes = requested_bytes + slot_sizes[slot];
+            usable_bytes = usable_bytes + ksize(slots[slot]);
+        }
+    }
+    size_t used_bytes = (free_pages_before - pmm_get_free_pages()) * PAGE_SIZE_BYTE;
+
+    // Clean up.
+    for (size_t slot = 0; slot < BENCHMARK_KMALLOC_SLOTS; slot++)
+    {
+        if (slots[slot] != NULL)
+        {
+            kfree(slots[slot]);
+            slots[slot] = NULL;
+        }
+    }
+
+    arena_rewind(scratch, mark);
+
+    if (allocs == 0 || frees == 0)
+    {
+        return;
+    }
+
+    LOG_INFO("kmalloc: %u allocs/s (%u cycles each), kfree: %u frees/s (%u cycles each), %u of %u allocations failed, %u corrupted.", allocs * tsc_frequency / alloc_cycles, alloc_cycles / allocs, frees * tsc_frequency / free_cycles, free_cycles / frees, failures, allocs, corruptions);
+    if (usable_bytes > 0 && used_bytes >= usable_bytes)
+    {
+        LOG_INFO("Live memory: %u bytes requested, %u bytes usable (%u%% internal fragmentation), %u bytes of pages used (%u%% overhead).", requested_bytes, usable_bytes, 100 - requested_bytes * 100 / usable_bytes, used_bytes, 100 - requested_bytes * 100 / used_bytes);
+    }
+}
+
+/*!
+    @brief Compares allocating many small objects that are freed together from an arena and with kmalloc().
+
+    Allocates BENCHMARK_ARENA_ALLOCATIONS objects of 16 to 256 byte with both allocators,
+    then frees them with a single arena_reset() and with one kfree() per object.
+
+    @param hhdm_offset Offset used by the higher half direct map.
+*/
+static void benchmark_arena(ptrdiff_t hhdm_offset)
+{
+    static void *objects[BENCHMARK_ARENA_ALLOCATIONS];
+
+    LOG_INFO("Benchmark: arena vs. kmalloc(), %u objects.", BENCHMARK_ARENA_ALLOCATIONS);
+
+    struct arena_t arena;
+    if (arena_init(&arena, BENCHMARK_ARENA_CHUNK_PAGES, hhdm_offset) != ARENA_OK)
+    {
+        return;
+    }
+
+    uint64_t random_state = 0x6172656e61;
+    size_t failures = 0;
+
+    uint64_t start = read_tsc();
+    for (size_t i = 0; i < BENCHMARK_ARENA_ALLOCATIONS; i++)
+    {
+        if (arena_alloc(&arena, 16 + benchmark_random(&random_state) % 241, 0) == NULL)
+        {
+            failures = failures + 1;
+        }
+    }
+    uint64_t arena_alloc_cycles = read_tsc() - start;
+
+    start = read_tsc();
+    arena_reset(&arena);
+    uint64_t arena_reset_cycles = read_tsc() - start;
+
+    random_state = 0x6172656e61;
+
+    start = read_tsc();
+    for (size_t i = 0; i < BENCHMARK_ARENA_ALLOCATIONS; i++)
+    {
+        objects[i] = kmalloc(16 + benchmark_random(&random_state) % 241);
+        if (objects[i] == NULL)
+        {
+            failures = failures + 1;
+        }
+    }
+    uint64_t kmalloc_cycles = read_tsc() - start;
+
+    start = read_tsc();
+    for (size_t i = 0; i < BENCHMARK_ARENA_ALLOCATIONS; i++)
+    {
+        kfree(objects[i]);
+    }
+    uint64_t kfree_cycles = read_tsc() - start;
+
+    arena_destroy(&arena);
+
+    LOG_INFO("arena: %u cycles per alloc, %u cycles for the reset. kmalloc: %u cycles per alloc, %u cycles for freeing all. %u allocations failed.", arena_alloc_cycles / BENCHMARK_ARENA_ALLOCATIONS, arena_reset_cycles, kmalloc_cycles / BENCHMARK_ARENA_ALLOCATIONS, kfree_cycles, failures);
+}
+
+/*!
+    @brief Compares backing a virtual range with vmm_alloc() to mapping it page by page.
+
+    vmm_alloc() maps BENCHMARK_VMM_PAGES pages in batches with a single page table walk per page table.
+    The same number of pages is then mapped one by one with pmm_alloc() and paging_map_page() into a range from vmm_reserve().
+
+    @param hhdm_offset Offset used by the higher half direct map.
+*/
+static void benchmark_vmm(ptrdiff_t hhdm_offset)
+{
+    union page_table_entry_t *pml4 = (union page_table_entry_t *)((read_cr3() & ~0xfff) + hhdm_offset);
+
+    LOG_INFO("Benchmark: vmm_alloc() vs. mapping page by page, %u pages.", BENCHMARK_VMM_PAGES);
+
+    uint64_t start = read_tsc();
+    void *range = vmm_alloc(BENCHMARK_VMM_PAGES * PAGE_SIZE_BYTE, VMM_FLAG_WRITABLE);
+    uint64_t vmm_alloc_cycles = read_tsc() - start;
+
+    if (range == NULL)
+    {
+        LOG_ERROR("vmm_alloc() failed.");
+        return;
+    }
+
+    start = read_tsc();
+    vmm_free(range);
+    uint64_t vmm_free_cycles = read_tsc() - start;
+
+    range = vmm_reserve(BENCHMARK_VMM_PAGES * PAGE_SIZE_BYTE, 0);
+    if (range == NULL)
+    {
+        LOG_ERROR("vmm_reserve() failed.");
+        return;
+    }
+
+    start = read_tsc();
+    for (size_t i = 0; i < BENCHMARK_VMM_PAGES; i++)
+    {
+        void *page = pmm_alloc();
+        if (page == NULL || paging_map_page(pml4, (uintptr_t)page, (uintptr_t)range + i * PAGE_SIZE_BYTE, PAGE_SIZE_4KB, PAGING_FLAG_PRESENT | PAGING_FLAG_WRITABLE) != PAGING_OK)
+        {
+            LOG_ERROR("Mapping page %u failed.", i);
+            break;
+        }
+    }
+    uint64_t map_cycles = read_tsc() - start;
+
+    start = read_tsc();
+    for (size_t i = 0; i < BENCHMARK_VMM_PAGES; i++)
+    {
+        uintptr_t virt = (uintptr_t)range + i * PAGE_SIZE_BYTE;
+        uintptr_t page = paging_resolve_virtual_address(pml4, virt);
+        if (page == (uintptr_t)NULL)
+        {
+            continue;
+        }
+
+        paging_unmap_page(pml4, virt, PAGE_SIZE_4KB);
+        pmm_free((void *)page);
+    }
+    uint64_t unmap_cycles = read_tsc() - start;
+
+    vmm_free(range);
+
+    LOG_INFO("vmm_alloc: %u cycles, vmm_free: %u cycles. Page by page: %u cycles to map, %u cycles to unmap.", vmm_alloc_cycles, vmm_free_cycles, map_cycles, unmap_cycles);
+}
+
+/*!
+    @brief Measures the cost of demand paging on a sparsely used range.
+
+    Allocates BENCHMARK_LAZY_PAGES pages with VMM_FLAG_LAZY and writes to every BENCHMARK_LAZY_STRIDE-th page,
+    so only those pages are backed. Reports the setup time, the number of pages taken from the PMM and the fault latencies.
+*/
+static void benchmark_vmm_lazy()
+{
+    LOG_INFO("Benchmark: demand paging, touching every %u. page of %u pages.", BENCHMARK_LAZY_STRIDE, BENCHMARK_LAZY_PAGES);
+
+    struct vmm_fault_stats_t before;
+    vmm_get_fault_stats(&before);
+    size_t free_pages_before = pmm_get_free_pages();
+
+    uint64_t start = read_tsc();
+    uint8_t *range = vmm_alloc(BENCHMARK_LAZY_PAGES * PAGE_SIZE_BYTE, VMM_FLAG_WRITABLE | VMM_FLAG_LAZY);
+    uint64_t alloc_cycles = read_tsc() - start;
+
+    if (range == NULL)
+    {
+        LOG_ERROR("vmm_alloc() failed.");
+        return;
+    }
+
+    start = read_tsc();
+    for (size_t i = 0; i < BENCHMARK_LAZY_PAGES; i = i + BENCHMARK_LAZY_STRIDE)
+    {
+        range[i * PAGE_SIZE_BYTE] = 1;
+    }
+    uint64_t touch_cycles = read_tsc() - start;
+
+    size_t used_pages = free_pages_before - pmm_get_free_pages();
+
+    struct vmm_fault_stats_t after;
+    vmm_get_fault_stats(&after);
+    size_t faults = after.handled - before.handled;
+
+    vmm_free(range);
+
+    LOG_INFO("vmm_alloc: %u cycles, touching: %u cycles, %u pages used (incl. page tables).", alloc_cycles, touch_cycles, used_pages);
+    if (faults > 0)
+    {
+        LOG_INFO("%u faults, %u cycles per fault on average, min %u, max %u.", faults, (after.total_cycles - before.total_cycles) / faults, after.min_cycles, after.max_cycles);
+    }
+}
+
+/*!
+    @brief Compares mapping a physically contiguous range with paging_map_range() to mapping it page by page.
+
+    Maps BENCHMARK_MAP_RANGE_SIZE bytes three times: With paging_map_range() and an aligned physical address, so large pages are used,
+    with paging_map_range() and a physical address that is only 4 kB aligned, and with paging_map_page() for every 4 kB page.
+    Only the page tables are touched, the mapped memory is never accessed.
+
+    @param hhdm_offset Offset used by the higher half direct map.
+*/
+static void benchmark_paging_map_range(ptrdiff_t hhdm_offset)
+{
+    union page_table_entry_t *pml4 = (union page_table_entry_t *)((read_cr3() & ~0xfff) + hhdm_offset);
+
+    LOG_INFO("Benchmark: paging_map_range() vs. paging_map_page(), %u MB.", BENCHMARK_MAP_RANGE_SIZE / (1024 * 1024));
+
+    void *range = vmm_reserve(BENCHMARK_MAP_RANGE_SIZE, BENCHMARK_MAP_RANGE_SIZE);
+    if (range == NULL)
+    {
+        LOG_ERROR("vmm_reserve() failed.");
+        return;
+    }
+    uintptr_t virt = (uintptr_t)range;
+
+    // Large pages.
+    uint64_t start = read_tsc();
+    paging_error_codes_t result = paging_map_range(pml4, 0, virt, BENCHMARK_MAP_RANGE_SIZE, PAGING_FLAG_PRESENT | PAGING_FLAG_WRITABLE);
+    uint64_t large_map_cycles = read_tsc() - start;
+
+    start = read_tsc();
+    paging_unmap_range(pml4, virt, BENCHMARK_MAP_RANGE_SIZE);
+    uint64_t large_unmap_cycles = read_tsc() - start;
+
+    // 4 kB pages, as the physical address is not aligned to 2 MB.
+    start = read_tsc();
+    if (paging_map_range(pml4, PAGE_SIZE_BYTE, virt, BENCHMARK_MAP_RANGE_SIZE, PAGING_FLAG_PRESENT | PAGING_FLAG_WRITABLE) != PAGING_OK)
+    {
+        result = PAGING_ERROR;
+    }
+    uint64_t small_map_cycles = read_tsc() - start;
+
+    start = read_tsc();
+    paging_unmap_range(pml4, virt, BENCHMARK_MAP_RANGE_SIZE);
+    uint64_t small_unmap_cycles = read_tsc() - start;
+
+    // Page by page.
+    start = read_tsc();
+    for (size_t offset = 0; offset < BENCHMARK_MAP_RANGE_SIZE; offset = offset + PAGE_SIZE_BYTE)
+    {
+        if (paging_map_page(pml4, PAGE_SIZE_BYTE + offset, virt + offset, PAGE_SIZE_4KB, PAGING_FLAG_PRESENT | PAGING_FLAG_WRITABLE) != PAGING_OK)
+        {
+            result = PAGING_ERROR;
+            break;
+        }
+    }
+    uint64_t page_map_cycles = read_tsc() - start;
+
+    start = read_tsc();
+    for (size_t offset = 0; offset < BENCHMARK_MAP_RANGE_SIZE; offset = offset + PAGE_SIZE_BYTE)
+    {
+        if (paging_resolve_virtual_address(pml4, virt + offset) != (uintptr_t)NULL)
+        {
+            paging_unmap_page(pml4, virt + offset, PAGE_SIZE_4KB);
+        }
+    }
+    uint64_t page_unmap_cycles = read_tsc() - start;
+
+    vmm_free(range);
+
+    if (result != PAGING_OK)
+    {
+        LOG_ERROR("Mapping failed, results are incomplete.");
+    }
+
+    LOG_INFO("paging_map_range, large pages: %u cycles to map, %u cycles to unmap.", large_map_cycles, large_unmap_cycles);
+    LOG_INFO("paging_map_range, 4 kB pages: %u cycles to map, %u cycles to unmap.", small_map_cycles, small_unmap_cycles);
+    LOG_INFO("Page by page: %u cycles to map, %u cycles to unmap.", page_map_cycles, page_unmap_cycles);
+}
+
+/*!
+    @brief Maps pages, touches them so they are cached in the TLB, and measures how long unmapping them takes.
+
+    @param pml4 PML4 the pages are mapped in.
+    @param phys Physical address of the pages.
+    @param virt Virtual address of the pages.
+    @param count Number of pages.
+    @param batched If true, paging_unmap_range() is used, which flushes the TLB in a batch. Otherwise paging_unmap_page() is called for every page.
+    @returns Number of cycles unmapping took.
+*/
+static uint64_t benchmark_unmap_once(union page_table_entry_t *pml4, uintptr_t phys, uintptr_t virt, size_t count, bool batched)
+{
+    paging_map_range(pml4, phys, virt, count * PAGE_SIZE_BYTE, PAGING_FLAG_PRESENT | PAGING_FLAG_WRITABLE);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        *(volatile uint8_t *)(virt + i * PAGE_SIZE_BYTE);
+    }
+
+    uint64_t start = read_tsc();
+    if (batched)
+    {
+        paging_unmap_range(pml4, virt, count * PAGE_SIZE_BYTE);
+    }
+    else
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            paging_unmap_page(pml4, virt + i * PAGE_SIZE_BYTE, PAGE_SIZE_4KB);
+        }
+    }
+
+    return read_tsc() - start;
+}
+
+/*!
+    @brief Compares the unmap throughput with one invlpg per page to batched TLB flushes.
+
+    Unmaps 1, 64 and BENCHMARK_UNMAP_MAX_PAGES pages at a time, until BENCHMARK_UNMAP_MAX_PAGES pages were unmapped for each size.
+    The pages are read after being mapped, so their TLB entries really have to be invalidated.
+    Up to PAGING_TLB_BATCH_SIZE pages are flushed with invlpg, larger ranges reload CR3 once.
+
+    @param hhdm_offset Offset used by the higher half direct map.
+*/
+static void benchmark_tlb_flush(ptrdiff_t hhdm_offset)
+{
+    static const size_t sizes[] = {1, 64, BENCHMARK_UNMAP_MAX_PAGES};
+
+    union page_table_entry_t *pml4 = (union page_table_entry_t *)((read_cr3() & ~0xfff) + hhdm_offset);
+
+    LOG_INFO("Benchmark: unmap throughput, invlpg per page vs. batched TLB flushes.");
+
+    void *phys = pmm_alloc_pages(BENCHMARK_UNMAP_MAX_PAGES, 0);
+    void *range = vmm_reserve(BENCHMARK_UNMAP_MAX_PAGES * PAGE_SIZE_BYTE, 0);
+    if (phys == NULL || range == NULL)
+    {
+        LOG_ERROR("Failed to allocate memory for the benchmark.");
+        if (phys != NULL)
+        {
+            pmm_free_pages(phys, BENCHMARK_UNMAP_MAX_PAGES);
+        }
+        if (range != NULL)
+        {
+            vmm_free(range);
+        }
+        return;
+    }
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        size_t count = sizes[s];
+        uint64_t single_cycles = 0;
+        uint64_t batched_cycles = 0;
+
+        for (size_t done = 0; done < BENCHMARK_UNMAP_MAX_PAGES; done = done + count)
+        {
+            single_cycles = single_cycles + benchmark_unmap_once(pml4, (uintptr_t)phys, (uintptr_t)range, count, false);
+            batched_cycles = batched_cycles + benchmark_unmap_once(pml4, (uintptr_t)phys, (uintptr_t)range, count, true);
+        }
+
+        LOG_INFO("%u pages at a time: %u cycles per page with invlpg per page, %u cycles per page batched.", count, single_cycles / BENCHMARK_UNMAP_MAX_PAGES, batched_cycles / BENCHMARK_UNMAP_MAX_PAGES);
+    }
+
+    vmm_free(range);
+    pmm_free_pages(phys, BENCHMARK_UNMAP_MAX_PAGES);
+}
+
+/*!
+    @brief Switches back and forth between two address spaces and touches a working set after every switch.
+
+    @param pml4_a Physical address of the first PML4.
+    @param pml4_b Physical address of the second PML4.
+    @param pages Working set, mapped in both address spaces.
+    @param use_pcid If true, pcid_switch() is used. Otherwise CR3 is written with PCID 0 and without PCID_CR3_NO_FLUSH, which flushes the TLB like it does without PCIDs.
+    @returns Number of cycles for all switches and accesses.
+*/
+static uint64_t benchmark_switch_address_spaces(uintptr_t pml4_a, uintptr_t pml4_b, volatile uint8_t *pages, bool use_pcid)
+{
+    uint64_t start = read_tsc();
+
+    for (size_t i = 0; i < 2 * BENCHMARK_SWITCH_ITERATIONS; i++)
+    {
+        uintptr_t pml4 = i % 2 == 0 ? pml4_b : pml4_a;
+        if (use_pcid)
+        {
+            pcid_switch(pml4);
+        }
+        else
+        {
+            set_cr3(pml4);
+        }
+
+        for (size_t page = 0; page < BENCHMARK_SWITCH_PAGES; page++)
+        {
+            pages[page * PAGE_SIZE_BYTE] = pages[page * PAGE_SIZE_BYTE] + 1;
+        }
+    }
+
+    return read_tsc() - start;
+}
+
+/*!
+    @brief Measures the cost of switching address spaces with and without PCIDs.
+
+    The second address space is a copy of the current PML4, so both map the same memory and the same working set can be touched after every switch.
+    Without PCIDs every switch flushes the TLB and the working set has to be walked again, with PCIDs the entries of both address spaces survive.
+    PCIDs need a CPU model that supports them, e.g. QEMU with "-cpu max".
+
+    @param hhdm_offset Offset used by the higher half direct map.
+*/
+static void benchmark_pcid(ptrdiff_t hhdm_offset)
+{
+    LOG_INFO("Benchmark: address space switches with and without PCIDs, %u switches touching %u pages.", 2 * BENCHMARK_SWITCH_ITERATIONS, BENCHMARK_SWITCH_PAGES);
+
+    uintptr_t pml4_a = read_cr3() & ~(uint64_t)0xfff;
+    union page_table_entry_t *pml4 = (union page_table_entry_t *)(pml4_a + hhdm_offset);
+
+    // The working set is mapped without PAGING_FLAG_GLOBAL like memory of a process would be, so reloading CR3 flushes it.
+    void *pml4_b = pmm_alloc();
+    void *phys = pmm_alloc_pages(BENCHMARK_SWITCH_PAGES, 0);
+    volatile uint8_t *pages = vmm_reserve(BENCHMARK_SWITCH_PAGES * PAGE_SIZE_BYTE, 0);
+    if (pml4_b == NULL || phys == NULL || pages == NULL || paging_map_range(pml4, (uintptr_t)phys, (uintptr_t)pages, BENCHMARK_SWITCH_PAGES * PAGE_SIZE_BYTE, PAGING_FLAG_PRESENT | PAGING_FLAG_WRITABLE) != PAGING_OK)
+    {
+        LOG_ERROR("Failed to allocate memory for the benchmark.");
+        if (pml4_b != NULL)
+        {
+            pmm_free(pml4_b);
+        }
+        if (pages != NULL)
+        {
+            paging_unmap_range(pml4, (uintptr_t)pages, BENCHMARK_SWITCH_PAGES * PAGE_SIZE_BYTE);
+            vmm_free((void *)pages);
+        }
+        if (phys != NULL)
+        {
+            pmm_free_pages(phys, BENCHMARK_SWITCH_PAGES);
+        }
+        return;
+    }
+
+    memcpy((void *)((uintptr_t)pml4_b + hhdm_offset), (void *)(pml4_a + hhdm_offset), PAGE_SIZE_BYTE);
+
+    uint64_t rflags = cpu_disable_interrupts();
+
+    uint64_t flush_cycles = benchmark_switch_address_spaces(pml4_a, (uintptr_t)pml4_b, pages, false);
+    uint64_t pcid_cycles = benchmark_switch_address_spaces(pml4_a, (uintptr_t)pml4_b, pages, true);
+
+    // Both loops end in the first address space, but the first one with PCID 0.
+    pcid_switch(pml4_a);
+
+    cpu_restore_interrupts(rflags);
+
+    pcid_release((uintptr_t)pml4_b);
+    pmm_free(pml4_b);
+    paging_unmap_range(pml4, (uintptr_t)pages, BENCHMARK_SWITCH_PAGES * PAGE_SIZE_BYTE);
+    vmm_free((void *)pages);
+    pmm_free_pages(phys, BENCHMARK_SWITCH_PAGES);
+
+    if (!pcid_is_enabled())
+    {
+        LOG_INFO("PCIDs are not enabled, both runs flush the TLB.");
+    }
+    LOG_INFO("Without PCIDs: %u cycles per switch, with PCIDs: %u cycles per switch.", flush_cycles / (2 * BENCHMARK_SWITCH_ITERATIONS), pcid_cycles / (2 * BENCHMARK_SWITCH_ITERATIONS));
+
+    struct pcid_stats_t stats;
+    pcid_get_stats(cpu_get_id(), &stats);
+    LOG_INFO("PCID: switches=%u hits=%u misses=%u recycles=%u", stats.switches, stats.hits, stats.misses, stats.recycles);
+}
+
+/*!
+    @brief Measures how long creating and destroying an address space with a shared kernel half takes.
+
+    Compare with the time kmain() needs to clone the whole page table hierarchy, which grows with the amount of mapped memory.
+    Every address space gets one page mapped in the lower half, so destroying it has tables to free.
+*/
+static void benchmark_address_spaces()
+{
+    LOG_INFO("Benchmark: creating and destroying %u address spaces.", BENCHMARK_ADDRESS_SPACES);
+
+    void *page = pmm_alloc();
+    if (page == NULL)
+    {
+        LOG_ERROR("Failed to allocate memory for the benchmark.");
+        return;
+    }
+
+    uint64_t create_cycles = 0;
+    uint64_t destroy_cycles = 0;
+
+    for (size_t i = 0; i < BENCHMARK_ADDRESS_SPACES; i++)
+    {
+        union page_table_entry_t *pml4;
+
+        uint64_t start = read_tsc();
+        if (paging_create_address_space(&pml4) != PAGING_OK)
+        {
+            LOG_ERROR("Failed to create an address space.");
+            break;
+        }
+        create_cycles = create_cycles + read_tsc() - start;
+
+        if (paging_map_page(pml4, (uintptr_t)page, PAGE_SIZE_BYTE, PAGE_SIZE_4KB, PAGING_FLAG_PRESENT | PAGING_FLAG_WRITABLE | PAGING_FLAG_USER_LEVEL) != PAGING_OK)
+        {
+            LOG_ERROR("Failed to map a page into the address space.");
+        }
+
+        start = read_tsc();
+        paging_destroy_address_space(pml4);
+        destroy_cycles = destroy_cycles + read_tsc() - start;
+    }
+
+    pmm_free(page);
+
+    LOG_INFO("Address spaces: %u cycles per create, %u cycles per destroy.", create_cycles / BENCHMARK_ADDRESS_SPACES, destroy_cycles / BENCHMARK_ADDRESS_SPACES);
+}
+
+/*!
+    @brief Measures forking an address space copy-on-write against copying all of its pages up front.
+
+    After the fork, the child is switched to and every BENCHMARK_FORK_STRIDE-th page is written, which copies it in the page fault handler.
+
+    @param hhdm_offset Offset used by the higher half direct map.
+*/
+static void benchmark_fork(ptrdiff_t hhdm_offset)
+{
+    LOG_INFO("Benchmark: forking an address space with %u pages, writing every %u. page.", BENCHMARK_FORK_PAGES, BENCHMARK_FORK_STRIDE);
+
+    union page_table_entry_t *parent;
+    if (paging_create_address_space(&parent) != PAGING_OK)
+    {
+        LOG_ERROR("Failed to create an address space.");
+        return;
+    }
+
+    size_t mapped = 0;
+    while (mapped < BENCHMARK_FORK_PAGES)
+    {
+        void *page = pmm_alloc();
+        if (page == NULL || paging_map_page(parent, (uintptr_t)page, BENCHMARK_FORK_BASE + mapped * PAGE_SIZE_BYTE, PAGE_SIZE_4KB, PAGING_FLAG_PRESENT | PAGING_FLAG_WRITABLE | PAGING_FLAG_USER_LEVEL) != PAGING_OK)
+        {
+            LOG_ERROR("Failed to map the pages of the address space.");
+            if (page != NULL)
+            {
+                pmm_free(page);
+            }
+            break;
+        }
+        mapped = mapped + 1;
+    }
+
+    // Reference: what copying every page at fork time would cost.
+    uint64_t start = read_tsc();
+    for (size_t i = 0; i < mapped; i++)
+    {
+        void *copy = pmm_alloc();
+        if (copy == NULL)
+        {
+            break;
+        }
+        uintptr_t phys = paging_resolve_virtual_address(parent, BENCHMARK_FORK_BASE + i * PAGE_SIZE_BYTE);
+        memcpy(copy + hhdm_offset, (void *)(phys + hhdm_offset), PAGE_SIZE_BYTE);
+        pmm_free(copy);
+    }
+    uint64_t copy_cycles = read_tsc() - start;
+
+    union page_table_entry_t *child;
+    start = read_tsc();
+    if (paging_fork_address_space(parent, &child) != PAGING_OK)
+    {
+        LOG_ERROR("Failed to fork the address space.");
+        paging_destroy_address_space(parent);
+        return;
+    }
+    uint64_t fork_cycles = read_tsc() - start;
+
+    uintptr_t current = read_cr3() & ~(uint64_t)0xfff;
+    pcid_switch((uintptr_t)child - hhdm_offset);
+
+    size_t writes = 0;
+    start = read_tsc();
+    for (size_t i = 0; i < mapped; i = i + BENCHMARK_FORK_STRIDE)
+    {
+        *(volatile uint8_t *)(BENCHMARK_FORK_BASE + i * PAGE_SIZE_BYTE) = 1;
+        writes = writes + 1;
+    }
+    uint64_t write_cycles = read_tsc() - start;
+
+    pcid_switch(current);
+
+    // The pages belong to their reference counts now, so destroying both address spaces frees them.
+    paging_destroy_address_space(child);
+    paging_destroy_address_space(parent);
+
+    LOG_INFO("Copying all pages: %u cycles, copy-on-write fork: %u cycles.", copy_cycles, fork_cycles);
+    if (writes > 0)
+    {
+        LOG_INFO("%u copy-on-write faults: %u cycles per fault.", writes, write_cycles / writes);
+    }
+}
+
+/*!
+    @brief Reads one byte of every 4 kB page of a buffer, BENCHMARK_HUGE_ROUNDS times.
+
+    @param buffer The buffer, BENCHMARK_HUGE_SIZE bytes long.
+    @returns Number of cycles it took.
+*/
+static uint64_t benchmark_stride(volatile uint8_t *buffer)
+{
+    uint64_t start = read_tsc();
+
+    for (size_t round = 0; round < BENCHMARK_HUGE_ROUNDS; round++)
+    {
+        for (size_t offset = 0; offset < BENCHMARK_HUGE_SIZE; offset = offset + PAGE_SIZE_BYTE)
+        {
+            (void)buffer[offset];
+        }
+    }
+
+    return read_tsc() - start;
+}
+
+/*!
+    @brief Measures the TLB reach gained by promoting 4 kB pages to 2 MB pages.
+
+    The same physical memory is mapped page by page with paging_map_page() twice.
+    First one page after a 2 MB boundary, so no PT can be promoted, then at the boundary, so every full PT is replaced by a 2 MB page.
+    Then one page is unmapped to show the demotion.
+
+    @param hhdm_offset Offset used by the higher half direct map.
+*/
+static void benchmark_huge_pages(ptrdiff_t hhdm_offset)
+{
+    union page_table_entry_t *pml4 = (union page_table_entry_t *)((read_cr3() & ~0xfff) + hhdm_offset);
+
+    LOG_INFO("Benchmark: striding over %u MB mapped with 4 kB pages and with promoted 2 MB pages.", BENCHMARK_HUGE_SIZE / (1024 * 1024));
+
+    size_t pages = BENCHMARK_HUGE_SIZE / PAGE_SIZE_BYTE;
+    uint64_t flags = PAGING_FLAG_PRESENT | PAGING_FLAG_WRITABLE | paging_get_kernel_flags();
+
+    void *phys = pmm_alloc_pages(pages, PMM_ALIGNMENT_2MB);
+    void *range = vmm_reserve(BENCHMARK_HUGE_SIZE + PMM_ALIGNMENT_2MB, PMM_ALIGNMENT_2MB);
+    if (phys == NULL || range == NULL)
+    {
+        LOG_ERROR("Failed to allocate memory for the benchmark.");
+        if (phys != NULL)
+        {
+            pmm_free_pages(phys, pages);
+        }
+        if (range != NULL)
+        {
+            vmm_free(range);
+        }
+        return;
+    }
+
+    struct paging_huge_page_stats_t before;
+    paging_get_huge_page_stats(&before);
+
+    uint64_t map_cycles[2];
+    uint64_t stride_cycles[2];
+    for (size_t run = 0; run < 2; run++)
+    {
+        // The first run is shifted by one page, so the PTs never map 2 MB aligned memory.
+        uintptr_t virt = (uintptr_t)range + (run == 0 ? PAGE_SIZE_BYTE : 0);
+
+        uint64_t start = read_tsc();
+        for (size_t i = 0; i < pages; i++)
+        {
+            if (paging_map_page(pml4, (uintptr_t)phys + i * PAGE_SIZE_BYTE, virt + i * PAGE_SIZE_BYTE, PAGE_SIZE_4KB, flags) != PAGING_OK)
+            {
+                LOG_ERROR("Mapping page %u failed.", i);
+                break;
+            }
+        }
+        map_cycles[run] = read_tsc() - start;
+
+        // Warm up the caches, so both runs only differ in their TLB misses.
+        benchmark_stride((volatile uint8_t *)virt);
+        stride_cycles[run] = benchmark_stride((volatile uint8_t *)virt);
+
+        if (run == 1)
+        {
+            paging_unmap_page(pml4, virt + PAGE_SIZE_BYTE, PAGE_SIZE_4KB);
+        }
+        paging_unmap_range(pml4, virt, BENCHMARK_HUGE_SIZE);
+    }
+
+    struct paging_huge_page_stats_t after;
+    paging_get_huge_page_stats(&after);
+
+    vmm_free(range);
+    pmm_free_pages(phys, pages);
+
+    size_t accesses = BENCHMARK_HUGE_ROUNDS * pages;
+    LOG_INFO("4 kB pages: %u cycles to map, %u cycles per access.", map_cycles[0], stride_cycles[0] / accesses);
+    LOG_INFO("Promoted: %u cycles to map, %u cycles per access. %u promotions, %u demotions.", map_cycles[1], stride_cycles[1] / accesses, after.promotions - before.promotions, after.demotions - before.demotions);
+}
+
+/*!
+    @brief Measures resolving virtual addresses one by one, with and without hitting the translation cache, and with paging_resolve_range().
+
+    The range is mapped with 4 kB pages by giving paging_map_range() a physical address that isn't 2 MB aligned.
+    Resolving one address per 2 MB window never hits the cache, as there are more windows than cache entries.
+
+    @param hhdm_offset Offset used by the higher half direct map.
+*/
+static void benchmark_resolve(ptrdiff_t hhdm_offset)
+{
+    union page_table_entry_t *pml4 = (union page_table_entry_t *)((read_cr3() & ~0xfff) + hhdm_offset);
+
+    LOG_INFO("Benchmark: resolving %u MB mapped with 4 kB pages.", BENCHMARK_RESOLVE_SIZE / (1024 * 1024));
+
+    void *range = vmm_reserve(BENCHMARK_RESOLVE_SIZE, PMM_ALIGNMENT_2MB);
+    if (range == NULL || paging_map_range(pml4, PAGE_SIZE_BYTE, (uintptr_t)range, BENCHMARK_RESOLVE_SIZE, PAGING_FLAG_PRESENT | PAGING_FLAG_WRITABLE) != PAGING_OK)
+    {
+        LOG_ERROR("Failed to map the range.");
+        if (range != NULL)
+        {
+            paging_unmap_range(pml4, (uintptr_t)range, BENCHMARK_RESOLVE_SIZE);
+            vmm_free(range);
+        }
+        return;
+    }
+
+    size_t pages = BENCHMARK_RESOLVE_SIZE / PAGE_SIZE_BYTE;
+    size_t windows = BENCHMARK_RESOLVE_SIZE / PMM_ALIGNMENT_2MB;
+    uintptr_t checksum = 0;
+
+    struct paging_translation_cache_stats_t before;
+    paging_get_translation_cache_stats(&before);
+
+    uint64_t start = read_tsc();
+    for (size_t i = 0; i < windows; i++)
+    {
+        checksum = checksum + paging_resolve_virtual_address(pml4, (uintptr_t)range + i * PMM_ALIGNMENT_2MB);
+    }
+    uint64_t miss_cycles = read_tsc() - start;
+
+    start = read_tsc();
+    for (size_t i = 0; i < pages; i++)
+    {
+        checksum = checksum + paging_resolve_virtual_address(pml4, (uintptr_t)range + i * PAGE_SIZE_BYTE);
+    }
+    uint64_t sequential_cycles = read_tsc() - start;
+
+    struct paging_translation_cache_stats_t after;
+    paging_get_translation_cache_stats(&after);
+
+    struct paging_extent_t extents[BENCHMARK_RESOLVE_EXTENTS];
+    start = read_tsc();
+    size_t count = paging_resolve_range(pml4, (uintptr_t)range, BENCHMARK_RESOLVE_SIZE, extents, BENCHMARK_RESOLVE_EXTENTS);
+    uint64_t range_cycles = read_tsc() - start;
+
+    paging_unmap_range(pml4, (uintptr_t)range, BENCHMARK_RESOLVE_SIZE);
+    vmm_free(range);
+
+    LOG_INFO("Full walks: %u cycles per lookup, sequential: %u cycles per page (%u hits, %u misses).", miss_cycles / windows, sequential_cycles / pages, after.hits - before.hits, after.misses - before.misses);
+    LOG_INFO("paging_resolve_range(): %u cycles in total, %u extents. Checksum %x.", range_cycles, count, checksum);
+}
+
+/*!
+    @brief Maps, resolves and unmaps BENCHMARK_RECURSIVE_PAGES pages of an address space one by one.
+
+    @param pml4 PML4 of the address space.
+    @param phys Physical page all pages are mapped to.
+    @param cycles Array the cycles needed for mapping, resolving and unmapping all pages are stored in.
+*/
+static void benchmark_page_table_walks(union page_table_entry_t *pml4, uintptr_t phys, uint64_t cycles[3])
+{
+    uint64_t start = read_tsc();
+    for (size_t i = 0; i < BENCHMARK_RECURSIVE_PAGES; i++)
+    {
+        paging_map_page(pml4, phys, BENCHMARK_RECURSIVE_BASE + i * PMM_ALIGNMENT_2MB, PAGE_SIZE_4KB, PAGING_FLAG_PRESENT | PAGING_FLAG_WRITABLE);
+    }
+    cycles[0] = read_tsc() - start;
+
+    uintptr_t checksum = 0;
+    start = read_tsc();
+    for (size_t i = 0; i < BENCHMARK_RECURSIVE_PAGES; i++)
+    {
+        checksum = checksum + paging_resolve_virtual_address(pml4, BENCHMARK_RECURSIVE_BASE + i * PMM_ALIGNMENT_2MB);
+    }
+    cycles[1] = read_tsc() - start;
+
+    start = read_tsc();
+    for (size_t i = 0; i < BENCHMARK_RECURSIVE_PAGES; i++)
+    {
+        paging_unmap_page(pml4, BENCHMARK_RECURSIVE_BASE + i * PMM_ALIGNMENT_2MB, PAGE_SIZE_4KB);
+    }
+    cycles[2] = read_tsc() - start;
+
+    if (checksum != phys * BENCHMARK_RECURSIVE_PAGES)
+    {
+        LOG_ERROR("Resolved the wrong addresses.");
+    }
+}
+
+/*!
+    @brief Compares walking the page tables of the active address space with walking the ones of an inactive address space.
+
+    With PAGING_RECURSIVE, the tables of the active address space are accessed through the recursive slot,
+    the ones of the inactive address space always through the HHDM. Build with both settings to compare the active address space alone.
+    Unmapping from the inactive address space also marks its PCIDs as stale every time.
+
+    @param hhdm_offset Offset used by the higher half direct map.
+*/
+static void benchmark_recursive_slot(ptrdiff_t hhdm_offset)
+{
+    LOG_INFO("Benchmark: mapping, resolving and unmapping %u pages, active address space through the %s.", BENCHMARK_RECURSIVE_PAGES, PAGING_RECURSIVE ? "recursive slot" : "HHDM");
+
+    union page_table_entry_t *active = NULL;
+    union page_table_entry_t *inactive = NULL;
+    void *page = pmm_alloc();
+    if (page == NULL || paging_create_address_space(&active) != PAGING_OK || paging_create_address_space(&inactive) != PAGING_OK)
+    {
+        LOG_ERROR("Failed to create the address spaces.");
+        if (active != NULL)
+        {
+            paging_destroy_address_space(active);
+        }
+        if (page != NULL)
+        {
+            pmm_free(page);
+        }
+        return;
+    }
+
+    uintptr_t current = read_cr3() & ~(uint64_t)0xfff;
+    pcid_switch((uintptr_t)active - hhdm_offset);
+
+    uint64_t active_cycles[3];
+    uint64_t inactive_cycles[3];
+    benchmark_page_table_walks(active, (uintptr_t)page, active_cycles);
+    benchmark_page_table_walks(inactive, (uintptr_t)page, inactive_cycles);
+
+    pcid_switch(current);
+
+    paging_destroy_address_space(inactive);
+    paging_destroy_address_space(active);
+    pmm_free(page);
+
+    LOG_INFO("Active: map %u, resolve %u, unmap %u cycles per page.", active_cycles[0] / BENCHMARK_RECURSIVE_PAGES, active_cycles[1] / BENCHMARK_RECURSIVE_PAGES, active_cycles[2] / BENCHMARK_RECURSIVE_PAGES);
+    LOG_INFO("Inactive (HHDM): map %u, resolve %u, unmap %u cycles per page.", inactive_cycles[0] / BENCHMARK_RECURSIVE_PAGES, inactive_cycles[1] / BENCHMARK_RECURSIVE_PAGES, inactive_cycles[2] / BENCHMARK_RECURSIVE_PAGES);
+}
+
+/*!
+    @brief Runs all benchmarks.
+
+    Must be called after the PMM, kmalloc() and the VMM are initialized.
+
+    @param hhdm_offset Offset used by the higher half direct map.
+*/
+void benchmark_run_all(ptrdiff_t hhdm_offset)
+{
+    LOG_INFO("Running benchmarks...");
+
+    benchmark_pmm_alloc_occupancy(hhdm_offset);
+
+    LOG_INFO("Benchmark: random PMM workload.");
+    benchmark_pmm_random_workload(1);
+    benchmark_pmm_random_workload(64);
+
+    benchmark_pmm_numa(hhdm_offset);
+
+    uint64_t tsc_frequency = pit_measure_tsc_frequency();
+    LOG_INFO("TSC runs at %u kHz.", tsc_frequency / 1000);
+
+    struct arena_t scratch;
+    arena_init(&scratch, BENCHMARK_ARENA_CHUNK_PAGES, hhdm_offset);
+
+    benchmark_kmalloc_stress(&scratch, tsc_frequency);
+    benchmark_arena(hhdm_offset);
+    benchmark_vmm(hhdm_offset);
+    benchmark_vmm_lazy();
+    benchmark_paging_map_range(hhdm_offset);
+    benchmark_tlb_flush(hhdm_offset);
+    benchmark_pcid(hhdm_offset);
+    benchmark_address_spaces();
+    benchmark_fork(hhdm_offset);
+    benchmark_huge_pages(hhdm_offset);
+    benchmark_resolve(hhdm_offset);
+    benchmark_recursive_slot(hhdm_offset);
+
+    arena_destroy(&scratch);
+
+    struct pmm_magazine_stats_t stats;
+    if (pmm_get_magazine_stats(cpu_get_id(), &stats) == PMM_OK)
+    {
+        LOG_INFO("PMM magazine: hits=%u misses=%u refills=%u drains=%u", stats.hits, stats.misses, stats.refills, stats.drains);
+    }
+
+    LOG_INFO("Benchmarks finished.");
+}
+
+#endif // BENCHMARKS_ENABLED
@@ -0,0 +1,23 @@
+#include "cpu/idle.h"
+
+#include "memory/pmm.h"
+
+/*!
+    @brief Idle loop.
+
+    Uses the time the CPU would otherwise spend halted for background work, like refilling the PMMs zeroed page pool.
+    Halts until the next interrupt once there is nothing left to do.
+    Interrupts must be enabled, otherwise the CPU would never wake up again.
+*/
+void idle(void)
+{
+    while (1)
+    {
+        // Clear pages one by one, so an interrupt is never delayed by more than a single page.
+        while (pmm_zero_pool_refill_page())
+        {
+        }
+
+        asm("hlt");
+    }
+}
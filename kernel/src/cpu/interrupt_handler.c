@@ -8,6 +8,11 @@
 #include "drivers/pic.h"
 #include "drivers/ps2_keyboard.h"
 #include "logging.h"
+#include "memory/paging.h"
+#include "memory/vmm.h"
+
+/// @brief Bit of the page fault error code that is set if the page was present, i.e. the fault is a protection violation.
+#define INTERRUPT_PAGE_FAULT_PRESENT (1 << 0)
 
 /*!
     @brief Handles CPU exceptions and interrupts.
@@ -17,6 +22,9 @@
       prints a predefined error message and halts the system.
     - For exceptions with error codes (e.g. page fault),
       prints the description and the error code and halts.
+    - Page faults on pages that are not present are passed to vmm_handle_page_fault(), which resolves them inside of ranges allocated with VMM_FLAG_LAZY.
+      Faults on present pages are passed to paging_handle_cow_fault(), which resolves writes to copy-on-write pages.
+      All other page faults are printed and halt.
     - For external interrupts 0 to 15 (from the PIC), prints the IRQs number
       and sends an End-Of-Interrupt command.
     - For unknown / unhandled interrupts, prints a generic message 
@@ -69,6 +77,20 @@ void interrupt_handler(struct interrupt_stack_frame *stack)
         break;
     case INT_PAGE_FAULT:
         uint64_t cr2 = read_cr2();
+        // Only one of the handlers can resolve a fault, so the VMM doesn't count copy-on-write faults as unhandled.
+        if (stack->error_code & INTERRUPT_PAGE_FAULT_PRESENT)
+        {
+            // Writes to pages shared by a fork are resolved by copying them.
+            if (paging_handle_cow_fault(cr2, stack->error_code) == PAGING_OK)
+            {
+                break;
+            }
+        }
+        // Faults inside of lazy ranges are resolved by mapping a page, the faulting instruction is then restarted.
+        else if (vmm_handle_page_fault(cr2, stack->error_code) == VMM_OK)
+        {
+            break;
+        }
         LOG_ERROR(interrupt_descriptions[stack->interrupt_vector], stack->error_code, cr2);
         hcf();
         break;
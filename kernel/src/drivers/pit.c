@@ -1,6 +1,7 @@
 #include "drivers/pit.h"
 
 #include "cpu/port_io.h"
+#include "cpu/registers.h"
 #include "logging.h"
 
 #define PIT_COMMAND 0x43
@@ -13,6 +14,12 @@
 #define PIT_BCD_BINARY 0
 #define PIT_BCD_BCD 1
 
+// Controls the gate of channel 2 and the PC speaker, also holds the output of channel 2.
+#define PIT_CHANNEL_2_CONTROL 0x61
+#define PIT_CHANNEL_2_GATE (1 << 0)
+#define PIT_CHANNEL_2_SPEAKER (1 << 1)
+#define PIT_CHANNEL_2_OUTPUT (1 << 5)
+
 /*!
     @brief Initializes a channel of the PIT.
 
@@ -60,4 +67,35 @@ pit_error_codes pit_init_channel(uint8_t channel, uint64_t frequency, uint8_t mo
     asm("sti");
 
     return PIT_OK;
-}
\ No newline at end of file
+}
+
+/*!
+    @brief Measures the frequency of the time stamp counter (TSC) using channel 2 of the PIT.
+
+    Lets channel 2 count down for PIT_TSC_CALIBRATION_MS milliseconds and reads the TSC before and after.
+    Channel 2 only drives the PC speaker, which is kept disabled, so this doesn't interfere with the timer interrupt on channel 0.
+    Takes PIT_TSC_CALIBRATION_MS milliseconds and busy waits the whole time.
+
+    @returns Frequency of the TSC in Hz.
+*/
+uint64_t pit_measure_tsc_frequency()
+{
+    uint16_t count = PIT_F_REF * PIT_TSC_CALIBRATION_MS / 1000;
+
+    // Enable the gate of channel 2, but keep the speaker off.
+    uint8_t control = port_read_byte(PIT_CHANNEL_2_CONTROL);
+    port_write_byte(PIT_CHANNEL_2_CONTROL, (control & ~PIT_CHANNEL_2_SPEAKER) | PIT_CHANNEL_2_GATE);
+
+    // In this mode the output goes HIGH once the count reaches 0, counting starts when the count is set.
+    port_write_byte(PIT_COMMAND, PIT_SC_COUNTER_2 | PIT_RW_LOW_HIGH | PIT_MODE_INT_ON_TERMINAL_COUNT | PIT_BCD_BINARY);
+    port_write_byte(PIT_CHANNEL_2, count & 0x00ff);
+    port_write_byte(PIT_CHANNEL_2, (count & 0xff00) >> 8);
+
+    uint64_t start = read_tsc();
+    while ((port_read_byte(PIT_CHANNEL_2_CONTROL) & PIT_CHANNEL_2_OUTPUT) == 0) {}
+    uint64_t end = read_tsc();
+
+    port_write_byte(PIT_CHANNEL_2_CONTROL, control);
+
+    return (end - start) * 1000 / PIT_TSC_CALIBRATION_MS;
+}
@@ -7,18 +7,27 @@
 #include "stdio.h"
 #include "string.h"
 
+#include "acpi/acpi.h"
+#include "acpi/srat.h"
+#include "benchmark.h"
 #include "charset.h"
+#include "cpu/cpu.h"
 #include "cpu/gdt.h"
 #include "cpu/hcf.h"
 #include "cpu/idt.h"
+#include "cpu/idle.h"
 #include "cpu/registers.h"
 #include "drivers/pic.h"
 #include "drivers/pit.h"
 #include "drivers/ps2.h"
 #include "drivers/serial.h"
 #include "logging.h"
+#include "memory/kmalloc.h"
 #include "memory/paging.h"
+#include "memory/pcid.h"
 #include "memory/pmm.h"
+#include "memory/slab.h"
+#include "memory/vmm.h"
 #include "terminal.h"
 
 // set limine base revision to 3
@@ -36,6 +45,18 @@ __attribute__((used, section(".limine_requests"))) static volatile struct limine
     .id = LIMINE_HHDM_REQUEST,
     .revision = 0};
 
+__attribute__((used, section(".limine_requests"))) static volatile struct limine_rsdp_request rsdp_request = {
+    .id = LIMINE_RSDP_REQUEST,
+    .revision = 0};
+
+// Request a stack of known size, so it can be excluded when bootloader reclaimable memory is reclaimed.
+#define KERNEL_STACK_SIZE 0x10000
+
+__attribute__((used, section(".limine_requests"))) static volatile struct limine_stack_size_request stack_size_request = {
+    .id = LIMINE_STACK_SIZE_REQUEST,
+    .revision = 0,
+    .stack_size = KERNEL_STACK_SIZE};
+
 __attribute__((used, section(".limine_requests_start"))) static volatile LIMINE_REQUESTS_START_MARKER;
 
 __attribute__((used, section(".limine_requests_end"))) static volatile LIMINE_REQUESTS_END_MARKER;
@@ -55,9 +76,11 @@ void kmain(void)
     }
 
     // Fetch a framebuffer.
-    struct limine_framebuffer *framebuffer = framebuffer_request.response->framebuffers[0];
+    // It is copied, as Limines response is stored in bootloader reclaimable memory that will be reused later on.
+    static struct limine_framebuffer framebuffer;
+    framebuffer = *framebuffer_request.response->framebuffers[0];
 
-    terminal_init(framebuffer, CHARACTER_WIDTH * 1.3, CHARACTER_HEIGHT * 2.2);
+    terminal_init(&framebuffer, CHARACTER_WIDTH * 1.3, CHARACTER_HEIGHT * 2.2);
 
     terminal_write_string("Joe\n", strlen("Joe\n"));
     terminal_set_color(0xaa0000);
@@ -103,32 +126,94 @@ void kmain(void)
         hcf();
     }
     
-    struct limine_hhdm_response *hhdm_response = hhdm_request.response;
+    // The response is stored in bootloader reclaimable memory, so only a copy of the offset is kept.
+    uint64_t hhdm_offset = hhdm_request.response->offset;
     
-    if (pmm_init(memmap, hhdm_response->offset) != PMM_OK)
+    // Read the NUMA topology from the ACPI tables, so the PMM can split its regions at node boundaries.
+    // This has to happen before the ACPI tables are reclaimed.
+    bool numa_available = false;
+    if (rsdp_request.response != NULL && acpi_init(rsdp_request.response->address, hhdm_offset, memmap) == ACPI_OK && srat_init() == ACPI_OK)
+    {
+        struct pmm_node_range_t node_ranges[PMM_MAX_NODE_RANGES];
+        size_t num_node_ranges = srat_get_memory_ranges(node_ranges, PMM_MAX_NODE_RANGES);
+        numa_available = pmm_set_node_ranges(node_ranges, num_node_ranges) == PMM_OK;
+    }
+
+    if (pmm_init(memmap, hhdm_offset) != PMM_OK)
     {
         hcf();
     }
 
-    paging_init((ptrdiff_t)hhdm_response->offset);
+    uint32_t cpu_node;
+    if (numa_available && srat_get_cpu_node(cpu_get_apic_id(), &cpu_node))
+    {
+        pmm_set_cpu_node(cpu_get_id(), cpu_node);
+        LOG_INFO("CPU %u is in NUMA node %u of %u.", cpu_get_id(), cpu_node, pmm_get_num_nodes());
+    }
+
+    slab_init((ptrdiff_t)hhdm_offset);
+    kmalloc_init((ptrdiff_t)hhdm_offset);
 
-    union page_table_entry_t *old_pml4 = (union page_table_entry_t *) ((read_cr3() & ~0x7ff) + hhdm_response->offset);
+    paging_init((ptrdiff_t)hhdm_offset);
+
+    union page_table_entry_t *old_pml4 = (union page_table_entry_t *) ((read_cr3() & ~0x7ff) + hhdm_offset);
 
     union page_table_entry_t *pml4 = NULL;
 
+    uint64_t clone_start = read_tsc();
     if (paging_clone_page_table(old_pml4, &pml4, PML4) != PAGING_OK)
     {
         LOG_ERROR("Failed to clone page table.");
         hcf();
     }
-    LOG_INFO("Successfully cloned the page table.");
+    LOG_INFO("Successfully cloned the page table in %u cycles.", read_tsc() - clone_start);
 
     LOG_INFO("Before loading cr3");
-    
-    set_cr3(((uint64_t)pml4) - hhdm_response->offset);
+
+    // CR3 still holds PCID 0 here, which is required for enabling PCIDs.
+    pcid_init();
+    pcid_switch(((uint64_t)pml4) - hhdm_offset);
 
     LOG_INFO("after loading cr3");
 
+    // From now on, new address spaces share the higher half of this PML4.
+    if (paging_init_kernel_half(pml4) != PAGING_OK)
+    {
+        LOG_ERROR("Failed to prepare the kernel half for sharing.");
+        hcf();
+    }
+
+    if (vmm_init(pml4) != VMM_OK)
+    {
+        LOG_ERROR("Failed to initialize the VMM.");
+        hcf();
+    }
+
+    // The ACPI code still points to the memory map and the tables, which are about to be reclaimed.
+    acpi_release();
+
+    /*
+        Limines page tables, responses and memory map are no longer used, so their memory can be reclaimed.
+        Only the stack we are running on has to be kept.
+        We don't know where rsp is inside the stack, so everything up to a stack size around it is kept.
+    */
+    uint64_t rsp = read_rsp();
+    if (rsp >= hhdm_offset)
+    {
+        pmm_reclaim_memory(MEMMAP_TYPE_BOOTLOADER_RECLAIMABLE, rsp - hhdm_offset - KERNEL_STACK_SIZE, 2 * KERNEL_STACK_SIZE);
+    }
+    else
+    {
+        LOG_WARNING("Stack is not in the HHDM, bootloader reclaimable memory is not reclaimed.");
+    }
+    
+    // The SRAT was already read before the PMM was set up and acpi_release() was called, so the ACPI tables can be reclaimed as well.
+    pmm_reclaim_memory(MEMMAP_TYPE_ACPI_RECLAIMABLE, 0, 0);
+
+#if BENCHMARKS_ENABLED
+    benchmark_run_all((ptrdiff_t)hhdm_offset);
+#endif
+
     // Initialize the PIC and enable interrupts.
     pic_init(0x20, 0x28);
     asm("sti");
@@ -139,17 +224,122 @@ void kmain(void)
 
     LOG_INFO("Test mapping and unmapping a page...");
 
-    if (paging_map_page(pml4, 0x7fb000, 0x7fb000, PAGE_SIZE_4KB, PAGING_FLAG_PRESENT | PAGING_FLAG_WRITABLE))
+    void *test_page = pmm_alloc();
+    void *test_virt = vmm_reserve(0x1000, 0);
+    if (test_page == NULL || test_virt == NULL)
     {
-        LOG_ERROR("Failed to map page");
+        LOG_ERROR("Failed to allocate a page");
     }
-    
-    if (paging_unmap_page(pml4, 0x7fb000, PAGE_SIZE_4KB))
+    else
     {
-        LOG_ERROR("Failed to unmap page");
+        if (paging_map_page(pml4, (uintptr_t)test_page, (uintptr_t)test_virt, PAGE_SIZE_4KB, PAGING_FLAG_PRESENT | PAGING_FLAG_WRITABLE))
+        {
+            LOG_ERROR("Failed to map page");
+        }
+        // pml4 is the active address space, so with PAGING_RECURSIVE this walks through the recursive slot.
+        else if (paging_resolve_virtual_address(pml4, (uintptr_t)test_virt) != (uintptr_t)test_page)
+        {
+            LOG_ERROR("Mapped page resolves to the wrong address");
+        }
+
+        if (paging_unmap_page(pml4, (uintptr_t)test_virt, PAGE_SIZE_4KB))
+        {
+            LOG_ERROR("Failed to unmap page");
+        }
+        else if (paging_resolve_virtual_address(pml4, (uintptr_t)test_virt) != (uintptr_t)NULL)
+        {
+            LOG_ERROR("Unmapped page is still mapped");
+        }
+    }
+
+    if (test_page != NULL)
+    {
+        pmm_free(test_page);
+    }
+    if (test_virt != NULL)
+    {
+        vmm_free(test_virt);
+    }
+
+    LOG_INFO("Test mapping and unmapping a 2 MB page...");
+
+    void *huge_page = pmm_alloc_pages(512, PMM_ALIGNMENT_2MB);
+    void *huge_virt = vmm_reserve(PMM_ALIGNMENT_2MB, PMM_ALIGNMENT_2MB);
+    if (huge_page == NULL || huge_virt == NULL)
+    {
+        LOG_ERROR("Failed to allocate 2 MB of contiguous memory");
+    }
+    else
+    {
+        if (paging_map_page(pml4, (uintptr_t)huge_page, (uintptr_t)huge_virt, PAGE_SIZE_2MB, PAGING_FLAG_PRESENT | PAGING_FLAG_WRITABLE | PAGING_FLAG_PAGE_SIZE))
+        {
+            LOG_ERROR("Failed to map 2 MB page");
+        }
+        else if (paging_resolve_virtual_address(pml4, (uintptr_t)huge_virt + 0x1000) != (uintptr_t)huge_page + 0x1000)
+        {
+            LOG_ERROR("Mapped 2 MB page resolves to the wrong address");
+        }
+
+        if (paging_unmap_page(pml4, (uintptr_t)huge_virt, PAGE_SIZE_2MB))
+        {
+            LOG_ERROR("Failed to unmap 2 MB page");
+        }
+    }
+
+    if (huge_page != NULL)
+    {
+        pmm_free_pages(huge_page, 512);
+    }
+    if (huge_virt != NULL)
+    {
+        vmm_free(huge_virt);
+    }
+
+    LOG_INFO("Test allocating virtual memory...");
+
+    uint64_t *vmm_test = vmm_alloc(0x10000, VMM_FLAG_WRITABLE | VMM_FLAG_ZERO);
+    if (vmm_test == NULL)
+    {
+        LOG_ERROR("Failed to allocate virtual memory");
+    }
+    else
+    {
+        vmm_test[0] = 0x6a4f6553;
+        vmm_test[0x10000 / sizeof(uint64_t) - 1] = vmm_test[0];
+
+        if (vmm_free(vmm_test) != VMM_OK)
+        {
+            LOG_ERROR("Failed to free virtual memory");
+        }
+    }
+
+    LOG_INFO("Test demand paging...");
+
+    uint64_t *lazy_test = vmm_alloc(0x100000, VMM_FLAG_WRITABLE | VMM_FLAG_LAZY);
+    if (lazy_test == NULL)
+    {
+        LOG_ERROR("Failed to reserve lazy virtual memory");
+    }
+    else
+    {
+        // Both accesses fault and get a zeroed page, the pages in between are never backed.
+        lazy_test[0x80000 / sizeof(uint64_t)] = lazy_test[0] + 0x6a4f6553;
+
+        struct vmm_fault_stats_t fault_stats;
+        vmm_get_fault_stats(&fault_stats);
+        LOG_INFO("Lazy range: value=%x, %u faults handled, %u cycles max.", lazy_test[0x80000 / sizeof(uint64_t)], fault_stats.handled, fault_stats.max_cycles);
+        if (lazy_test[0x80000 / sizeof(uint64_t)] != 0x6a4f6553 || fault_stats.unhandled != 0)
+        {
+            LOG_ERROR("Demand paging returned a wrong value or left faults unhandled");
+        }
+
+        if (vmm_free(lazy_test) != VMM_OK)
+        {
+            LOG_ERROR("Failed to free lazy virtual memory");
+        }
     }
 
     LOG_INFO("No erros. Seems to work i guess.");
 
-    hcf();
+    idle();
 }
\ No newline at end of file
@@ -0,0 +1,221 @@
+#include "memory/arena.h"
+
+#include <stdbool.h>
+
+#include "logging.h"
+#include "memory/pmm.h"
+
+#define PAGE_SIZE_BYTE 4096
+
+/// @brief Rounds x up to the next multiple of align. align must be a power of two.
+#define ARENA_ALIGN_UP(x, align) (((x) + (align) - 1) & ~((uintptr_t)(align) - 1))
+
+/*!
+    @brief Gets the end of a chunk.
+
+    @param chunk The chunk.
+    @returns Virtual address of the first byte behind the chunk.
+*/
+static inline uintptr_t arena_get_chunk_end(struct arena_chunk_t *chunk)
+{
+    return (uintptr_t)chunk + chunk->pages * PAGE_SIZE_BYTE;
+}
+
+/*!
+    @brief Adds a new chunk to an arena and makes it the current one.
+
+    @param arena The arena.
+    @param min_size Number of bytes that must fit into the chunk behind its header.
+    @returns true on success, false if the PMM is out of memory.
+*/
+static bool arena_add_chunk(struct arena_t *arena, size_t min_size)
+{
+    size_t pages = (sizeof(struct arena_chunk_t) + min_size + PAGE_SIZE_BYTE - 1) / PAGE_SIZE_BYTE;
+    if (pages < arena->chunk_pages)
+    {
+        pages = arena->chunk_pages;
+    }
+
+    void *phys = pmm_alloc_pages(pages, 0);
+    if (phys == NULL)
+    {
+        return false;
+    }
+
+    struct arena_chunk_t *chunk = (struct arena_chunk_t *)((uintptr_t)phys + arena->hhdm_offset);
+    chunk->previous = arena->chunk;
+    chunk->pages = pages;
+
+    arena->chunk = chunk;
+    arena->next = (uintptr_t)chunk + sizeof(struct arena_chunk_t);
+    arena->end = arena_get_chunk_end(chunk);
+
+    return true;
+}
+
+/*!
+    @brief Gives the current chunk of an arena back to the PMM and makes the previous one the current chunk.
+
+    The arenas pointer is left at the end of the previous chunk.
+
+    @param arena The arena. Must have a chunk.
+*/
+static void arena_free_chunk(struct arena_t *arena)
+{
+    struct arena_chunk_t *chunk = arena->chunk;
+
+    arena->chunk = chunk->previous;
+    if (arena->chunk != NULL)
+    {
+        arena->end = arena_get_chunk_end(arena->chunk);
+    }
+    else
+    {
+        arena->end = 0;
+    }
+    arena->next = arena->end;
+
+    pmm_free_pages((void *)((uintptr_t)chunk - arena->hhdm_offset), chunk->pages);
+}
+
+/*!
+    @brief Sets up an empty arena.
+
+    No memory is allocated until the first call to arena_alloc().
+
+    @param arena The arena.
+    @param chunk_pages Minimum number of pages taken from the PMM whenever the arena needs more memory.
+    @param hhdm_offset Offset used by the higher half direct map.
+    @returns ARENA_OK on success, ARENA_ERROR_INVALID_ARGUMENT if chunk_pages is 0.
+*/
+arena_error_codes_t arena_init(struct arena_t *arena, size_t chunk_pages, ptrdiff_t hhdm_offset)
+{
+    if (chunk_pages == 0)
+    {
+        return ARENA_ERROR_INVALID_ARGUMENT;
+    }
+
+    arena->chunk = NULL;
+    arena->next = 0;
+    arena->end = 0;
+    arena->chunk_pages = chunk_pages;
+    arena->hhdm_offset = hhdm_offset;
+
+    return ARENA_OK;
+}
+
+/*!
+    @brief Allocates memory from an arena.
+
+    Moves the arenas pointer forward by size byte (plus padding for alignment), so this takes constant time.
+    If the current chunk is too small, a new chunk of at least chunk_pages pages is allocated and the rest of the old one is left unused.
+
+    @param arena The arena.
+    @param size Number of bytes to allocate.
+    @param alignment Alignment of the memory in byte. Must be 0 or a power of two up to the page size. 0 means ARENA_DEFAULT_ALIGNMENT.
+    @returns Pointer (virtual address) to the memory, or NULL if the arguments are invalid or no memory is left.
+*/
+void * arena_alloc(struct arena_t *arena, size_t size, size_t alignment)
+{
+    if (alignment == 0)
+    {
+        alignment = ARENA_DEFAULT_ALIGNMENT;
+    }
+
+    if (size == 0 || (alignment & (alignment - 1)) != 0 || alignment > PAGE_SIZE_BYTE)
+    {
+        LOG_ERROR("Invalid arguments: size=%u, alignment=%u", size, alignment);
+        return NULL;
+    }
+
+    uintptr_t ptr = ARENA_ALIGN_UP(arena->next, alignment);
+
+    if (arena->chunk == NULL || ptr > arena->end || arena->end - ptr < size)
+    {
+        // Chunks start at a page boundary, so padding the size by the alignment is always enough.
+        if (!arena_add_chunk(arena, size + alignment))
+        {
+            return NULL;
+        }
+
+        ptr = ARENA_ALIGN_UP(arena->next, alignment);
+    }
+
+    arena->next = ptr + size;
+
+    return (void *)ptr;
+}
+
+/*!
+    @brief Gets the current position of an arena.
+
+    @param arena The arena.
+    @returns Mark that can be passed to arena_rewind().
+*/
+struct arena_mark_t arena_get_mark(struct arena_t *arena)
+{
+    struct arena_mark_t mark = {
+        .chunk = arena->chunk,
+        .next = arena->next};
+
+    return mark;
+}
+
+/*!
+    @brief Frees everything that was allocated from an arena after a mark was taken.
+
+    Chunks that were added after the mark are given back to the PMM.
+
+    @param arena The arena.
+    @param mark Mark returned by arena_get_mark() on the same arena. Marks taken after it become invalid.
+*/
+void arena_rewind(struct arena_t *arena, struct arena_mark_t mark)
+{
+    while (arena->chunk != mark.chunk && arena->chunk != NULL)
+    {
+        arena_free_chunk(arena);
+    }
+
+    if (arena->chunk != NULL)
+    {
+        arena->next = mark.next;
+    }
+}
+
+/*!
+    @brief Frees everything that was allocated from an arena.
+
+    The first chunk is kept, so the arena can be used again without asking the PMM for memory.
+
+    @param arena The arena.
+*/
+void arena_reset(struct arena_t *arena)
+{
+    if (arena->chunk == NULL)
+    {
+        return;
+    }
+
+    while (arena->chunk->previous != NULL)
+    {
+        arena_free_chunk(arena);
+    }
+
+    arena->next = (uintptr_t)arena->chunk + sizeof(struct arena_chunk_t);
+}
+
+/*!
+    @brief Frees everything that was allocated from an arena and gives all of its chunks back to the PMM.
+
+    @param arena The arena.
+*/
+void arena_destroy(struct arena_t *arena)
+{
+    while (arena->chunk != NULL)
+    {
+        arena_free_chunk(arena);
+    }
+
+    arena->next = 0;
+    arena->end = 0;
+}
@@ -0,0 +1,219 @@
+#include "memory/kmalloc.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "logging.h"
+#include "memory/pmm.h"
+#include "memory/slab.h"
+
+#define PAGE_SIZE_BYTE 4096
+
+/// @brief log2 of KMALLOC_MIN_SIZE.
+#define KMALLOC_MIN_SIZE_SHIFT 4
+
+static bool kmalloc_initialized = false;
+
+static ptrdiff_t kmalloc_hhdm_offset = 0;
+
+// One cache per size class, kmalloc_caches[i] holds objects of KMALLOC_MIN_SIZE << i byte.
+static struct kmem_cache_t *kmalloc_caches[KMALLOC_NUM_SIZE_CLASSES];
+
+/*!
+    @brief Gets the size class of a small allocation.
+
+    @param size Size of the allocation. Must be between 1 and KMALLOC_MAX_SMALL_SIZE.
+    @returns Index of the size class in kmalloc_caches.
+*/
+static inline size_t kmalloc_get_size_class(size_t size)
+{
+    if (size <= KMALLOC_MIN_SIZE)
+    {
+        return 0;
+    }
+
+    // Number of bits needed for size - 1 is log2 of the next power of two.
+    return (64 - __builtin_clzll(size - 1)) - KMALLOC_MIN_SIZE_SHIFT;
+}
+
+/*!
+    @brief Checks if a cache belongs to kmalloc().
+
+    @param cache The cache.
+    @returns true if it is the cache of a size class, false if not.
+*/
+static bool kmalloc_is_own_cache(struct kmem_cache_t *cache)
+{
+    for (size_t i = 0; i < KMALLOC_NUM_SIZE_CLASSES; i++)
+    {
+        if (kmalloc_caches[i] == cache)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*!
+    @brief Gets the struct of the first page of a large allocation.
+
+    @param ptr Pointer (virtual address) to the allocation.
+    @returns Pointer to the page struct, or NULL if ptr is not the start of a large allocation.
+*/
+static struct page_t * kmalloc_get_large_page(void *ptr)
+{
+    if (((uintptr_t)ptr & (PAGE_SIZE_BYTE - 1)) != 0)
+    {
+        return NULL;
+    }
+
+    struct page_t *page = phys_to_page((uintptr_t)ptr - kmalloc_hhdm_offset);
+    if (page == NULL || page->owner != PAGE_OWNER_KMALLOC || page->private == 0)
+    {
+        return NULL;
+    }
+
+    return page;
+}
+
+/*!
+    @brief Initializes kmalloc() by creating a slab cache for each size class.
+
+    Must be called after slab_init().
+
+    @param hhdm_offset Offset used by the higher half direct map.
+    @returns KMALLOC_OK on success, KMALLOC_ERROR_NOT_INITIALIZED if a cache could not be created.
+*/
+kmalloc_error_codes_t kmalloc_init(ptrdiff_t hhdm_offset)
+{
+    kmalloc_hhdm_offset = hhdm_offset;
+
+    for (size_t i = 0; i < KMALLOC_NUM_SIZE_CLASSES; i++)
+    {
+        kmalloc_caches[i] = kmem_cache_create((size_t)KMALLOC_MIN_SIZE << i, 0);
+        if (kmalloc_caches[i] == NULL)
+        {
+            LOG_ERROR("Failed to create cache for size class %u.", KMALLOC_MIN_SIZE << i);
+            return KMALLOC_ERROR_NOT_INITIALIZED;
+        }
+    }
+
+    kmalloc_initialized = true;
+
+    LOG_INFO("kmalloc initialized, size classes %u - %u bytes.", KMALLOC_MIN_SIZE, KMALLOC_MAX_SMALL_SIZE);
+
+    return KMALLOC_OK;
+}
+
+/*!
+    @brief Allocates memory.
+
+    Sizes up to KMALLOC_MAX_SMALL_SIZE are taken from the slab cache of the next larger size class.
+    Larger sizes are rounded up to whole pages, allocated with pmm_alloc_pages().
+    Their first page is tagged with PAGE_OWNER_KMALLOC and remembers the number of pages.
+    Small allocations are aligned to their size class, but at most to a cache line. Large allocations are page aligned.
+
+    @param size Number of bytes to allocate.
+    @returns Pointer (virtual address) to the memory, or NULL if size is 0 or no memory is left.
+*/
+void * kmalloc(size_t size)
+{
+    if (!kmalloc_initialized || size == 0)
+    {
+        return NULL;
+    }
+
+    if (size <= KMALLOC_MAX_SMALL_SIZE)
+    {
+        return kmem_cache_alloc(kmalloc_caches[kmalloc_get_size_class(size)]);
+    }
+
+    size_t count = (size + PAGE_SIZE_BYTE - 1) / PAGE_SIZE_BYTE;
+
+    void *phys = pmm_alloc_pages(count, 0);
+    if (phys == NULL)
+    {
+        return NULL;
+    }
+
+    struct page_t *page = phys_to_page((uintptr_t)phys);
+    page->owner = PAGE_OWNER_KMALLOC;
+    page->private = count;
+
+    return (void *)((uintptr_t)phys + kmalloc_hhdm_offset);
+}
+
+/*!
+    @brief Frees memory allocated by kmalloc().
+
+    The size of the allocation is looked up in the struct page_t of its first page:
+    Pages of slabs lead to the cache of the size class, large allocations store their number of pages.
+    Freeing NULL does nothing.
+
+    @param ptr Pointer (virtual address) returned by kmalloc().
+    @returns KMALLOC_OK on success, KMALLOC_ERROR_INVALID_POINTER if ptr was not returned by kmalloc().
+*/
+kmalloc_error_codes_t kfree(void *ptr)
+{
+    if (ptr == NULL)
+    {
+        return KMALLOC_OK;
+    }
+
+    struct kmem_cache_t *cache = kmem_cache_find(ptr);
+    if (cache != NULL)
+    {
+        if (!kmalloc_is_own_cache(cache) || kmem_cache_free(cache, ptr) != SLAB_OK)
+        {
+            LOG_ERROR("%p was not allocated by kmalloc().", ptr);
+            return KMALLOC_ERROR_INVALID_POINTER;
+        }
+
+        return KMALLOC_OK;
+    }
+
+    struct page_t *page = kmalloc_get_large_page(ptr);
+    if (page == NULL)
+    {
+        LOG_ERROR("%p was not allocated by kmalloc().", ptr);
+        return KMALLOC_ERROR_INVALID_POINTER;
+    }
+
+    if (pmm_free_pages((void *)((uintptr_t)ptr - kmalloc_hhdm_offset), page->private) != PMM_OK)
+    {
+        return KMALLOC_ERROR_INVALID_POINTER;
+    }
+
+    return KMALLOC_OK;
+}
+
+/*!
+    @brief Gets the usable size of an allocation.
+
+    This is the size of its size class or the size of its pages, so it can be larger than the requested size.
+
+    @param ptr Pointer (virtual address) returned by kmalloc().
+    @returns Usable size in byte, 0 if ptr was not returned by kmalloc().
+*/
+size_t ksize(void *ptr)
+{
+    if (ptr == NULL)
+    {
+        return 0;
+    }
+
+    struct kmem_cache_t *cache = kmem_cache_find(ptr);
+    if (cache != NULL)
+    {
+        return kmalloc_is_own_cache(cache) ? kmem_cache_get_object_size(cache) : 0;
+    }
+
+    struct page_t *page = kmalloc_get_large_page(ptr);
+    if (page == NULL)
+    {
+        return 0;
+    }
+
+    return page->private * PAGE_SIZE_BYTE;
+}
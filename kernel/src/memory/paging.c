@@ -2,15 +2,153 @@
 
 #include "string.h"
 
+#include "cpu/cpu.h"
+#include "cpu/registers.h"
 #include "logging.h"
+#include "memory/pcid.h"
 #include "memory/pmm.h"
 #include <stdint.h>
 
 #define PAGE_TABLE_NUM_ENTRIES 512
 
+#define PAGE_SIZE_BYTE 4096
+
+// Number of pages kept in reserve for new page tables.
+#define PAGING_TABLE_RESERVE_SIZE 64
+
+/// @brief Bit of the page fault error code that is set if the page was present, i.e. the fault is a protection violation.
+#define PAGING_PAGE_FAULT_PRESENT (1 << 0)
+/// @brief Bit of the page fault error code that is set if the fault was caused by a write.
+#define PAGING_PAGE_FAULT_WRITE (1 << 1)
+
 // For now I just use a global offset for virtual to physical translation.
 static ptrdiff_t g_hhdm_offset = (ptrdiff_t)NULL;
 
+// Whether the CPU can map 1 GB pages. Checked in paging_init().
+static bool paging_1gb_pages_supported = false;
+// Whether CR4.PGE and EFER.NXE were set by paging_init().
+static bool paging_global_pages_enabled = false;
+static bool paging_nx_enabled = false;
+
+// Number of huge pages created by paging_try_promote_pt() and split by paging_split_leaf().
+static struct paging_huge_page_stats_t paging_huge_page_stats = {0};
+
+/*!
+    @brief Cached result of walking down to the PD entry of a 2 MB window.
+*/
+struct paging_translation_cache_entry_t {
+    /// @brief Value of paging_translation_cache_generation when the entry was filled. Entries of older generations are invalid.
+    uint64_t generation;
+    union page_table_entry_t *pml4;
+    /// @brief Virtual address shifted right by 21 bits.
+    uintptr_t window;
+    /// @brief PT that maps the window, NULL if the window lies inside of a large page.
+    union page_table_entry_t *pt;
+    /// @brief Physical address of the window if it lies inside of a large page.
+    uintptr_t phys;
+};
+
+static struct paging_translation_cache_entry_t paging_translation_cache[PAGING_TRANSLATION_CACHE_SIZE];
+// Starts at 1, so the zeroed entries are invalid.
+static uint64_t paging_translation_cache_generation = 1;
+static struct paging_translation_cache_stats_t paging_translation_cache_stats = {0};
+
+// Set when a table was freed or a large page removed or split, as the TLB might still translate their old recursive addresses.
+// Only used with PAGING_RECURSIVE.
+static bool paging_recursive_flush_pending = false;
+
+// PML4 whose higher half is shared by all address spaces, set by paging_init_kernel_half().
+static union page_table_entry_t *paging_kernel_pml4 = NULL;
+
+// Section boundaries of the kernel, defined in the linker script.
+extern char __kernel_text_start[];
+extern char __kernel_text_end[];
+extern char __kernel_rodata_start[];
+extern char __kernel_rodata_end[];
+
+// Physical pages reserved for page tables. They are always cleared, so a new table can be used right away.
+static void *paging_table_reserve[PAGING_TABLE_RESERVE_SIZE];
+static size_t paging_table_reserve_count = 0;
+
+/*!
+    @brief Invalidates all entries of the translation cache of paging_resolve_virtual_address().
+
+    Has to be called whenever a table is freed or a PD or PDPR entry that might be cached changes,
+    i.e. a large page is removed or split. Changes to PT entries don't matter, as the cache only points to the PT.
+    With PAGING_RECURSIVE, the same changes move tables around below PAGING_RECURSIVE_BASE,
+    so the TLB is flushed before the recursive slot is used the next time (see paging_use_recursive()).
+*/
+static inline void paging_translation_cache_invalidate()
+{
+    paging_translation_cache_generation = paging_translation_cache_generation + 1;
+    paging_translation_cache_stats.invalidations = paging_translation_cache_stats.invalidations + 1;
+    paging_recursive_flush_pending = true;
+}
+
+/*!
+    @brief Allocate memory for a page table.
+
+    Takes a cleared page from the page table reserve and marks it as a page table in its struct page_t.
+    If the reserve is empty, it is refilled with pmm_alloc_zeroed_batch(), which takes the pages from the PMMs zeroed page pool.
+    That way neither the PMM nor a memset are needed for every single table, e.g. when cloning a page table hierarchy.
+
+    @returns Pointer (virtual address) to the zeroed table, or NULL if no memory is left.
+*/
+static union page_table_entry_t * paging_alloc_table()
+{
+    if (paging_table_reserve_count == 0)
+    {
+        paging_table_reserve_count = pmm_alloc_zeroed_batch(paging_table_reserve, PAGING_TABLE_RESERVE_SIZE);
+        if (paging_table_reserve_count == 0)
+        {
+            return NULL;
+        }
+    }
+
+    paging_table_reserve_count = paging_table_reserve_count - 1;
+    void *phys = paging_table_reserve[paging_table_reserve_count];
+
+    struct page_t *page = phys_to_page((uintptr_t)phys);
+    if (page != NULL)
+    {
+        page->flags = page->flags | PAGE_FLAG_PAGE_TABLE;
+        page->owner = PAGE_OWNER_PAGING;
+    }
+
+    return phys + g_hhdm_offset;
+}
+
+/*!
+    @brief Give the memory of a page table back.
+
+    Puts the tables page back into the page table reserve.
+    The table is cleared first, as only the present bits of its entries are known to be zero.
+    If the reserve is full, half of it is given back to the PMM at once with pmm_free_batch().
+
+    @param table Pointer (virtual address) to the table.
+*/
+static void paging_free_table(union page_table_entry_t *table)
+{
+    if (paging_table_reserve_count == PAGING_TABLE_RESERVE_SIZE)
+    {
+        pmm_free_batch(&paging_table_reserve[PAGING_TABLE_RESERVE_SIZE / 2], PAGING_TABLE_RESERVE_SIZE / 2);
+        paging_table_reserve_count = PAGING_TABLE_RESERVE_SIZE / 2;
+    }
+
+    memset(table, 0, 0x1000);
+    paging_translation_cache_invalidate();
+
+    struct page_t *page = phys_to_page((uintptr_t)table - g_hhdm_offset);
+    if (page != NULL)
+    {
+        page->flags = page->flags & ~PAGE_FLAG_PAGE_TABLE;
+        page->owner = PAGE_OWNER_KERNEL;
+    }
+
+    paging_table_reserve[paging_table_reserve_count] = (void *)table - g_hhdm_offset;
+    paging_table_reserve_count = paging_table_reserve_count + 1;
+}
+
 /*!
     @brief Invalidate a cached page entry in TLB.
 
@@ -28,13 +166,199 @@ static inline void invalidate_tlb(uintptr_t virt)
     );
 }
 
+/*!
+    @brief Invalidate all TLB entries.
+
+    Reloading CR3 keeps global entries, so if global pages are enabled, CR4.PGE is toggled instead, which flushes everything.
+*/
+static inline void flush_tlb()
+{
+    if (paging_global_pages_enabled)
+    {
+        uint64_t cr4 = read_cr4();
+        set_cr4(cr4 & ~(uint64_t)PAGING_CR4_PGE);
+        set_cr4(cr4);
+        return;
+    }
+
+    uint64_t cr3;
+
+    asm volatile (
+        "mov %%cr3, %0\n"
+        "mov %0, %%cr3"
+        : "=r" (cr3)
+        :
+        : "memory"
+    );
+}
+
+/*!
+    @brief Gets the virtual address of a table of the active address space inside the recursive slot.
+
+    Every pass through PAGING_RECURSIVE_SLOT skips one level of the walk, so the CPU ends up at the table of the given level
+    on the path to virt, and the page offset selects its entries.
+    E.g. the PT of virt lies at PAGING_RECURSIVE_BASE + the indices of the PML4, PDPR and PD entries of virt shifted down by 9 bits.
+    The entries on the path above the table must be present pointers.
+
+    @param virt Virtual address whose path is followed.
+    @param level Level of the table.
+    @returns Pointer (virtual address) to the table.
+*/
+static inline union page_table_entry_t * paging_get_recursive_table(uintptr_t virt, page_table_level_t level)
+{
+    uint64_t passes = PT + 1 - level;
+
+    uintptr_t address = ((virt & 0x0000ffffffffffff) >> (9 * passes)) & ~(uintptr_t)0xfff;
+    for (uint64_t i = 0; i < passes; i++)
+    {
+        address = address | ((uintptr_t)PAGING_RECURSIVE_SLOT << (39 - 9 * i));
+    }
+
+    // The slot lies in the higher half, so the address is sign extended.
+    return (union page_table_entry_t *)(address | 0xffff000000000000);
+}
+
+/*!
+    @brief Checks if the tables of a PML4 can be accessed through the recursive slot.
+
+    That is the case with PAGING_RECURSIVE if the PML4 is the active one.
+    If tables were freed or large pages removed or split since the slot was used last, the TLB is flushed first,
+    as it might still translate their old recursive addresses. The other PCIDs are marked as stale for the same reason.
+
+    @param pml4 PML4 that is about to be walked.
+    @returns true if paging_get_next_table() should use the recursive slot.
+*/
+static inline bool paging_use_recursive(union page_table_entry_t *pml4)
+{
+    if (!PAGING_RECURSIVE || (uintptr_t)pml4 - g_hhdm_offset != (read_cr3() & ~(uint64_t)0xfff))
+    {
+        return false;
+    }
+
+    if (paging_recursive_flush_pending)
+    {
+        flush_tlb();
+        pcid_invalidate_others();
+        paging_recursive_flush_pending = false;
+    }
+
+    return true;
+}
+
+/*!
+    @brief Invalidates the recursive addresses of the tables on the path to a virtual address.
+
+    Cheaper than the flush of paging_use_recursive(), if a walk through the recursive slot only freed tables
+    or removed or split large pages on its own path. invlpg also clears the paging structure caches of the current PCID,
+    so no stale pointer to a freed table is left. Other address spaces share the tables of the higher half,
+    so their PCIDs are marked as stale if the path lies there.
+
+    @param virt Virtual address whose path was walked.
+*/
+static void paging_invalidate_recursive_path(uintptr_t virt)
+{
+    if (!paging_recursive_flush_pending)
+    {
+        return;
+    }
+
+    for (page_table_level_t level = PDPR; level <= PT; level++)
+    {
+        invalidate_tlb((uintptr_t)paging_get_recursive_table(virt, level));
+    }
+
+    if (virt >= PAGING_HIGHER_HALF_START)
+    {
+        pcid_invalidate_others();
+    }
+
+    paging_recursive_flush_pending = false;
+}
+
+/*!
+    @brief Gets the table a present pointer entry points to.
+
+    @param entry The pointer entry.
+    @param virt Virtual address whose path the entry belongs to.
+    @param level Level of the table the entry points to.
+    @param recursive Result of paging_use_recursive(). If set, the table is accessed through the recursive slot instead of the HHDM.
+    @returns Pointer (virtual address) to the table.
+*/
+static inline union page_table_entry_t * paging_get_next_table(union page_table_entry_t entry, uintptr_t virt, page_table_level_t level, bool recursive)
+{
+    if (recursive)
+    {
+        return paging_get_recursive_table(virt, level);
+    }
+
+    return (union page_table_entry_t *) (((uintptr_t)entry.pml4.pointer_fields.base_address << 12) + g_hhdm_offset);
+}
+
+/*!
+    @brief Applies the kernels mapping policy to the flags of a leaf.
+
+    Leaves in the lower half are left alone. In the higher half, leaves are made global,
+    leaves overlapping the kernels .text executable, and leaves completely inside of .text or .rodata read-only.
+    Everything else in the higher half (.data, .bss, the HHDM, ...) is made not executable.
+
+    @param virt Virtual address of the leaf.
+    @param size Size of the leaf in byte.
+    @param flags Flags of the leaf.
+    @returns The new flags.
+*/
+static uint64_t paging_apply_kernel_policy(uintptr_t virt, uint64_t size, uint64_t flags)
+{
+    if (virt < PAGING_HIGHER_HALF_START)
+    {
+        return flags;
+    }
+
+    flags = flags | paging_get_kernel_flags();
+
+    uintptr_t end = virt + size;
+    uintptr_t text_start = (uintptr_t)__kernel_text_start;
+    uintptr_t text_end = (uintptr_t)__kernel_text_end;
+    uintptr_t rodata_start = (uintptr_t)__kernel_rodata_start;
+    uintptr_t rodata_end = (uintptr_t)__kernel_rodata_end;
+
+    if (virt < text_end && end > text_start)
+    {
+        flags = flags & ~PAGING_FLAG_DISABLE_EXECUTION;
+    }
+
+    if ((virt >= text_start && end <= text_end) || (virt >= rodata_start && end <= rodata_end))
+    {
+        flags = flags & ~(uint64_t)PAGING_FLAG_WRITABLE;
+    }
+
+    return flags;
+}
+
+/*!
+    @brief Makes sure a PML4 that isn't loaded doesn't keep stale TLB entries after pages were unmapped from it.
+
+    invlpg and CR3 reloads only affect the active address space, with PCIDs only its PCID.
+    Other address spaces keep the TLB entries tagged with their PCID, so they are flushed the next time they are switched to.
+
+    @param pml4 PML4 the pages were unmapped from.
+*/
+static void paging_invalidate_inactive(union page_table_entry_t *pml4)
+{
+    uintptr_t pml4_phys = (uintptr_t)pml4 - g_hhdm_offset;
+
+    if (pml4_phys != (read_cr3() & ~(uint64_t)0xfff))
+    {
+        pcid_invalidate(pml4_phys);
+    }
+}
+
 /*!
     @brief Check if a page table is empty and if so, delete it.
 
     Checks all entries in a page table.
     If all entries are empty, its entry in the parent table is deleted and the tables memory is freed.
 
-    @param table Page table that is checked for emptiness.
+    @param table Page table that is checked for emptiness. May be accessed through the recursive slot.
     @param parent_table Parent table that points to [table].
     @param idx_in_parent_table [table]s index in [parent_table].
 */
@@ -53,9 +377,78 @@ static void paging_check_for_empty_table(union page_table_entry_t *table, union
     if (table_empty)
     {
         LOG_DEBUG("Table is empty. Remove table @%d from parent table.", idx_in_parent_table);
+        // The table is freed through the HHDM, no matter how it was accessed.
+        union page_table_entry_t *hhdm_table = paging_get_next_table(parent_table[idx_in_parent_table], 0, PML4, false);
         parent_table[idx_in_parent_table].pml4.pointer_fields.present = 0;
-        pmm_free(((void *)table) - g_hhdm_offset);
+        paging_free_table(hhdm_table);
+    }
+}
+
+/*!
+    @brief Check if a PDPR is empty and if so, delete it.
+
+    PDPRs of the higher half are shared by all address spaces once paging_init_kernel_half() was called, so they are never deleted.
+
+    @param pdpr PDPR that is checked for emptiness.
+    @param pml4 PML4 that points to the PDPR.
+    @param pml4_idx Index of the PDPR in the PML4.
+*/
+static void paging_check_for_empty_pdpr(union page_table_entry_t *pdpr, union page_table_entry_t *pml4, uint64_t pml4_idx)
+{
+    if (paging_kernel_pml4 != NULL && pml4_idx >= PAGE_TABLE_NUM_ENTRIES / 2)
+    {
+        return;
+    }
+
+    paging_check_for_empty_table(pdpr, pml4, pml4_idx);
+}
+
+/*!
+    @brief Checks if other address spaces might still have a removed leaf in their TLB.
+
+    The higher half is shared by all address spaces. invlpg invalidates global entries for all PCIDs,
+    but non-global ones stay cached under the PCIDs of the other address spaces.
+
+    @param virt Virtual address of the leaf.
+    @param entry The leaf before it was removed.
+    @returns true if the other PCIDs have to be flushed.
+*/
+static inline bool paging_is_shared_leaf(uintptr_t virt, union page_table_entry_t entry)
+{
+    return virt >= PAGING_HIGHER_HALF_START && (entry.raw & PAGING_FLAG_GLOBAL) == 0;
+}
+
+/*!
+    @brief Frees the tables on the path to a virtual address that became empty.
+
+    Checks the PT, PD and PDPR that map virt from the bottom up and deletes them if none of their entries is present.
+
+    @param pml4 PML4 containing the path.
+    @param virt Virtual address whose tables should be checked.
+*/
+static void paging_free_empty_tables(union page_table_entry_t *pml4, uintptr_t virt)
+{
+    uint64_t pml4_idx = (virt >> 39) & 0x1ff;
+    uint64_t pdpr_idx = (virt >> 30) & 0x1ff;
+    uint64_t pd_idx = (virt >> 21) & 0x1ff;
+
+    if (pml4[pml4_idx].pml4.pointer_fields.present == 0)
+    {
+        return;
     }
+
+    union page_table_entry_t *pdpr = (union page_table_entry_t *) (((uintptr_t)pml4[pml4_idx].pml4.pointer_fields.base_address << 12) + g_hhdm_offset);
+    if (pdpr[pdpr_idx].pdpr.pointer_fields.present != 0 && pdpr[pdpr_idx].pdpr.pointer_fields.page_size == 0)
+    {
+        union page_table_entry_t *pd = (union page_table_entry_t *) (((uintptr_t)pdpr[pdpr_idx].pdpr.pointer_fields.base_address << 12) + g_hhdm_offset);
+        if (pd[pd_idx].pd.pointer_fields.present != 0 && pd[pd_idx].pd.pointer_fields.page_size == 0)
+        {
+            union page_table_entry_t *pt = (union page_table_entry_t *) (((uintptr_t)pd[pd_idx].pd.pointer_fields.base_address << 12) + g_hhdm_offset);
+            paging_check_for_empty_table(pt, pd, pd_idx);
+        }
+        paging_check_for_empty_table(pd, pdpr, pdpr_idx);
+    }
+    paging_check_for_empty_pdpr(pdpr, pml4, pml4_idx);
 }
 
 /*!
@@ -176,463 +569,1944 @@ static uint64_t paging_get_flags_from_entry(union page_table_entry_t entry, page
 }
 
 /*!
-    @brief Map a virtual address to a physical address in the page table.
+    @brief Gets the physical address of the page a leaf points to.
 
-    Traverses the page table hierarchy until the leaf is reached to map a physical address to a virtual address.
-    Supports 4kB, 2MB and 1GB pages.
-    Creates entries and allocates memory for page tables as needed.
+    @param entry The leaf.
+    @param level Level of the table containing the leaf.
+    @returns Physical address of the page.
+*/
+static inline uintptr_t paging_get_leaf_address(union page_table_entry_t entry, page_table_level_t level)
+{
+    if (level == PDPR)
+    {
+        return (uintptr_t)entry.pdpr.page_fields.base_address << 30;
+    }
+    if (level == PD)
+    {
+        return (uintptr_t)entry.pd.page_fields.base_address << 21;
+    }
+    return (uintptr_t)entry.pt.page_fields.base_address << 12;
+}
 
-    Returns an error if allocating memory fails or if the leaf is already used (present flag is set).
+/*!
+    @brief Gets the number of bytes mapped by a single entry of a table.
 
-    @param pml4 PML4 in which the page should be mapped.
-    @param phys Physical address to which the virtual address should be mapped.
-    @param virt Virtual address that should be mapped to the physical address.
-    @param page_size Size of the page to map (4kB, 2MB or 1GB).
-    @param flags Flags for the page.
+    @param level Level of the table.
+    @returns 512 GB for the PML4, 1 GB for a PDPR, 2 MB for a PD and 4 kB for a PT.
+*/
+static inline uint64_t paging_get_entry_size(page_table_level_t level)
+{
+    // Every level uses 9 bits of the address, starting at bit 39 for the PML4.
+    return (uint64_t)1 << (39 - 9 * level);
+}
 
-    @returns PAGING_OK on success, PAGING_ERROR if allocating memory failed or the leafs present bit is set.
+/*!
+    @brief Splits a 2 MB or 1 GB page into a table of 512 smaller pages that map the same memory with the same flags.
+
+    The TLB doesn't have to be flushed, as all addresses are still translated the same way.
+    Copy-on-write pages are not split, as their reference count belongs to the whole page.
+
+    @param table Table containing the leaf, a PD or a PDPR.
+    @param idx Index of the leaf in the table.
+    @param level Level of the table.
+
+    @returns Pointer (virtual address) to the new table, NULL if allocating it failed or the page is copy-on-write.
 */
-static paging_error_codes_t paging_map_page_without_tlb_invalidation(union page_table_entry_t *pml4, uintptr_t phys, uintptr_t virt, page_size_t page_size, uint64_t flags)
+static union page_table_entry_t * paging_split_leaf(union page_table_entry_t *table, uint64_t idx, page_table_level_t level)
 {
-    uint64_t pml4_idx = (virt >> 39) & 0x1ff;
-    uint64_t pdpr_idx = (virt >> 30) & 0x1ff;
-    uint64_t pd_idx = (virt >> 21) & 0x1ff;
-    uint64_t pt_idx = (virt >> 12) & 0x1ff;
-    
-    LOG_DEBUG("Mapping %p (virt) to %p (phys)", virt, phys);
-    LOG_DEBUG("Indices: pml4=%d, pdpr=%d, pd=%d, pt=%d", pml4_idx, pdpr_idx, pd_idx, pt_idx);
+    if ((table[idx].raw & PAGING_FLAG_COW) != 0)
+    {
+        LOG_ERROR("Can't split a copy-on-write page.");
+        return NULL;
+    }
 
-    union page_table_entry_t *pdpr = NULL;
-    if (pml4[pml4_idx].pml4.pointer_fields.present == 0)
+    union page_table_entry_t *next_table = paging_alloc_table();
+    if (next_table == NULL)
     {
-        pdpr = pmm_alloc() + g_hhdm_offset;
-        if (pdpr == NULL)
-        {
-            LOG_ERROR("Failed to allocate memory for the PDPR.");
-            return PAGING_ERROR;
-        }
-        memset(pdpr, 0, 0x1000);
-        
-        pml4[pml4_idx] = paging_create_entry((uintptr_t)pdpr - g_hhdm_offset, PAGING_FLAG_PRESENT | PAGING_FLAG_WRITABLE, PML4, PAGING_ENTRY_POINTER);
+        LOG_ERROR("Failed to allocate memory for splitting a large page.");
+        return NULL;
     }
-    else
+
+    uintptr_t phys = paging_get_leaf_address(table[idx], level);
+    uint64_t flags = paging_get_flags_from_entry(table[idx], level, PAGING_ENTRY_PAGE);
+    uint64_t size = paging_get_entry_size(level + 1);
+
+    // Bit 7 is the page size flag in PDPRs and PDs, but the PAT bit in PTs.
+    if (level + 1 == PT)
     {
-        pdpr = (union page_table_entry_t *) (((uintptr_t)pml4[pml4_idx].pml4.pointer_fields.base_address << 12) + g_hhdm_offset);
+        flags = flags & ~(uint64_t)PAGING_FLAG_PAGE_SIZE;
     }
-    
-    if (page_size == PAGE_SIZE_1GB)
+
+    for (size_t i = 0; i < PAGE_TABLE_NUM_ENTRIES; i++)
     {
-        if (pdpr[pdpr_idx].pdpr.page_fields.present != 0)
-        {
-            LOG_ERROR("Virtual address is already in use: %p", virt);
-            return PAGING_ERROR;
-        }
-        pdpr[pdpr_idx] = paging_create_entry(phys, flags, PDPR, PAGING_ENTRY_PAGE);
-        return PAGING_OK;
+        next_table[i] = paging_create_entry(phys + i * size, flags, level + 1, PAGING_ENTRY_PAGE);
     }
 
-    union page_table_entry_t *pd = NULL;
-    if (pdpr[pdpr_idx].pdpr.pointer_fields.present == 0)
+    table[idx] = paging_create_entry((uintptr_t)next_table - g_hhdm_offset, PAGING_FLAG_PRESENT | PAGING_FLAG_WRITABLE | (flags & PAGING_FLAG_USER_LEVEL), level, PAGING_ENTRY_POINTER);
+    paging_translation_cache_invalidate();
+
+    paging_huge_page_stats.demotions = paging_huge_page_stats.demotions + 1;
+
+    return next_table;
+}
+
+/*!
+    @brief Replaces a PT by a 2 MB page if the page maps exactly the same.
+
+    That is the case if all 512 entries of the PT are present, have the same flags and map contiguous memory starting at a 2 MB boundary.
+    The accessed and dirty bits are set by the CPU and ignored when comparing, the 2 MB page gets the ones set in any of the entries.
+    Checking stops at the first entry that doesn't fit, which is usually the first one.
+    Only done in the higher half: pages of the lower half might be forked, and their reference counts are kept per 4 kB page.
+    As the TLB might still hold the 4 kB entries and the paging structure caches the freed PT, the whole TLB is flushed.
+
+    @param pd PD containing the PT.
+    @param pd_idx Index of the PT in the PD.
+    @param virt Virtual address inside of the range mapped by the PT.
+
+    @returns true if the PT was replaced.
+*/
+static bool paging_try_promote_pt(union page_table_entry_t *pd, uint64_t pd_idx, uintptr_t virt)
+{
+    if (virt < PAGING_HIGHER_HALF_START || pd[pd_idx].pd.pointer_fields.present == 0 || pd[pd_idx].pd.pointer_fields.page_size != 0)
     {
-        pd = pmm_alloc() + g_hhdm_offset;
-        if (pd == NULL)
+        return false;
+    }
+
+    union page_table_entry_t *pt = (union page_table_entry_t *) (((uintptr_t)pd[pd_idx].pd.pointer_fields.base_address << 12) + g_hhdm_offset);
+
+    // Bit 7 is the PAT bit in PTs, it would become the page size flag.
+    uint64_t first = pt[0].raw;
+    if ((first & PAGING_FLAG_PRESENT) == 0 || (first & (PAGING_FLAG_PAGE_SIZE | PAGING_FLAG_COW)) != 0 || (paging_get_leaf_address(pt[0], PT) & (paging_get_entry_size(PD) - 1)) != 0)
+    {
+        return false;
+    }
+
+    // Same flags and contiguous memory means every entry is the previous one plus 4 kB.
+    uint64_t cpu_flags = PAGING_FLAG_ACCESSED | PAGING_FLAG_DIRTY;
+    uint64_t cpu_flags_set = first & cpu_flags;
+    first = first & ~cpu_flags;
+    for (size_t i = 1; i < PAGE_TABLE_NUM_ENTRIES; i++)
+    {
+        if ((pt[i].raw & ~cpu_flags) != first + i * PAGE_SIZE_BYTE)
         {
-            LOG_ERROR("Failed to allocate memory for the PD.");
-            return PAGING_ERROR;
+            return false;
         }
-        memset(pd, 0, 0x1000);
 
-        pdpr[pdpr_idx] = paging_create_entry((uintptr_t)pd - g_hhdm_offset, PAGING_FLAG_PRESENT | PAGING_FLAG_WRITABLE, PDPR, PAGING_ENTRY_POINTER);
-    }
-    else
-    {
-        pd = (union page_table_entry_t *) (((uintptr_t)pdpr[pdpr_idx].pdpr.pointer_fields.base_address << 12) + g_hhdm_offset);
-    }
-    
-    if (page_size == PAGE_SIZE_2MB)
-    {
-        if (pd[pd_idx].pd.page_fields.present != 0)
-        {
-            LOG_ERROR("Virtual address is already in use: %p", virt);
-            return PAGING_ERROR;
-        }
-        pd[pd_idx] = paging_create_entry(phys, flags, PD, PAGING_ENTRY_PAGE);
-        return PAGING_OK;
+        cpu_flags_set = cpu_flags_set | (pt[i].raw & cpu_flags);
     }
 
-    union page_table_entry_t *pt = NULL;
-    if (pd[pd_idx].pd.pointer_fields.present == 0)
-    {
-        pt = pmm_alloc() + g_hhdm_offset;
-        if (pt == NULL)
-        {
-            LOG_ERROR("Failed to allocate memory for the PT.");
-            return PAGING_ERROR;
-        }
-        memset(pt, 0, 0x1000);
-        
-        pd[pd_idx] = paging_create_entry((uintptr_t)pt - g_hhdm_offset, PAGING_FLAG_PRESENT | PAGING_FLAG_WRITABLE, PD, PAGING_ENTRY_POINTER);
-    }
-    else
-    {
-        pt = (union page_table_entry_t *) (((uintptr_t)pd[pd_idx].pd.pointer_fields.base_address << 12) + g_hhdm_offset);
-    }
+    // A dirty bit that got lost would let the 2 MB page look clean although parts of it were written to.
+    uint64_t flags = (paging_get_flags_from_entry(pt[0], PT, PAGING_ENTRY_PAGE) & ~cpu_flags) | cpu_flags_set | PAGING_FLAG_PAGE_SIZE;
+    pd[pd_idx] = paging_create_entry(paging_get_leaf_address(pt[0], PT), flags, PD, PAGING_ENTRY_PAGE);
+    paging_free_table(pt);
 
-    if (pt[pt_idx].pt.page_fields.present != 0)
-    {
-        LOG_ERROR("Virtual address is already in use: %p", virt);
-        return PAGING_ERROR;
-    }
-    pt[pt_idx] = paging_create_entry(phys, flags, PT, PAGING_ENTRY_PAGE);
+    flush_tlb();
+    pcid_invalidate_others();
 
-    return PAGING_OK;
+    paging_huge_page_stats.promotions = paging_huge_page_stats.promotions + 1;
+
+    return true;
 }
 
 /*!
-    @brief Resolve a virtual address to a physical address.
-
-    Walks through the page table hierarchy until a leaf is reached and returns the base address of it.
-    Returns NULL if an entry along the way is not present .
+    @brief Walks down to the PD of a virtual address and tries to replace the PT of the address by a 2 MB page.
 
-    @param pml4 Page table from that the physical address should be retrieved.
-    @param virt Virtual address to translate.
-    
-    @returns Physical address as a uintptr_t.
+    @param pml4 PML4 containing the address.
+    @param virt The virtual address.
 */
-uintptr_t paging_resolve_virtual_address(union page_table_entry_t *pml4, uintptr_t virt)
+static void paging_try_promote(union page_table_entry_t *pml4, uintptr_t virt)
 {
+    if (virt < PAGING_HIGHER_HALF_START)
+    {
+        return;
+    }
+
     uint64_t pml4_idx = (virt >> 39) & 0x1ff;
     uint64_t pdpr_idx = (virt >> 30) & 0x1ff;
     uint64_t pd_idx = (virt >> 21) & 0x1ff;
-    uint64_t pt_idx = (virt >> 12) & 0x1ff;
 
     if (pml4[pml4_idx].pml4.pointer_fields.present == 0)
     {
-        return (uintptr_t) NULL;
+        return;
     }
-
     union page_table_entry_t *pdpr = (union page_table_entry_t *) (((uintptr_t)pml4[pml4_idx].pml4.pointer_fields.base_address << 12) + g_hhdm_offset);
-
-    if (pdpr[pdpr_idx].pdpr.pointer_fields.present == 0)
-    {
-        return (uintptr_t) NULL;
-    }
-    if (pdpr[pdpr_idx].pdpr.pointer_fields.page_size != 0)
+    if (pdpr[pdpr_idx].pdpr.pointer_fields.present == 0 || pdpr[pdpr_idx].pdpr.pointer_fields.page_size != 0)
     {
-        return (uintptr_t)pdpr[pdpr_idx].pdpr.page_fields.base_address << 30;
+        return;
     }
-
     union page_table_entry_t *pd = (union page_table_entry_t *) (((uintptr_t)pdpr[pdpr_idx].pdpr.pointer_fields.base_address << 12) + g_hhdm_offset);
 
-    if (pd[pd_idx].pd.pointer_fields.present == 0)
-    {
-        return (uintptr_t) NULL;
-    }
-    if (pd[pd_idx].pd.pointer_fields.page_size != 0)
-    {
-        return (uintptr_t)(pd[pd_idx].pd.page_fields.base_address) << 21;
-    }
-
-    union page_table_entry_t *pt = (union page_table_entry_t *) (((uintptr_t)pd[pd_idx].pd.pointer_fields.base_address << 12) + g_hhdm_offset);
-    
-    if (pt[pt_idx].pt.page_fields.present == 0)
-    {
-        return (uintptr_t) NULL;
-    }
-
-    return (uintptr_t)pt[pt_idx].pt.page_fields.base_address << 12;
+    paging_try_promote_pt(pd, pd_idx, virt);
 }
 
 /*!
-    @brief Initializes the global HHDM offset.
-
-    @param hhdm_offset HHDM offset used for address translation.
+    @brief Walks the page table hierarchy down to the PT that maps a virtual address.
+
+    @param pml4 PML4 to walk through.
+    @param virt Virtual address.
+    @param create If true, missing tables are allocated on the way.
+    @param split If true, 2 MB / 1 GB pages in the way are split with paging_split_leaf().
+    @returns Pointer (virtual address) to the PT, or NULL if a table is missing and create is false,
+             allocating a table failed or a 2 MB / 1 GB page is mapped in the way and split is false.
 */
-void paging_init(ptrdiff_t hhdm_offset)
+static union page_table_entry_t * paging_get_pt(union page_table_entry_t *pml4, uintptr_t virt, bool create, bool split)
 {
-    g_hhdm_offset = hhdm_offset;
-}
+    union page_table_entry_t *table = pml4;
 
-/*!
-    @brief Recursively traverse and log the structure of a page table.
+    for (page_table_level_t level = PML4; level < PT; level++)
+    {
+        // Every level uses 9 bits of the address, starting at bit 39 for the PML4.
+        uint64_t idx = (virt >> (39 - 9 * level)) & 0x1ff;
 
-    Walks through all entries of a given page table (PML4, PDPR, PD or PT) and prints information about each non-empty entry.
-    For entries that reference lower-level tables, the function recursively descends into the next level.
-    Pages larger than 4kB are detected and logged without further recursion.
-    
-    Output format:
-        PML4@[pml4_idx]: [pml4_entry]\n
-        PDPR-[pml4_idx]@[pdpr_idx: [pdpr_entry]\n
-        PD-[pml4_idx]-[pdpr_idx]@[pd_idx]: [pd_entry]\n
-        PT-[pml4_idx]-[pdpr_idx]-[pd_idx]@[pt_idx]: [pt_entry]\n
+        if (table[idx].pml4.pointer_fields.present == 0)
+        {
+            if (!create)
+            {
+                return NULL;
+            }
 
-    @param page_table Pointer to the current page table.
-    @param hhdm_offset Offset for phys<->virt address translation.
-    @param level Current page table level (PML4, PDPR, PD, PT).
-*/
-void paging_dump_page_table(union page_table_entry_t *page_table, page_table_level_t level)
-{
-    static int16_t pml4_idx = -1;
-    static int16_t pdpr_idx = -1;
-    static int16_t pd_idx = -1;
-    static int16_t pt_idx = -1;
+            union page_table_entry_t *new_table = paging_alloc_table();
+            if (new_table == NULL)
+            {
+                LOG_ERROR("Failed to allocate memory for a page table.");
+                return NULL;
+            }
 
-    for (int16_t idx = 0; idx < PAGE_TABLE_NUM_ENTRIES; idx++)
-    {
-        // Skip empty entries.
-        if (page_table[idx].pml4.pointer_fields.present == 0)
-        {
+            table[idx] = paging_create_entry((uintptr_t)new_table - g_hhdm_offset, PAGING_FLAG_PRESENT | PAGING_FLAG_WRITABLE, level, PAGING_ENTRY_POINTER);
+            table = new_table;
             continue;
         }
-        
-        switch (level)
-        {
-        case PML4:
-            pml4_idx = idx;
-            LOG_INFO("PML4@%d: %x", pml4_idx, page_table[pml4_idx].raw);
-            union page_table_entry_t *pdpr = (union page_table_entry_t *) ((page_table[pml4_idx].pml4.pointer_fields.base_address << 12) + g_hhdm_offset);
-            paging_dump_page_table(pdpr, PDPR);
-            break;
-
-        case PDPR:
-            pdpr_idx = idx;
 
-            if (page_table[pdpr_idx].pdpr.pointer_fields.page_size != 0)
+        if (level != PML4 && table[idx].pdpr.pointer_fields.page_size != 0)
+        {
+            if (!split)
             {
-                LOG_INFO("PDPR-%d@%d: %x (1GB-PAGE)", pml4_idx, pdpr_idx, page_table[pdpr_idx].raw);
-                break;
+                return NULL;
             }
 
-            LOG_INFO("PDPR-%d@%d: %x", pml4_idx, pdpr_idx, page_table[pdpr_idx].raw);
-            union page_table_entry_t *pd = (union page_table_entry_t *) ((page_table[pdpr_idx].pdpr.pointer_fields.base_address << 12) + g_hhdm_offset);
-            paging_dump_page_table(pd, PD);
-            break;
-
-        case PD:
-            pd_idx = idx;
-
-            if (page_table[pd_idx].pd.pointer_fields.page_size != 0)
+            table = paging_split_leaf(table, idx, level);
+            if (table == NULL)
             {
-                LOG_INFO("PD-%d-%d@%d: %x (2MB-PAGE)", pml4_idx, pdpr_idx, pd_idx, page_table[pd_idx].raw);
-                break;
+                return NULL;
             }
-
-            LOG_INFO("PD-%d-%d@%d: %x", pml4_idx, pdpr_idx, pd_idx, page_table[pd_idx].raw);
-            union page_table_entry_t *pt = (union page_table_entry_t *) ((page_table[pd_idx].pd.pointer_fields.base_address << 12) + g_hhdm_offset);
-            paging_dump_page_table(pt, PT);
-            break;
-
-        case PT:
-            pt_idx = idx;
-            LOG_INFO("PT-%d-%d-%d@%d: %x", pml4_idx, pdpr_idx, pd_idx, pt_idx, page_table[pt_idx].raw);
-            break;
-
-        default:
-            break;
+            continue;
         }
+
+        table = (union page_table_entry_t *) (((uintptr_t)table[idx].pml4.pointer_fields.base_address << 12) + g_hhdm_offset);
     }
+
+    return table;
 }
 
 /*!
-    @brief Recursively walk a page table and clone mapped pages to another page table.
+    @brief Maps the part of a range that lies inside of a single table.
 
-    Recursively walks through all entries of a given page table (PML4, PDPR, PD or PT).
-    If a leaf is reached, its flags and the physical address are retrieved and the virtual address is calculated from the indices.
-    Maps the page in another page table WITHOUT invalidating its TLB entry.
+    Goes through the tables entries one after another instead of walking down from the PML4 for every page.
+    An entry is made a leaf if the range covers all of it and phys is aligned to its size, so the largest possible pages are used.
+    Otherwise the next lower table is created if necessary and the part of the range that belongs to the entry is mapped there.
 
-    @param old_page_table Pointer to the current level of page table that should be cloned.
-    @param new_pml4 Pointer to the PML4 of the page table that the entries should be cloned to.
-    @param level Current page table level (PML4, PDPR, PD, PT).
+    @param table Table containing the range.
+    @param level Level of the table.
+    @param phys Physical address the range is mapped to.
+    @param virt Virtual address of the range.
+    @param length Length of the range. Must not reach past the end of the table.
+    @param flags Flags for the pages.
 
-    @returns PAGING_OK on success, PAGING_ERROR when allocating memory for the PML4 fails.
+    @returns PAGING_OK on success, PAGING_ERROR if allocating memory failed or a part of the range is already mapped.
 */
-paging_error_codes_t paging_clone_page_table(union page_table_entry_t *old_page_table, union page_table_entry_t **new_pml4, page_table_level_t level)
+static paging_error_codes_t paging_map_range_in_table(union page_table_entry_t *table, page_table_level_t level, uintptr_t phys, uintptr_t virt, size_t length, uint64_t flags)
 {
-    static uint64_t pml4_idx = 0;
-    static uint64_t pdpr_idx = 0;
-    static uint64_t pd_idx = 0;
-    static uint64_t pt_idx = 0;
+    uint64_t entry_size = paging_get_entry_size(level);
+    uint64_t idx = (virt >> (39 - 9 * level)) & 0x1ff;
 
-    // Allocate memory for the PML4 if necessary.
-    if (level == PML4 && *new_pml4 == NULL)
+    while (length > 0)
     {
-        *new_pml4 = pmm_alloc() + g_hhdm_offset;
-        if (*new_pml4 == NULL)
+        // Part of the range that belongs to the current entry.
+        size_t chunk = entry_size - (virt & (entry_size - 1));
+        if (chunk > length)
         {
-            LOG_ERROR("Failed to allocate new pml4.");
-            return PAGING_ERROR;
+            chunk = length;
         }
-    }
 
-    for (uint64_t idx = 0; idx < PAGE_TABLE_NUM_ENTRIES; idx++)
-    {
-        // Skip empty entries.
-        if (old_page_table[idx].pml4.pointer_fields.present == 0)
+        bool fits_leaf = chunk == entry_size && (phys & (entry_size - 1)) == 0;
+
+        if (level == PT || (fits_leaf && (level == PD || (level == PDPR && paging_1gb_pages_supported))))
         {
-            continue;
+            if (table[idx].pml4.pointer_fields.present != 0)
+            {
+                LOG_ERROR("Virtual address is already in use: %p", virt);
+                return PAGING_ERROR;
+            }
+
+            // Bit 7 is the page size flag in PDPRs and PDs, but the PAT bit in PTs.
+            uint64_t leaf_flags = level == PT ? flags & ~PAGING_FLAG_PAGE_SIZE : flags | PAGING_FLAG_PAGE_SIZE;
+            table[idx] = paging_create_entry(phys, leaf_flags, level, PAGING_ENTRY_PAGE);
         }
-        
-        switch (level)
+        else
         {
-        case PML4:
-            pml4_idx = idx;
-            LOG_DEBUG("PML4@%d: %x", pml4_idx, old_page_table[pml4_idx].raw);
-            union page_table_entry_t *pdpr = (union page_table_entry_t *) (((uintptr_t)old_page_table[pml4_idx].pml4.pointer_fields.base_address << 12) + g_hhdm_offset);
-            paging_clone_page_table(pdpr, new_pml4, PDPR);
-            break;
-
-        case PDPR:
-            pdpr_idx = idx;
-
-            if (old_page_table[pdpr_idx].pdpr.pointer_fields.page_size != 0)
+            union page_table_entry_t *next_table;
+            if (table[idx].pml4.pointer_fields.present == 0)
             {
-                LOG_DEBUG("PDPR-%d@%d: %x (1GB-PAGE)", pml4_idx, pdpr_idx, old_page_table[pdpr_idx].raw);
-                uintptr_t phys = (uintptr_t)old_page_table[pdpr_idx].pdpr.page_fields.base_address << 30;
-                uintptr_t virt = paging_get_virt_address_from_indices(pml4_idx, pdpr_idx, 0, 0);
-                uint64_t flags = paging_get_flags_from_entry(old_page_table[pdpr_idx], PDPR, PAGING_ENTRY_PAGE);
-                paging_map_page_without_tlb_invalidation(*new_pml4, phys, virt, PAGE_SIZE_1GB, flags);
-                break;
+                next_table = paging_alloc_table();
+                if (next_table == NULL)
+                {
+                    LOG_ERROR("Failed to allocate memory for a page table.");
+                    return PAGING_ERROR;
+                }
+
+                table[idx] = paging_create_entry((uintptr_t)next_table - g_hhdm_offset, PAGING_FLAG_PRESENT | PAGING_FLAG_WRITABLE, level, PAGING_ENTRY_POINTER);
             }
-
-            LOG_DEBUG("PDPR-%d@%d: %x", pml4_idx, pdpr_idx, old_page_table[pdpr_idx].raw);
-            union page_table_entry_t *pd = (union page_table_entry_t *) (((uintptr_t)old_page_table[pdpr_idx].pdpr.pointer_fields.base_address << 12) + g_hhdm_offset);
-            paging_clone_page_table(pd, new_pml4, PD);
-            break;
-
-        case PD:
-            pd_idx = idx;
-
-            if (old_page_table[pd_idx].pd.pointer_fields.page_size != 0)
+            else if (level != PML4 && table[idx].pdpr.pointer_fields.page_size != 0)
             {
-                LOG_DEBUG("PD-%d-%d@%d: %x (2MB-PAGE)", pml4_idx, pdpr_idx, pd_idx, old_page_table[pd_idx].raw);
-                uintptr_t phys = (uintptr_t)old_page_table[pd_idx].pd.page_fields.base_address << 21;
-                uintptr_t virt = paging_get_virt_address_from_indices(pml4_idx, pdpr_idx, pd_idx, 0);
-                uint64_t flags = paging_get_flags_from_entry(old_page_table[pd_idx], PD, PAGING_ENTRY_PAGE);
-                paging_map_page_without_tlb_invalidation(*new_pml4, phys, virt, PAGE_SIZE_2MB, flags);
-                break;
+                LOG_ERROR("Virtual address is already in use by a large page: %p", virt);
+                return PAGING_ERROR;
+            }
+            else
+            {
+                next_table = (union page_table_entry_t *) (((uintptr_t)table[idx].pml4.pointer_fields.base_address << 12) + g_hhdm_offset);
             }
 
-            LOG_DEBUG("PD-%d-%d@%d: %x", pml4_idx, pdpr_idx, pd_idx, old_page_table[pd_idx].raw);
-            union page_table_entry_t *pt = (union page_table_entry_t *) (((uintptr_t)old_page_table[pd_idx].pd.pointer_fields.base_address << 12) + g_hhdm_offset);
-            paging_clone_page_table(pt, new_pml4, PT);
-            break;
-
-        case PT:
-            pt_idx = idx;
-            LOG_DEBUG("PT-%d-%d-%d@%d: %x", pml4_idx, pdpr_idx, pd_idx, pt_idx, old_page_table[pt_idx].raw);
-            uintptr_t phys = ((uintptr_t)old_page_table[pt_idx].pt.page_fields.base_address << 12);
-            uintptr_t virt = paging_get_virt_address_from_indices(pml4_idx, pdpr_idx, pd_idx, pt_idx);
-            uint64_t flags = paging_get_flags_from_entry(old_page_table[pt_idx], PT, PAGING_ENTRY_PAGE);
-            paging_map_page_without_tlb_invalidation(*new_pml4, phys, virt, PAGE_SIZE_4KB, flags);
-            break;
+            paging_error_codes_t result = paging_map_range_in_table(next_table, level + 1, phys, virt, chunk, flags);
+            if (result != PAGING_OK)
+            {
+                return result;
+            }
 
-        default:
-            break;
+            if (level == PD)
+            {
+                paging_try_promote_pt(table, idx, virt);
+            }
         }
+
+        phys = phys + chunk;
+        virt = virt + chunk;
+        length = length - chunk;
+        idx = idx + 1;
     }
 
     return PAGING_OK;
 }
 
 /*!
-    @brief Unmap a page and invalidate its TLB entry.
+    @brief Unmaps the part of a range that lies inside of a single table.
 
-    Unmaps a page by clearing the present bit in its entry.
-    Supports 4kB, 2MB and 1GB pages.
-    After clearing the pages present bit, its page table and its parents are checked for emptiness and deletes them if they are no longer required.
-
-    Returns an error if a non-leaf entry is not present.
+    Goes through the tables entries one after another, entries that aren't present are skipped.
+    After the part of the range belonging to an entry is unmapped from the next lower table,
+    that table is checked for emptiness once and deleted if it is no longer required, instead of after every page.
 
-    @param pml4 Page table in which the page should be unmapped.
-    @param virt Virtual address to unmap.
-    @param page_size Size of the page to unmap.
+    @param table Table containing the range.
+    @param level Level of the table.
+    @param virt Virtual address of the range.
+    @param length Length of the range. Must not reach past the end of the table.
+    @param batch Batch the addresses of unmapped pages are added to.
 
-    @returns PAGING_OK on success, PAGING_ERROR if a non-leaf entry is not present.
+    @returns PAGING_OK on success, PAGING_ERROR if a 2 MB or 1 GB page is only partially inside of the range and couldn't be split.
+             Such pages stay mapped.
 */
-paging_error_codes_t paging_unmap_page(union page_table_entry_t *pml4, uintptr_t virt, page_size_t page_size)
+static paging_error_codes_t paging_unmap_range_in_table(union page_table_entry_t *table, page_table_level_t level, uintptr_t virt, size_t length, struct paging_tlb_batch_t *batch)
 {
-    uint64_t pml4_idx = (virt >> 39) & 0x1ff;
-    uint64_t pdpr_idx = (virt >> 30) & 0x1ff;
-    uint64_t pd_idx = (virt >> 21) & 0x1ff;
-    uint64_t pt_idx = (virt >> 12) & 0x1ff;
+    paging_error_codes_t result = PAGING_OK;
 
-    LOG_DEBUG("Unmapping virt=%p", virt);
-    LOG_DEBUG("Indices: pml4=%d, pdpr=%d, pd=%d, pt=%d", pml4_idx, pdpr_idx, pd_idx, pt_idx);
+    uint64_t entry_size = paging_get_entry_size(level);
+    uint64_t idx = (virt >> (39 - 9 * level)) & 0x1ff;
+
+    while (length > 0)
+    {
+        size_t chunk = entry_size - (virt & (entry_size - 1));
+        if (chunk > length)
+        {
+            chunk = length;
+        }
+
+        if (table[idx].pml4.pointer_fields.present == 0)
+        {
+            // Nothing to do.
+        }
+        else if (level == PT || (level != PML4 && table[idx].pdpr.pointer_fields.page_size != 0 && chunk == entry_size))
+        {
+            if (paging_is_shared_leaf(virt, table[idx]))
+            {
+                batch->shared = true;
+            }
+            table[idx].raw = 0;
+            paging_tlb_batch_add(batch, virt);
+
+            if (level != PT)
+            {
+                paging_translation_cache_invalidate();
+            }
+        }
+        else if (level != PML4 && table[idx].pdpr.pointer_fields.page_size != 0 && paging_split_leaf(table, idx, level) == NULL)
+        {
+            // Only a part of the large page is unmapped, but it couldn't be split.
+            result = PAGING_ERROR;
+        }
+        else
+        {
+            union page_table_entry_t *next_table = (union page_table_entry_t *) (((uintptr_t)table[idx].pml4.pointer_fields.base_address << 12) + g_hhdm_offset);
+
+            if (paging_unmap_range_in_table(next_table, level + 1, virt, chunk, batch) != PAGING_OK)
+            {
+                result = PAGING_ERROR;
+            }
+
+            if (level == PML4)
+            {
+                paging_check_for_empty_pdpr(next_table, table, idx);
+            }
+            else
+            {
+                paging_check_for_empty_table(next_table, table, idx);
+            }
+        }
+
+        virt = virt + chunk;
+        length = length - chunk;
+        idx = idx + 1;
+    }
+
+    return result;
+}
+
+/*!
+    @brief Changes the flags of the part of a range that lies inside of a single table.
+
+    Works like paging_unmap_range_in_table(). Large pages that are only partially inside of the range are split,
+    and PTs are replaced by 2 MB pages afterwards if possible.
+
+    @param table Table containing the range.
+    @param level Level of the table.
+    @param virt Virtual address of the range.
+    @param length Length of the range. Must not reach past the end of the table.
+    @param flags New flags for the pages.
+    @param batch Batch the addresses of changed pages are added to.
+
+    @returns PAGING_OK on success, PAGING_ERROR if a 2 MB or 1 GB page is only partially inside of the range and couldn't be split.
+             Such pages keep their flags.
+*/
+static paging_error_codes_t paging_protect_range_in_table(union page_table_entry_t *table, page_table_level_t level, uintptr_t virt, size_t length, uint64_t flags, struct paging_tlb_batch_t *batch)
+{
+    paging_error_codes_t result = PAGING_OK;
+
+    uint64_t entry_size = paging_get_entry_size(level);
+    uint64_t idx = (virt >> (39 - 9 * level)) & 0x1ff;
+
+    while (length > 0)
+    {
+        size_t chunk = entry_size - (virt & (entry_size - 1));
+        if (chunk > length)
+        {
+            chunk = length;
+        }
+
+        if (table[idx].pml4.pointer_fields.present == 0)
+        {
+            // Nothing to do.
+        }
+        else if (level == PT || (level != PML4 && table[idx].pdpr.pointer_fields.page_size != 0 && chunk == entry_size))
+        {
+            // Bit 7 is the page size flag in PDPRs and PDs, but the PAT bit in PTs.
+            uint64_t leaf_flags = level == PT ? flags & ~PAGING_FLAG_PAGE_SIZE : flags | PAGING_FLAG_PAGE_SIZE;
+            if ((table[idx].raw & PAGING_FLAG_COW) != 0)
+            {
+                leaf_flags = (leaf_flags | PAGING_FLAG_COW) & ~(uint64_t)PAGING_FLAG_WRITABLE;
+            }
+
+            if (paging_is_shared_leaf(virt, table[idx]))
+            {
+                batch->shared = true;
+            }
+            table[idx] = paging_create_entry(paging_get_leaf_address(table[idx], level), leaf_flags, level, PAGING_ENTRY_PAGE);
+            paging_tlb_batch_add(batch, virt);
+        }
+        else if (level != PML4 && table[idx].pdpr.pointer_fields.page_size != 0 && paging_split_leaf(table, idx, level) == NULL)
+        {
+            result = PAGING_ERROR;
+        }
+        else
+        {
+            union page_table_entry_t *next_table = (union page_table_entry_t *) (((uintptr_t)table[idx].pml4.pointer_fields.base_address << 12) + g_hhdm_offset);
+
+            if (paging_protect_range_in_table(next_table, level + 1, virt, chunk, flags, batch) != PAGING_OK)
+            {
+                result = PAGING_ERROR;
+            }
+
+            if (level == PD)
+            {
+                paging_try_promote_pt(table, idx, virt);
+            }
+        }
+
+        virt = virt + chunk;
+        length = length - chunk;
+        idx = idx + 1;
+    }
+
+    return result;
+}
+
+/*!
+    @brief Map a virtual address to a physical address in the page table.
+
+    Traverses the page table hierarchy until the leaf is reached to map a physical address to a virtual address.
+    Supports 4kB, 2MB and 1GB pages.
+    Creates entries and allocates memory for page tables as needed.
+
+    Returns an error if allocating memory fails or if the leaf is already used (present flag is set).
+
+    @param pml4 PML4 in which the page should be mapped.
+    @param phys Physical address to which the virtual address should be mapped.
+    @param virt Virtual address that should be mapped to the physical address.
+    @param page_size Size of the page to map (4kB, 2MB or 1GB).
+    @param flags Flags for the page.
+
+    @returns PAGING_OK on success, PAGING_ERROR if allocating memory failed or the leafs present bit is set.
+*/
+static paging_error_codes_t paging_map_page_without_tlb_invalidation(union page_table_entry_t *pml4, uintptr_t phys, uintptr_t virt, page_size_t page_size, uint64_t flags)
+{
+    uint64_t pml4_idx = (virt >> 39) & 0x1ff;
+    uint64_t pdpr_idx = (virt >> 30) & 0x1ff;
+    uint64_t pd_idx = (virt >> 21) & 0x1ff;
+    uint64_t pt_idx = (virt >> 12) & 0x1ff;
+    
+    LOG_DEBUG("Mapping %p (virt) to %p (phys)", virt, phys);
+    LOG_DEBUG("Indices: pml4=%d, pdpr=%d, pd=%d, pt=%d", pml4_idx, pdpr_idx, pd_idx, pt_idx);
+
+    bool recursive = paging_use_recursive(pml4);
+
+    union page_table_entry_t *pdpr = NULL;
+    if (pml4[pml4_idx].pml4.pointer_fields.present == 0)
+    {
+        pdpr = paging_alloc_table();
+        if (pdpr == NULL)
+        {
+            LOG_ERROR("Failed to allocate memory for the PDPR.");
+            return PAGING_ERROR;
+        }
+        
+        pml4[pml4_idx] = paging_create_entry((uintptr_t)pdpr - g_hhdm_offset, PAGING_FLAG_PRESENT | PAGING_FLAG_WRITABLE, PML4, PAGING_ENTRY_POINTER);
+    }
+    else
+    {
+        pdpr = paging_get_next_table(pml4[pml4_idx], virt, PDPR, recursive);
+    }
+    
+    if (page_size == PAGE_SIZE_1GB)
+    {
+        if (pdpr[pdpr_idx].pdpr.page_fields.present != 0)
+        {
+            LOG_ERROR("Virtual address is already in use: %p", virt);
+            return PAGING_ERROR;
+        }
+        pdpr[pdpr_idx] = paging_create_entry(phys, flags, PDPR, PAGING_ENTRY_PAGE);
+        return PAGING_OK;
+    }
+
+    union page_table_entry_t *pd = NULL;
+    if (pdpr[pdpr_idx].pdpr.pointer_fields.present == 0)
+    {
+        pd = paging_alloc_table();
+        if (pd == NULL)
+        {
+            LOG_ERROR("Failed to allocate memory for the PD.");
+            return PAGING_ERROR;
+        }
+
+        pdpr[pdpr_idx] = paging_create_entry((uintptr_t)pd - g_hhdm_offset, PAGING_FLAG_PRESENT | PAGING_FLAG_WRITABLE, PDPR, PAGING_ENTRY_POINTER);
+    }
+    else
+    {
+        pd = paging_get_next_table(pdpr[pdpr_idx], virt, PD, recursive);
+    }
+    
+    if (page_size == PAGE_SIZE_2MB)
+    {
+        if (pd[pd_idx].pd.page_fields.present != 0)
+        {
+            LOG_ERROR("Virtual address is already in use: %p", virt);
+            return PAGING_ERROR;
+        }
+        pd[pd_idx] = paging_create_entry(phys, flags, PD, PAGING_ENTRY_PAGE);
+        return PAGING_OK;
+    }
+
+    union page_table_entry_t *pt = NULL;
+    if (pd[pd_idx].pd.pointer_fields.present == 0)
+    {
+        pt = paging_alloc_table();
+        if (pt == NULL)
+        {
+            LOG_ERROR("Failed to allocate memory for the PT.");
+            return PAGING_ERROR;
+        }
+        
+        pd[pd_idx] = paging_create_entry((uintptr_t)pt - g_hhdm_offset, PAGING_FLAG_PRESENT | PAGING_FLAG_WRITABLE, PD, PAGING_ENTRY_POINTER);
+    }
+    else
+    {
+        pt = paging_get_next_table(pd[pd_idx], virt, PT, recursive);
+    }
+
+    if (pt[pt_idx].pt.page_fields.present != 0)
+    {
+        LOG_ERROR("Virtual address is already in use: %p", virt);
+        return PAGING_ERROR;
+    }
+    pt[pt_idx] = paging_create_entry(phys, flags, PT, PAGING_ENTRY_PAGE);
+
+    return PAGING_OK;
+}
+
+/*!
+    @brief Resolves a virtual address of the active address space through the recursive slot.
+
+    The tables on the path to virt lie at fixed addresses, so no entry has to be followed through the HHDM
+    and there is nothing for the translation cache to remember.
+    Each entry still has to be checked before the table below it is read, as missing tables have no recursive mapping.
+
+    @param virt Virtual address to translate.
+    @returns Physical address of the 4 kB page containing virt, NULL if it isn't mapped.
+*/
+static uintptr_t paging_resolve_recursive(uintptr_t virt)
+{
+    union page_table_entry_t entry = paging_get_recursive_table(virt, PML4)[(virt >> 39) & 0x1ff];
+    if (entry.pml4.pointer_fields.present == 0)
+    {
+        return (uintptr_t) NULL;
+    }
+
+    entry = paging_get_recursive_table(virt, PDPR)[(virt >> 30) & 0x1ff];
+    if (entry.pdpr.pointer_fields.present == 0)
+    {
+        return (uintptr_t) NULL;
+    }
+    if (entry.pdpr.pointer_fields.page_size != 0)
+    {
+        return ((uintptr_t)entry.pdpr.page_fields.base_address << 30) + (virt & 0x3ffff000);
+    }
+
+    entry = paging_get_recursive_table(virt, PD)[(virt >> 21) & 0x1ff];
+    if (entry.pd.pointer_fields.present == 0)
+    {
+        return (uintptr_t) NULL;
+    }
+    if (entry.pd.pointer_fields.page_size != 0)
+    {
+        return ((uintptr_t)entry.pd.page_fields.base_address << 21) + (virt & 0x1ff000);
+    }
+
+    entry = paging_get_recursive_table(virt, PT)[(virt >> 12) & 0x1ff];
+    if (entry.pt.page_fields.present == 0)
+    {
+        return (uintptr_t) NULL;
+    }
+
+    return (uintptr_t)entry.pt.page_fields.base_address << 12;
+}
+
+/*!
+    @brief Resolve a virtual address to a physical address.
+
+    Walks through the page table hierarchy until a leaf is reached and returns the address of the 4 kB page containing virt.
+    Inside of 2 MB and 1 GB pages, the offset of that 4 kB page is added to the base address of the leaf,
+    so the result doesn't change when pages are promoted or demoted.
+    Returns NULL if an entry along the way is not present .
+
+    The PT (or the large page) of the last PAGING_TRANSLATION_CACHE_SIZE 2 MB windows that were looked up is cached,
+    so further lookups in the same window only read a single entry of the PT instead of walking all four levels.
+    Mapping and unmapping 4 kB pages doesn't affect the cache, it is invalidated when a table is freed or a large page is removed or split.
+    With PAGING_RECURSIVE, the active address space bypasses the cache and is walked through the recursive slot instead.
+
+    @param pml4 Page table from that the physical address should be retrieved.
+    @param virt Virtual address to translate.
+    
+    @returns Physical address as a uintptr_t.
+*/
+uintptr_t paging_resolve_virtual_address(union page_table_entry_t *pml4, uintptr_t virt)
+{
+    uint64_t pml4_idx = (virt >> 39) & 0x1ff;
+    uint64_t pdpr_idx = (virt >> 30) & 0x1ff;
+    uint64_t pd_idx = (virt >> 21) & 0x1ff;
+    uint64_t pt_idx = (virt >> 12) & 0x1ff;
+
+    if (paging_use_recursive(pml4))
+    {
+        return paging_resolve_recursive(virt);
+    }
+
+    uintptr_t window = virt >> 21;
+    struct paging_translation_cache_entry_t *cached = &paging_translation_cache[(window ^ ((uintptr_t)pml4 >> 12)) & (PAGING_TRANSLATION_CACHE_SIZE - 1)];
+
+    if (cached->generation == paging_translation_cache_generation && cached->pml4 == pml4 && cached->window == window)
+    {
+        paging_translation_cache_stats.hits = paging_translation_cache_stats.hits + 1;
+
+        if (cached->pt == NULL)
+        {
+            return cached->phys + (virt & 0x1ff000);
+        }
+        if (cached->pt[pt_idx].pt.page_fields.present == 0)
+        {
+            return (uintptr_t) NULL;
+        }
+        return (uintptr_t)cached->pt[pt_idx].pt.page_fields.base_address << 12;
+    }
+
+    paging_translation_cache_stats.misses = paging_translation_cache_stats.misses + 1;
 
     if (pml4[pml4_idx].pml4.pointer_fields.present == 0)
     {
-        LOG_ERROR("Failed to unmap virt=%p. PML4 entry not present in entry: %p", virt, pml4[pml4_idx].raw);
+        return (uintptr_t) NULL;
+    }
+
+    union page_table_entry_t *pdpr = (union page_table_entry_t *) (((uintptr_t)pml4[pml4_idx].pml4.pointer_fields.base_address << 12) + g_hhdm_offset);
+
+    if (pdpr[pdpr_idx].pdpr.pointer_fields.present == 0)
+    {
+        return (uintptr_t) NULL;
+    }
+
+    cached->generation = paging_translation_cache_generation;
+    cached->pml4 = pml4;
+    cached->window = window;
+    cached->pt = NULL;
+
+    if (pdpr[pdpr_idx].pdpr.pointer_fields.page_size != 0)
+    {
+        cached->phys = ((uintptr_t)pdpr[pdpr_idx].pdpr.page_fields.base_address << 30) + (virt & 0x3fe00000);
+        return cached->phys + (virt & 0x1ff000);
+    }
+
+    union page_table_entry_t *pd = (union page_table_entry_t *) (((uintptr_t)pdpr[pdpr_idx].pdpr.pointer_fields.base_address << 12) + g_hhdm_offset);
+
+    if (pd[pd_idx].pd.pointer_fields.present == 0)
+    {
+        // Nothing is mapped in the window, which isn't worth caching.
+        cached->generation = 0;
+        return (uintptr_t) NULL;
+    }
+    if (pd[pd_idx].pd.pointer_fields.page_size != 0)
+    {
+        cached->phys = (uintptr_t)(pd[pd_idx].pd.page_fields.base_address) << 21;
+        return cached->phys + (virt & 0x1ff000);
+    }
+
+    union page_table_entry_t *pt = (union page_table_entry_t *) (((uintptr_t)pd[pd_idx].pd.pointer_fields.base_address << 12) + g_hhdm_offset);
+    cached->pt = pt;
+    
+    if (pt[pt_idx].pt.page_fields.present == 0)
+    {
+        return (uintptr_t) NULL;
+    }
+
+    return (uintptr_t)pt[pt_idx].pt.page_fields.base_address << 12;
+}
+
+/*!
+    @brief Initializes the global HHDM offset and enables global pages and the execute-disable bit.
+
+    Sets CR4.PGE and EFER.NXE if the CPU supports them. Must be called before paging_clone_page_table().
+
+    @param hhdm_offset HHDM offset used for address translation.
+*/
+void paging_init(ptrdiff_t hhdm_offset)
+{
+    g_hhdm_offset = hhdm_offset;
+
+    paging_1gb_pages_supported = cpu_has_1gb_pages();
+
+    if (cpu_has_global_pages())
+    {
+        set_cr4(read_cr4() | PAGING_CR4_PGE);
+        paging_global_pages_enabled = true;
+    }
+
+    if (cpu_has_nx())
+    {
+        write_msr(PAGING_MSR_EFER, read_msr(PAGING_MSR_EFER) | PAGING_EFER_NXE);
+        paging_nx_enabled = true;
+    }
+
+    LOG_INFO("Paging: global pages %s, execute-disable %s.", paging_global_pages_enabled ? "enabled" : "not supported", paging_nx_enabled ? "enabled" : "not supported");
+}
+
+/*!
+    @brief Gets the flags that kernel data mappings in the higher half should have.
+
+    @returns PAGING_FLAG_GLOBAL and PAGING_FLAG_DISABLE_EXECUTION, if they are supported by the CPU.
+*/
+uint64_t paging_get_kernel_flags()
+{
+    uint64_t flags = 0;
+
+    if (paging_global_pages_enabled)
+    {
+        flags = flags | PAGING_FLAG_GLOBAL;
+    }
+    if (paging_nx_enabled)
+    {
+        flags = flags | PAGING_FLAG_DISABLE_EXECUTION;
+    }
+
+    return flags;
+}
+
+/*!
+    @brief Recursively traverse and log the structure of a page table.
+
+    Walks through all entries of a given page table (PML4, PDPR, PD or PT) and prints information about each non-empty entry.
+    For entries that reference lower-level tables, the function recursively descends into the next level.
+    Pages larger than 4kB are detected and logged without further recursion.
+    
+    Output format:
+        PML4@[pml4_idx]: [pml4_entry]\n
+        PDPR-[pml4_idx]@[pdpr_idx: [pdpr_entry]\n
+        PD-[pml4_idx]-[pdpr_idx]@[pd_idx]: [pd_entry]\n
+        PT-[pml4_idx]-[pdpr_idx]-[pd_idx]@[pt_idx]: [pt_entry]\n
+
+    @param page_table Pointer to the current page table.
+    @param hhdm_offset Offset for phys<->virt address translation.
+    @param level Current page table level (PML4, PDPR, PD, PT).
+*/
+void paging_dump_page_table(union page_table_entry_t *page_table, page_table_level_t level)
+{
+    static int16_t pml4_idx = -1;
+    static int16_t pdpr_idx = -1;
+    static int16_t pd_idx = -1;
+    static int16_t pt_idx = -1;
+
+    for (int16_t idx = 0; idx < PAGE_TABLE_NUM_ENTRIES; idx++)
+    {
+        // Skip empty entries.
+        if (page_table[idx].pml4.pointer_fields.present == 0)
+        {
+            continue;
+        }
+        
+        switch (level)
+        {
+        case PML4:
+            pml4_idx = idx;
+            LOG_INFO("PML4@%d: %x", pml4_idx, page_table[pml4_idx].raw);
+            union page_table_entry_t *pdpr = (union page_table_entry_t *) ((page_table[pml4_idx].pml4.pointer_fields.base_address << 12) + g_hhdm_offset);
+            paging_dump_page_table(pdpr, PDPR);
+            break;
+
+        case PDPR:
+            pdpr_idx = idx;
+
+            if (page_table[pdpr_idx].pdpr.pointer_fields.page_size != 0)
+            {
+                LOG_INFO("PDPR-%d@%d: %x (1GB-PAGE)", pml4_idx, pdpr_idx, page_table[pdpr_idx].raw);
+                break;
+            }
+
+            LOG_INFO("PDPR-%d@%d: %x", pml4_idx, pdpr_idx, page_table[pdpr_idx].raw);
+            union page_table_entry_t *pd = (union page_table_entry_t *) ((page_table[pdpr_idx].pdpr.pointer_fields.base_address << 12) + g_hhdm_offset);
+            paging_dump_page_table(pd, PD);
+            break;
+
+        case PD:
+            pd_idx = idx;
+
+            if (page_table[pd_idx].pd.pointer_fields.page_size != 0)
+            {
+                LOG_INFO("PD-%d-%d@%d: %x (2MB-PAGE)", pml4_idx, pdpr_idx, pd_idx, page_table[pd_idx].raw);
+                break;
+            }
+
+            LOG_INFO("PD-%d-%d@%d: %x", pml4_idx, pdpr_idx, pd_idx, page_table[pd_idx].raw);
+            union page_table_entry_t *pt = (union page_table_entry_t *) ((page_table[pd_idx].pd.pointer_fields.base_address << 12) + g_hhdm_offset);
+            paging_dump_page_table(pt, PT);
+            break;
+
+        case PT:
+            pt_idx = idx;
+            LOG_INFO("PT-%d-%d-%d@%d: %x", pml4_idx, pdpr_idx, pd_idx, pt_idx, page_table[pt_idx].raw);
+            break;
+
+        default:
+            break;
+        }
+    }
+}
+
+/*!
+    @brief Recursively walk a page table and clone mapped pages to another page table.
+
+    Recursively walks through all entries of a given page table (PML4, PDPR, PD or PT).
+    If a leaf is reached, its flags and the physical address are retrieved and the virtual address is calculated from the indices.
+    Maps the page in another page table WITHOUT invalidating its TLB entry.
+    Leaves in the higher half are made global. Pages of the kernels .text are made read-only and executable,
+    pages of .rodata read-only and all other pages in the higher half not executable.
+
+    @param old_page_table Pointer to the current level of page table that should be cloned.
+    @param new_pml4 Pointer to the PML4 of the page table that the entries should be cloned to.
+    @param level Current page table level (PML4, PDPR, PD, PT).
+
+    @returns PAGING_OK on success, PAGING_ERROR when allocating memory for the PML4 fails.
+*/
+paging_error_codes_t paging_clone_page_table(union page_table_entry_t *old_page_table, union page_table_entry_t **new_pml4, page_table_level_t level)
+{
+    static uint64_t pml4_idx = 0;
+    static uint64_t pdpr_idx = 0;
+    static uint64_t pd_idx = 0;
+    static uint64_t pt_idx = 0;
+
+    // Allocate memory for the PML4 if necessary.
+    if (level == PML4 && *new_pml4 == NULL)
+    {
+        *new_pml4 = paging_alloc_table();
+        if (*new_pml4 == NULL)
+        {
+            LOG_ERROR("Failed to allocate new pml4.");
+            return PAGING_ERROR;
+        }
+    }
+
+    for (uint64_t idx = 0; idx < PAGE_TABLE_NUM_ENTRIES; idx++)
+    {
+        // Skip empty entries.
+        if (old_page_table[idx].pml4.pointer_fields.present == 0)
+        {
+            continue;
+        }
+        
+        switch (level)
+        {
+        case PML4:
+            pml4_idx = idx;
+            LOG_DEBUG("PML4@%d: %x", pml4_idx, old_page_table[pml4_idx].raw);
+            union page_table_entry_t *pdpr = (union page_table_entry_t *) (((uintptr_t)old_page_table[pml4_idx].pml4.pointer_fields.base_address << 12) + g_hhdm_offset);
+            paging_clone_page_table(pdpr, new_pml4, PDPR);
+            break;
+
+        case PDPR:
+            pdpr_idx = idx;
+
+            if (old_page_table[pdpr_idx].pdpr.pointer_fields.page_size != 0)
+            {
+                LOG_DEBUG("PDPR-%d@%d: %x (1GB-PAGE)", pml4_idx, pdpr_idx, old_page_table[pdpr_idx].raw);
+                uintptr_t phys = (uintptr_t)old_page_table[pdpr_idx].pdpr.page_fields.base_address << 30;
+                uintptr_t virt = paging_get_virt_address_from_indices(pml4_idx, pdpr_idx, 0, 0);
+                uint64_t flags = paging_get_flags_from_entry(old_page_table[pdpr_idx], PDPR, PAGING_ENTRY_PAGE);
+                flags = paging_apply_kernel_policy(virt, (uint64_t)1 << 30, flags);
+                paging_map_page_without_tlb_invalidation(*new_pml4, phys, virt, PAGE_SIZE_1GB, flags);
+                break;
+            }
+
+            LOG_DEBUG("PDPR-%d@%d: %x", pml4_idx, pdpr_idx, old_page_table[pdpr_idx].raw);
+            union page_table_entry_t *pd = (union page_table_entry_t *) (((uintptr_t)old_page_table[pdpr_idx].pdpr.pointer_fields.base_address << 12) + g_hhdm_offset);
+            paging_clone_page_table(pd, new_pml4, PD);
+            break;
+
+        case PD:
+            pd_idx = idx;
+
+            if (old_page_table[pd_idx].pd.pointer_fields.page_size != 0)
+            {
+                LOG_DEBUG("PD-%d-%d@%d: %x (2MB-PAGE)", pml4_idx, pdpr_idx, pd_idx, old_page_table[pd_idx].raw);
+                uintptr_t phys = (uintptr_t)old_page_table[pd_idx].pd.page_fields.base_address << 21;
+                uintptr_t virt = paging_get_virt_address_from_indices(pml4_idx, pdpr_idx, pd_idx, 0);
+                uint64_t flags = paging_get_flags_from_entry(old_page_table[pd_idx], PD, PAGING_ENTRY_PAGE);
+                flags = paging_apply_kernel_policy(virt, (uint64_t)1 << 21, flags);
+                paging_map_page_without_tlb_invalidation(*new_pml4, phys, virt, PAGE_SIZE_2MB, flags);
+                break;
+            }
+
+            LOG_DEBUG("PD-%d-%d@%d: %x", pml4_idx, pdpr_idx, pd_idx, old_page_table[pd_idx].raw);
+            union page_table_entry_t *pt = (union page_table_entry_t *) (((uintptr_t)old_page_table[pd_idx].pd.pointer_fields.base_address << 12) + g_hhdm_offset);
+            paging_clone_page_table(pt, new_pml4, PT);
+            break;
+
+        case PT:
+            pt_idx = idx;
+            LOG_DEBUG("PT-%d-%d-%d@%d: %x", pml4_idx, pdpr_idx, pd_idx, pt_idx, old_page_table[pt_idx].raw);
+            uintptr_t phys = ((uintptr_t)old_page_table[pt_idx].pt.page_fields.base_address << 12);
+            uintptr_t virt = paging_get_virt_address_from_indices(pml4_idx, pdpr_idx, pd_idx, pt_idx);
+            uint64_t flags = paging_get_flags_from_entry(old_page_table[pt_idx], PT, PAGING_ENTRY_PAGE);
+            flags = paging_apply_kernel_policy(virt, PAGE_SIZE_BYTE, flags);
+            paging_map_page_without_tlb_invalidation(*new_pml4, phys, virt, PAGE_SIZE_4KB, flags);
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    return PAGING_OK;
+}
+
+/*!
+    @brief Unmap a page and invalidate its TLB entry.
+
+    Unmaps a page by clearing the present bit in its entry.
+    Supports 4kB, 2MB and 1GB pages.
+    After clearing the pages present bit, its page table and its parents are checked for emptiness and deletes them if they are no longer required.
+
+    Returns an error if a non-leaf entry is not present.
+
+    @param pml4 Page table in which the page should be unmapped.
+    @param virt Virtual address to unmap.
+    @param page_size Size of the page to unmap.
+
+    @returns PAGING_OK on success, PAGING_ERROR if a non-leaf entry is not present.
+*/
+paging_error_codes_t paging_unmap_page(union page_table_entry_t *pml4, uintptr_t virt, page_size_t page_size)
+{
+    uint64_t pml4_idx = (virt >> 39) & 0x1ff;
+    uint64_t pdpr_idx = (virt >> 30) & 0x1ff;
+    uint64_t pd_idx = (virt >> 21) & 0x1ff;
+    uint64_t pt_idx = (virt >> 12) & 0x1ff;
+
+    LOG_DEBUG("Unmapping virt=%p", virt);
+    LOG_DEBUG("Indices: pml4=%d, pdpr=%d, pd=%d, pt=%d", pml4_idx, pdpr_idx, pd_idx, pt_idx);
+
+    union page_table_entry_t leaf;
+    bool recursive = paging_use_recursive(pml4);
+
+    if (pml4[pml4_idx].pml4.pointer_fields.present == 0)
+    {
+        LOG_ERROR("Failed to unmap virt=%p. PML4 entry not present in entry: %p", virt, pml4[pml4_idx].raw);
+        return PAGING_ERROR;
+    }
+
+    union page_table_entry_t *pdpr = paging_get_next_table(pml4[pml4_idx], virt, PDPR, recursive);
+    if (pdpr[pdpr_idx].pdpr.pointer_fields.present == 0)
+    {
+        LOG_ERROR("Failed to unmap virt=%p. PDPR entry not present.", virt);
+        return PAGING_ERROR;
+    }
+    if (page_size == PAGE_SIZE_1GB)
+    {
+        leaf = pdpr[pdpr_idx];
+        pdpr[pdpr_idx].pdpr.page_fields.present = 0;
+        paging_translation_cache_invalidate();
+        goto CHECK_FOR_EMPTY_PDPR;
+    }
+
+    // Tables created by splitting a large page are used through the HHDM, as the TLB might still translate their recursive address for the large page.
+    union page_table_entry_t *pd = NULL;
+    if (pdpr[pdpr_idx].pdpr.pointer_fields.page_size != 0)
+    {
+        pd = paging_split_leaf(pdpr, pdpr_idx, PDPR);
+        if (pd == NULL)
+        {
+            LOG_ERROR("Failed to unmap virt=%p. Couldn't split the 1 GB page containing it.", virt);
+            return PAGING_ERROR;
+        }
+    }
+    else
+    {
+        pd = paging_get_next_table(pdpr[pdpr_idx], virt, PD, recursive);
+    }
+
+    if (pd[pd_idx].pd.pointer_fields.present == 0)
+    {
+        LOG_ERROR("Failed to unmap virt=%p. PD entry not present.", virt);
+        return PAGING_ERROR;
+    }
+    if (page_size == PAGE_SIZE_2MB)
+    {
+        leaf = pd[pd_idx];
+        pd[pd_idx].pd.page_fields.present = 0;
+        paging_translation_cache_invalidate();
+        goto CHECK_FOR_EMPTY_PD;
+    }
+
+    union page_table_entry_t *pt = NULL;
+    if (pd[pd_idx].pd.pointer_fields.page_size != 0)
+    {
+        pt = paging_split_leaf(pd, pd_idx, PD);
+        if (pt == NULL)
+        {
+            LOG_ERROR("Failed to unmap virt=%p. Couldn't split the 2 MB page containing it.", virt);
+            return PAGING_ERROR;
+        }
+    }
+    else
+    {
+        pt = paging_get_next_table(pd[pd_idx], virt, PT, recursive);
+    }
+
+    leaf = pt[pt_idx];
+    pt[pt_idx].pt.page_fields.present = 0;
+
+    // Free empty tables.
+    // TODO: Only check parent tables if table was empty.
+    paging_check_for_empty_table(pt, pd, pd_idx);
+    CHECK_FOR_EMPTY_PD:
+    paging_check_for_empty_table(pd, pdpr, pdpr_idx);
+    CHECK_FOR_EMPTY_PDPR:
+    paging_check_for_empty_pdpr(pdpr, pml4, pml4_idx);
+
+    invalidate_tlb(virt);
+    if (recursive)
+    {
+        paging_invalidate_recursive_path(virt);
+    }
+    paging_invalidate_inactive(pml4);
+    if (paging_is_shared_leaf(virt, leaf))
+    {
+        pcid_invalidate_others();
+    }
+
+    return PAGING_OK;
+}
+
+/*!
+    @brief Map a virtual address to a physical address in the page table and invalidates its TLB entry.
+
+    Traverses the page table hierarchy until the leaf is reached to map a physical address to a virtual address.
+    Supports 4kB, 2MB and 1GB pages.
+    Creates entries and allocates memory for page tables as needed.
+    Invalidates the pages TLB entry if the page was successfully mapped.
+
+    Returns an error if allocating memory fails or if the leaf is already used (present flag is set).
+
+    @param pml4 PML4 in which the page should be mapped.
+    @param phys Physical address to which the virtual address should be mapped.
+    @param virt Virtual address that should be mapped to the physical address.
+    @param page_size Size of the page to map (4kB, 2MB or 1GB).
+    @param flags Flags for the page.
+
+    @returns PAGING_OK on success, PAGING_ERROR if allocating memory failed or the leafs present bit is set.
+*/
+paging_error_codes_t paging_map_page(union page_table_entry_t *pml4, uintptr_t phys, uintptr_t virt, page_size_t page_size, uint64_t flags)
+{
+    paging_error_codes_t success = paging_map_page_without_tlb_invalidation(pml4, phys, virt, page_size, flags);
+    if (success != PAGING_OK)
+    {
+        LOG_ERROR("Failed to map page. virt=%p, phys=%p, error=%d", virt, phys, success);
+        return success;
+    }
+
+    invalidate_tlb(virt);
+
+    if (page_size == PAGE_SIZE_4KB)
+    {
+        paging_try_promote(pml4, virt);
+    }
+
+    return PAGING_OK;
+}
+
+/*!
+    @brief Map a range of virtual memory to a list of physical pages.
+
+    Maps count 4 kB pages starting at virt, the i-th one to pages[i].
+    The page table hierarchy is only walked for the first page and whenever the range crosses into the next PT,
+    instead of once per page like calling paging_map_page() count times.
+    Creates entries and allocates memory for page tables as needed.
+    The entries weren't present before, so they can't be cached in the TLB and nothing has to be invalidated.
+
+    If an error occurs, the pages that were mapped up to that point stay mapped.
+
+    @param pml4 PML4 in which the pages should be mapped.
+    @param virt Virtual address of the first page. Must be 4 kB aligned.
+    @param pages Array of physical addresses of the pages.
+    @param count Number of pages to map.
+    @param flags Flags for the pages.
+
+    @returns PAGING_OK on success, PAGING_ERROR if allocating memory failed, a page is already mapped or a large page is in the way.
+*/
+paging_error_codes_t paging_map_pages(union page_table_entry_t *pml4, uintptr_t virt, void **pages, size_t count, uint64_t flags)
+{
+    union page_table_entry_t *pt = NULL;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        uintptr_t page_virt = virt + i * PAGE_SIZE_BYTE;
+        uint64_t pt_idx = (page_virt >> 12) & 0x1ff;
+
+        if (pt == NULL || pt_idx == 0)
+        {
+            if (pt != NULL)
+            {
+                paging_try_promote(pml4, page_virt - PAGE_SIZE_BYTE);
+            }
+            pt = paging_get_pt(pml4, page_virt, true, false);
+            if (pt == NULL)
+            {
+                LOG_ERROR("Failed to get the PT for virt=%p", page_virt);
+                return PAGING_ERROR;
+            }
+        }
+
+        if (pt[pt_idx].pt.page_fields.present != 0)
+        {
+            LOG_ERROR("Virtual address is already in use: %p", page_virt);
+            return PAGING_ERROR;
+        }
+
+        pt[pt_idx] = paging_create_entry((uintptr_t)pages[i], flags, PT, PAGING_ENTRY_PAGE);
+    }
+
+    if (count > 0)
+    {
+        paging_try_promote(pml4, virt + (count - 1) * PAGE_SIZE_BYTE);
+    }
+
+    return PAGING_OK;
+}
+
+/*!
+    @brief Unmap a range of virtual memory and invalidate its TLB entries.
+
+    Unmaps count 4 kB pages starting at virt.
+    Like paging_map_pages(), the page table hierarchy is only walked once per PT.
+    Whenever the range leaves a PT, the PT and its parents are checked for emptiness and deleted if they are no longer required.
+    The TLB entries are collected in a struct paging_tlb_batch_t and flushed at once before returning.
+
+    @param pml4 Page table in which the pages should be unmapped.
+    @param virt Virtual address of the first page. Must be 4 kB aligned.
+    @param count Number of pages to unmap.
+    @param pages Array where the physical addresses of the unmapped pages are stored, NULL for pages that weren't mapped. Can be NULL if they are not needed.
+
+    @returns PAGING_OK on success, PAGING_ERROR if some of the pages weren't mapped by a PT.
+*/
+paging_error_codes_t paging_unmap_pages(union page_table_entry_t *pml4, uintptr_t virt, size_t count, void **pages)
+{
+    paging_error_codes_t result = PAGING_OK;
+    union page_table_entry_t *pt = NULL;
+
+    struct paging_tlb_batch_t batch;
+    paging_tlb_batch_init(&batch);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        uintptr_t page_virt = virt + i * PAGE_SIZE_BYTE;
+        uint64_t pt_idx = (page_virt >> 12) & 0x1ff;
+
+        if (pt == NULL || pt_idx == 0)
+        {
+            if (pt != NULL)
+            {
+                paging_free_empty_tables(pml4, page_virt - PAGE_SIZE_BYTE);
+            }
+            pt = paging_get_pt(pml4, page_virt, false, true);
+        }
+
+        if (pt == NULL || pt[pt_idx].pt.page_fields.present == 0)
+        {
+            if (pages != NULL)
+            {
+                pages[i] = NULL;
+            }
+            result = PAGING_ERROR;
+            continue;
+        }
+
+        if (pages != NULL)
+        {
+            pages[i] = (void *)((uintptr_t)pt[pt_idx].pt.page_fields.base_address << 12);
+        }
+
+        if (paging_is_shared_leaf(page_virt, pt[pt_idx]))
+        {
+            batch.shared = true;
+        }
+        pt[pt_idx].raw = 0;
+        paging_tlb_batch_add(&batch, page_virt);
+    }
+
+    if (pt != NULL)
+    {
+        paging_free_empty_tables(pml4, virt + (count - 1) * PAGE_SIZE_BYTE);
+    }
+
+    paging_tlb_batch_flush(&batch);
+    paging_invalidate_inactive(pml4);
+
+    return result;
+}
+
+/*!
+    @brief Map a physically contiguous range.
+
+    Walks the page table hierarchy once for the whole range instead of once per page:
+    Consecutive entries of a table are filled one after another and every table is only visited once.
+    The page size is picked automatically. Wherever virt and phys are aligned to 1 GB or 2 MB and the rest of the range is large enough,
+    a 1 GB (if supported by the CPU) or 2 MB page is used, 4 kB pages everywhere else.
+    Creates entries and allocates memory for page tables as needed.
+    The entries weren't present before, so nothing has to be invalidated in the TLB.
+
+    If an error occurs, the part of the range that was mapped up to that point stays mapped.
+
+    @param pml4 PML4 in which the range should be mapped.
+    @param phys Physical address of the range. Must be 4 kB aligned.
+    @param virt Virtual address of the range. Must be 4 kB aligned.
+    @param length Length of the range in byte. Must be a multiple of 4 kB.
+    @param flags Flags for the pages. PAGING_FLAG_PAGE_SIZE is set or cleared depending on the page size.
+
+    @returns PAGING_OK on success, PAGING_ERROR if the arguments are not aligned, allocating memory failed or a part of the range is already mapped.
+*/
+paging_error_codes_t paging_map_range(union page_table_entry_t *pml4, uintptr_t phys, uintptr_t virt, size_t length, uint64_t flags)
+{
+    if (((phys | virt | length) & (PAGE_SIZE_BYTE - 1)) != 0)
+    {
+        LOG_ERROR("Range is not page aligned: phys=%p, virt=%p, length=%x", phys, virt, length);
+        return PAGING_ERROR;
+    }
+
+    return paging_map_range_in_table(pml4, PML4, phys, virt, length, flags);
+}
+
+/*!
+    @brief Unmap a range and invalidate its TLB entries.
+
+    Like paging_map_range(), the page table hierarchy is only walked once for the whole range.
+    4 kB, 2 MB and 1 GB pages inside the range are unmapped, parts of the range that aren't mapped are skipped.
+    Tables are checked for emptiness once, after the part of the range inside of them has been unmapped,
+    instead of up to three times for every page like paging_unmap_page() does.
+    The TLB entries are collected in a struct paging_tlb_batch_t and flushed at once before returning.
+
+    @param pml4 Page table in which the range should be unmapped.
+    @param virt Virtual address of the range. Must be 4 kB aligned.
+    @param length Length of the range in byte. Must be a multiple of 4 kB.
+
+    2 MB and 1 GB pages that are only partially inside of the range are split first.
+
+    @returns PAGING_OK on success, PAGING_ERROR if the arguments are not aligned or a large page that is only partially inside of the range couldn't be split.
+*/
+paging_error_codes_t paging_unmap_range(union page_table_entry_t *pml4, uintptr_t virt, size_t length)
+{
+    if (((virt | length) & (PAGE_SIZE_BYTE - 1)) != 0)
+    {
+        LOG_ERROR("Range is not page aligned: virt=%p, length=%x", virt, length);
+        return PAGING_ERROR;
+    }
+
+    struct paging_tlb_batch_t batch;
+    paging_tlb_batch_init(&batch);
+
+    paging_error_codes_t result = paging_unmap_range_in_table(pml4, PML4, virt, length, &batch);
+
+    paging_tlb_batch_flush(&batch);
+    paging_invalidate_inactive(pml4);
+
+    return result;
+}
+
+/*!
+    @brief Sets up an empty TLB flush batch.
+
+    @param batch The batch.
+*/
+void paging_tlb_batch_init(struct paging_tlb_batch_t *batch)
+{
+    batch->count = 0;
+    batch->flush_all = false;
+    batch->shared = false;
+}
+
+/*!
+    @brief Adds a virtual address whose TLB entry has to be invalidated to a batch.
+
+    Once the batch is full, further addresses are not stored, but the whole TLB is flushed by paging_tlb_batch_flush().
+
+    @param batch The batch.
+    @param virt Virtual address of the page.
+*/
+void paging_tlb_batch_add(struct paging_tlb_batch_t *batch, uintptr_t virt)
+{
+    if (batch->count == PAGING_TLB_BATCH_SIZE)
+    {
+        batch->flush_all = true;
+        return;
+    }
+
+    batch->addresses[batch->count] = virt;
+    batch->count = batch->count + 1;
+}
+
+/*!
+    @brief Invalidates the TLB entries of all addresses in a batch and empties it.
+
+    Uses invlpg for every address, or reloads CR3 if there were more than PAGING_TLB_BATCH_SIZE addresses.
+    If shared is set, the PCIDs of all other address spaces are flushed the next time they are switched to.
+    Must be called before the physical pages that were unmapped are reused.
+
+    @param batch The batch.
+*/
+void paging_tlb_batch_flush(struct paging_tlb_batch_t *batch)
+{
+    if (batch->flush_all)
+    {
+        flush_tlb();
+    }
+    else
+    {
+        for (size_t i = 0; i < batch->count; i++)
+        {
+            invalidate_tlb(batch->addresses[i]);
+        }
+    }
+
+    if (batch->shared)
+    {
+        pcid_invalidate_others();
+    }
+
+    paging_tlb_batch_init(batch);
+}
+
+/*!
+    @brief Points PAGING_RECURSIVE_SLOT of a PML4 to the PML4 itself.
+
+    The entry is neither global nor accessible from user mode, as every address space sees its own tables there, and not executable.
+
+    @param pml4 The PML4.
+*/
+static void paging_set_recursive_slot(union page_table_entry_t *pml4)
+{
+    uint64_t flags = PAGING_FLAG_PRESENT | PAGING_FLAG_WRITABLE;
+    if (paging_nx_enabled)
+    {
+        flags = flags | PAGING_FLAG_DISABLE_EXECUTION;
+    }
+
+    pml4[PAGING_RECURSIVE_SLOT] = paging_create_entry((uintptr_t)pml4 - g_hhdm_offset, flags, PML4, PAGING_ENTRY_POINTER);
+}
+
+/*!
+    @brief Prepares the higher half of a PML4 to be shared by all address spaces.
+
+    With PAGING_RECURSIVE, PAGING_RECURSIVE_SLOT is pointed to the PML4 itself first.
+    Allocates an empty PDPR for every entry of the higher half that isn't present yet,
+    so the higher half entries of the PML4 never change again and can simply be copied by paging_create_address_space().
+    From now on, PDPRs of the higher half are not deleted when they become empty.
+    This costs up to 256 pages (1 MB) once.
+
+    @param pml4 PML4 of the kernel. Must be the PML4 all address spaces are created from.
+
+    @returns PAGING_OK on success, PAGING_ERROR if allocating memory for a PDPR failed or the recursive slot is already in use.
+*/
+paging_error_codes_t paging_init_kernel_half(union page_table_entry_t *pml4)
+{
+    if (PAGING_RECURSIVE)
+    {
+        if (pml4[PAGING_RECURSIVE_SLOT].pml4.pointer_fields.present != 0)
+        {
+            LOG_ERROR("PML4 entry %u is already in use and can't be the recursive slot.", PAGING_RECURSIVE_SLOT);
+            return PAGING_ERROR;
+        }
+        paging_set_recursive_slot(pml4);
+    }
+
+    for (size_t idx = PAGE_TABLE_NUM_ENTRIES / 2; idx < PAGE_TABLE_NUM_ENTRIES; idx++)
+    {
+        if (pml4[idx].pml4.pointer_fields.present != 0)
+        {
+            continue;
+        }
+
+        union page_table_entry_t *pdpr = paging_alloc_table();
+        if (pdpr == NULL)
+        {
+            LOG_ERROR("Failed to allocate memory for the PDPR of PML4 entry %u.", idx);
+            return PAGING_ERROR;
+        }
+
+        pml4[idx] = paging_create_entry((uintptr_t)pdpr - g_hhdm_offset, PAGING_FLAG_PRESENT | PAGING_FLAG_WRITABLE, PML4, PAGING_ENTRY_POINTER);
+    }
+
+    paging_kernel_pml4 = pml4;
+
+    return PAGING_OK;
+}
+
+/*!
+    @brief Creates a new address space that shares the kernels higher half.
+
+    Allocates a PML4 and copies the 256 higher half entries of the kernels PML4, so all tables below them are shared.
+    The lower half starts out empty. This takes constant time, no matter how much memory the kernel has mapped.
+    With PAGING_RECURSIVE, the copied PAGING_RECURSIVE_SLOT is pointed to the new PML4.
+
+    @param new_pml4 Pointer to where the pointer (virtual address) to the new PML4 is stored.
+
+    @returns PAGING_OK on success, PAGING_ERROR if paging_init_kernel_half() wasn't called or allocating memory for the PML4 failed.
+*/
+paging_error_codes_t paging_create_address_space(union page_table_entry_t **new_pml4)
+{
+    if (paging_kernel_pml4 == NULL)
+    {
+        LOG_ERROR("The kernel half is not initialized.");
         return PAGING_ERROR;
     }
 
-    union page_table_entry_t *pdpr = (union page_table_entry_t *) (((uintptr_t)pml4[pml4_idx].pml4.pointer_fields.base_address << 12) + g_hhdm_offset);
-    if (pdpr[pdpr_idx].pdpr.pointer_fields.present == 0)
+    union page_table_entry_t *pml4 = paging_alloc_table();
+    if (pml4 == NULL)
     {
-        LOG_ERROR("Failed to unmap virt=%p. PDPR entry not present.", virt);
+        LOG_ERROR("Failed to allocate new pml4.");
         return PAGING_ERROR;
     }
-    if (page_size == PAGE_SIZE_1GB)
+
+    memcpy(&pml4[PAGE_TABLE_NUM_ENTRIES / 2], &paging_kernel_pml4[PAGE_TABLE_NUM_ENTRIES / 2], PAGE_TABLE_NUM_ENTRIES / 2 * sizeof(union page_table_entry_t));
+
+    // The copied slot points to the kernels PML4.
+    if (PAGING_RECURSIVE)
     {
-        pdpr[pdpr_idx].pdpr.page_fields.present = 0;
-        goto CHECK_FOR_EMPTY_PDPR;
+        paging_set_recursive_slot(pml4);
     }
 
-    union page_table_entry_t *pd = (union page_table_entry_t *) (((uintptr_t)pdpr[pdpr_idx].pdpr.pointer_fields.base_address << 12) + g_hhdm_offset);
-    if (pd[pd_idx].pd.pointer_fields.present == 0)
+    *new_pml4 = pml4;
+
+    return PAGING_OK;
+}
+
+/*!
+    @brief Drops a reference to a copy-on-write page and frees it if it was the last one.
+
+    @param phys Physical address of the page.
+    @param size Size of the page in byte.
+*/
+static void paging_put_cow_page(uintptr_t phys, uint64_t size)
+{
+    struct page_t *page = phys_to_page(phys);
+    if (page == NULL)
     {
-        LOG_ERROR("Failed to unmap virt=%p. PD entry not present.", virt);
-        return PAGING_ERROR;
+        return;
     }
-    if (page_size == PAGE_SIZE_2MB)
+
+    // The last reference is dropped by freeing the page, pmm_free() rejects pages whose refcount is already 0.
+    uint64_t rflags = cpu_disable_interrupts();
+    bool unused = page->refcount == 1;
+    if (!unused)
     {
-        pd[pd_idx].pd.page_fields.present = 0;
-        goto CHECK_FOR_EMPTY_PD;
+        page->refcount = page->refcount - 1;
     }
+    cpu_restore_interrupts(rflags);
 
-    union page_table_entry_t *pt = (union page_table_entry_t *) (((uintptr_t)pd[pd_idx].pd.pointer_fields.base_address << 12) + g_hhdm_offset);
-    pt[pt_idx].pt.page_fields.present = 0;
+    if (!unused)
+    {
+        return;
+    }
 
-    // Free empty tables.
-    // TODO: Only check parent tables if table was empty.
-    paging_check_for_empty_table(pt, pd, pd_idx);
-    CHECK_FOR_EMPTY_PD:
-    paging_check_for_empty_table(pd, pdpr, pdpr_idx);
-    CHECK_FOR_EMPTY_PDPR:
-    paging_check_for_empty_table(pdpr, pml4, pml4_idx);
+    if (size == PAGE_SIZE_BYTE)
+    {
+        pmm_free((void *)phys);
+    }
+    else
+    {
+        pmm_free_pages((void *)phys, size / PAGE_SIZE_BYTE);
+    }
+}
 
-    invalidate_tlb(virt);
+/*!
+    @brief Frees the tables of the lower half of a table and everything below it.
+
+    Copy-on-write pages lose the reference of the table, see paging_put_cow_page().
+
+    @param table The table.
+    @param level Level of the table.
+    @param num_entries Number of entries of the table to look at, starting at the first one.
+*/
+static void paging_free_lower_tables(union page_table_entry_t *table, page_table_level_t level, size_t num_entries)
+{
+    for (size_t idx = 0; idx < num_entries; idx++)
+    {
+        if (table[idx].pml4.pointer_fields.present == 0)
+        {
+            continue;
+        }
+
+        if (level == PT || (level != PML4 && table[idx].pdpr.pointer_fields.page_size != 0))
+        {
+            if ((table[idx].raw & PAGING_FLAG_COW) != 0)
+            {
+                paging_put_cow_page(paging_get_leaf_address(table[idx], level), paging_get_entry_size(level));
+            }
+            continue;
+        }
+
+        union page_table_entry_t *next_table = (union page_table_entry_t *) (((uintptr_t)table[idx].pml4.pointer_fields.base_address << 12) + g_hhdm_offset);
+        paging_free_lower_tables(next_table, level + 1, PAGE_TABLE_NUM_ENTRIES);
+        paging_free_table(next_table);
+        table[idx].raw = 0;
+    }
+}
+
+/*!
+    @brief Destroys an address space created by paging_create_address_space().
+
+    Frees all page tables of the lower half and the PML4 and gives up the address spaces PCIDs.
+    The shared higher half is left alone. Pages mapped with PAGING_FLAG_COW lose a reference and are freed with the last one,
+    other pages that are still mapped in the lower half are not freed, that is up to their owner.
+
+    @param pml4 PML4 of the address space. Must not be loaded.
+*/
+void paging_destroy_address_space(union page_table_entry_t *pml4)
+{
+    paging_free_lower_tables(pml4, PML4, PAGE_TABLE_NUM_ENTRIES / 2);
+
+    pcid_release((uintptr_t)pml4 - g_hhdm_offset);
+
+    // The higher half entries point to shared tables and must not be freed.
+    memset(&pml4[PAGE_TABLE_NUM_ENTRIES / 2], 0, PAGE_TABLE_NUM_ENTRIES / 2 * sizeof(union page_table_entry_t));
+    paging_free_table(pml4);
+}
+
+/*!
+    @brief Copies the part of a table that belongs to the lower half into the table of a child, sharing all pages.
+
+    Writable leaves and leaves that are already copy-on-write are made read-only copy-on-write leaves in both tables,
+    and the reference counts of their pages are incremented. Tables below the leaves are duplicated.
+
+    @param parent Table of the parent.
+    @param child Empty table of the child at the same position.
+    @param level Level of the tables.
+    @param num_entries Number of entries to look at, starting at the first one.
+
+    @returns PAGING_OK on success, PAGING_ERROR if allocating memory for a table failed.
+*/
+static paging_error_codes_t paging_fork_table(union page_table_entry_t *parent, union page_table_entry_t *child, page_table_level_t level, size_t num_entries)
+{
+    for (size_t idx = 0; idx < num_entries; idx++)
+    {
+        if (parent[idx].pml4.pointer_fields.present == 0)
+        {
+            continue;
+        }
+
+        if (level == PT || (level != PML4 && parent[idx].pdpr.pointer_fields.page_size != 0))
+        {
+            struct page_t *page = phys_to_page(paging_get_leaf_address(parent[idx], level));
+
+            if (page != NULL && (parent[idx].raw & (PAGING_FLAG_WRITABLE | PAGING_FLAG_COW)) != 0)
+            {
+                uint64_t rflags = cpu_disable_interrupts();
+                page->refcount = page->refcount + 1;
+                cpu_restore_interrupts(rflags);
+
+                parent[idx].raw = (parent[idx].raw & ~(uint64_t)PAGING_FLAG_WRITABLE) | PAGING_FLAG_COW;
+            }
+
+            child[idx] = parent[idx];
+            continue;
+        }
+
+        union page_table_entry_t *child_table = paging_alloc_table();
+        if (child_table == NULL)
+        {
+            LOG_ERROR("Failed to allocate memory for a page table.");
+            return PAGING_ERROR;
+        }
+
+        uint64_t flags = paging_get_flags_from_entry(parent[idx], level, PAGING_ENTRY_POINTER);
+        child[idx] = paging_create_entry((uintptr_t)child_table - g_hhdm_offset, flags, level, PAGING_ENTRY_POINTER);
+
+        union page_table_entry_t *parent_table = (union page_table_entry_t *) (((uintptr_t)parent[idx].pml4.pointer_fields.base_address << 12) + g_hhdm_offset);
+        if (paging_fork_table(parent_table, child_table, level + 1, PAGE_TABLE_NUM_ENTRIES) != PAGING_OK)
+        {
+            return PAGING_ERROR;
+        }
+    }
 
     return PAGING_OK;
 }
 
 /*!
-    @brief Map a virtual address to a physical address in the page table and invalidates its TLB entry.
+    @brief Creates a copy of an address space that shares its pages copy-on-write.
 
-    Traverses the page table hierarchy until the leaf is reached to map a physical address to a virtual address.
-    Supports 4kB, 2MB and 1GB pages.
-    Creates entries and allocates memory for page tables as needed.
-    Invalidates the pages TLB entry if the page was successfully mapped.
+    The child gets its own lower half tables, but no page is copied up front. Writable pages of the lower half are made read-only
+    in both address spaces and marked with PAGING_FLAG_COW, and their reference count (refcount of their struct page_t) is incremented.
+    The first write to such a page is resolved by paging_handle_cow_fault(). From now on the pages belong to their reference counts,
+    see paging_destroy_address_space().
+    Read-only pages and pages not managed by the PMM are simply shared.
 
-    Returns an error if allocating memory fails or if the leaf is already used (present flag is set).
+    @param parent_pml4 PML4 of the address space to fork. Created by paging_create_address_space().
+    @param child_pml4 Pointer to where the pointer (virtual address) to the PML4 of the child is stored.
 
-    @param pml4 PML4 in which the page should be mapped.
-    @param phys Physical address to which the virtual address should be mapped.
-    @param virt Virtual address that should be mapped to the physical address.
-    @param page_size Size of the page to map (4kB, 2MB or 1GB).
-    @param flags Flags for the page.
+    @returns PAGING_OK on success, PAGING_ERROR if allocating memory for a table failed. The child is destroyed in that case.
+*/
+paging_error_codes_t paging_fork_address_space(union page_table_entry_t *parent_pml4, union page_table_entry_t **child_pml4)
+{
+    union page_table_entry_t *pml4;
+    if (paging_create_address_space(&pml4) != PAGING_OK)
+    {
+        return PAGING_ERROR;
+    }
 
-    @returns PAGING_OK on success, PAGING_ERROR if allocating memory failed or the leafs present bit is set.
+    paging_error_codes_t result = paging_fork_table(parent_pml4, pml4, PML4, PAGE_TABLE_NUM_ENTRIES / 2);
+
+    // The parent lost write access to its pages, which might still be cached writable.
+    uintptr_t parent_phys = (uintptr_t)parent_pml4 - g_hhdm_offset;
+    if (parent_phys == (read_cr3() & ~(uint64_t)0xfff))
+    {
+        flush_tlb();
+    }
+    else
+    {
+        pcid_invalidate(parent_phys);
+    }
+
+    if (result != PAGING_OK)
+    {
+        paging_destroy_address_space(pml4);
+        return result;
+    }
+
+    *child_pml4 = pml4;
+
+    return PAGING_OK;
+}
+
+/*!
+    @brief Resolves a write to a copy-on-write page of the active address space.
+
+    Called by the page fault handler. If the page is still shared, it is copied to a new page that replaces it in this address space.
+    If this address space is its last user, the page is simply made writable again.
+
+    @param address The faulting address (CR2).
+    @param error_code Error code pushed by the CPU for the page fault.
+
+    @returns PAGING_OK if the faulting instruction can be restarted,
+             PAGING_ERROR if the fault wasn't a write to a copy-on-write page or copying failed.
 */
-paging_error_codes_t paging_map_page(union page_table_entry_t *pml4, uintptr_t phys, uintptr_t virt, page_size_t page_size, uint64_t flags)
+paging_error_codes_t paging_handle_cow_fault(uintptr_t address, uint64_t error_code)
 {
-    paging_error_codes_t success = paging_map_page_without_tlb_invalidation(pml4, phys, virt, page_size, flags);
-    if (success != PAGING_OK)
+    // Only writes to pages that are present can be caused by copy-on-write.
+    if ((error_code & PAGING_PAGE_FAULT_PRESENT) == 0 || (error_code & PAGING_PAGE_FAULT_WRITE) == 0 || address >= PAGING_HIGHER_HALF_START)
     {
-        LOG_ERROR("Failed to map page. virt=%p, phys=%p, error=%d", virt, phys, success);
-        return success;
+        return PAGING_ERROR;
     }
 
-    invalidate_tlb(virt);
+    // Find the leaf of the address.
+    union page_table_entry_t *table = (union page_table_entry_t *) ((read_cr3() & ~(uint64_t)0xfff) + g_hhdm_offset);
+    page_table_level_t level = PML4;
+    uint64_t idx;
+    while (true)
+    {
+        idx = (address >> (39 - 9 * level)) & 0x1ff;
+
+        if (table[idx].pml4.pointer_fields.present == 0)
+        {
+            return PAGING_ERROR;
+        }
+        if (level == PT || (level != PML4 && table[idx].pdpr.pointer_fields.page_size != 0))
+        {
+            break;
+        }
+
+        table = (union page_table_entry_t *) (((uintptr_t)table[idx].pml4.pointer_fields.base_address << 12) + g_hhdm_offset);
+        level = level + 1;
+    }
+
+    if ((table[idx].raw & PAGING_FLAG_COW) == 0 || (table[idx].raw & PAGING_FLAG_WRITABLE) != 0)
+    {
+        return PAGING_ERROR;
+    }
+
+    uint64_t size = paging_get_entry_size(level);
+    uintptr_t old_phys = paging_get_leaf_address(table[idx], level);
+    struct page_t *page = phys_to_page(old_phys);
+
+    if (page != NULL && page->refcount == 1)
+    {
+        // All other users already made their own copy.
+        table[idx].raw = table[idx].raw | PAGING_FLAG_WRITABLE;
+    }
+    else
+    {
+        void *new_phys = size == PAGE_SIZE_BYTE ? pmm_alloc() : pmm_alloc_pages(size / PAGE_SIZE_BYTE, size);
+        if (new_phys == NULL)
+        {
+            LOG_ERROR("Failed to allocate memory for copying the page at %p.", address);
+            return PAGING_ERROR;
+        }
+
+        memcpy(new_phys + g_hhdm_offset, (void *)(old_phys + g_hhdm_offset), size);
+
+        uint64_t flags = paging_get_flags_from_entry(table[idx], level, PAGING_ENTRY_PAGE) | PAGING_FLAG_WRITABLE;
+        table[idx] = paging_create_entry((uintptr_t)new_phys, flags, level, PAGING_ENTRY_PAGE);
+        if (level != PT)
+        {
+            paging_translation_cache_invalidate();
+        }
+
+        paging_put_cow_page(old_phys, size);
+    }
+
+    invalidate_tlb(address & ~(size - 1));
 
     return PAGING_OK;
-}
\ No newline at end of file
+}
+
+/*!
+    @brief Changes the flags of all pages inside of a range and invalidates their TLB entries.
+
+    Parts of the range that aren't mapped are skipped. 2 MB and 1 GB pages that are only partially inside of the range are split first.
+    Afterwards, PTs whose pages all ended up with the same flags are replaced by 2 MB pages if possible.
+    Copy-on-write pages keep PAGING_FLAG_COW and stay read-only.
+
+    @param pml4 Page table containing the range.
+    @param virt Virtual address of the range. Must be 4 kB aligned.
+    @param length Length of the range in byte. Must be a multiple of 4 kB.
+    @param flags New flags for the pages. PAGING_FLAG_PRESENT is always set, PAGING_FLAG_PAGE_SIZE is set or cleared depending on the page size.
+
+    @returns PAGING_OK on success, PAGING_ERROR if the arguments are not aligned or a large page that is only partially inside of the range couldn't be split.
+*/
+paging_error_codes_t paging_protect_range(union page_table_entry_t *pml4, uintptr_t virt, size_t length, uint64_t flags)
+{
+    if (((virt | length) & (PAGE_SIZE_BYTE - 1)) != 0)
+    {
+        LOG_ERROR("Range is not page aligned: virt=%p, length=%x", virt, length);
+        return PAGING_ERROR;
+    }
+
+    struct paging_tlb_batch_t batch;
+    paging_tlb_batch_init(&batch);
+
+    paging_error_codes_t result = paging_protect_range_in_table(pml4, PML4, virt, length, flags | PAGING_FLAG_PRESENT, &batch);
+
+    paging_tlb_batch_flush(&batch);
+    paging_invalidate_inactive(pml4);
+
+    return result;
+}
+
+/*!
+    @brief Gets the number of huge pages that were created and split so far.
+
+    PTs of the higher half are replaced by a 2 MB page as soon as their 512 pages map contiguous, 2 MB aligned memory with the same flags,
+    2 MB and 1 GB pages are split when a part of them is unmapped or changes its flags.
+
+    @param stats Pointer to the struct the statistics should be copied to.
+*/
+void paging_get_huge_page_stats(struct paging_huge_page_stats_t *stats)
+{
+    *stats = paging_huge_page_stats;
+}
+
+/*!
+    @brief Adds a piece of a range to the extents, merging it with the last extent if it continues it.
+
+    @param virt Virtual address of the piece.
+    @param phys Physical address of the piece.
+    @param length Length of the piece.
+    @param extents Array of extents.
+    @param max_extents Size of the array.
+    @param count Number of extents in the array.
+
+    @returns false if the piece would need a new extent, but the array is full.
+*/
+static bool paging_add_extent(uintptr_t virt, uintptr_t phys, size_t length, struct paging_extent_t *extents, size_t max_extents, size_t *count)
+{
+    if (*count > 0)
+    {
+        struct paging_extent_t *last = &extents[*count - 1];
+        if (last->virt + last->length == virt && last->phys + last->length == phys)
+        {
+            last->length = last->length + length;
+            return true;
+        }
+    }
+
+    if (*count == max_extents)
+    {
+        return false;
+    }
+
+    extents[*count] = (struct paging_extent_t){.virt = virt, .phys = phys, .length = length};
+    *count = *count + 1;
+
+    return true;
+}
+
+/*!
+    @brief Resolves the part of a range that lies inside of a single table into extents.
+
+    Works like paging_map_range_in_table(), every leaf adds the part of the range it maps with paging_add_extent().
+
+    @param table Table containing the range.
+    @param level Level of the table.
+    @param virt Virtual address of the range.
+    @param length Length of the range. Must not reach past the end of the table.
+    @param extents Array of extents.
+    @param max_extents Size of the array.
+    @param count Number of extents in the array.
+
+    @returns false if the array is full and the walk has to stop.
+*/
+static bool paging_resolve_range_in_table(union page_table_entry_t *table, page_table_level_t level, uintptr_t virt, size_t length, struct paging_extent_t *extents, size_t max_extents, size_t *count)
+{
+    uint64_t entry_size = paging_get_entry_size(level);
+    uint64_t idx = (virt >> (39 - 9 * level)) & 0x1ff;
+
+    while (length > 0)
+    {
+        size_t chunk = entry_size - (virt & (entry_size - 1));
+        if (chunk > length)
+        {
+            chunk = length;
+        }
+
+        if (table[idx].pml4.pointer_fields.present == 0)
+        {
+            // Not mapped, the next piece can't be merged with the last extent as virt doesn't continue it.
+        }
+        else if (level == PT || (level != PML4 && table[idx].pdpr.pointer_fields.page_size != 0))
+        {
+            uintptr_t phys = paging_get_leaf_address(table[idx], level) + (virt & (entry_size - 1));
+            if (!paging_add_extent(virt, phys, chunk, extents, max_extents, count))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            union page_table_entry_t *next_table = (union page_table_entry_t *) (((uintptr_t)table[idx].pml4.pointer_fields.base_address << 12) + g_hhdm_offset);
+            if (!paging_resolve_range_in_table(next_table, level + 1, virt, chunk, extents, max_extents, count))
+            {
+                return false;
+            }
+        }
+
+        virt = virt + chunk;
+        length = length - chunk;
+        idx = idx + 1;
+    }
+
+    return true;
+}
+
+/*!
+    @brief Resolves a whole virtual range into physically contiguous extents.
+
+    Walks the page table hierarchy once for the whole range, like paging_map_range(), instead of once per page.
+    Neighbouring pages that are contiguous in virtual and physical memory are merged into one extent,
+    parts of the range that aren't mapped end the current extent and are left out.
+
+    @param pml4 Page table containing the range.
+    @param virt Virtual address of the range. Must be 4 kB aligned.
+    @param length Length of the range in byte. Must be a multiple of 4 kB.
+    @param extents Array the extents are stored in, sorted by address.
+    @param max_extents Size of the array. If the range has more extents, only the first max_extents are stored.
+
+    @returns Number of extents stored, 0 if the arguments are not aligned or nothing in the range is mapped.
+*/
+size_t paging_resolve_range(union page_table_entry_t *pml4, uintptr_t virt, size_t length, struct paging_extent_t *extents, size_t max_extents)
+{
+    if (((virt | length) & (PAGE_SIZE_BYTE - 1)) != 0)
+    {
+        LOG_ERROR("Range is not page aligned: virt=%p, length=%x", virt, length);
+        return 0;
+    }
+
+    size_t count = 0;
+    paging_resolve_range_in_table(pml4, PML4, virt, length, extents, max_extents, &count);
+
+    return count;
+}
+
+/*!
+    @brief Gets the statistics of the translation cache of paging_resolve_virtual_address().
+
+    @param stats Pointer to the struct the statistics should be copied to.
+*/
+void paging_get_translation_cache_stats(struct paging_translation_cache_stats_t *stats)
+{
+    *stats = paging_translation_cache_stats;
+}
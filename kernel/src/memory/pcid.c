@@ -0,0 +1,249 @@
+#include "memory/pcid.h"
+
+#include "cpu/cpu.h"
+#include "cpu/registers.h"
+#include "logging.h"
+
+/*!
+    @brief A PCID of a CPU and the address space it belongs to.
+*/
+struct pcid_slot_t {
+    /// @brief Physical address of the PML4 of the address space, 0 if the PCID is free.
+    uintptr_t pml4_phys;
+    /// @brief Value of the CPUs clock when the address space was last switched to.
+    uint64_t last_used;
+    /// @brief Set if the TLB entries of the PCID have to be flushed before it is used again.
+    bool stale;
+};
+
+/*!
+    @brief PCIDs of a single CPU.
+*/
+struct pcid_cpu_t {
+    struct pcid_slot_t slots[PCID_NUM_SLOTS];
+    /// @brief Incremented on every switch, used to find the least recently used slot.
+    uint64_t clock;
+    struct pcid_stats_t stats;
+} __attribute__((aligned(CPU_CACHE_LINE_SIZE)));
+
+static bool pcid_enabled = false;
+
+static struct pcid_cpu_t pcid_cpus[CPU_MAX_CPUS];
+
+/*!
+    @brief Enables PCIDs if the CPU supports them.
+
+    Must be called while CR3 holds PCID 0, i.e. before the first call to pcid_switch().
+    Without support, pcid_switch() simply writes CR3.
+
+    @returns true if PCIDs are enabled.
+*/
+bool pcid_init()
+{
+    if (!cpu_has_pcid())
+    {
+        LOG_INFO("CPU doesn't support PCIDs.");
+        return false;
+    }
+
+    set_cr4(read_cr4() | PCID_CR4_PCIDE);
+    pcid_enabled = true;
+
+    LOG_INFO("PCIDs enabled, %u per CPU.", PCID_NUM_SLOTS);
+
+    return true;
+}
+
+/*!
+    @brief Checks if PCIDs are enabled.
+
+    @returns true if pcid_init() enabled PCIDs.
+*/
+bool pcid_is_enabled()
+{
+    return pcid_enabled;
+}
+
+/*!
+    @brief Switches to another address space.
+
+    If the address space still has a PCID on this CPU, CR3 is written with PCID_CR3_NO_FLUSH, so its TLB entries are kept.
+    Otherwise it gets a free PCID or the least recently used one, whose old entries are flushed.
+
+    @param pml4_phys Physical address of the PML4 of the address space.
+*/
+void pcid_switch(uintptr_t pml4_phys)
+{
+    if (!pcid_enabled)
+    {
+        set_cr3(pml4_phys);
+        return;
+    }
+
+    uint64_t rflags = cpu_disable_interrupts();
+
+    struct pcid_cpu_t *cpu = &pcid_cpus[cpu_get_id()];
+    cpu->clock = cpu->clock + 1;
+    cpu->stats.switches = cpu->stats.switches + 1;
+
+    // Look for the address space, remembering a free or the least recently used slot on the way.
+    size_t slot = PCID_NUM_SLOTS;
+    size_t victim = 0;
+    for (size_t i = 0; i < PCID_NUM_SLOTS; i++)
+    {
+        if (cpu->slots[i].pml4_phys == pml4_phys)
+        {
+            slot = i;
+            break;
+        }
+
+        if (cpu->slots[victim].pml4_phys != 0 && (cpu->slots[i].pml4_phys == 0 || cpu->slots[i].last_used < cpu->slots[victim].last_used))
+        {
+            victim = i;
+        }
+    }
+
+    uint64_t cr3 = pml4_phys;
+
+    if (slot == PCID_NUM_SLOTS)
+    {
+        slot = victim;
+        if (cpu->slots[slot].pml4_phys != 0)
+        {
+            cpu->stats.recycles = cpu->stats.recycles + 1;
+        }
+        cpu->slots[slot].pml4_phys = pml4_phys;
+        cpu->slots[slot].stale = true;
+    }
+
+    if (cpu->slots[slot].stale)
+    {
+        // Without PCID_CR3_NO_FLUSH, writing CR3 flushes the entries of the previous owner of the PCID.
+        cpu->stats.misses = cpu->stats.misses + 1;
+        cpu->slots[slot].stale = false;
+    }
+    else
+    {
+        cpu->stats.hits = cpu->stats.hits + 1;
+        cr3 = cr3 | PCID_CR3_NO_FLUSH;
+    }
+
+    cpu->slots[slot].last_used = cpu->clock;
+
+    // PCIDs start at 1, PCID 0 was used before pcid_init().
+    set_cr3(cr3 | (slot + 1));
+
+    cpu_restore_interrupts(rflags);
+}
+
+/*!
+    @brief Marks the TLB entries of an address space as stale.
+
+    The next switch to the address space flushes its PCID. Used when mappings of an address space change while it isn't active.
+
+    @param pml4_phys Physical address of the PML4 of the address space.
+*/
+void pcid_invalidate(uintptr_t pml4_phys)
+{
+    if (!pcid_enabled)
+    {
+        return;
+    }
+
+    uint64_t rflags = cpu_disable_interrupts();
+
+    for (size_t cpu = 0; cpu < CPU_MAX_CPUS; cpu++)
+    {
+        for (size_t i = 0; i < PCID_NUM_SLOTS; i++)
+        {
+            if (pcid_cpus[cpu].slots[i].pml4_phys == pml4_phys)
+            {
+                pcid_cpus[cpu].slots[i].stale = true;
+            }
+        }
+    }
+
+    cpu_restore_interrupts(rflags);
+}
+
+/*!
+    @brief Marks the TLB entries of all address spaces but the active one as stale.
+
+    Used when a non-global mapping of the shared higher half was removed, which all address spaces might have cached.
+    The active address space has to invalidate the mapping itself, e.g. with invlpg.
+*/
+void pcid_invalidate_others()
+{
+    if (!pcid_enabled)
+    {
+        return;
+    }
+
+    uint64_t rflags = cpu_disable_interrupts();
+
+    // PCIDs start at 1, so the current slot is one below the PCID in CR3.
+    size_t current = (read_cr3() & 0xfff) - 1;
+
+    for (size_t cpu = 0; cpu < CPU_MAX_CPUS; cpu++)
+    {
+        for (size_t i = 0; i < PCID_NUM_SLOTS; i++)
+        {
+            if (cpu != cpu_get_id() || i != current)
+            {
+                pcid_cpus[cpu].slots[i].stale = true;
+            }
+        }
+    }
+
+    cpu_restore_interrupts(rflags);
+}
+
+/*!
+    @brief Takes the PCIDs of an address space away, e.g. before its PML4 is freed.
+
+    @param pml4_phys Physical address of the PML4 of the address space. Must not be active.
+*/
+void pcid_release(uintptr_t pml4_phys)
+{
+    if (!pcid_enabled)
+    {
+        return;
+    }
+
+    uint64_t rflags = cpu_disable_interrupts();
+
+    for (size_t cpu = 0; cpu < CPU_MAX_CPUS; cpu++)
+    {
+        for (size_t i = 0; i < PCID_NUM_SLOTS; i++)
+        {
+            if (pcid_cpus[cpu].slots[i].pml4_phys == pml4_phys)
+            {
+                // The PCID keeps its TLB entries, so the next owner has to flush them.
+                pcid_cpus[cpu].slots[i].pml4_phys = 0;
+                pcid_cpus[cpu].slots[i].last_used = 0;
+            }
+        }
+    }
+
+    cpu_restore_interrupts(rflags);
+}
+
+/*!
+    @brief Gets the address space switch statistics of a CPU.
+
+    @param cpu Number of the CPU.
+    @param stats Pointer to the struct the statistics should be copied to.
+*/
+void pcid_get_stats(uint32_t cpu, struct pcid_stats_t *stats)
+{
+    if (cpu >= CPU_MAX_CPUS)
+    {
+        return;
+    }
+
+    uint64_t rflags = cpu_disable_interrupts();
+
+    *stats = pcid_cpus[cpu].stats;
+
+    cpu_restore_interrupts(rflags);
+}
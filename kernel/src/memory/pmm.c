@@ -3,11 +3,21 @@
 #include "stdio.h"
 #include "string.h"
 
+#include "cpu/cpu.h"
 #include "logging.h"
+#include "memory/pmm_backend.h"
 #include "memory/pmm_region.h"
 
 #define PAGE_SIZE_BYTE 4096
 
+/// @brief Rounds x up to the next multiple of align. align must be a power of two.
+#define PMM_ALIGN_UP(x, align) (((x) + (align) - 1) & ~((align) - 1))
+
+/// @brief Each section of the section table covers 2^27 B = 128 MiB of physical memory.
+#define PMM_SECTION_SHIFT 27
+/// @brief Marks sections without any region.
+#define PMM_SECTION_NONE UINT16_MAX
+
 static size_t pmm_memory_size_pages = 0;
 static size_t pmm_num_regions = 0;
 
@@ -15,6 +25,41 @@ static ptrdiff_t phys_to_virt_offset = 0;
 
 static struct pmm_region_t *pmm_regions;
 
+/*!
+    Section table for constant time address-to-region lookups.
+    Physical memory is split into sections of 2^PMM_SECTION_SHIFT bytes.
+    Each entry holds the index of the first region overlapping the section, or PMM_SECTION_NONE if there is none.
+*/
+static uint16_t *pmm_sections;
+static size_t pmm_num_sections = 0;
+
+/*!
+    @brief Per-CPU cache of free pages.
+
+    A stack of pages that are marked as used in the regions, but are free to be handed out by the CPU owning the magazine.
+    It is refilled / drained in batches of PMM_MAGAZINE_BATCH pages, so most allocations and frees don't touch the regions at all.
+*/
+struct pmm_magazine_t {
+    void *pages[PMM_MAGAZINE_SIZE];
+    size_t count;
+    struct pmm_magazine_stats_t stats;
+    /// @brief NUMA node of the CPU owning the magazine. Memory of this node is preferred when refilling.
+    uint32_t node;
+};
+
+static struct pmm_magazine_t pmm_magazines[CPU_MAX_CPUS];
+
+// Index of the region where the last page was allocated.
+static size_t pmm_region_cache = 0;
+
+// NUMA node of each memory range, as set by pmm_set_node_ranges(). Used to split regions at node boundaries.
+static struct pmm_node_range_t pmm_node_ranges[PMM_MAX_NODE_RANGES];
+static size_t pmm_num_node_ranges = 0;
+
+// Pages that are already cleared, handed out by pmm_alloc_zeroed(). Refilled by pmm_zero_pool_refill_page() while the CPU is idle.
+static void *pmm_zero_pool[PMM_ZERO_POOL_SIZE];
+static size_t pmm_zero_pool_count = 0;
+
 /*!
     @brief Convert physical to virtual addresses by adding the offset.
 
@@ -27,47 +72,224 @@ static inline uintptr_t phys_to_virt(uintptr_t phys, ptrdiff_t offset)
     return phys + offset;
 }
 
+/*!
+    @brief Checks if the PMM keeps track of memory of a type.
+
+    Only memory that is usable or can become usable by reclaiming it gets a region.
+    Reserved memory, the framebuffer, the kernel and so on can never be allocated, so there is no need to track it.
+
+    @param type Type of the memory.
+    @returns true if the memory gets a region, false if not.
+*/
+static inline bool pmm_is_tracked_type(uint64_t type)
+{
+    return type == MEMMAP_TYPE_USABLE || type == MEMMAP_TYPE_BOOTLOADER_RECLAIMABLE || type == MEMMAP_TYPE_ACPI_RECLAIMABLE;
+}
+
+/*!
+    @brief State of an iteration over the ranges that get a region (see pmm_get_next_range()).
+*/
+struct pmm_range_cursor_t {
+    /// @brief Index of the next memory map entry to look at.
+    size_t entry;
+    /// @brief Rest of the last range that was split at a node boundary, split_base == split_end if there is none.
+    uintptr_t split_base;
+    uintptr_t split_end;
+    uint64_t split_type;
+};
+
+/*!
+    @brief Finds the NUMA node of a range and where it has to be split.
+
+    The range is cut at the first node boundary inside of it, so every region belongs to exactly one node.
+    Memory that isn't covered by any node range belongs to node 0.
+
+    @param base Base address of the range.
+    @param length Length of the range. Is shortened if the range has to be split.
+    @returns NUMA node of the (shortened) range.
+*/
+static uint32_t pmm_split_range_at_node(uintptr_t base, size_t *length)
+{
+    uint32_t node = 0;
+    uintptr_t end = base + *length;
+
+    for (size_t i = 0; i < pmm_num_node_ranges; i++)
+    {
+        uintptr_t node_base = pmm_node_ranges[i].base;
+        uintptr_t node_end = pmm_node_ranges[i].base + pmm_node_ranges[i].length;
+
+        if (base >= node_base && base < node_end)
+        {
+            // The range starts inside of this node, so it has to end where the node ends.
+            node = pmm_node_ranges[i].node;
+            if (node_end < end)
+            {
+                end = node_end;
+            }
+        }
+        else if (node_base > base && node_base < end)
+        {
+            // Another node starts inside of the range.
+            end = node_base;
+        }
+    }
+
+    // Regions must consist of whole pages.
+    end = PMM_ALIGN_UP(end, PAGE_SIZE_BYTE);
+    if (end < base + *length)
+    {
+        *length = end - base;
+    }
+
+    return node;
+}
+
+/*!
+    @brief Gets the next range of memory from the memory map that gets a region.
+
+    Skips memory map entries of types the PMM doesn't keep track of (see pmm_is_tracked_type())
+    and merges directly adjacent entries of the same type into a single range.
+    Ranges spanning more than one NUMA node are split at the node boundaries.
+
+    @param memmap Pointer to Limines memory map.
+    @param cursor Pointer to the state of the iteration. Must be zeroed for the first call.
+    @param base Pointer to the variable where the ranges base address should be stored.
+    @param length Pointer to the variable where the ranges length should be stored.
+    @param type Pointer to the variable where the ranges type should be stored.
+    @param node Pointer to the variable where the ranges NUMA node should be stored.
+    @returns true if a range was found, false if the end of the memory map was reached.
+*/
+static bool pmm_get_next_range(struct limine_memmap_response *memmap, struct pmm_range_cursor_t *cursor, uintptr_t *base, size_t *length, uint64_t *type, uint32_t *node)
+{
+    if (cursor->split_base < cursor->split_end)
+    {
+        // Continue with the rest of a range that was split.
+        *base = cursor->split_base;
+        *length = cursor->split_end - cursor->split_base;
+        *type = cursor->split_type;
+    }
+    else
+    {
+        while (cursor->entry < memmap->entry_count && !pmm_is_tracked_type(memmap->entries[cursor->entry]->type))
+        {
+            cursor->entry = cursor->entry + 1;
+        }
+
+        if (cursor->entry >= memmap->entry_count)
+        {
+            return false;
+        }
+
+        *base = memmap->entries[cursor->entry]->base;
+        *length = memmap->entries[cursor->entry]->length;
+        *type = memmap->entries[cursor->entry]->type;
+        cursor->entry = cursor->entry + 1;
+
+        // Merge the following entries as long as they continue the range with the same type.
+        while (cursor->entry < memmap->entry_count && memmap->entries[cursor->entry]->type == *type && memmap->entries[cursor->entry]->base == *base + *length)
+        {
+            *length = *length + memmap->entries[cursor->entry]->length;
+            cursor->entry = cursor->entry + 1;
+        }
+    }
+
+    uintptr_t end = *base + *length;
+    *node = pmm_split_range_at_node(*base, length);
+
+    // Remember the rest of the range if it was split.
+    cursor->split_base = *base + *length;
+    cursor->split_end = end;
+    cursor->split_type = *type;
+
+    return true;
+}
+
 /*!
     @brief Gets info about available memory and memory regions from the memory map.
 
-    Iterates over the memory map and calculates how many pages there are.
-    Saves the result to pmm_memory_size_pages and the number of memory regions to pmm_num_regions.
+    Iterates over the memory map and calculates how many pages there are, how many regions are needed
+    and how many sections the section table needs to cover all regions.
+    Saves the result to pmm_memory_size_pages, the number of memory regions to pmm_num_regions and the number of sections to pmm_num_sections.
 
     @param memmap Pointer to Limines memory map.
     @param num_regions Pointer to the variable where the number of regions should be stored.
     @param num_pages Pointer to the variable where the number of pages should be stored.
+    @param num_sections Pointer to the variable where the number of sections should be stored.
 */
-static void pmm_detect_memory(struct limine_memmap_response *memmap, size_t *num_regions, size_t *num_pages)
+static void pmm_detect_memory(struct limine_memmap_response *memmap, size_t *num_regions, size_t *num_pages, size_t *num_sections)
 {
     size_t memory_size_byte = 0;
 
     // Sum up the length of all entries of the memory map.
-    *num_regions = memmap->entry_count;
-    for (size_t i = 0; i < *num_regions; i++)
+    for (size_t i = 0; i < memmap->entry_count; i++)
     {
         memory_size_byte = memory_size_byte + memmap->entries[i]->length;
     }
 
     *num_pages = memory_size_byte / PAGE_SIZE_BYTE;
 
-    LOG_DEBUG("Detected %u kiB ^= %u pages of memory.", memory_size_byte / 1024, *num_pages);
+    // Count the ranges that get a region and find the end of the last one.
+    *num_regions = 0;
+    uintptr_t memory_end = 0;
+
+    struct pmm_range_cursor_t cursor = {0};
+    uintptr_t base;
+    size_t length;
+    uint64_t type;
+    uint32_t node;
+    while (pmm_get_next_range(memmap, &cursor, &base, &length, &type, &node))
+    {
+        *num_regions = *num_regions + 1;
+        memory_end = base + length;
+    }
+
+    *num_sections = (memory_end + ((uintptr_t)1 << PMM_SECTION_SHIFT) - 1) >> PMM_SECTION_SHIFT;
+
+    LOG_DEBUG("Detected %u kiB ^= %u pages of memory in %u regions.", memory_size_byte / 1024, *num_pages, *num_regions);
+}
+
+/*!
+    @brief Calculates how many bytes the page structs of a region need.
+
+    @param region_length The regions length in byte.
+    @returns Number of bytes needed, a multiple of 8.
+*/
+static inline size_t pmm_get_page_array_size(ptrdiff_t region_length)
+{
+    return PMM_ALIGN_UP((region_length / PAGE_SIZE_BYTE) * sizeof(struct page_t), sizeof(uint64_t));
 }
 
 /*!
     @brief Calculates how many pages are required to store the PMMs data.
 
+    Adds up the size of the region structs, the section table and the metadata (bitmap, summary levels, backend data and page structs) of every region.
+
+    @param memmap Pointer to Limines memory map.
     @param regions How many memory regions exist.
-    @param pages How many pages exist.
+    @param sections How many entries the section table has.
     @returns Number of pages required to store the PMMs data.
 */
-static size_t pmm_get_num_required_pages(size_t regions, size_t pages)
+static size_t pmm_get_num_required_pages(struct limine_memmap_response *memmap, size_t regions, size_t sections)
 {
     size_t required_pages = 0;
 
-    // Space required for the pmm_region_t structs.
-    size_t required_bytes = regions * sizeof(struct pmm_region_t);
-    // Space required for the bitmaps.
-    required_bytes = required_bytes + ((pages + 7) / 8);
+    // Space required for the pmm_region_t structs and the section table.
+    // Both are rounded up, so that the bitmaps behind them are aligned to their word size.
+    size_t required_bytes = PMM_ALIGN_UP(regions * sizeof(struct pmm_region_t), sizeof(uint64_t));
+    required_bytes = required_bytes + PMM_ALIGN_UP(sections * sizeof(uint16_t), sizeof(uint64_t));
+
+    // Space required for the bitmaps and their summary levels.
+    struct pmm_range_cursor_t cursor = {0};
+    uintptr_t base;
+    size_t length;
+    uint64_t type;
+    uint32_t node;
+    while (pmm_get_next_range(memmap, &cursor, &base, &length, &type, &node))
+    {
+        required_bytes = required_bytes + pmm_region_get_metadata_size(length);
+        required_bytes = required_bytes + pmm_backend_get_metadata_size(length);
+        required_bytes = required_bytes + pmm_get_page_array_size(length);
+    }
 
     required_pages = (required_bytes + PAGE_SIZE_BYTE - 1) / PAGE_SIZE_BYTE;
 
@@ -100,21 +322,129 @@ static size_t pmm_get_num_required_pages(size_t regions, size_t pages)
     }
 }
 
+/*!
+    @brief Searches a region containing a page.
+
+    Looks up the first region overlapping the pages section in the section table.
+    Sections are large and regions are sorted, so at most a few regions following it have to be checked.
+    If it is found, its index in the region array is written into the value pointed to by region_index.
+    Returns an error code if no region containing the pages address was found.
+
+    @param region_index Pointer to the variable where the regions index should be stored.
+    @param ptr Pointer (physical address) off the page.
+    @returns PMM_OK if a matching region was found, PMM_ERROR_ADDRESS_NOT_FOUND if not.
+*/
+static pmm_error_codes_t get_region_containing_page(size_t *region_index, void *ptr)
+{
+    size_t section = (uintptr_t)ptr >> PMM_SECTION_SHIFT;
+
+    if (section >= pmm_num_sections || pmm_sections[section] == PMM_SECTION_NONE)
+    {
+        return PMM_ERROR_ADDRESS_NOT_FOUND;
+    }
+
+    for (size_t i = pmm_sections[section]; i < pmm_num_regions && pmm_regions[i].base <= (uintptr_t)ptr; i++)
+    {
+        if ((uintptr_t)ptr - pmm_regions[i].base < (uintptr_t)pmm_regions[i].length)
+        {
+            *region_index = i;
+            return PMM_OK;
+        }
+    }
+
+    // No region including the physical address pointed to by ptr was found.
+    return PMM_ERROR_ADDRESS_NOT_FOUND;
+}
+
+/*!
+    @brief Gets the struct of a page inside a known region.
+
+    @param region_index Index of the region containing the page.
+    @param phys Physical address of the page.
+    @returns Pointer to the pages struct.
+*/
+static inline struct page_t * pmm_get_page(size_t region_index, uintptr_t phys)
+{
+    return &pmm_regions[region_index].pages[(phys - pmm_regions[region_index].base) / PAGE_SIZE_BYTE];
+}
+
+/*!
+    @brief Updates the page structs of freshly allocated pages.
+
+    Sets their refcount to 1 and their owner to owner.
+    If more than one page was allocated, the first one is marked as the head of the allocation.
+
+    @param ptr Pointer (physical address) to the first page.
+    @param count Number of contiguous pages.
+    @param owner New owner of the pages.
+*/
+static void pmm_pages_mark_allocated(void *ptr, size_t count, page_owner_t owner)
+{
+    size_t region_index;
+    if (get_region_containing_page(&region_index, ptr) != PMM_OK)
+    {
+        return;
+    }
+
+    struct page_t *page = pmm_get_page(region_index, (uintptr_t)ptr);
+    for (size_t i = 0; i < count; i++)
+    {
+        page[i].flags = 0;
+        page[i].refcount = 1;
+        page[i].order = 0;
+        page[i].owner = owner;
+        page[i].private = 0;
+    }
+
+    if (count > 1)
+    {
+        uint8_t order = 0;
+        while (((size_t)1 << order) < count)
+        {
+            order = order + 1;
+        }
+
+        page[0].flags = PAGE_FLAG_HEAD;
+        page[0].order = order;
+    }
+}
+
+/*!
+    @brief Resets the page structs of pages that are freed.
+
+    @param region_index Index of the region containing the pages.
+    @param phys Physical address of the first page.
+    @param count Number of contiguous pages.
+*/
+static void pmm_pages_mark_free(size_t region_index, uintptr_t phys, size_t count)
+{
+    struct page_t *page = pmm_get_page(region_index, phys);
+    for (size_t i = 0; i < count; i++)
+    {
+        page[i].flags = 0;
+        page[i].refcount = 0;
+        page[i].order = 0;
+        page[i].owner = PAGE_OWNER_NONE;
+        page[i].private = 0;
+    }
+}
+
 /*!
     @brief Initializes region structs for the physical memory manager (PMM).
 
     Converts the physical base address to a virtual address and sets up an array of pmm_region_t structs,
-    each representing a memory region from Limines memory map.
-    For each region, a bitmap is initialized to track page usage.
+    one for each range of usable or reclaimable memory (see pmm_get_next_range()).
+    For each region, a bitmap and its summary levels are initialized to track page usage.
+    Then the section table is filled, the pages used by the PMM are marked as used
+    and the allocation backend sets up its data for each region.
 
-    Assumes that the PMM metadata (region structs and bitmaps) is stored in usable memory.
+    Assumes that the PMM metadata (region structs, section table and bitmaps) is stored in usable memory.
     Pages used by the PMM are marked as used, to protect them of accidental overwriting.
 
     PMM metadata is stored in an array of pmm_region_t structs at the physical address stored in base. 
     It gets converted to a virtual address and is stored in the pointer pointed to by region_array_pointer.
 
     @todo Instead of marking pages as used, I could create a seperate region for PMM data.
-    @todo If there are multiple regions with a length thats not a multiple of the page size, the calculated number of required pages from pmm_get_num_required_pages() could be wrong.
 
     @param memmap Pointer to a Limine memory map.
     @param region_array_ptr Pointer to a pointer to memory region structs (pmm_region_t).
@@ -128,112 +458,103 @@ static pmm_error_codes_t pmm_init_region_structs(struct limine_memmap_response *
     // Set the base address for the region array.
     *region_array_ptr = (struct pmm_region_t *) phys_to_virt(base, offset);
 
-    // Increment base to point to the first byte behind the region array.
-    // We will use this for the first regions bitmap.
-    uintptr_t bitmap_base = base + pmm_num_regions * sizeof(struct pmm_region_t);
+    // The section table is stored directly behind the region array.
+    uintptr_t sections_base = base + PMM_ALIGN_UP(pmm_num_regions * sizeof(struct pmm_region_t), sizeof(uint64_t));
+    pmm_sections = (uint16_t *) phys_to_virt(sections_base, offset);
+
+    // Increment base to point to the first byte behind the section table.
+    // We will use this for the first regions bitmap, so it is aligned to the bitmaps word size.
+    uintptr_t metadata_base = sections_base + PMM_ALIGN_UP(pmm_num_sections * sizeof(uint16_t), sizeof(uint64_t));
+    uintptr_t bitmap_base = metadata_base;
 
     // Initialize structs for all regions.
-    for (size_t i = 0; i < pmm_num_regions; i++)
+    struct pmm_range_cursor_t cursor = {0};
+    uintptr_t region_base;
+    size_t region_length;
+    uint64_t region_type;
+    uint32_t region_node;
+    for (size_t i = 0; i < pmm_num_regions && pmm_get_next_range(memmap, &cursor, &region_base, &region_length, &region_type, &region_node); i++)
     {
-        pmm_region_init(&((*region_array_ptr)[i]), (uint8_t *)phys_to_virt(bitmap_base, offset), memmap->entries[i]->base, memmap->entries[i]->length, memmap->entries[i]->type);
+        pmm_region_init(&((*region_array_ptr)[i]), (uint64_t *)phys_to_virt(bitmap_base, offset), region_base, region_length, region_type);
+        (*region_array_ptr)[i].node = region_node;
 
-        // Increment base to point to the first byte after the current regions bitmap.
+        // Increment base to point to the first byte after the current regions bitmap, summary levels, backend data and page structs.
         // We will use this for the next bitmap.
-        bitmap_base = bitmap_base + pmm_regions[i].bitmap_size;
+        bitmap_base = bitmap_base + pmm_region_get_metadata_size(region_length);
+        bitmap_base = bitmap_base + pmm_backend_get_metadata_size(region_length);
+        bitmap_base = bitmap_base + pmm_get_page_array_size(region_length);
     }
 
-    /// @todo: Instead of marking the pages as used, I could split the region in two, so that the pages used by the PMM get their own region.
-    
-    // Mark memory used for storing these structs as used.
-    for (size_t i = 0; i < pmm_num_regions; i++)
+    // Fill the section table. Regions are sorted, so the first region seen for a section is the first one overlapping it.
+    for (size_t section = 0; section < pmm_num_sections; section++)
     {
-        // Skip the region if its not the region where the PMMs data is stored.
-        if ((*region_array_ptr)[i].base != base)
+        pmm_sections[section] = PMM_SECTION_NONE;
+    }
+    for (size_t i = pmm_num_regions; i > 0; i--)
+    {
+        struct pmm_region_t *region = &((*region_array_ptr)[i - 1]);
+
+        size_t first_section = region->base >> PMM_SECTION_SHIFT;
+        size_t last_section = (region->base + region->length - 1) >> PMM_SECTION_SHIFT;
+        for (size_t section = first_section; section <= last_section; section++)
         {
-            continue;
+            pmm_sections[section] = i - 1;
         }
-        
-        // Mark the regions first pages as used.
-        /// @todo If there are multiple regions with a length thats not a multiple of the page size, the calculated number of required pages from pmm_get_num_required_pages() could be wrong.
-        for (size_t page = 0; page < required_pages; page++)
-        {
-            // Calculate the pages physical address.
-            // regions needs to be casted to an uintptr_t, so that the addition does not increment by regions size, but uses bytes instead.
-            uintptr_t page_address = ((uintptr_t)(*region_array_ptr) - offset + page * PAGE_SIZE_BYTE);
-            
-            if (pmm_region_mark_page_used(&((*region_array_ptr)[i]), page_address) != PMM_REGION_OK)
-            {
-                LOG_ERROR("Failed to mark a page used by the PMM as used!\n");
-                return PMM_ERROR_INIT_FAILED;
-            }
-        }        
-
-        break;
     }
-    
-    return PMM_OK;
-}
-
-/*!
-    @brief Searches a region containing a page.
-
-    Uses binary search to find the region containing the pages address.
-    If it is found, its index in the region array is written into the value pointed to by region_index.
-    Returns an error code if no region containing the pages address was found.
 
-    @param region_index Pointer to the variable where the regions index should be stored.
-    @param ptr Pointer (physical address) off the page.
-    @returns PMM_OK if a matching region was found, PMM_ERROR_ADDRESS_NOT_FOUND if not.
-*/
-static pmm_error_codes_t get_region_containing_page(size_t *region_index, void *ptr)
-{
-    size_t lower_bound = 0;
-    size_t upper_bound = pmm_num_regions - 1;
+    /// @todo: Instead of marking the pages as used, I could split the region in two, so that the pages used by the PMM get their own region.
+    
+    // Mark memory used for storing these structs as used.
+    size_t region_index;
+    if (get_region_containing_page(&region_index, (void *)base) != PMM_OK
+        || pmm_region_mark_range_used(&((*region_array_ptr)[region_index]), base, required_pages) != PMM_REGION_OK)
+    {
+        LOG_ERROR("Failed to mark the pages used by the PMM as used!\n");
+        return PMM_ERROR_INIT_FAILED;
+    }
 
-    /*
-        Search for up to pmm_num_regions tries. 
-        If all tries failed we can be sure that no region containing 
-        the address exists and the search got stuck in an endless loop,
-        as binary searchs worst case is log_2(pmm_num_regions).
-    */
+    // Now that the bitmaps are final, let the backend set up its data and set up the page structs.
+    // Both are stored behind each regions bitmap and summary levels.
+    bitmap_base = metadata_base;
     for (size_t i = 0; i < pmm_num_regions; i++)
     {
-        // Calculate the next index to look at in the middle of the searched range.
-        *region_index = lower_bound + ((upper_bound - lower_bound) / 2);
+        struct pmm_region_t *region = &((*region_array_ptr)[i]);
 
-        // The address is smaller then the regions max. address.
-        // The search windows upper bound is moved to the current index because the region can only be below there.
-        if (pmm_regions[*region_index].base > (uintptr_t)ptr)
-        {
-            upper_bound = *region_index - 1;
-            continue;
-        }
-        // The address is bigger then the regions max address.
-        // The search windows lower bound is moved to the current index because the region can only be above there.
-        else if ((uintptr_t)ptr > pmm_regions[*region_index].base + pmm_regions[*region_index].length - 1)
+        bitmap_base = bitmap_base + pmm_region_get_metadata_size(region->length);
+        pmm_backend_init_region(region, (void *)phys_to_virt(bitmap_base, offset), offset);
+        bitmap_base = bitmap_base + pmm_backend_get_metadata_size(region->length);
+
+        region->pages = (struct page_t *)phys_to_virt(bitmap_base, offset);
+        bitmap_base = bitmap_base + pmm_get_page_array_size(region->length);
+
+        // Pages of regions that are not usable yet are reserved until they are reclaimed.
+        uint16_t flags = region->type == MEMMAP_TYPE_USABLE ? 0 : PAGE_FLAG_RESERVED;
+        for (size_t page = 0; page < (size_t)region->length / PAGE_SIZE_BYTE; page++)
         {
-            lower_bound = *region_index + 1;
-            continue;
+            region->pages[page] = (struct page_t){.flags = flags, .region = i};
         }
-        else
-        {
-            // The current region includes the address, so we can return from the function.
-            // The value pointed to by region_index does now include the correct index.
-            return PMM_OK;
-        }        
+    }
+
+    // The pages storing the PMMs data belong to the PMM.
+    struct page_t *pmm_pages = &(*region_array_ptr)[region_index].pages[(base - (*region_array_ptr)[region_index].base) / PAGE_SIZE_BYTE];
+    for (size_t page = 0; page < required_pages; page++)
+    {
+        pmm_pages[page].flags = PAGE_FLAG_RESERVED;
+        pmm_pages[page].refcount = 1;
+        pmm_pages[page].owner = PAGE_OWNER_PMM;
     }
     
-    // No region including the physical address pointed to by ptr was found.
-    return PMM_ERROR_ADDRESS_NOT_FOUND;
+    return PMM_OK;
 }
 
 /*!
     @brief Checks if a page is currently free or in use.
 
-    Searches through all regions to find the region that includes the addresses page.
-    If it is found, calculates the page number corresponding page.
-    Checks its status in the bitmap and returns it.
-    If no matching region is found, a special page status is returned.
+    Looks up the region that includes the addresses page in the section table.
+    If it is found, the status is taken from the pages struct page_t: pages with a refcount of 0 are free,
+    just like the pages of the zeroed page pool, which belong to the PMM (PAGE_OWNER_PMM). Reserved pages are always used.
+    That way pages cached in a magazine or the zeroed page pool are reported as free, although their bitmap bit is still set.
+    If no matching region is found (e.g. for reserved memory, which has no region), a special page status is returned.
 
     @param ptr Pointer (physical address) off the page to check.
     @returns PMM_PAGE_FREE if the page is free, PMM_PAGE_USED if it is used and PMM_PAGE_NOT_FOUND if no region matching the address is found.
@@ -248,122 +569,753 @@ pmm_page_status_t pmm_check_page(void *ptr)
         return PMM_PAGE_NOT_FOUND;
     }
     
-    size_t page_index = ((uintptr_t)ptr - pmm_regions[region_index].base) / PAGE_SIZE_BYTE;
-    
-    return pmm_regions[region_index].bitmap[(uintptr_t)page_index / 8] & (1 << ((uintptr_t)page_index % 8));    
+    struct page_t *page = pmm_get_page(region_index, (uintptr_t)ptr);
+
+    // The PMMs own data is reserved and belongs to the PMM as well, but is never free.
+    if ((page->flags & PAGE_FLAG_RESERVED) == 0 && (page->refcount == 0 || page->owner == PAGE_OWNER_PMM))
+    {
+        return PMM_PAGE_FREE;
+    }
+
+    return PMM_PAGE_USED;
 }
 
 /*!
-    @brief Allocates a single free physical memory page.
+    @brief Allocates up to count single pages from the regions.
 
-    Searches through all memory regions managed by the PMM to find a free page.
-    The search is optimized by using static caches (region_cache, bitmap_cache)
-    to reduce iteration overhead by starting from the last successful allocated page.
+    Searches through all memory regions managed by the PMM for free pages.
+    Regions of the preferred NUMA node are searched first, the others only if they don't have enough free pages.
+    The search starts at the region where the last page was allocated (pmm_region_cache), as it is likely to have more free pages.
+    Inside a region, the pages are picked by the allocation backend in a single pass (see pmm_backend_alloc_batch()).
 
-    The function scans each regions bitmap for a free bit (representing a free page),
-    marks the page as used, and returns its physical address.
-    If no free page is found across all regions, NULL is returned.
-
-    @returns Pointer to the allocated physical page, or NULL if no free page was found.
+    @param pages Array where the physical addresses of the pages are stored.
+    @param count Number of pages wanted.
+    @param node Preferred NUMA node.
+    @returns Number of pages that were allocated, less than count if the PMM ran out of free pages.
 */
-void * pmm_alloc()
+static size_t pmm_alloc_batch_from_regions(void **pages, size_t count, uint32_t node)
 {
-    static size_t region_cache = 0;
-    static size_t bitmap_cache = 0;
+    size_t allocated = 0;
 
-    // Search a region that has free pages left.
-    for (size_t i = 0; i < pmm_num_regions; i++)
+    // The first pass only looks at regions of the preferred node, the second one at all others.
+    for (size_t i = 0; i < 2 * pmm_num_regions && allocated < count; i++)
     {
+        bool local_pass = i < pmm_num_regions;
         /*
             Start at the last region where a free page was found in hope that there are more free pages.
             This could avoid some iterations and therefore speed up the search a little.
             The modulo operation is there so that the search will wrap around if the end of the array is reached without a hit.
             This ensures everything, not just everything behind our cached region, is searched.
         */
-        size_t region_index = (i + region_cache) % pmm_num_regions;
+        size_t region_index = (i + pmm_region_cache) % pmm_num_regions;
 
-        // Skip the current region if it has no free pages.
-        if (pmm_regions[region_index].free_pages == 0)
+        // Skip the current region if it has no free pages or isn't part of the current pass.
+        if (pmm_regions[region_index].free_pages == 0 || (pmm_regions[region_index].node == node) != local_pass)
         {
             continue;
         }
-        
+
+        allocated = allocated + pmm_backend_alloc_batch(&pmm_regions[region_index], &pages[allocated], count - allocated);
+
         // A region with free pages was found, so the regions index is saved as a starting point for the next allocation.
-        region_cache = region_index;
-        
-        // Search a byte with free pages in the regions bitmap.
-        for (size_t j = 0; j < pmm_regions[region_index].bitmap_size; j++)
+        pmm_region_cache = region_index;
+    }
+
+    return allocated;
+}
+
+/*!
+    @brief Sorts an array of page addresses in ascending order.
+
+    Uses heapsort, as it needs no extra memory and has no quadratic worst case.
+
+    @param pages Array of physical page addresses.
+    @param count Number of pages in the array.
+*/
+static void pmm_sort_pages(void **pages, size_t count)
+{
+    if (count < 2)
+    {
+        return;
+    }
+
+    // Builds a max-heap first, then repeatedly moves its root behind the heap.
+    for (size_t end = count, start = count / 2; end > 1;)
+    {
+        size_t root;
+        if (start > 0)
+        {
+            start = start - 1;
+            root = start;
+        }
+        else
         {
-            /*
-                Start at the last byte where a free page was found in hope that there are more free pages.
-                This could avoid some iterations and therefore speed up the search a little.
-                The modulo operation is also there to make it wrap around at the end of the bitmap.
-            */
-            size_t bitmap_index =(j + bitmap_cache) % pmm_regions[region_index].bitmap_size;
-
-            // Skip bytes with no free pages.
-            if (pmm_regions[region_index].bitmap[bitmap_index] == UINT8_MAX)
+            end = end - 1;
+            void *tmp = pages[0];
+            pages[0] = pages[end];
+            pages[end] = tmp;
+            root = 0;
+        }
+
+        // Sift the root down until the heap property holds again.
+        while (2 * root + 1 < end)
+        {
+            size_t child = 2 * root + 1;
+            if (child + 1 < end && (uintptr_t)pages[child] < (uintptr_t)pages[child + 1])
             {
-                continue;
+                child = child + 1;
             }
-            
-            // A byte with free pages was found, so its index is saved as a starting point for the next allocation.
-            bitmap_cache = bitmap_index;
-
-            // Search through the bytes bits for a free page.
-            for (size_t k = 0; k < 8; k++)
+            if ((uintptr_t)pages[root] >= (uintptr_t)pages[child])
             {
-                if ((pmm_regions[region_index].bitmap[bitmap_index] & (1 << k)) == PMM_REGION_BITMAP_FREE)
-                {
-                    // Calculate the pages index in the region.
-                    size_t page = (bitmap_index * 8) + k;
-
-                    // Make ptr point to the pages physical address by adding the pages offset (page size * page index) to the regions base address.
-                    void * ptr = (void *)(pmm_regions[region_index].base + page * PAGE_SIZE_BYTE);
-                    // Mark the page as used.
-                    pmm_region_mark_page_used(&pmm_regions[region_index], (uintptr_t)ptr);                    
-                    
-                    // A page was found, so all these loops can be left and the address of the page returned.
-                    return ptr;
-                }
+                break;
             }
+
+            void *tmp = pages[root];
+            pages[root] = pages[child];
+            pages[child] = tmp;
+            root = child;
         }
     }
-    
-    // Returns NULL if no free page was found, and its address if one was found.
-    return NULL;
 }
 
 /*!
-    @brief Frees a single physical memory page.
+    @brief Frees an array of single pages back to the regions.
 
-    Uses get_region_containing_page() to find the region that includes the page.
-    If it is found, the page is marked as free.
-    If none is found, an error is returned.
+    The array is sorted, so the region of a group of pages only has to be searched once
+    and neighbouring pages can be freed as a single run by the allocation backend.
+    Pages that are not inside a usable region are skipped.
+    The magazines hold pages that are already marked as free, so the check for double frees is optional.
 
-    @param ptr Pointer (physical address) to the page to free.
-    @returns PMM_OK on success, PMM_ERROR_ADDRESS_NOT_FOUND if no region that contains the pages address was found.
+    @param pages Array of physical page addresses. Gets sorted in place.
+    @param count Number of pages in the array.
+    @param check_free If set, pages with a reference count of 0 are skipped, as they are already free.
+    @returns PMM_OK on success, PMM_ERROR_ADDRESS_NOT_FOUND if at least one page could not be freed,
+             PMM_ERROR_ALREADY_FREE if at least one page was already free.
 */
-pmm_error_codes_t pmm_free(void *ptr)
+static pmm_error_codes_t pmm_free_batch_to_regions(void **pages, size_t count, bool check_free)
 {
-    size_t region_index;
-    
-    if (get_region_containing_page(&region_index, ptr) != PMM_OK)
+    pmm_error_codes_t result = PMM_OK;
+
+    pmm_sort_pages(pages, count);
+
+    size_t i = 0;
+    while (i < count)
     {
-        // No region including the physical address pointed to by ptr was found, so an error is returned. 
-        return PMM_ERROR_ADDRESS_NOT_FOUND;
-    }
-    
-    // A region including ptr was found. Mark the page corresponding to the address as free.
-    pmm_region_mark_page_free(&pmm_regions[region_index], (uintptr_t)ptr);
-    return PMM_OK;
-}
+        size_t region_index;
+        if (get_region_containing_page(&region_index, pages[i]) != PMM_OK || pmm_regions[region_index].type != MEMMAP_TYPE_USABLE)
+        {
+            result = PMM_ERROR_ADDRESS_NOT_FOUND;
+            i = i + 1;
+            continue;
+        }
 
-/*!
-    @brief Initializes the physical memory manager (PMM).
+        struct pmm_region_t *region = &pmm_regions[region_index];
+        uintptr_t region_end = region->base + region->length;
 
-    Sets up the PMM by parsing Limines memory map, detecting usable memory regions. 
-    Calculates how many pages are required to store PMM metadata (region structs, bitmaps) 
+        // All following pages below the regions end belong to the same region, as the array is sorted.
+        while (i < count && (uintptr_t)pages[i] < region_end)
+        {
+            // Runs are marked as free right after they were given back, so a page that is in the array twice is caught here as well.
+            if (check_free && pmm_get_page(region_index, (uintptr_t)pages[i])->refcount == 0)
+            {
+                LOG_ERROR("Page %p is already free.", pages[i]);
+                result = PMM_ERROR_ALREADY_FREE;
+                i = i + 1;
+                continue;
+            }
+
+            uintptr_t run_base = (uintptr_t)pages[i] & ~((uintptr_t)PAGE_SIZE_BYTE - 1);
+            size_t run_length = 1;
+            i = i + 1;
+
+            while (i < count && ((uintptr_t)pages[i] & ~((uintptr_t)PAGE_SIZE_BYTE - 1)) == run_base + run_length * PAGE_SIZE_BYTE
+                   && (!check_free || pmm_get_page(region_index, (uintptr_t)pages[i])->refcount != 0))
+            {
+                run_length = run_length + 1;
+                i = i + 1;
+            }
+
+            if (pmm_backend_free_pages(region, run_base, run_length) != PMM_REGION_OK)
+            {
+                result = PMM_ERROR_ADDRESS_NOT_FOUND;
+                continue;
+            }
+
+            pmm_pages_mark_free(region_index, run_base, run_length);
+        }
+    }
+
+    return result;
+}
+
+/*!
+    @brief Refills an empty magazine with PMM_MAGAZINE_BATCH pages from the regions.
+
+    @param magazine Pointer to the magazine.
+*/
+static void pmm_magazine_refill(struct pmm_magazine_t *magazine)
+{
+    magazine->stats.refills = magazine->stats.refills + 1;
+
+    magazine->count = pmm_alloc_batch_from_regions(magazine->pages, PMM_MAGAZINE_BATCH, magazine->node);
+}
+
+/*!
+    @brief Gives PMM_MAGAZINE_BATCH pages of a full magazine back to the regions.
+
+    The pages that were freed first are given back, as the recently freed ones are more likely to still be in the cache.
+
+    @param magazine Pointer to the magazine.
+*/
+static void pmm_magazine_drain(struct pmm_magazine_t *magazine)
+{
+    magazine->stats.drains = magazine->stats.drains + 1;
+
+    pmm_free_batch_to_regions(magazine->pages, PMM_MAGAZINE_BATCH, false);
+
+    memmove(&magazine->pages[0], &magazine->pages[PMM_MAGAZINE_BATCH], (magazine->count - PMM_MAGAZINE_BATCH) * sizeof(void *));
+    magazine->count = magazine->count - PMM_MAGAZINE_BATCH;
+}
+
+/*!
+    @brief Gives all pages of the current CPUs magazine back to the regions.
+
+    Used when a contiguous allocation failed, as the cached pages might be the ones missing for a free run.
+*/
+static void pmm_magazine_flush()
+{
+    uint64_t rflags = cpu_disable_interrupts();
+
+    struct pmm_magazine_t *magazine = &pmm_magazines[cpu_get_id()];
+
+    pmm_free_batch_to_regions(magazine->pages, magazine->count, false);
+    magazine->count = 0;
+
+    cpu_restore_interrupts(rflags);
+}
+
+/*!
+    @brief Allocates a single free physical memory page.
+
+    Takes the page from the magazine of the current CPU, so the common case only touches CPU-local data and needs no lock.
+    Only if the magazine is empty, it is refilled with PMM_MAGAZINE_BATCH pages from the regions (see pmm_alloc_batch_from_regions()).
+    Interrupts are disabled while the magazine is accessed, so allocating from interrupt handlers is safe.
+
+    If no free page is left, NULL is returned.
+
+    @returns Pointer to the allocated physical page, or NULL if no free page was found.
+*/
+void * pmm_alloc()
+{
+    uint64_t rflags = cpu_disable_interrupts();
+
+    struct pmm_magazine_t *magazine = &pmm_magazines[cpu_get_id()];
+
+    if (magazine->count == 0)
+    {
+        magazine->stats.misses = magazine->stats.misses + 1;
+        pmm_magazine_refill(magazine);
+    }
+    else
+    {
+        magazine->stats.hits = magazine->stats.hits + 1;
+    }
+
+    void *ptr = NULL;
+    if (magazine->count > 0)
+    {
+        magazine->count = magazine->count - 1;
+        ptr = magazine->pages[magazine->count];
+        pmm_pages_mark_allocated(ptr, 1, PAGE_OWNER_KERNEL);
+    }
+
+    cpu_restore_interrupts(rflags);
+
+    return ptr;
+}
+
+/*!
+    @brief Reclaims all memory regions of a type, so their pages can be allocated.
+
+    Meant for BOOTLOADER_RECLAIMABLE and ACPI_RECLAIMABLE memory once the data stored there is no longer needed,
+    e.g. Limines responses and page tables or the ACPI tables.
+    The regions become usable and their pages are freed by the allocation backend.
+    Pages inside [keep_base, keep_base + keep_length) are left as used, e.g. for the stack the kernel is still running on.
+
+    @param type Type of the regions to reclaim. Must not be MEMMAP_TYPE_USABLE.
+    @param keep_base Physical address of memory that must not be reclaimed.
+    @param keep_length Length of the memory that must not be reclaimed in byte. 0 if everything can be reclaimed.
+    @returns Number of pages that were reclaimed.
+*/
+size_t pmm_reclaim_memory(pmm_memory_types_t type, uintptr_t keep_base, size_t keep_length)
+{
+    if (type == MEMMAP_TYPE_USABLE)
+    {
+        return 0;
+    }
+
+    // Round the kept range to whole pages.
+    uintptr_t keep_start = keep_base & ~((uintptr_t)PAGE_SIZE_BYTE - 1);
+    uintptr_t keep_end = PMM_ALIGN_UP(keep_base + keep_length, PAGE_SIZE_BYTE);
+    if (keep_length == 0)
+    {
+        keep_start = 0;
+        keep_end = 0;
+    }
+
+    size_t reclaimed_pages = 0;
+
+    uint64_t rflags = cpu_disable_interrupts();
+
+    for (size_t i = 0; i < pmm_num_regions; i++)
+    {
+        struct pmm_region_t *region = &pmm_regions[i];
+
+        if (region->type != type)
+        {
+            continue;
+        }
+
+        uintptr_t start = region->base;
+        uintptr_t end = region->base + (region->length / PAGE_SIZE_BYTE) * PAGE_SIZE_BYTE;
+
+        // The region becomes usable first, so the backend accepts its pages.
+        region->type = MEMMAP_TYPE_USABLE;
+
+        // Free the parts of the region in front of and behind the kept range.
+        uintptr_t front_end = end;
+        uintptr_t back_start = end;
+        if (keep_start < end && keep_end > start)
+        {
+            front_end = keep_start > start ? keep_start : start;
+            back_start = keep_end;
+        }
+
+        if (front_end > start)
+        {
+            pmm_backend_free_pages(region, start, (front_end - start) / PAGE_SIZE_BYTE);
+            pmm_pages_mark_free(i, start, (front_end - start) / PAGE_SIZE_BYTE);
+            reclaimed_pages = reclaimed_pages + (front_end - start) / PAGE_SIZE_BYTE;
+        }
+        if (back_start < end)
+        {
+            pmm_backend_free_pages(region, back_start, (end - back_start) / PAGE_SIZE_BYTE);
+            pmm_pages_mark_free(i, back_start, (end - back_start) / PAGE_SIZE_BYTE);
+            reclaimed_pages = reclaimed_pages + (end - back_start) / PAGE_SIZE_BYTE;
+        }
+    }
+
+    cpu_restore_interrupts(rflags);
+
+    LOG_INFO("Reclaimed %u pages of memory type %u.", reclaimed_pages, type);
+
+    return reclaimed_pages;
+}
+
+/*!
+    @brief Gets the number of free pages.
+
+    Sums up the free pages of all regions and the pages cached in the magazines and the zeroed page pool.
+
+    @returns Number of free pages.
+*/
+size_t pmm_get_free_pages()
+{
+    size_t free_pages = 0;
+
+    for (size_t i = 0; i < pmm_num_regions; i++)
+    {
+        free_pages = free_pages + pmm_regions[i].free_pages;
+    }
+
+    for (size_t cpu = 0; cpu < CPU_MAX_CPUS; cpu++)
+    {
+        free_pages = free_pages + pmm_magazines[cpu].count;
+    }
+
+    free_pages = free_pages + pmm_zero_pool_count;
+
+    return free_pages;
+}
+
+/*!
+    @brief Gets the statistics of a CPUs page magazine.
+
+    @param cpu Number of the CPU.
+    @param stats Pointer to the struct the statistics should be copied to.
+    @returns PMM_OK on success, PMM_ERROR_INVALID_CPU if there is no magazine for the CPU.
+*/
+pmm_error_codes_t pmm_get_magazine_stats(uint32_t cpu, struct pmm_magazine_stats_t *stats)
+{
+    if (cpu >= CPU_MAX_CPUS)
+    {
+        return PMM_ERROR_INVALID_CPU;
+    }
+
+    *stats = pmm_magazines[cpu].stats;
+
+    return PMM_OK;
+}
+
+/*!
+    @brief Frees a single physical memory page.
+
+    Uses get_region_containing_page() to check that the page belongs to a usable region.
+    If it does, the page is put into the magazine of the current CPU, so it can be handed out again without touching the regions.
+    If the magazine is full, PMM_MAGAZINE_BATCH pages are given back to the regions first.
+    If no usable region contains the page, an error is returned.
+    Pages that are already free (refcount 0 in their struct page_t) are rejected, so a double free can't put a page into a magazine twice.
+
+    @param ptr Pointer (physical address) to the page to free.
+    @returns PMM_OK on success, PMM_ERROR_ADDRESS_NOT_FOUND if no usable region that contains the pages address was found,
+             PMM_ERROR_ALREADY_FREE if the page is already free.
+*/
+pmm_error_codes_t pmm_free(void *ptr)
+{
+    size_t region_index;
+    
+    if (get_region_containing_page(&region_index, ptr) != PMM_OK || pmm_regions[region_index].type != MEMMAP_TYPE_USABLE)
+    {
+        // No usable region including the physical address pointed to by ptr was found, so an error is returned. 
+        return PMM_ERROR_ADDRESS_NOT_FOUND;
+    }
+
+    uint64_t rflags = cpu_disable_interrupts();
+
+    if (pmm_get_page(region_index, (uintptr_t)ptr)->refcount == 0)
+    {
+        cpu_restore_interrupts(rflags);
+        LOG_ERROR("Page %p is already free.", ptr);
+        return PMM_ERROR_ALREADY_FREE;
+    }
+
+    pmm_pages_mark_free(region_index, (uintptr_t)ptr, 1);
+
+    struct pmm_magazine_t *magazine = &pmm_magazines[cpu_get_id()];
+
+    if (magazine->count == PMM_MAGAZINE_SIZE)
+    {
+        pmm_magazine_drain(magazine);
+    }
+
+    magazine->pages[magazine->count] = (void *)((uintptr_t)ptr & ~((uintptr_t)PAGE_SIZE_BYTE - 1));
+    magazine->count = magazine->count + 1;
+
+    cpu_restore_interrupts(rflags);
+
+    return PMM_OK;
+}
+
+/*!
+    @brief Allocates up to count single pages at once.
+
+    Takes pages from the magazine of the current CPU first.
+    The rest is allocated from the regions in one pass per region, handing out runs of neighbouring pages where possible.
+    This is a lot cheaper than calling pmm_alloc() count times if the magazine can't serve all pages.
+
+    @param pages Array where the physical addresses of the pages are stored.
+    @param count Number of pages wanted.
+    @returns Number of pages that were allocated, less than count if the PMM ran out of free pages.
+*/
+size_t pmm_alloc_batch(void **pages, size_t count)
+{
+    uint64_t rflags = cpu_disable_interrupts();
+
+    struct pmm_magazine_t *magazine = &pmm_magazines[cpu_get_id()];
+
+    size_t allocated = 0;
+    while (allocated < count && magazine->count > 0)
+    {
+        magazine->count = magazine->count - 1;
+        pages[allocated] = magazine->pages[magazine->count];
+        allocated = allocated + 1;
+    }
+
+    if (allocated < count)
+    {
+        allocated = allocated + pmm_alloc_batch_from_regions(&pages[allocated], count - allocated, magazine->node);
+    }
+
+    for (size_t i = 0; i < allocated; i++)
+    {
+        pmm_pages_mark_allocated(pages[i], 1, PAGE_OWNER_KERNEL);
+    }
+
+    cpu_restore_interrupts(rflags);
+
+    return allocated;
+}
+
+/*!
+    @brief Frees an array of single pages at once.
+
+    Sorts the array and groups the pages by region, so each region is only searched once
+    and neighbouring pages are freed as a single run.
+    The pages bypass the magazines and go straight back to the regions.
+    Pages that are not inside a usable region or already free (e.g. sitting in a magazine after pmm_free()) are skipped, all others are freed.
+
+    @param pages Array of physical page addresses. Gets sorted in place.
+    @param count Number of pages in the array.
+    @returns PMM_OK on success, PMM_ERROR_ADDRESS_NOT_FOUND if at least one page could not be freed,
+             PMM_ERROR_ALREADY_FREE if at least one page was already free.
+*/
+pmm_error_codes_t pmm_free_batch(void **pages, size_t count)
+{
+    uint64_t rflags = cpu_disable_interrupts();
+
+    pmm_error_codes_t result = pmm_free_batch_to_regions(pages, count, true);
+
+    cpu_restore_interrupts(rflags);
+
+    return result;
+}
+
+/*!
+    @brief Allocates up to count pages that are filled with zeros.
+
+    Takes already cleared pages from the zeroed page pool first.
+    If the pool runs empty, the remaining pages are allocated with pmm_alloc_batch() and cleared right away.
+
+    @param pages Array where the physical addresses of the pages are stored.
+    @param count Number of pages wanted.
+    @returns Number of pages that were allocated, less than count if the PMM ran out of free pages.
+*/
+size_t pmm_alloc_zeroed_batch(void **pages, size_t count)
+{
+    size_t allocated = 0;
+
+    uint64_t rflags = cpu_disable_interrupts();
+
+    while (allocated < count && pmm_zero_pool_count > 0)
+    {
+        pmm_zero_pool_count = pmm_zero_pool_count - 1;
+        pages[allocated] = pmm_zero_pool[pmm_zero_pool_count];
+        pmm_pages_mark_allocated(pages[allocated], 1, PAGE_OWNER_KERNEL);
+        allocated = allocated + 1;
+    }
+
+    cpu_restore_interrupts(rflags);
+
+    if (allocated < count)
+    {
+        // The pool is empty, so the rest has to be cleared synchronously.
+        size_t new_pages = pmm_alloc_batch(&pages[allocated], count - allocated);
+        for (size_t i = 0; i < new_pages; i++)
+        {
+            memset(pages[allocated + i] + phys_to_virt_offset, 0, PAGE_SIZE_BYTE);
+        }
+
+        allocated = allocated + new_pages;
+    }
+
+    return allocated;
+}
+
+/*!
+    @brief Allocates a single page that is filled with zeros.
+
+    Takes an already cleared page from the zeroed page pool, so the page doesn't need to be cleared on the callers hot path.
+    If the pool is empty, a page is allocated with pmm_alloc() and cleared synchronously.
+
+    @returns Pointer to the allocated physical page, or NULL if no free page was found.
+*/
+void * pmm_alloc_zeroed()
+{
+    void *ptr;
+
+    if (pmm_alloc_zeroed_batch(&ptr, 1) != 1)
+    {
+        return NULL;
+    }
+
+    return ptr;
+}
+
+/*!
+    @brief Clears a single page and adds it to the zeroed page pool.
+
+    Meant to be called while the CPU has nothing else to do, e.g. in the idle loop before halting.
+    Only one page is cleared per call, so pending work isn't delayed for long.
+    Interrupts stay enabled while the page is cleared.
+
+    @returns true if a page was added to the pool, false if the pool is full or no free page is left.
+*/
+bool pmm_zero_pool_refill_page()
+{
+    if (pmm_zero_pool_count >= PMM_ZERO_POOL_SIZE)
+    {
+        return false;
+    }
+
+    void *page = pmm_alloc();
+    if (page == NULL)
+    {
+        return false;
+    }
+
+    memset(page + phys_to_virt_offset, 0, PAGE_SIZE_BYTE);
+
+    uint64_t rflags = cpu_disable_interrupts();
+
+    // The pool might have been filled by someone else while the page was cleared.
+    bool added = false;
+    if (pmm_zero_pool_count < PMM_ZERO_POOL_SIZE)
+    {
+        // Pages in the pool belong to the PMM until they are handed out.
+        pmm_pages_mark_allocated(page, 1, PAGE_OWNER_PMM);
+        pmm_zero_pool[pmm_zero_pool_count] = page;
+        pmm_zero_pool_count = pmm_zero_pool_count + 1;
+        added = true;
+    }
+    else
+    {
+        pmm_free(page);
+    }
+
+    cpu_restore_interrupts(rflags);
+
+    return added;
+}
+
+/*!
+    @brief Allocates physically contiguous pages.
+
+    Searches all regions for a run of count free pages whose first page is aligned to alignment.
+    The run is picked by the allocation backend (see pmm_backend.h).
+    All pages of the run are marked as used.
+    If no run is found, the magazine of the current CPU is flushed and the search is repeated once.
+    Interrupts are disabled while the regions are searched, as pmm_alloc() might refill a magazine from them.
+
+    @param count Number of contiguous pages to allocate.
+    @param alignment Alignment of the physical address in byte, e.g. PMM_ALIGNMENT_2MB. Must be a power of two. Values below the page size are treated as the page size.
+    @returns Pointer (physical address) to the first page, or NULL if no matching run of free pages was found.
+*/
+void * pmm_alloc_pages(size_t count, size_t alignment)
+{
+    if (count == 0 || (alignment & (alignment - 1)) != 0)
+    {
+        LOG_ERROR("Invalid arguments: count=%u, alignment=%p", count, alignment);
+        return NULL;
+    }
+
+    // Single pages can use the region cache of pmm_alloc().
+    if (count == 1 && alignment <= PAGE_SIZE_BYTE)
+    {
+        return pmm_alloc();
+    }
+
+    if (alignment < PAGE_SIZE_BYTE)
+    {
+        alignment = PAGE_SIZE_BYTE;
+    }
+
+    uint32_t node = pmm_magazines[cpu_get_id()].node;
+
+    // If no run is found, the pages cached in the magazine are given back and the search is repeated once.
+    for (size_t attempt = 0; attempt < 2; attempt++)
+    {
+        uint64_t rflags = cpu_disable_interrupts();
+
+        // Regions of the local NUMA node are searched first.
+        for (size_t i = 0; i < 2 * pmm_num_regions; i++)
+        {
+            size_t region_index = i % pmm_num_regions;
+            bool local_pass = i < pmm_num_regions;
+
+            if (pmm_regions[region_index].free_pages < count || (pmm_regions[region_index].node == node) != local_pass)
+            {
+                continue;
+            }
+
+            uintptr_t ptr;
+            if (pmm_backend_alloc_pages(&pmm_regions[region_index], count, alignment, &ptr))
+            {
+                pmm_pages_mark_allocated((void *)ptr, count, PAGE_OWNER_KERNEL);
+                cpu_restore_interrupts(rflags);
+                return (void *)ptr;
+            }
+        }
+
+        cpu_restore_interrupts(rflags);
+
+        pmm_magazine_flush();
+    }
+
+    LOG_WARNING("Could not find %u contiguous free pages with alignment %p.", count, alignment);
+
+    return NULL;
+}
+
+/*!
+    @brief Frees physically contiguous pages.
+
+    Uses the section table to find the region that includes the pages and lets the backend free all of them.
+    The pages must be inside a single region, as they are when allocated by pmm_alloc_pages().
+    Nothing is freed if any of the pages is already free.
+    Interrupts are disabled while the region is changed, as pmm_alloc() might refill a magazine from it.
+
+    @param ptr Pointer (physical address) to the first page.
+    @param count Number of pages to free.
+    @returns PMM_OK on success, PMM_ERROR_ADDRESS_NOT_FOUND if no region containing all the pages was found,
+             PMM_ERROR_ALREADY_FREE if one of the pages is already free.
+*/
+pmm_error_codes_t pmm_free_pages(void *ptr, size_t count)
+{
+    size_t region_index;
+
+    // Single pages go back into the magazine, just like they came from it.
+    if (count == 1)
+    {
+        return pmm_free(ptr);
+    }
+
+    if (get_region_containing_page(&region_index, ptr) != PMM_OK)
+    {
+        return PMM_ERROR_ADDRESS_NOT_FOUND;
+    }
+
+    uint64_t rflags = cpu_disable_interrupts();
+
+    pmm_error_codes_t result = PMM_OK;
+
+    struct page_t *pages = pmm_get_page(region_index, (uintptr_t)ptr);
+    for (size_t i = 0; i < count; i++)
+    {
+        // Pages behind the regions end have no struct, the backend rejects them below.
+        if ((uintptr_t)ptr + i * PAGE_SIZE_BYTE >= pmm_regions[region_index].base + pmm_regions[region_index].length)
+        {
+            break;
+        }
+        if (pages[i].refcount == 0)
+        {
+            LOG_ERROR("Page %p is already free.", (uintptr_t)ptr + i * PAGE_SIZE_BYTE);
+            result = PMM_ERROR_ALREADY_FREE;
+            break;
+        }
+    }
+
+    if (result == PMM_OK)
+    {
+        if (pmm_backend_free_pages(&pmm_regions[region_index], (uintptr_t)ptr, count) == PMM_REGION_OK)
+        {
+            pmm_pages_mark_free(region_index, (uintptr_t)ptr, count);
+        }
+        else
+        {
+            result = PMM_ERROR_ADDRESS_NOT_FOUND;
+        }
+    }
+
+    cpu_restore_interrupts(rflags);
+
+    return result;
+}
+
+/*!
+    @brief Initializes the physical memory manager (PMM).
+
+    Sets up the PMM by parsing Limines memory map, detecting usable memory regions. 
+    Calculates how many pages are required to store PMM metadata (region structs, bitmaps) 
     and searches for a suitable memory region to store this data.
     Once found, initializes all region structs and marks memory used by the PMM as used to prevent reuse.
 
@@ -376,27 +1328,39 @@ pmm_error_codes_t pmm_free(void *ptr)
 */
 pmm_error_codes_t pmm_init(struct limine_memmap_response *memmap, uint64_t hhdm_offset)
 {
-    LOG_INFO("Initializing PMM...");
+    LOG_INFO("Initializing PMM (%s backend)...", pmm_backend_name);
     LOG_DEBUG("HHDM=%p", hhdm_offset);
     phys_to_virt_offset = hhdm_offset;
  
-    pmm_detect_memory(memmap, &pmm_num_regions, &pmm_memory_size_pages);
+    pmm_detect_memory(memmap, &pmm_num_regions, &pmm_memory_size_pages, &pmm_num_sections);
+
+    if (pmm_num_regions == 0 || pmm_num_regions >= PMM_SECTION_NONE)
+    {
+        LOG_ERROR("Unsupported number of memory regions: %u", pmm_num_regions);
+        return PMM_ERROR_INIT_FAILED;
+    }
 
     // Calculate how many pages are required to store the PMMs data.
-    size_t required_pages =  pmm_get_num_required_pages(pmm_num_regions, pmm_memory_size_pages);
+    size_t required_pages =  pmm_get_num_required_pages(memmap, pmm_num_regions, pmm_num_sections);
 
     // Search for a place where the PMMs data can be stored.
+    // It has to fit into a single region, so the ranges are searched instead of the memory map entries.
     uintptr_t pmm_base = (uintptr_t)NULL;
-    for (size_t i = 0; i < pmm_num_regions; i++)
+    struct pmm_range_cursor_t cursor = {0};
+    uintptr_t base;
+    size_t length;
+    uint64_t type;
+    uint32_t node;
+    while (pmm_get_next_range(memmap, &cursor, &base, &length, &type, &node))
     {
-        if (memmap->entries[i]->type != MEMMAP_TYPE_USABLE)
+        if (type != MEMMAP_TYPE_USABLE)
         {
             continue;
         }
         
-        if (memmap->entries[i]->length >= required_pages * PAGE_SIZE_BYTE)
+        if (length >= required_pages * PAGE_SIZE_BYTE)
         {
-            pmm_base = memmap->entries[i]->base;
+            pmm_base = base;
             break;
         }
     }
@@ -418,4 +1382,204 @@ pmm_error_codes_t pmm_init(struct limine_memmap_response *memmap, uint64_t hhdm_
     LOG_INFO("PMM initialized.");    
 
     return PMM_OK;
-}
\ No newline at end of file
+}
+
+/*!
+    @brief Gets the metadata of a page by its page frame number.
+
+    @param pfn Page frame number (physical address / page size).
+    @returns Pointer to the pages struct, or NULL if the page isn't inside a region.
+*/
+struct page_t * pfn_to_page(uintptr_t pfn)
+{
+    return phys_to_page(pfn * PAGE_SIZE_BYTE);
+}
+
+/*!
+    @brief Gets the metadata of the page containing a physical address.
+
+    @param phys Physical address.
+    @returns Pointer to the pages struct, or NULL if the page isn't inside a region.
+*/
+struct page_t * phys_to_page(uintptr_t phys)
+{
+    size_t region_index;
+
+    if (get_region_containing_page(&region_index, (void *)phys) != PMM_OK)
+    {
+        return NULL;
+    }
+
+    return pmm_get_page(region_index, phys);
+}
+
+/*!
+    @brief Gets the physical address of a page from its metadata.
+
+    @param page Pointer to the pages struct.
+    @returns Physical address of the page.
+*/
+uintptr_t page_to_phys(struct page_t *page)
+{
+    struct pmm_region_t *region = &pmm_regions[page->region];
+
+    return region->base + (uintptr_t)(page - region->pages) * PAGE_SIZE_BYTE;
+}
+
+/*!
+    @brief Sets the NUMA node of physical memory ranges, e.g. from the ACPI SRAT.
+
+    Must be called before pmm_init(), so the regions can be split at node boundaries.
+    The ranges are copied. Memory that isn't covered by any range belongs to node 0.
+
+    @param ranges Array of memory ranges.
+    @param count Number of ranges in the array.
+    @returns PMM_OK on success, PMM_ERROR_INIT_FAILED if there are more than PMM_MAX_NODE_RANGES ranges.
+*/
+pmm_error_codes_t pmm_set_node_ranges(const struct pmm_node_range_t *ranges, size_t count)
+{
+    if (count > PMM_MAX_NODE_RANGES)
+    {
+        LOG_ERROR("Too many NUMA memory ranges: %u", count);
+        return PMM_ERROR_INIT_FAILED;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        pmm_node_ranges[i] = ranges[i];
+    }
+    pmm_num_node_ranges = count;
+
+    return PMM_OK;
+}
+
+/*!
+    @brief Sets the NUMA node of a CPU.
+
+    Single page allocations of the CPU prefer memory of this node. All CPUs start out in node 0.
+
+    @param cpu Number of the CPU.
+    @param node NUMA node of the CPU.
+    @returns PMM_OK on success, PMM_ERROR_INVALID_CPU if there is no such CPU.
+*/
+pmm_error_codes_t pmm_set_cpu_node(uint32_t cpu, uint32_t node)
+{
+    if (cpu >= CPU_MAX_CPUS)
+    {
+        return PMM_ERROR_INVALID_CPU;
+    }
+
+    pmm_magazines[cpu].node = node;
+
+    return PMM_OK;
+}
+
+/*!
+    @brief Gets the NUMA node of a CPU.
+
+    @param cpu Number of the CPU.
+    @returns NUMA node of the CPU, 0 if there is no such CPU.
+*/
+uint32_t pmm_get_cpu_node(uint32_t cpu)
+{
+    if (cpu >= CPU_MAX_CPUS)
+    {
+        return 0;
+    }
+
+    return pmm_magazines[cpu].node;
+}
+
+/*!
+    @brief Allocates a single page, preferring memory of a NUMA node.
+
+    Pages of the current CPUs node are taken from its magazine like in pmm_alloc().
+    For other nodes, the regions of that node are searched directly.
+    If the node has no free memory left, the page is taken from any other node.
+
+    @param node Preferred NUMA node.
+    @returns Pointer to the allocated physical page, or NULL if no free page was found.
+*/
+void * pmm_alloc_node(uint32_t node)
+{
+    if (pmm_magazines[cpu_get_id()].node == node)
+    {
+        return pmm_alloc();
+    }
+
+    uint64_t rflags = cpu_disable_interrupts();
+
+    void *ptr = NULL;
+    if (pmm_alloc_batch_from_regions(&ptr, 1, node) == 1)
+    {
+        pmm_pages_mark_allocated(ptr, 1, PAGE_OWNER_KERNEL);
+    }
+
+    cpu_restore_interrupts(rflags);
+
+    return ptr;
+}
+
+/*!
+    @brief Gets the NUMA node of a page.
+
+    @param ptr Pointer (physical address) to the page.
+    @param node Pointer to the variable where the node should be stored.
+    @returns PMM_OK on success, PMM_ERROR_ADDRESS_NOT_FOUND if no region contains the page.
+*/
+pmm_error_codes_t pmm_get_page_node(void *ptr, uint32_t *node)
+{
+    size_t region_index;
+
+    if (get_region_containing_page(&region_index, ptr) != PMM_OK)
+    {
+        return PMM_ERROR_ADDRESS_NOT_FOUND;
+    }
+
+    *node = pmm_regions[region_index].node;
+
+    return PMM_OK;
+}
+
+/*!
+    @brief Gets the number of free pages of a NUMA node.
+
+    Only counts the pages in the regions, not the ones cached in magazines.
+
+    @param node NUMA node.
+    @returns Number of free pages.
+*/
+size_t pmm_get_node_free_pages(uint32_t node)
+{
+    size_t free_pages = 0;
+
+    for (size_t i = 0; i < pmm_num_regions; i++)
+    {
+        if (pmm_regions[i].node == node)
+        {
+            free_pages = free_pages + pmm_regions[i].free_pages;
+        }
+    }
+
+    return free_pages;
+}
+
+/*!
+    @brief Gets the number of NUMA nodes.
+
+    @returns Highest node that has a region plus one.
+*/
+uint32_t pmm_get_num_nodes()
+{
+    uint32_t num_nodes = 1;
+
+    for (size_t i = 0; i < pmm_num_regions; i++)
+    {
+        if (pmm_regions[i].node >= num_nodes)
+        {
+            num_nodes = pmm_regions[i].node + 1;
+        }
+    }
+
+    return num_nodes;
+}
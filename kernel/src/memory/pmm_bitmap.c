@@ -0,0 +1,137 @@
+#include "memory/pmm_backend.h"
+
+#if PMM_BACKEND == PMM_BACKEND_BITMAP
+
+#include "logging.h"
+
+#define PAGE_SIZE_BYTE 4096
+
+const char *pmm_backend_name = "bitmap";
+
+/*!
+    @brief Calculates how many bytes of metadata the backend needs for a region.
+
+    The bitmap backend works on the regions bitmap only, so no extra space is needed.
+
+    @param region_length The regions length in byte.
+    @returns Number of bytes needed, a multiple of 8.
+*/
+size_t pmm_backend_get_metadata_size([[maybe_unused]] ptrdiff_t region_length)
+{
+    return 0;
+}
+
+/*!
+    @brief Sets up the backends data for a region.
+
+    Nothing to do here, the regions bitmap is all the bitmap backend needs.
+
+    @param region Pointer to the regions struct.
+    @param metadata Pointer (virtual address) to pmm_backend_get_metadata_size() bytes reserved for the backend.
+    @param offset Offset used by the higher half direct map.
+*/
+void pmm_backend_init_region([[maybe_unused]] struct pmm_region_t *region, [[maybe_unused]] void *metadata, [[maybe_unused]] ptrdiff_t offset)
+{
+}
+
+/*!
+    @brief Allocates physically contiguous pages from a region.
+
+    Single pages are found by descending the regions summary levels with pmm_region_find_free_page(),
+    runs of pages by the word-level search of pmm_region_find_free_range().
+    The pages are marked as used in the regions bitmap.
+
+    @param region Pointer to the regions struct.
+    @param count Number of pages.
+    @param alignment Alignment of the physical address in byte. Must be a power of two and at least the page size.
+    @param phys Pointer to the variable where the physical address of the first page should be stored.
+    @returns true on success, false if the region has no matching free pages.
+*/
+bool pmm_backend_alloc_pages(struct pmm_region_t *region, size_t count, size_t alignment, uintptr_t *phys)
+{
+    size_t page;
+
+    if (count == 1 && alignment == PAGE_SIZE_BYTE)
+    {
+        if (!pmm_region_find_free_page(region, &page))
+        {
+            return false;
+        }
+
+        *phys = region->base + page * PAGE_SIZE_BYTE;
+        pmm_region_mark_page_used(region, *phys);
+
+        return true;
+    }
+
+    if (!pmm_region_find_free_range(region, count, alignment, &page))
+    {
+        return false;
+    }
+
+    *phys = region->base + page * PAGE_SIZE_BYTE;
+    pmm_region_mark_range_used(region, *phys, count);
+
+    return true;
+}
+
+/*!
+    @brief Allocates up to count single pages from a region in one pass.
+
+    Walks the free runs of the bitmap with pmm_region_find_free_run() and marks each run as used at once,
+    so the bitmap and its summary levels are only passed once per batch.
+
+    @param region Pointer to the regions struct.
+    @param pages Array where the physical addresses of the pages are stored.
+    @param count Number of pages wanted.
+    @returns Number of pages that were allocated, less than count if the region ran out of free pages.
+*/
+size_t pmm_backend_alloc_batch(struct pmm_region_t *region, void **pages, size_t count)
+{
+    size_t allocated = 0;
+    size_t from = 0;
+    size_t first;
+    size_t run;
+
+    while (allocated < count && pmm_region_find_free_run(region, from, &first, &run))
+    {
+        if (run > count - allocated)
+        {
+            run = count - allocated;
+        }
+
+        pmm_region_mark_range_used(region, region->base + first * PAGE_SIZE_BYTE, run);
+
+        for (size_t i = 0; i < run; i++)
+        {
+            pages[allocated + i] = (void *)(region->base + (first + i) * PAGE_SIZE_BYTE);
+        }
+
+        allocated = allocated + run;
+        from = first + run;
+    }
+
+    return allocated;
+}
+
+/*!
+    @brief Frees physically contiguous pages of a region.
+
+    The pages are marked as free in the regions bitmap.
+
+    @param region Pointer to the regions struct.
+    @param phys Physical address of the first page.
+    @param count Number of pages.
+    @returns PMM_REGION_OK on success, PMM_REGION_ERROR if the pages are not inside the region.
+*/
+pmm_region_error_codes_t pmm_backend_free_pages(struct pmm_region_t *region, uintptr_t phys, size_t count)
+{
+    if (count == 1)
+    {
+        return pmm_region_mark_page_free(region, phys);
+    }
+
+    return pmm_region_mark_range_free(region, phys, count);
+}
+
+#endif // PMM_BACKEND == PMM_BACKEND_BITMAP
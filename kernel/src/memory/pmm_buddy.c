@@ -0,0 +1,407 @@
+#include "memory/pmm_backend.h"
+
+#if PMM_BACKEND == PMM_BACKEND_BUDDY
+
+#include "string.h"
+
+#include "logging.h"
+
+#define PAGE_SIZE_BYTE 4096
+
+#define PMM_BUDDY_NUM_ORDERS (PMM_BUDDY_MAX_ORDER + 1)
+
+/// @brief Entry in the order array for pages that are not the first page of a free block.
+#define PMM_BUDDY_NOT_A_HEAD UINT8_MAX
+
+/// @brief Rounds x up to the next multiple of 8.
+#define PMM_BUDDY_ALIGN_UP_8(x) (((x) + 7) & ~((size_t)7))
+
+const char *pmm_backend_name = "buddy";
+
+/*!
+    @brief Node of a free list.
+
+    Stored in the first page of each free block, so the free lists don't need any extra memory.
+*/
+struct pmm_buddy_node_t {
+    struct pmm_buddy_node_t *next;
+    struct pmm_buddy_node_t *prev;
+};
+
+/*!
+    @brief Buddy allocator data of a region.
+
+    A block of order n consists of 2^n pages and its physical address is aligned to its size.
+    Its buddy is the block of the same order it was split from / can be merged with, found by flipping bit n of the page frame number.
+*/
+struct pmm_buddy_t {
+    /// @brief One doubly linked list of free blocks per order.
+    struct pmm_buddy_node_t *free_lists[PMM_BUDDY_NUM_ORDERS];
+
+    /// @brief Bit n is set if the free list of order n is not empty. Allows finding the smallest fitting block without walking the lists.
+    uint32_t non_empty_orders;
+
+    /// @brief One entry per page: The order of the free block starting at the page, or PMM_BUDDY_NOT_A_HEAD.
+    uint8_t *orders;
+};
+
+static ptrdiff_t phys_to_virt_offset = 0;
+
+/*!
+    @brief Gets the free list node stored in a page.
+
+    @param region Pointer to the regions struct.
+    @param page Index of the page in the region.
+    @returns Pointer (virtual address) to the node.
+*/
+static inline struct pmm_buddy_node_t * pmm_buddy_get_node(struct pmm_region_t *region, size_t page)
+{
+    return (struct pmm_buddy_node_t *)(region->base + page * PAGE_SIZE_BYTE + phys_to_virt_offset);
+}
+
+/*!
+    @brief Gets the index of the page a free list node is stored in.
+
+    @param region Pointer to the regions struct.
+    @param node Pointer (virtual address) to the node.
+    @returns Index of the page in the region.
+*/
+static inline size_t pmm_buddy_get_page(struct pmm_region_t *region, struct pmm_buddy_node_t *node)
+{
+    return ((uintptr_t)node - phys_to_virt_offset - region->base) / PAGE_SIZE_BYTE;
+}
+
+/*!
+    @brief Adds a free block to the free list of its order.
+
+    @param region Pointer to the regions struct.
+    @param page Index of the blocks first page in the region.
+    @param order Order of the block.
+*/
+static void pmm_buddy_push(struct pmm_region_t *region, size_t page, size_t order)
+{
+    struct pmm_buddy_t *buddy = region->backend;
+    struct pmm_buddy_node_t *node = pmm_buddy_get_node(region, page);
+
+    node->prev = NULL;
+    node->next = buddy->free_lists[order];
+    if (node->next != NULL)
+    {
+        node->next->prev = node;
+    }
+    buddy->free_lists[order] = node;
+
+    buddy->orders[page] = order;
+    buddy->non_empty_orders = buddy->non_empty_orders | (1u << order);
+}
+
+/*!
+    @brief Removes a free block from the free list of its order.
+
+    @param region Pointer to the regions struct.
+    @param page Index of the blocks first page in the region.
+    @param order Order of the block.
+*/
+static void pmm_buddy_remove(struct pmm_region_t *region, size_t page, size_t order)
+{
+    struct pmm_buddy_t *buddy = region->backend;
+    struct pmm_buddy_node_t *node = pmm_buddy_get_node(region, page);
+
+    if (node->prev != NULL)
+    {
+        node->prev->next = node->next;
+    }
+    else
+    {
+        buddy->free_lists[order] = node->next;
+    }
+    if (node->next != NULL)
+    {
+        node->next->prev = node->prev;
+    }
+
+    buddy->orders[page] = PMM_BUDDY_NOT_A_HEAD;
+    if (buddy->free_lists[order] == NULL)
+    {
+        buddy->non_empty_orders = buddy->non_empty_orders & ~(1u << order);
+    }
+}
+
+/*!
+    @brief Adds a free block and merges it with its buddies.
+
+    As long as the blocks buddy is free and of the same order, both are merged into a block of the next order.
+
+    @param region Pointer to the regions struct.
+    @param page Index of the blocks first page in the region.
+    @param order Order of the block.
+*/
+static void pmm_buddy_insert_block(struct pmm_region_t *region, size_t page, size_t order)
+{
+    struct pmm_buddy_t *buddy = region->backend;
+    size_t region_pages = region->length / PAGE_SIZE_BYTE;
+    size_t base_pfn = region->base / PAGE_SIZE_BYTE;
+    size_t pfn = base_pfn + page;
+
+    while (order < PMM_BUDDY_MAX_ORDER)
+    {
+        size_t buddy_pfn = pfn ^ ((size_t)1 << order);
+        if (buddy_pfn < base_pfn || buddy_pfn - base_pfn >= region_pages)
+        {
+            break;
+        }
+
+        // Only a free block of the same order can be merged.
+        size_t buddy_page = buddy_pfn - base_pfn;
+        if (buddy->orders[buddy_page] != order)
+        {
+            break;
+        }
+
+        pmm_buddy_remove(region, buddy_page, order);
+
+        pfn = pfn & ~((size_t)1 << order);
+        order = order + 1;
+    }
+
+    pmm_buddy_push(region, pfn - base_pfn, order);
+}
+
+/*!
+    @brief Adds a range of free pages to the free lists.
+
+    Splits the range into the largest blocks that are aligned to their size and adds them one by one.
+    Does NOT touch the regions bitmap.
+
+    @param region Pointer to the regions struct.
+    @param first Index of the ranges first page in the region.
+    @param count Number of pages in the range.
+*/
+static void pmm_buddy_insert_range(struct pmm_region_t *region, size_t first, size_t count)
+{
+    size_t base_pfn = region->base / PAGE_SIZE_BYTE;
+
+    while (count > 0)
+    {
+        size_t pfn = base_pfn + first;
+
+        // The largest block that starts here is limited by the alignment of the page frame number...
+        size_t order = (pfn == 0) ? PMM_BUDDY_MAX_ORDER : (size_t)__builtin_ctzll(pfn);
+        if (order > PMM_BUDDY_MAX_ORDER)
+        {
+            order = PMM_BUDDY_MAX_ORDER;
+        }
+        // ... and by the number of pages left.
+        while (((size_t)1 << order) > count)
+        {
+            order = order - 1;
+        }
+
+        pmm_buddy_insert_block(region, first, order);
+
+        first = first + ((size_t)1 << order);
+        count = count - ((size_t)1 << order);
+    }
+}
+
+/*!
+    @brief Calculates how many bytes of metadata the backend needs for a region.
+
+    Space for the regions free lists and one byte per page for the order array.
+
+    @param region_length The regions length in byte.
+    @returns Number of bytes needed, a multiple of 8.
+*/
+size_t pmm_backend_get_metadata_size(ptrdiff_t region_length)
+{
+    return PMM_BUDDY_ALIGN_UP_8(sizeof(struct pmm_buddy_t)) + PMM_BUDDY_ALIGN_UP_8(region_length / PAGE_SIZE_BYTE);
+}
+
+/*!
+    @brief Sets up the backends data for a region.
+
+    Initializes the free lists and the order array and adds all pages that are free in the regions bitmap to the free lists.
+
+    @param region Pointer to the regions struct.
+    @param metadata Pointer (virtual address) to pmm_backend_get_metadata_size() bytes reserved for the backend.
+    @param offset Offset used by the higher half direct map.
+*/
+void pmm_backend_init_region(struct pmm_region_t *region, void *metadata, ptrdiff_t offset)
+{
+    phys_to_virt_offset = offset;
+
+    struct pmm_buddy_t *buddy = metadata;
+    memset(buddy, 0, sizeof(struct pmm_buddy_t));
+
+    buddy->orders = (uint8_t *)metadata + PMM_BUDDY_ALIGN_UP_8(sizeof(struct pmm_buddy_t));
+    memset(buddy->orders, PMM_BUDDY_NOT_A_HEAD, region->length / PAGE_SIZE_BYTE);
+
+    region->backend = buddy;
+
+    // Add every run of free pages to the free lists.
+    size_t first = 0;
+    size_t count = 0;
+    while (pmm_region_find_free_run(region, first + count, &first, &count))
+    {
+        pmm_buddy_insert_range(region, first, count);
+    }
+}
+
+/*!
+    @brief Allocates physically contiguous pages from a region.
+
+    Takes the smallest free block that is large enough and aligned as needed, splitting larger blocks if necessary.
+    Pages of the block that are not needed are given back to the free lists right away.
+    The pages are marked as used in the regions bitmap.
+
+    @param region Pointer to the regions struct.
+    @param count Number of pages. At most 2^PMM_BUDDY_MAX_ORDER.
+    @param alignment Alignment of the physical address in byte. Must be a power of two and at least the page size.
+    @param phys Pointer to the variable where the physical address of the first page should be stored.
+    @returns true on success, false if the region has no matching free block.
+*/
+bool pmm_backend_alloc_pages(struct pmm_region_t *region, size_t count, size_t alignment, uintptr_t *phys)
+{
+    struct pmm_buddy_t *buddy = region->backend;
+
+    // Blocks are aligned to their size, so the order needs to cover both the number of pages and the alignment.
+    size_t order = 0;
+    while (((size_t)1 << order) < count || ((size_t)PAGE_SIZE_BYTE << order) < alignment)
+    {
+        order = order + 1;
+    }
+
+    if (order > PMM_BUDDY_MAX_ORDER)
+    {
+        return false;
+    }
+
+    // Find the smallest order with free blocks that is large enough.
+    uint32_t available = buddy->non_empty_orders & (UINT32_MAX << order);
+    if (available == 0)
+    {
+        return false;
+    }
+    size_t block_order = __builtin_ctz(available);
+
+    size_t page = pmm_buddy_get_page(region, buddy->free_lists[block_order]);
+    pmm_buddy_remove(region, page, block_order);
+
+    // Split the block until it has the wanted order, the upper halves go back to the free lists.
+    while (block_order > order)
+    {
+        block_order = block_order - 1;
+        pmm_buddy_push(region, page + ((size_t)1 << block_order), block_order);
+    }
+
+    *phys = region->base + page * PAGE_SIZE_BYTE;
+    pmm_region_mark_range_used(region, *phys, count);
+
+    // Give back the pages that were only needed to get a large enough block.
+    if (count < ((size_t)1 << order))
+    {
+        pmm_buddy_insert_range(region, page + count, ((size_t)1 << order) - count);
+    }
+
+    return true;
+}
+
+/*!
+    @brief Allocates up to count single pages from a region in one pass.
+
+    Takes the largest free block that is not larger than the number of missing pages and hands out all of its pages,
+    so a batch needs only a few free list operations instead of one per page.
+    If only larger blocks are left, the smallest one is used and its unneeded pages are given back.
+    The pages are marked as used in the regions bitmap.
+
+    @param region Pointer to the regions struct.
+    @param pages Array where the physical addresses of the pages are stored.
+    @param count Number of pages wanted.
+    @returns Number of pages that were allocated, less than count if the region ran out of free pages.
+*/
+size_t pmm_backend_alloc_batch(struct pmm_region_t *region, void **pages, size_t count)
+{
+    struct pmm_buddy_t *buddy = region->backend;
+
+    size_t allocated = 0;
+
+    while (allocated < count && buddy->non_empty_orders != 0)
+    {
+        size_t remaining = count - allocated;
+
+        size_t max_order = 63 - __builtin_clzll(remaining);
+        if (max_order > PMM_BUDDY_MAX_ORDER)
+        {
+            max_order = PMM_BUDDY_MAX_ORDER;
+        }
+
+        size_t order;
+        uint32_t fitting = buddy->non_empty_orders & ((2u << max_order) - 1);
+        if (fitting != 0)
+        {
+            order = 31 - __builtin_clz(fitting);
+        }
+        else
+        {
+            order = __builtin_ctz(buddy->non_empty_orders);
+        }
+
+        size_t page = pmm_buddy_get_page(region, buddy->free_lists[order]);
+        pmm_buddy_remove(region, page, order);
+
+        size_t block_pages = (size_t)1 << order;
+        size_t used_pages = block_pages < remaining ? block_pages : remaining;
+
+        pmm_region_mark_range_used(region, region->base + page * PAGE_SIZE_BYTE, used_pages);
+
+        if (used_pages < block_pages)
+        {
+            pmm_buddy_insert_range(region, page + used_pages, block_pages - used_pages);
+        }
+
+        for (size_t i = 0; i < used_pages; i++)
+        {
+            pages[allocated + i] = (void *)(region->base + (page + i) * PAGE_SIZE_BYTE);
+        }
+
+        allocated = allocated + used_pages;
+    }
+
+    return allocated;
+}
+
+/*!
+    @brief Frees physically contiguous pages of a region.
+
+    The pages are marked as free in the regions bitmap and added to the free lists, merging them with their buddies.
+
+    @param region Pointer to the regions struct.
+    @param phys Physical address of the first page.
+    @param count Number of pages.
+    @returns PMM_REGION_OK on success, PMM_REGION_ERROR if the pages are not inside the region or are already free.
+*/
+pmm_region_error_codes_t pmm_backend_free_pages(struct pmm_region_t *region, uintptr_t phys, size_t count)
+{
+    if (phys < region->base || phys >= region->base + region->length)
+    {
+        LOG_ERROR("Address is not in region: phys address=%p, base=%p, len=%u!", phys, region->base, region->length);
+        return PMM_REGION_ERROR;
+    }
+
+    size_t first = (phys - region->base) / PAGE_SIZE_BYTE;
+
+    // A page that is already in a free list must not be added a second time, its list node lives inside the page.
+    if (!pmm_region_is_range_used(region, phys, count))
+    {
+        LOG_ERROR("Range is already free or not in the region: phys address=%p, pages=%u", phys, count);
+        return PMM_REGION_ERROR;
+    }
+
+    pmm_region_mark_range_free(region, phys, count);
+
+    pmm_buddy_insert_range(region, first, count);
+
+    return PMM_REGION_OK;
+}
+
+#endif // PMM_BACKEND == PMM_BACKEND_BUDDY
@@ -6,10 +6,106 @@
 
 #define PAGE_SIZE_BYTE 4096
 
+#define BITS_PER_WORD 64
+
+/*!
+    @brief Calculates how many words are needed to summarize a number of words.
+
+    @param words Number of words to summarize.
+    @returns Number of words needed, one bit per summarized word.
+*/
+static inline size_t pmm_region_get_summary_words(size_t words)
+{
+    return (words + BITS_PER_WORD - 1) / BITS_PER_WORD;
+}
+
+/*!
+    @brief Sets the summary bits of a full bitmap word.
+
+    Sets the words bit in level 0. If this makes the summary word full, its bit in the next level is set too, and so on.
+
+    @param region Pointer to the regions struct.
+    @param word Index of the word in the bitmap that became full.
+*/
+static void pmm_region_summary_mark_full(struct pmm_region_t *region, size_t word)
+{
+    for (size_t level = 0; level < PMM_REGION_SUMMARY_LEVELS; level++)
+    {
+        size_t summary_word = word / BITS_PER_WORD;
+
+        region->summary[level][summary_word] = region->summary[level][summary_word] | (1ull << (word % BITS_PER_WORD));
+
+        // Only propagate to the next level if this word became full as well.
+        if (region->summary[level][summary_word] != UINT64_MAX)
+        {
+            break;
+        }
+
+        word = summary_word;
+    }
+}
+
+/*!
+    @brief Clears the summary bits of a bitmap word that is no longer full.
+
+    Clears the words bit in level 0. If the summary word was full before, its bit in the next level is cleared too, and so on.
+
+    @param region Pointer to the regions struct.
+    @param word Index of the word in the bitmap that is no longer full.
+*/
+static void pmm_region_summary_mark_not_full(struct pmm_region_t *region, size_t word)
+{
+    for (size_t level = 0; level < PMM_REGION_SUMMARY_LEVELS; level++)
+    {
+        size_t summary_word = word / BITS_PER_WORD;
+        bool was_full = region->summary[level][summary_word] == UINT64_MAX;
+
+        region->summary[level][summary_word] = region->summary[level][summary_word] & ~(1ull << (word % BITS_PER_WORD));
+
+        // The next level only knows about full words, so there is nothing to change if this one wasn't full.
+        if (!was_full)
+        {
+            break;
+        }
+
+        word = summary_word;
+    }
+}
+
+/*!
+    @brief Rebuilds all summary levels from the bitmap.
+
+    Bits that don't correspond to a word of the level below are set, so that they are never picked by a search.
+
+    @param region Pointer to the regions struct.
+*/
+static void pmm_region_rebuild_summary(struct pmm_region_t *region)
+{
+    size_t lower_words = region->bitmap_size;
+
+    for (size_t level = 0; level < PMM_REGION_SUMMARY_LEVELS; level++)
+    {
+        // Mark everything as full first, this also takes care of the padding bits.
+        memset(region->summary[level], UINT8_MAX, region->summary_size[level] * sizeof(uint64_t));
+
+        for (size_t word = 0; word < lower_words; word++)
+        {
+            uint64_t lower = (level == 0) ? region->bitmap[word] : region->summary[level - 1][word];
+            if (lower != UINT64_MAX)
+            {
+                region->summary[level][word / BITS_PER_WORD] = region->summary[level][word / BITS_PER_WORD] & ~(1ull << (word % BITS_PER_WORD));
+            }
+        }
+
+        lower_words = region->summary_size[level];
+    }
+}
+
 /*!
     @brief Mark a page corresponding to a physical address as free.
 
     Clears the bit corresponding to the page and increments the number of free pages by one.
+    If the pages bitmap word was full before, the summary levels are updated.
 
     @param region Pointer to the regions struct.
     @param phys_address Physical address of the page.
@@ -17,17 +113,25 @@
 */
 pmm_region_error_codes_t pmm_region_mark_page_free(struct pmm_region_t *region, uintptr_t phys_address)
 {
-    if (phys_address < region->base || phys_address > (region->base + region->length))
+    if (phys_address < region->base || phys_address >= (region->base + region->length))
     {
         LOG_ERROR("Address is not in region: phys address=%p, base=%p, len=%u!", phys_address, region->base, region->length);
         return PMM_REGION_ERROR;
-    }   
+    }
 
     size_t page = (phys_address - region->base) / PAGE_SIZE_BYTE;
+    size_t word = page / BITS_PER_WORD;
+
+    bool word_was_full = region->bitmap[word] == UINT64_MAX;
+
+    region->bitmap[word] = region->bitmap[word] & ~(1ull << (page % BITS_PER_WORD));
+    region->free_pages = region->free_pages + 1;
+
+    if (word_was_full)
+    {
+        pmm_region_summary_mark_not_full(region, word);
+    }
 
-    region->bitmap[page / 8] = region->bitmap[page / 8] & ~(1 << page % 8);
-    region->free_pages = region->free_pages + 1; 
-    
     return PMM_REGION_OK;
 }
 
@@ -35,6 +139,7 @@ pmm_region_error_codes_t pmm_region_mark_page_free(struct pmm_region_t *region,
     @brief Mark a page corresponding to a physical address as used.
 
     Sets the bit corresponding to the page and decrements the number of free pages by one.
+    If the pages bitmap word becomes full, the summary levels are updated.
 
     @param region Pointer to the regions struct.
     @param phys_address Physical address of the page.
@@ -42,55 +147,519 @@ pmm_region_error_codes_t pmm_region_mark_page_free(struct pmm_region_t *region,
 */
 pmm_region_error_codes_t pmm_region_mark_page_used(struct pmm_region_t *region, uintptr_t phys_address)
 {
-    if (phys_address < region->base || phys_address > (region->base + region->length))
+    if (phys_address < region->base || phys_address >= (region->base + region->length))
     {
         LOG_ERROR("Address is not in region: phys address=%p, base=%p, len=%u!", phys_address, region->base, region->length);
         return PMM_REGION_ERROR;
-    }   
+    }
 
     size_t page = (phys_address - region->base) / PAGE_SIZE_BYTE;
+    size_t word = page / BITS_PER_WORD;
 
-    region->bitmap[page / 8] = region->bitmap[page / 8] | (1 << page % 8); 
+    region->bitmap[word] = region->bitmap[word] | (1ull << (page % BITS_PER_WORD));
     region->free_pages = region->free_pages - 1;
-    
+
+    if (region->bitmap[word] == UINT64_MAX)
+    {
+        pmm_region_summary_mark_full(region, word);
+    }
+
+    return PMM_REGION_OK;
+}
+
+/*!
+    @brief Search a free page in a region.
+
+    Descends the summary levels, starting at the top, always following the first word that is not full.
+    Uses find-first-zero bit operations, so the search takes O(log n) word operations instead of a linear scan over the bitmap.
+    The page is NOT marked as used.
+
+    @param region Pointer to the regions struct.
+    @param page Pointer to the variable where the index of the free page in the region should be stored.
+    @returns true if a free page was found, false if the region is full.
+*/
+bool pmm_region_find_free_page(struct pmm_region_t *region, size_t *page)
+{
+    if (region->free_pages == 0)
+    {
+        return false;
+    }
+
+    // Search the top level for a word that is not full. The top level is small, so a linear scan is fine here.
+    size_t top = PMM_REGION_SUMMARY_LEVELS - 1;
+    size_t index = 0;
+    bool found = false;
+    for (size_t word = 0; word < region->summary_size[top]; word++)
+    {
+        if (region->summary[top][word] != UINT64_MAX)
+        {
+            index = word * BITS_PER_WORD + __builtin_ctzll(~region->summary[top][word]);
+            found = true;
+            break;
+        }
+    }
+
+    if (!found)
+    {
+        return false;
+    }
+
+    // Descend the remaining levels. index is the index of a word that is not full in the level below.
+    for (size_t level = top; level > 0; level--)
+    {
+        index = index * BITS_PER_WORD + __builtin_ctzll(~region->summary[level - 1][index]);
+    }
+
+    // index now points to a bitmap word with at least one free page.
+    *page = index * BITS_PER_WORD + __builtin_ctzll(~region->bitmap[index]);
+
+    return true;
+}
+
+/*!
+    @brief Counts the set bits in a word.
+
+    The kernel is built for baseline x86-64 without POPCNT and isn't linked against libgcc, so __builtin_popcountll() can't be used.
+
+    @param word Word to count the set bits of.
+    @returns Number of set bits.
+*/
+static inline size_t pmm_region_count_bits(uint64_t word)
+{
+    word = word - ((word >> 1) & 0x5555555555555555ull);
+    word = (word & 0x3333333333333333ull) + ((word >> 2) & 0x3333333333333333ull);
+    word = (word + (word >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    return (word * 0x0101010101010101ull) >> 56;
+}
+
+/*!
+    @brief Checks if a range of pages lies completely inside a region.
+
+    @param region Pointer to the regions struct.
+    @param phys_address Physical address of the first page.
+    @param count Number of pages.
+    @returns true if the range is inside the region, false if not.
+*/
+static bool pmm_region_contains_range(struct pmm_region_t *region, uintptr_t phys_address, size_t count)
+{
+    size_t region_pages = region->length / PAGE_SIZE_BYTE;
+
+    if (phys_address < region->base)
+    {
+        return false;
+    }
+
+    size_t first = (phys_address - region->base) / PAGE_SIZE_BYTE;
+
+    return first < region_pages && count <= region_pages - first;
+}
+
+/*!
+    @brief Sets or clears the bits of a range of pages word by word.
+
+    Updates the number of free pages by the number of bits that actually changed and keeps the summary levels up to date.
+
+    @param region Pointer to the regions struct.
+    @param first Index of the first page in the region.
+    @param count Number of pages.
+    @param used true to mark the pages as used, false to mark them as free.
+*/
+static void pmm_region_set_range(struct pmm_region_t *region, size_t first, size_t count, bool used)
+{
+    while (count > 0)
+    {
+        size_t word = first / BITS_PER_WORD;
+        size_t bit = first % BITS_PER_WORD;
+        size_t bits_in_word = BITS_PER_WORD - bit;
+        if (bits_in_word > count)
+        {
+            bits_in_word = count;
+        }
+
+        uint64_t mask = (bits_in_word == BITS_PER_WORD) ? UINT64_MAX : ((1ull << bits_in_word) - 1) << bit;
+        uint64_t before = region->bitmap[word];
+
+        if (used)
+        {
+            region->bitmap[word] = before | mask;
+            region->free_pages = region->free_pages - pmm_region_count_bits(mask & ~before);
+
+            if (before != UINT64_MAX && region->bitmap[word] == UINT64_MAX)
+            {
+                pmm_region_summary_mark_full(region, word);
+            }
+        }
+        else
+        {
+            region->bitmap[word] = before & ~mask;
+            region->free_pages = region->free_pages + pmm_region_count_bits(mask & before);
+
+            if (before == UINT64_MAX && region->bitmap[word] != UINT64_MAX)
+            {
+                pmm_region_summary_mark_not_full(region, word);
+            }
+        }
+
+        first = first + bits_in_word;
+        count = count - bits_in_word;
+    }
+}
+
+/*!
+    @brief Mark a range of pages as used.
+
+    Sets the bits of all pages in the range word by word and decrements the number of free pages by the number of pages that were free before.
+
+    @param region Pointer to the regions struct.
+    @param phys_address Physical address of the first page.
+    @param count Number of pages.
+    @returns PMM_REGION_ERROR if the range is not completely inside the region, otherwise PMM_REGION_OK.
+*/
+pmm_region_error_codes_t pmm_region_mark_range_used(struct pmm_region_t *region, uintptr_t phys_address, size_t count)
+{
+    if (!pmm_region_contains_range(region, phys_address, count))
+    {
+        LOG_ERROR("Range is not in region: phys address=%p, pages=%u, base=%p, len=%u!", phys_address, count, region->base, region->length);
+        return PMM_REGION_ERROR;
+    }
+
+    pmm_region_set_range(region, (phys_address - region->base) / PAGE_SIZE_BYTE, count, true);
+
     return PMM_REGION_OK;
 }
 
+/*!
+    @brief Mark a range of pages as free.
+
+    Clears the bits of all pages in the range word by word and increments the number of free pages by the number of pages that were used before.
+
+    @param region Pointer to the regions struct.
+    @param phys_address Physical address of the first page.
+    @param count Number of pages.
+    @returns PMM_REGION_ERROR if the range is not completely inside the region, otherwise PMM_REGION_OK.
+*/
+pmm_region_error_codes_t pmm_region_mark_range_free(struct pmm_region_t *region, uintptr_t phys_address, size_t count)
+{
+    if (!pmm_region_contains_range(region, phys_address, count))
+    {
+        LOG_ERROR("Range is not in region: phys address=%p, pages=%u, base=%p, len=%u!", phys_address, count, region->base, region->length);
+        return PMM_REGION_ERROR;
+    }
+
+    pmm_region_set_range(region, (phys_address - region->base) / PAGE_SIZE_BYTE, count, false);
+
+    return PMM_REGION_OK;
+}
+
+/*!
+    @brief Checks if all pages of a range are marked as used.
+
+    Works word by word like pmm_region_mark_range_used(), so a free page anywhere in the range is found without checking every bit on its own.
+
+    @param region Pointer to the regions struct.
+    @param phys_address Physical address of the first page.
+    @param count Number of pages.
+    @returns true if the range is completely inside the region and all of its pages are used, false if not.
+*/
+bool pmm_region_is_range_used(struct pmm_region_t *region, uintptr_t phys_address, size_t count)
+{
+    if (!pmm_region_contains_range(region, phys_address, count))
+    {
+        return false;
+    }
+
+    size_t first = (phys_address - region->base) / PAGE_SIZE_BYTE;
+    while (count > 0)
+    {
+        size_t word = first / BITS_PER_WORD;
+        size_t bit = first % BITS_PER_WORD;
+        size_t bits_in_word = BITS_PER_WORD - bit;
+        if (bits_in_word > count)
+        {
+            bits_in_word = count;
+        }
+
+        uint64_t mask = (bits_in_word == BITS_PER_WORD) ? UINT64_MAX : ((1ull << bits_in_word) - 1) << bit;
+        if ((region->bitmap[word] & mask) != mask)
+        {
+            return false;
+        }
+
+        first = first + bits_in_word;
+        count = count - bits_in_word;
+    }
+
+    return true;
+}
+
+/*!
+    @brief Search the next free page at or behind a page.
+
+    Full bitmap words are skipped using the first summary level, so 4096 pages are checked per word operation.
+
+    @param region Pointer to the regions struct.
+    @param from Index of the page where the search starts.
+    @param page Pointer to the variable where the index of the free page should be stored.
+    @returns true if a free page was found, false if there are no free pages behind from.
+*/
+static bool pmm_region_find_next_free_page(struct pmm_region_t *region, size_t from, size_t *page)
+{
+    size_t word = from / BITS_PER_WORD;
+    if (word >= region->bitmap_size)
+    {
+        return false;
+    }
+
+    // Look at the rest of the first word.
+    uint64_t free_bits = ~region->bitmap[word] & (UINT64_MAX << (from % BITS_PER_WORD));
+    if (free_bits != 0)
+    {
+        *page = word * BITS_PER_WORD + __builtin_ctzll(free_bits);
+        return true;
+    }
+
+    // Use the first summary level to find the next word that is not full.
+    word = word + 1;
+    while (word < region->bitmap_size)
+    {
+        uint64_t not_full = ~region->summary[0][word / BITS_PER_WORD] & (UINT64_MAX << (word % BITS_PER_WORD));
+        if (not_full == 0)
+        {
+            word = (word / BITS_PER_WORD + 1) * BITS_PER_WORD;
+            continue;
+        }
+
+        // Padding bits of the summary are always set, so this is a valid word.
+        word = (word / BITS_PER_WORD) * BITS_PER_WORD + __builtin_ctzll(not_full);
+        *page = word * BITS_PER_WORD + __builtin_ctzll(~region->bitmap[word]);
+        return true;
+    }
+
+    return false;
+}
+
+/*!
+    @brief Search the next run of free pages at or behind a page.
+
+    Finds the first free page at or behind from and counts the free pages directly following it.
+
+    @param region Pointer to the regions struct.
+    @param from Index of the page where the search starts.
+    @param first Pointer to the variable where the index of the runs first page should be stored.
+    @param count Pointer to the variable where the number of pages in the run should be stored.
+    @returns true if a run was found, false if there are no free pages behind from.
+*/
+bool pmm_region_find_free_run(struct pmm_region_t *region, size_t from, size_t *first, size_t *count)
+{
+    if (!pmm_region_find_next_free_page(region, from, first))
+    {
+        return false;
+    }
+
+    // Search the next used page. There always is one, as the bitmaps padding bits are set, unless the region ends at a word boundary.
+    size_t word = *first / BITS_PER_WORD;
+    uint64_t used_bits = region->bitmap[word] & (UINT64_MAX << (*first % BITS_PER_WORD));
+    while (used_bits == 0)
+    {
+        word = word + 1;
+        if (word == region->bitmap_size)
+        {
+            break;
+        }
+        used_bits = region->bitmap[word];
+    }
+
+    size_t end = (used_bits == 0) ? region->bitmap_size * BITS_PER_WORD : word * BITS_PER_WORD + __builtin_ctzll(used_bits);
+    *count = end - *first;
+
+    return true;
+}
+
+/*!
+    @brief Search the last used page in a range of pages.
+
+    Checks the range word by word, starting at its end.
+
+    @param region Pointer to the regions struct.
+    @param first Index of the first page of the range.
+    @param count Number of pages in the range. Must not be 0.
+    @param page Pointer to the variable where the index of the used page should be stored.
+    @returns true if a used page was found, false if all pages of the range are free.
+*/
+static bool pmm_region_find_last_used_page(struct pmm_region_t *region, size_t first, size_t count, size_t *page)
+{
+    size_t last = first + count - 1;
+    size_t first_word = first / BITS_PER_WORD;
+
+    for (size_t word = last / BITS_PER_WORD; ; word--)
+    {
+        uint64_t used_bits = region->bitmap[word];
+
+        // Ignore bits outside of the range.
+        if (word == last / BITS_PER_WORD)
+        {
+            used_bits = used_bits & (UINT64_MAX >> (BITS_PER_WORD - 1 - (last % BITS_PER_WORD)));
+        }
+        if (word == first_word)
+        {
+            used_bits = used_bits & (UINT64_MAX << (first % BITS_PER_WORD));
+        }
+
+        if (used_bits != 0)
+        {
+            *page = word * BITS_PER_WORD + (BITS_PER_WORD - 1 - __builtin_clzll(used_bits));
+            return true;
+        }
+
+        if (word == first_word)
+        {
+            return false;
+        }
+    }
+}
+
+/*!
+    @brief Search a range of contiguous free pages in a region.
+
+    Works on whole bitmap words: Full words are skipped using the first summary level,
+    and if a candidate range contains a used page, the search continues behind the last used page of the range.
+    The pages are NOT marked as used.
+
+    @param region Pointer to the regions struct.
+    @param count Number of contiguous pages needed.
+    @param alignment Alignment of the first pages physical address in byte. Must be a power of two and at least the page size.
+    @param page Pointer to the variable where the index of the first page of the range should be stored.
+    @returns true if a free range was found, false if not.
+*/
+bool pmm_region_find_free_range(struct pmm_region_t *region, size_t count, size_t alignment, size_t *page)
+{
+    size_t region_pages = region->length / PAGE_SIZE_BYTE;
+
+    if (count == 0 || count > region->free_pages)
+    {
+        return false;
+    }
+
+    // Pages are aligned in physical memory, not relative to the regions base.
+    size_t step = alignment / PAGE_SIZE_BYTE;
+    uintptr_t first_aligned_address = (region->base + alignment - 1) & ~((uintptr_t)alignment - 1);
+    if (first_aligned_address >= region->base + region_pages * PAGE_SIZE_BYTE)
+    {
+        return false;
+    }
+    size_t first_aligned = (first_aligned_address - region->base) / PAGE_SIZE_BYTE;
+
+    size_t candidate = first_aligned;
+    while (true)
+    {
+        // Skip used pages and move to the next aligned page.
+        size_t free_page;
+        if (!pmm_region_find_next_free_page(region, candidate, &free_page))
+        {
+            return false;
+        }
+        candidate = first_aligned + ((free_page - first_aligned + step - 1) / step) * step;
+
+        if (candidate >= region_pages || count > region_pages - candidate)
+        {
+            return false;
+        }
+
+        size_t used_page;
+        if (!pmm_region_find_last_used_page(region, candidate, count, &used_page))
+        {
+            *page = candidate;
+            return true;
+        }
+
+        // No range starting before the used page can fit, so continue behind it.
+        candidate = used_page + 1;
+    }
+}
+
+/*!
+    @brief Calculates how many bytes of metadata (bitmap and summary levels) a region needs.
+
+    @param region_length The regions length in byte.
+    @returns Number of bytes needed to store the regions bitmap and its summary levels.
+*/
+size_t pmm_region_get_metadata_size(ptrdiff_t region_length)
+{
+    size_t pages = region_length / PAGE_SIZE_BYTE;
+
+    // The bitmap is rounded up to full words.
+    size_t words = pmm_region_get_summary_words(pages);
+    size_t size = words * sizeof(uint64_t);
+
+    for (size_t level = 0; level < PMM_REGION_SUMMARY_LEVELS; level++)
+    {
+        words = pmm_region_get_summary_words(words);
+        size = size + words * sizeof(uint64_t);
+    }
+
+    return size;
+}
+
 /*!
     @brief Initialize a struct for a region.
 
+    The regions bitmap is placed at bitmap_base, its summary levels are placed directly behind it.
+    Use pmm_region_get_metadata_size() to find out how much space is needed.
+
     @param region Pointer to the region struct.
-    @param bitmap_base Pointer where the regions bitmap should be stored.
+    @param bitmap_base Pointer where the regions bitmap and summary levels should be stored.
     @param region_base Physical base address of the region.
     @param region_length The regions lenght in byte.
     @param region_type Type of memory the region consists of.
 */
-void pmm_region_init(struct pmm_region_t *region, uint8_t *bitmap_base, uintptr_t region_base, ptrdiff_t region_length, pmm_memory_types_t region_type)
+void pmm_region_init(struct pmm_region_t *region, uint64_t *bitmap_base, uintptr_t region_base, ptrdiff_t region_length, pmm_memory_types_t region_type)
 {
     region->base = region_base;
     region->length = region_length;
     region->type = region_type;
+    region->backend = NULL;
+    region->pages = NULL;
+    region->node = 0;
 
-    // Calculate how many pages are in the region. 
+    // Calculate how many pages are in the region.
     // The result is rounded down, in case the end is not page aligned.
     region->free_pages = region_length / PAGE_SIZE_BYTE;
-    
-    // Calculate how large the bitmap needs to be to store information about all pages.
-    // The result is rounded up, as otherwise a number of pages thats not divisible by eight would lead to a too small bitmap.
-    region->bitmap_size = ((region->free_pages + 7) / 8);
+
+    // Calculate how many words the bitmap needs to store information about all pages.
+    // The result is rounded up, as otherwise a number of pages thats not divisible by 64 would lead to a too small bitmap.
+    size_t words = pmm_region_get_summary_words(region->free_pages);
+    region->bitmap_size = words;
 
     // Set the pointer for the bitmap.
     region->bitmap = bitmap_base;
-    
+
+    // The summary levels follow directly behind the bitmap.
+    uint64_t *summary_base = bitmap_base + region->bitmap_size;
+    for (size_t level = 0; level < PMM_REGION_SUMMARY_LEVELS; level++)
+    {
+        words = pmm_region_get_summary_words(words);
+        region->summary[level] = summary_base;
+        region->summary_size[level] = words;
+        summary_base = summary_base + words;
+    }
+
     if (region->type == MEMMAP_TYPE_USABLE)
     {
         // If the regions memory is usable, mark all pages as free.
-        memset(region->bitmap, PMM_REGION_BITMAP_FREE, region->bitmap_size);
+        memset(region->bitmap, PMM_REGION_BITMAP_FREE, region->bitmap_size * sizeof(uint64_t));
+
+        // Bits behind the last page don't belong to a page, so they are marked as used to keep them from being allocated.
+        if (region->free_pages % BITS_PER_WORD != 0)
+        {
+            region->bitmap[region->bitmap_size - 1] = UINT64_MAX << (region->free_pages % BITS_PER_WORD);
+        }
     }
     else
     {
         // If the regions memory is not usable, mark all pages as used.
-        memset(region->bitmap, UINT8_MAX, region->bitmap_size);
+        memset(region->bitmap, UINT8_MAX, region->bitmap_size * sizeof(uint64_t));
         region->free_pages = 0;
-    }      
-}
\ No newline at end of file
+    }
+
+    pmm_region_rebuild_summary(region);
+}
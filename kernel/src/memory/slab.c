@@ -0,0 +1,559 @@
+#include "memory/slab.h"
+
+#include <stdbool.h>
+
+#include "cpu/cpu.h"
+#include "logging.h"
+#include "memory/pmm.h"
+
+#define PAGE_SIZE_BYTE 4096
+
+/// @brief Rounds x up to the next multiple of align. align must be a power of two.
+#define SLAB_ALIGN_UP(x, align) (((x) + (align) - 1) & ~((align) - 1))
+
+/*!
+    @brief Header of a slab, stored at the start of its first page.
+
+    Every page of the slab points to it through the private field of its struct page_t,
+    so the slab of an object can be found without searching.
+*/
+struct slab_t {
+    struct kmem_cache_t *cache;
+    /// @brief Neighbours in the caches partial, full or empty list.
+    struct slab_t *prev;
+    struct slab_t *next;
+    /// @brief List of free objects. The first word of a free object points to the next one.
+    void *free;
+    /// @brief Number of objects taken out of the slab, including the ones cached in the CPUs free lists.
+    size_t in_use;
+};
+
+/*!
+    @brief Free list of a CPU.
+
+    Holds objects that are still counted as used by their slabs, but are free to be handed out by the CPU owning the list.
+    Aligned to a cache line, so CPUs working on the same cache don't touch each others lines.
+*/
+struct kmem_cpu_list_t {
+    void *free;
+    size_t count;
+} __attribute__((aligned(CPU_CACHE_LINE_SIZE)));
+
+struct kmem_cache_t {
+    struct kmem_cpu_list_t cpu_lists[CPU_MAX_CPUS];
+
+    size_t object_size;
+    size_t slab_pages;
+    size_t objects_per_slab;
+    /// @brief Offset of the first object from the start of the slab. The slab header is stored in front of it.
+    size_t first_object_offset;
+
+    /// @brief Slabs with some free objects. Objects are taken from them first.
+    struct slab_t *partial_slabs;
+    /// @brief Slabs without any free objects.
+    struct slab_t *full_slabs;
+    /// @brief Slabs without any used objects.
+    struct slab_t *empty_slabs;
+    size_t num_slabs;
+    size_t num_empty_slabs;
+    /// @brief Number of objects taken out of the slabs, including the ones cached in the CPUs free lists.
+    size_t objects_in_use;
+};
+
+static bool slab_initialized = false;
+
+static ptrdiff_t slab_hhdm_offset = 0;
+
+// The caches themselves are objects of this cache.
+static struct kmem_cache_t slab_cache_cache;
+
+/*!
+    @brief Adds a slab to the front of a list.
+
+    @param list Pointer to the head of the list.
+    @param slab The slab.
+*/
+static void slab_list_add(struct slab_t **list, struct slab_t *slab)
+{
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list != NULL)
+    {
+        (*list)->prev = slab;
+    }
+    *list = slab;
+}
+
+/*!
+    @brief Removes a slab from a list.
+
+    @param list Pointer to the head of the list.
+    @param slab The slab. Must be in the list.
+*/
+static void slab_list_remove(struct slab_t **list, struct slab_t *slab)
+{
+    if (slab->prev != NULL)
+    {
+        slab->prev->next = slab->next;
+    }
+    else
+    {
+        *list = slab->next;
+    }
+
+    if (slab->next != NULL)
+    {
+        slab->next->prev = slab->prev;
+    }
+
+    slab->prev = NULL;
+    slab->next = NULL;
+}
+
+/*!
+    @brief Creates a new slab for a cache and adds it to the caches empty list.
+
+    Allocates the pages, chains all objects into the slabs free list and points the page structs to the slab header.
+
+    @param cache The cache.
+    @returns Pointer to the slab, or NULL if the PMM is out of memory.
+*/
+static struct slab_t * slab_create(struct kmem_cache_t *cache)
+{
+    void *phys = pmm_alloc_pages(cache->slab_pages, 0);
+    if (phys == NULL)
+    {
+        return NULL;
+    }
+
+    uintptr_t base = (uintptr_t)phys + slab_hhdm_offset;
+
+    struct slab_t *slab = (struct slab_t *)base;
+    slab->cache = cache;
+    slab->free = NULL;
+    slab->in_use = 0;
+
+    // Chain the objects from back to front, so they are handed out in ascending order.
+    for (size_t i = cache->objects_per_slab; i > 0; i--)
+    {
+        void *object = (void *)(base + cache->first_object_offset + (i - 1) * cache->object_size);
+        *(void **)object = slab->free;
+        slab->free = object;
+    }
+
+    // The pages of a slab lie inside a single region, so their structs are contiguous as well.
+    struct page_t *page = phys_to_page((uintptr_t)phys);
+    for (size_t i = 0; i < cache->slab_pages; i++)
+    {
+        page[i].owner = PAGE_OWNER_SLAB;
+        page[i].private = (uint64_t)slab;
+    }
+
+    slab_list_add(&cache->empty_slabs, slab);
+    cache->num_slabs = cache->num_slabs + 1;
+    cache->num_empty_slabs = cache->num_empty_slabs + 1;
+
+    return slab;
+}
+
+/*!
+    @brief Gives an empty slab back to the PMM.
+
+    @param cache The cache owning the slab.
+    @param slab The slab. Must be in the caches empty list.
+*/
+static void slab_destroy(struct kmem_cache_t *cache, struct slab_t *slab)
+{
+    slab_list_remove(&cache->empty_slabs, slab);
+    cache->num_slabs = cache->num_slabs - 1;
+    cache->num_empty_slabs = cache->num_empty_slabs - 1;
+
+    pmm_free_pages((void *)((uintptr_t)slab - slab_hhdm_offset), cache->slab_pages);
+}
+
+/*!
+    @brief Finds the slab an object belongs to.
+
+    @param object Pointer (virtual address) to the object.
+    @returns Pointer to the slab, or NULL if the object isn't part of any slab.
+*/
+static struct slab_t * slab_get_slab(void *object)
+{
+    struct page_t *page = phys_to_page((uintptr_t)object - slab_hhdm_offset);
+    if (page == NULL || page->owner != PAGE_OWNER_SLAB)
+    {
+        return NULL;
+    }
+
+    return (struct slab_t *)page->private;
+}
+
+/*!
+    @brief Moves up to SLAB_CPU_LIST_BATCH objects from the caches slabs to a CPUs free list.
+
+    Partially used slabs are emptied first, so free memory stays concentrated in as few slabs as possible.
+    If there is no free object left, a new slab is created.
+
+    @param cache The cache.
+    @param list Free list of the current CPU.
+*/
+static void slab_cpu_list_refill(struct kmem_cache_t *cache, struct kmem_cpu_list_t *list)
+{
+    size_t moved = 0;
+
+    while (moved < SLAB_CPU_LIST_BATCH)
+    {
+        struct slab_t *slab = cache->partial_slabs;
+
+        if (slab == NULL)
+        {
+            slab = cache->empty_slabs;
+            if (slab == NULL)
+            {
+                slab = slab_create(cache);
+                if (slab == NULL)
+                {
+                    break;
+                }
+            }
+
+            slab_list_remove(&cache->empty_slabs, slab);
+            cache->num_empty_slabs = cache->num_empty_slabs - 1;
+            slab_list_add(&cache->partial_slabs, slab);
+        }
+
+        while (moved < SLAB_CPU_LIST_BATCH && slab->free != NULL)
+        {
+            void *object = slab->free;
+            slab->free = *(void **)object;
+            slab->in_use = slab->in_use + 1;
+
+            *(void **)object = list->free;
+            list->free = object;
+            list->count = list->count + 1;
+            moved = moved + 1;
+        }
+
+        if (slab->free == NULL)
+        {
+            slab_list_remove(&cache->partial_slabs, slab);
+            slab_list_add(&cache->full_slabs, slab);
+        }
+    }
+
+    cache->objects_in_use = cache->objects_in_use + moved;
+}
+
+/*!
+    @brief Gives SLAB_CPU_LIST_BATCH objects of a CPUs free list back to their slabs.
+
+    Slabs that become completely free are kept up to SLAB_MAX_EMPTY_SLABS, the rest is given back to the PMM.
+
+    @param cache The cache.
+    @param list Free list of the current CPU.
+*/
+static void slab_cpu_list_drain(struct kmem_cache_t *cache, struct kmem_cpu_list_t *list)
+{
+    for (size_t i = 0; i < SLAB_CPU_LIST_BATCH && list->free != NULL; i++)
+    {
+        void *object = list->free;
+        list->free = *(void **)object;
+        list->count = list->count - 1;
+
+        struct slab_t *slab = slab_get_slab(object);
+
+        if (slab->free == NULL)
+        {
+            // The slab was full, now it has a free object again.
+            slab_list_remove(&cache->full_slabs, slab);
+            slab_list_add(&cache->partial_slabs, slab);
+        }
+
+        *(void **)object = slab->free;
+        slab->free = object;
+        slab->in_use = slab->in_use - 1;
+        cache->objects_in_use = cache->objects_in_use - 1;
+
+        if (slab->in_use == 0)
+        {
+            slab_list_remove(&cache->partial_slabs, slab);
+            slab_list_add(&cache->empty_slabs, slab);
+            cache->num_empty_slabs = cache->num_empty_slabs + 1;
+
+            if (cache->num_empty_slabs > SLAB_MAX_EMPTY_SLABS)
+            {
+                slab_destroy(cache, slab);
+            }
+        }
+    }
+}
+
+/*!
+    @brief Sets up the layout of a cache.
+
+    @param cache The cache.
+    @param size Size of an object in byte.
+    @param align Alignment of the objects in byte. Must be 0 or a power of two up to the page size.
+    @returns true on success, false if the arguments are invalid.
+*/
+static bool slab_cache_setup(struct kmem_cache_t *cache, size_t size, size_t align)
+{
+    if (size == 0 || (align & (align - 1)) != 0 || align > PAGE_SIZE_BYTE)
+    {
+        LOG_ERROR("Invalid arguments: size=%u, align=%u", size, align);
+        return false;
+    }
+
+    // Free objects store a pointer to the next one.
+    if (size < sizeof(void *))
+    {
+        size = sizeof(void *);
+    }
+
+    if (align == 0)
+    {
+        // Use cache line alignment, but pack objects that are a lot smaller than a cache line.
+        align = CPU_CACHE_LINE_SIZE;
+        while (align / 2 >= size)
+        {
+            align = align / 2;
+        }
+    }
+
+    if (align < sizeof(void *))
+    {
+        align = sizeof(void *);
+    }
+
+    size_t object_size = SLAB_ALIGN_UP(size, align);
+    size_t first_object_offset = SLAB_ALIGN_UP(sizeof(struct slab_t), align);
+
+    // Use the smallest slab that wastes at most an eighth of its memory.
+    size_t slab_pages = 1;
+    while (slab_pages < SLAB_MAX_PAGES)
+    {
+        size_t slab_size = slab_pages * PAGE_SIZE_BYTE;
+        if (slab_size > first_object_offset)
+        {
+            size_t objects = (slab_size - first_object_offset) / object_size;
+            size_t waste = slab_size - first_object_offset - objects * object_size;
+            if (objects > 0 && waste * 8 <= slab_size)
+            {
+                break;
+            }
+        }
+
+        slab_pages = slab_pages * 2;
+    }
+
+    size_t slab_size = slab_pages * PAGE_SIZE_BYTE;
+    if (slab_size <= first_object_offset || (slab_size - first_object_offset) / object_size == 0)
+    {
+        LOG_ERROR("Objects of %u bytes don't fit into a slab.", size);
+        return false;
+    }
+
+    for (size_t i = 0; i < CPU_MAX_CPUS; i++)
+    {
+        cache->cpu_lists[i].free = NULL;
+        cache->cpu_lists[i].count = 0;
+    }
+
+    cache->object_size = object_size;
+    cache->slab_pages = slab_pages;
+    cache->objects_per_slab = (slab_size - first_object_offset) / object_size;
+    cache->first_object_offset = first_object_offset;
+    cache->partial_slabs = NULL;
+    cache->full_slabs = NULL;
+    cache->empty_slabs = NULL;
+    cache->num_slabs = 0;
+    cache->num_empty_slabs = 0;
+    cache->objects_in_use = 0;
+
+    return true;
+}
+
+/*!
+    @brief Initializes the slab allocator.
+
+    Must be called after pmm_init().
+
+    @param hhdm_offset Offset used by the higher half direct map.
+    @returns SLAB_OK on success.
+*/
+slab_error_codes_t slab_init(ptrdiff_t hhdm_offset)
+{
+    slab_hhdm_offset = hhdm_offset;
+
+    if (!slab_cache_setup(&slab_cache_cache, sizeof(struct kmem_cache_t), _Alignof(struct kmem_cache_t)))
+    {
+        return SLAB_ERROR_NOT_INITIALIZED;
+    }
+
+    slab_initialized = true;
+
+    LOG_INFO("Slab allocator initialized.");
+
+    return SLAB_OK;
+}
+
+/*!
+    @brief Creates a cache for objects of a fixed size.
+
+    The objects are aligned to align. If align is 0, they are aligned to the cache line size,
+    or to the next power of two of their size if they are smaller than half a cache line, so small objects are still packed tightly.
+    The slab size is picked so that at most an eighth of a slab is wasted, up to SLAB_MAX_PAGES pages.
+
+    @param size Size of an object in byte.
+    @param align Alignment of the objects in byte. Must be 0 or a power of two up to the page size.
+    @returns Pointer to the new cache, or NULL if the arguments are invalid or no memory is left.
+*/
+struct kmem_cache_t * kmem_cache_create(size_t size, size_t align)
+{
+    if (!slab_initialized)
+    {
+        LOG_ERROR("Slab allocator is not initialized.");
+        return NULL;
+    }
+
+    struct kmem_cache_t *cache = kmem_cache_alloc(&slab_cache_cache);
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+
+    if (!slab_cache_setup(cache, size, align))
+    {
+        kmem_cache_free(&slab_cache_cache, cache);
+        return NULL;
+    }
+
+    LOG_DEBUG("Created cache: object size=%u, %u objects per slab of %u pages.", cache->object_size, cache->objects_per_slab, cache->slab_pages);
+
+    return cache;
+}
+
+/*!
+    @brief Allocates an object from a cache.
+
+    Takes the object from the free list of the current CPU.
+    Only if it is empty, it is refilled with SLAB_CPU_LIST_BATCH objects from the caches slabs, creating a new slab if all of them are full.
+    Interrupts are disabled while the free list is accessed, so allocating from interrupt handlers is safe.
+
+    @param cache Cache to allocate from.
+    @returns Pointer (virtual address) to the object, or NULL if no memory is left.
+*/
+void * kmem_cache_alloc(struct kmem_cache_t *cache)
+{
+    uint64_t rflags = cpu_disable_interrupts();
+
+    struct kmem_cpu_list_t *list = &cache->cpu_lists[cpu_get_id()];
+
+    if (list->count == 0)
+    {
+        slab_cpu_list_refill(cache, list);
+    }
+
+    void *object = list->free;
+    if (object != NULL)
+    {
+        list->free = *(void **)object;
+        list->count = list->count - 1;
+    }
+
+    cpu_restore_interrupts(rflags);
+
+    return object;
+}
+
+/*!
+    @brief Frees an object that was allocated from a cache.
+
+    Pushes the object onto the free list of the current CPU.
+    If the list is full, SLAB_CPU_LIST_BATCH objects are given back to their slabs first.
+
+    @param cache Cache the object was allocated from.
+    @param object Pointer (virtual address) to the object.
+    @returns SLAB_OK on success, SLAB_ERROR_INVALID_OBJECT if the object doesn't belong to the cache.
+*/
+slab_error_codes_t kmem_cache_free(struct kmem_cache_t *cache, void *object)
+{
+    struct slab_t *slab = slab_get_slab(object);
+    if (slab == NULL || slab->cache != cache || ((uintptr_t)object - (uintptr_t)slab - cache->first_object_offset) % cache->object_size != 0)
+    {
+        LOG_ERROR("%p is not an object of this cache.", object);
+        return SLAB_ERROR_INVALID_OBJECT;
+    }
+
+    uint64_t rflags = cpu_disable_interrupts();
+
+    struct kmem_cpu_list_t *list = &cache->cpu_lists[cpu_get_id()];
+
+    if (list->count == SLAB_CPU_LIST_SIZE)
+    {
+        slab_cpu_list_drain(cache, list);
+    }
+
+    *(void **)object = list->free;
+    list->free = object;
+    list->count = list->count + 1;
+
+    cpu_restore_interrupts(rflags);
+
+    return SLAB_OK;
+}
+
+/*!
+    @brief Finds the cache an object belongs to.
+
+    Uses the struct page_t of the objects page, so it takes constant time.
+
+    @param object Pointer (virtual address) to the object.
+    @returns Pointer to the cache, or NULL if the object isn't part of any slab.
+*/
+struct kmem_cache_t * kmem_cache_find(void *object)
+{
+    struct slab_t *slab = slab_get_slab(object);
+    if (slab == NULL)
+    {
+        return NULL;
+    }
+
+    return slab->cache;
+}
+
+/*!
+    @brief Gets the size of the objects of a cache.
+
+    @param cache The cache.
+    @returns Size of an object including padding for alignment, so all of it can be used.
+*/
+size_t kmem_cache_get_object_size(struct kmem_cache_t *cache)
+{
+    return cache->object_size;
+}
+
+/*!
+    @brief Gets statistics of a cache.
+
+    @param cache The cache.
+    @param stats Pointer to the struct where the statistics should be stored.
+*/
+void kmem_cache_get_stats(struct kmem_cache_t *cache, struct kmem_cache_stats_t *stats)
+{
+    uint64_t rflags = cpu_disable_interrupts();
+
+    size_t cached = 0;
+    for (size_t i = 0; i < CPU_MAX_CPUS; i++)
+    {
+        cached = cached + cache->cpu_lists[i].count;
+    }
+
+    stats->object_size = cache->object_size;
+    stats->slab_pages = cache->slab_pages;
+    stats->objects_per_slab = cache->objects_per_slab;
+    stats->slabs = cache->num_slabs;
+    stats->objects_in_use = cache->objects_in_use - cached;
+
+    cpu_restore_interrupts(rflags);
+}
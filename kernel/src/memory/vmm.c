@@ -0,0 +1,780 @@
+#include "memory/vmm.h"
+
+#include <stdbool.h>
+
+#include "cpu/cpu.h"
+#include "cpu/registers.h"
+#include "logging.h"
+#include "memory/pmm.h"
+#include "memory/slab.h"
+
+#define PAGE_SIZE_BYTE 4096
+
+/// @brief Rounds x up to the next multiple of align. align must be a power of two.
+#define VMM_ALIGN_UP(x, align) (((x) + (align) - 1) & ~((uintptr_t)(align) - 1))
+
+/// @brief Internal flag of reserved ranges that are backed by pages, i.e. were allocated by vmm_alloc().
+#define VMM_RANGE_BACKED (1u << 31)
+
+/// @brief Bit of the page fault error code that is set if the page was present, i.e. the fault is a protection violation.
+#define VMM_PAGE_FAULT_PRESENT (1 << 0)
+
+/*!
+    @brief A range of virtual addresses. Node of an AVL tree sorted by base address.
+*/
+struct vmm_range_t {
+    uintptr_t base;
+    size_t length;
+    /// @brief Largest length of a range in the subtree starting at this node, including the node itself.
+    size_t max_length;
+    struct vmm_range_t *left;
+    struct vmm_range_t *right;
+    /// @brief Height of the subtree starting at this node, 1 for leaves.
+    int32_t height;
+    /// @brief VMM_FLAG_* flags the range was reserved with, plus VMM_RANGE_BACKED. Unused for free ranges.
+    uint32_t flags;
+};
+
+static bool vmm_initialized = false;
+
+static union page_table_entry_t *vmm_pml4 = NULL;
+
+// The nodes of both trees are allocated from this cache.
+static struct kmem_cache_t *vmm_range_cache = NULL;
+
+static struct vmm_range_t *vmm_free_ranges = NULL;
+static struct vmm_range_t *vmm_reserved_ranges = NULL;
+
+static size_t vmm_free_size = 0;
+
+static struct vmm_fault_stats_t vmm_fault_stats = {
+    .handled = 0,
+    .unhandled = 0,
+    .total_cycles = 0,
+    .min_cycles = UINT64_MAX,
+    .max_cycles = 0};
+
+static inline int32_t vmm_tree_height(struct vmm_range_t *node)
+{
+    return node == NULL ? 0 : node->height;
+}
+
+static inline size_t vmm_tree_max_length(struct vmm_range_t *node)
+{
+    return node == NULL ? 0 : node->max_length;
+}
+
+/*!
+    @brief Recalculates the height and the largest length of a node from its children.
+
+    @param node The node.
+*/
+static void vmm_tree_update(struct vmm_range_t *node)
+{
+    int32_t left_height = vmm_tree_height(node->left);
+    int32_t right_height = vmm_tree_height(node->right);
+    node->height = 1 + (left_height > right_height ? left_height : right_height);
+
+    size_t max_length = node->length;
+    if (vmm_tree_max_length(node->left) > max_length)
+    {
+        max_length = vmm_tree_max_length(node->left);
+    }
+    if (vmm_tree_max_length(node->right) > max_length)
+    {
+        max_length = vmm_tree_max_length(node->right);
+    }
+    node->max_length = max_length;
+}
+
+static struct vmm_range_t * vmm_tree_rotate_left(struct vmm_range_t *node)
+{
+    struct vmm_range_t *right = node->right;
+    node->right = right->left;
+    right->left = node;
+
+    vmm_tree_update(node);
+    vmm_tree_update(right);
+
+    return right;
+}
+
+static struct vmm_range_t * vmm_tree_rotate_right(struct vmm_range_t *node)
+{
+    struct vmm_range_t *left = node->left;
+    node->left = left->right;
+    left->right = node;
+
+    vmm_tree_update(node);
+    vmm_tree_update(left);
+
+    return left;
+}
+
+/*!
+    @brief Updates a node and rotates its subtree if the heights of its children differ by more than one.
+
+    @param node Root of the subtree.
+    @returns New root of the subtree.
+*/
+static struct vmm_range_t * vmm_tree_balance(struct vmm_range_t *node)
+{
+    vmm_tree_update(node);
+
+    int32_t balance = vmm_tree_height(node->left) - vmm_tree_height(node->right);
+
+    if (balance > 1)
+    {
+        if (vmm_tree_height(node->left->left) < vmm_tree_height(node->left->right))
+        {
+            node->left = vmm_tree_rotate_left(node->left);
+        }
+        return vmm_tree_rotate_right(node);
+    }
+
+    if (balance < -1)
+    {
+        if (vmm_tree_height(node->right->right) < vmm_tree_height(node->right->left))
+        {
+            node->right = vmm_tree_rotate_right(node->right);
+        }
+        return vmm_tree_rotate_left(node);
+    }
+
+    return node;
+}
+
+/*!
+    @brief Inserts a node into a tree.
+
+    @param root Root of the tree.
+    @param node Node to insert. Its base must not be in the tree yet.
+    @returns New root of the tree.
+*/
+static struct vmm_range_t * vmm_tree_insert(struct vmm_range_t *root, struct vmm_range_t *node)
+{
+    if (root == NULL)
+    {
+        node->left = NULL;
+        node->right = NULL;
+        vmm_tree_update(node);
+        return node;
+    }
+
+    if (node->base < root->base)
+    {
+        root->left = vmm_tree_insert(root->left, node);
+    }
+    else
+    {
+        root->right = vmm_tree_insert(root->right, node);
+    }
+
+    return vmm_tree_balance(root);
+}
+
+/*!
+    @brief Removes the node with the lowest base from a tree.
+
+    @param root Root of the tree. Must not be empty.
+    @param min Pointer to where the removed node is stored.
+    @returns New root of the tree.
+*/
+static struct vmm_range_t * vmm_tree_remove_min(struct vmm_range_t *root, struct vmm_range_t **min)
+{
+    if (root->left == NULL)
+    {
+        *min = root;
+        return root->right;
+    }
+
+    root->left = vmm_tree_remove_min(root->left, min);
+
+    return vmm_tree_balance(root);
+}
+
+/*!
+    @brief Removes the node with a base address from a tree.
+
+    @param root Root of the tree.
+    @param base Base address of the node.
+    @param removed Pointer to where the removed node is stored, NULL if there is no such node.
+    @returns New root of the tree.
+*/
+static struct vmm_range_t * vmm_tree_remove(struct vmm_range_t *root, uintptr_t base, struct vmm_range_t **removed)
+{
+    if (root == NULL)
+    {
+        *removed = NULL;
+        return NULL;
+    }
+
+    if (base < root->base)
+    {
+        root->left = vmm_tree_remove(root->left, base, removed);
+    }
+    else if (base > root->base)
+    {
+        root->right = vmm_tree_remove(root->right, base, removed);
+    }
+    else
+    {
+        *removed = root;
+
+        if (root->left == NULL)
+        {
+            return root->right;
+        }
+        if (root->right == NULL)
+        {
+            return root->left;
+        }
+
+        // Replace the node by the lowest node of its right subtree.
+        struct vmm_range_t *successor;
+        struct vmm_range_t *right = vmm_tree_remove_min(root->right, &successor);
+        successor->left = root->left;
+        successor->right = right;
+
+        return vmm_tree_balance(successor);
+    }
+
+    return vmm_tree_balance(root);
+}
+
+/*!
+    @brief Finds the node with a base address.
+
+    @param root Root of the tree.
+    @param base Base address of the node.
+    @returns The node, or NULL if there is none.
+*/
+static struct vmm_range_t * vmm_tree_find(struct vmm_range_t *root, uintptr_t base)
+{
+    struct vmm_range_t *node = root;
+
+    while (node != NULL && node->base != base)
+    {
+        node = base < node->base ? node->left : node->right;
+    }
+
+    return node;
+}
+
+/*!
+    @brief Finds the node with the highest base address below an address.
+
+    @param root Root of the tree.
+    @param address The address.
+    @returns The node, or NULL if all nodes start at or above address.
+*/
+static struct vmm_range_t * vmm_tree_find_below(struct vmm_range_t *root, uintptr_t address)
+{
+    struct vmm_range_t *below = NULL;
+    struct vmm_range_t *node = root;
+
+    while (node != NULL)
+    {
+        if (node->base < address)
+        {
+            below = node;
+            node = node->right;
+        }
+        else
+        {
+            node = node->left;
+        }
+    }
+
+    return below;
+}
+
+/*!
+    @brief Finds the free range with the lowest address that can hold an aligned range of a given length.
+
+    Subtrees whose largest range is shorter than length are skipped, so for page aligned requests this takes O(log n).
+    Larger alignments might have to look at ranges that are large enough, but can't fit the aligned range.
+
+    @param root Root of the free tree.
+    @param length Length of the wanted range.
+    @param alignment Alignment of the wanted range.
+    @param base Pointer to where the aligned base address inside the found range is stored.
+    @returns The free range, or NULL if none is large enough.
+*/
+static struct vmm_range_t * vmm_tree_find_fit(struct vmm_range_t *root, size_t length, size_t alignment, uintptr_t *base)
+{
+    if (root == NULL || root->max_length < length)
+    {
+        return NULL;
+    }
+
+    struct vmm_range_t *found = vmm_tree_find_fit(root->left, length, alignment, base);
+    if (found != NULL)
+    {
+        return found;
+    }
+
+    uintptr_t aligned_base = VMM_ALIGN_UP(root->base, alignment);
+    if (aligned_base - root->base < root->length && root->length - (aligned_base - root->base) >= length)
+    {
+        *base = aligned_base;
+        return root;
+    }
+
+    return vmm_tree_find_fit(root->right, length, alignment, base);
+}
+
+/*!
+    @brief Takes a range out of the free tree and puts it into the tree of reserved ranges.
+
+    @param length Length of the range. Must be a multiple of the page size.
+    @param alignment Alignment of the range. Must be a power of two and at least the page size.
+    @param flags Flags to store in the reserved range.
+    @returns Base address of the range, 0 if no free range is large enough or memory for the nodes could not be allocated.
+*/
+static uintptr_t vmm_reserve_range(size_t length, size_t alignment, uint32_t flags)
+{
+    // Allocate the nodes up front, so nothing can fail once the free tree is being changed.
+    // One node holds the reservation, one might be needed if the free range is split in three.
+    struct vmm_range_t *reserved = kmem_cache_alloc(vmm_range_cache);
+    struct vmm_range_t *spare = kmem_cache_alloc(vmm_range_cache);
+    if (reserved == NULL || spare == NULL)
+    {
+        if (reserved != NULL)
+        {
+            kmem_cache_free(vmm_range_cache, reserved);
+        }
+        if (spare != NULL)
+        {
+            kmem_cache_free(vmm_range_cache, spare);
+        }
+        return 0;
+    }
+
+    uint64_t rflags = cpu_disable_interrupts();
+
+    uintptr_t base;
+    struct vmm_range_t *range = vmm_tree_find_fit(vmm_free_ranges, length, alignment, &base);
+    if (range == NULL)
+    {
+        cpu_restore_interrupts(rflags);
+
+        LOG_WARNING("No free virtual address range of %u bytes.", length);
+        kmem_cache_free(vmm_range_cache, reserved);
+        kmem_cache_free(vmm_range_cache, spare);
+        return 0;
+    }
+
+    vmm_free_ranges = vmm_tree_remove(vmm_free_ranges, range->base, &range);
+
+    uintptr_t range_end = range->base + range->length;
+
+    // Put back what is left in front of and behind the reserved part.
+    if (base > range->base)
+    {
+        range->length = base - range->base;
+        vmm_free_ranges = vmm_tree_insert(vmm_free_ranges, range);
+        range = spare;
+        spare = NULL;
+    }
+    if (base + length < range_end)
+    {
+        range->base = base + length;
+        range->length = range_end - (base + length);
+        vmm_free_ranges = vmm_tree_insert(vmm_free_ranges, range);
+        range = NULL;
+    }
+
+    reserved->base = base;
+    reserved->length = length;
+    reserved->flags = flags;
+    vmm_reserved_ranges = vmm_tree_insert(vmm_reserved_ranges, reserved);
+
+    vmm_free_size = vmm_free_size - length;
+
+    cpu_restore_interrupts(rflags);
+
+    // Give back the nodes that weren't needed.
+    if (range != NULL)
+    {
+        kmem_cache_free(vmm_range_cache, range);
+    }
+    if (spare != NULL)
+    {
+        kmem_cache_free(vmm_range_cache, spare);
+    }
+
+    return base;
+}
+
+/*!
+    @brief Puts a reserved range back into the free tree, merging it with its free neighbours.
+
+    @param range The range. Must not be in any tree.
+*/
+static void vmm_release_range(struct vmm_range_t *range)
+{
+    struct vmm_range_t *unused[2] = {NULL, NULL};
+
+    uint64_t rflags = cpu_disable_interrupts();
+
+    vmm_free_size = vmm_free_size + range->length;
+
+    struct vmm_range_t *previous = vmm_tree_find_below(vmm_free_ranges, range->base);
+    if (previous != NULL && previous->base + previous->length == range->base)
+    {
+        vmm_free_ranges = vmm_tree_remove(vmm_free_ranges, previous->base, &previous);
+        range->base = previous->base;
+        range->length = range->length + previous->length;
+        unused[0] = previous;
+    }
+
+    struct vmm_range_t *next = vmm_tree_find(vmm_free_ranges, range->base + range->length);
+    if (next != NULL)
+    {
+        vmm_free_ranges = vmm_tree_remove(vmm_free_ranges, next->base, &next);
+        range->length = range->length + next->length;
+        unused[1] = next;
+    }
+
+    vmm_free_ranges = vmm_tree_insert(vmm_free_ranges, range);
+
+    cpu_restore_interrupts(rflags);
+
+    for (size_t i = 0; i < 2; i++)
+    {
+        if (unused[i] != NULL)
+        {
+            kmem_cache_free(vmm_range_cache, unused[i]);
+        }
+    }
+}
+
+/*!
+    @brief Unmaps pages and gives them back to the PMM.
+
+    Works in batches of VMM_BATCH_SIZE pages, so each batch only needs one page table walk per page table and one call to pmm_free_batch().
+    Pages that aren't mapped are skipped.
+
+    @param virt Virtual address of the first page.
+    @param count Number of pages.
+*/
+static void vmm_unmap_and_free_pages(uintptr_t virt, size_t count)
+{
+    void *pages[VMM_BATCH_SIZE];
+
+    for (size_t done = 0; done < count;)
+    {
+        size_t batch = count - done < VMM_BATCH_SIZE ? count - done : VMM_BATCH_SIZE;
+
+        paging_unmap_pages(vmm_pml4, virt + done * PAGE_SIZE_BYTE, batch, pages);
+
+        // Drop the pages that weren't mapped.
+        size_t mapped = 0;
+        for (size_t i = 0; i < batch; i++)
+        {
+            if (pages[i] != NULL)
+            {
+                pages[mapped] = pages[i];
+                mapped = mapped + 1;
+            }
+        }
+
+        pmm_free_batch(pages, mapped);
+
+        done = done + batch;
+    }
+}
+
+/*!
+    @brief Initializes the VMM.
+
+    The whole range from VMM_KERNEL_BASE to VMM_KERNEL_END starts out free.
+    Must be called after slab_init(), as the nodes of the trees are allocated from a slab cache.
+
+    @param pml4 Pointer (virtual address) to the PML4 that ranges are mapped in.
+    @returns VMM_OK on success, VMM_ERROR_NOT_INITIALIZED if memory for the trees could not be allocated.
+*/
+vmm_error_codes_t vmm_init(union page_table_entry_t *pml4)
+{
+    vmm_pml4 = pml4;
+
+    vmm_range_cache = kmem_cache_create(sizeof(struct vmm_range_t), 0);
+    if (vmm_range_cache == NULL)
+    {
+        return VMM_ERROR_NOT_INITIALIZED;
+    }
+
+    struct vmm_range_t *range = kmem_cache_alloc(vmm_range_cache);
+    if (range == NULL)
+    {
+        return VMM_ERROR_NOT_INITIALIZED;
+    }
+
+    range->base = VMM_KERNEL_BASE;
+    range->length = VMM_KERNEL_END - VMM_KERNEL_BASE;
+    range->flags = 0;
+    vmm_free_ranges = vmm_tree_insert(NULL, range);
+    vmm_free_size = range->length;
+
+    vmm_initialized = true;
+
+    LOG_INFO("VMM initialized, managing %p - %p.", VMM_KERNEL_BASE, VMM_KERNEL_END);
+
+    return VMM_OK;
+}
+
+/*!
+    @brief Reserves a range of virtual addresses without mapping anything.
+
+    Takes the lowest free range that is large enough (first fit).
+
+    @param size Size of the range in byte. Is rounded up to whole pages.
+    @param alignment Alignment of the range in byte. Must be 0 or a power of two. Values below the page size are treated as the page size.
+    @returns Virtual address of the range, or NULL if no free range is large enough.
+*/
+void * vmm_reserve(size_t size, size_t alignment)
+{
+    if (!vmm_initialized || size == 0 || (alignment & (alignment - 1)) != 0)
+    {
+        LOG_ERROR("Invalid arguments: size=%u, alignment=%p", size, alignment);
+        return NULL;
+    }
+
+    if (alignment < PAGE_SIZE_BYTE)
+    {
+        alignment = PAGE_SIZE_BYTE;
+    }
+
+    return (void *)vmm_reserve_range(VMM_ALIGN_UP(size, PAGE_SIZE_BYTE), alignment, 0);
+}
+
+/*!
+    @brief Reserves a range of virtual addresses, backs it with physical pages and maps them.
+
+    The pages are taken from the PMM in batches of VMM_BATCH_SIZE and mapped with paging_map_pages().
+    They don't need to be physically contiguous.
+    Like all kernel data, the range is mapped global and not executable (see paging_get_kernel_flags()).
+    If something goes wrong, everything allocated so far is given back.
+    With VMM_FLAG_LAZY only the range is reserved, its pages are mapped by vmm_handle_page_fault() when they are first accessed.
+
+    @param size Size of the range in byte. Is rounded up to whole pages.
+    @param flags Combination of VMM_FLAG_* flags.
+    @returns Virtual address of the range, or NULL if no free range is large enough or the PMM is out of memory.
+*/
+void * vmm_alloc(size_t size, uint32_t flags)
+{
+    if (!vmm_initialized || size == 0)
+    {
+        LOG_ERROR("Invalid arguments: size=%u", size);
+        return NULL;
+    }
+
+    size_t count = VMM_ALIGN_UP(size, PAGE_SIZE_BYTE) / PAGE_SIZE_BYTE;
+
+    uintptr_t base = vmm_reserve_range(count * PAGE_SIZE_BYTE, PAGE_SIZE_BYTE, flags | VMM_RANGE_BACKED);
+    if (base == 0)
+    {
+        return NULL;
+    }
+
+    if (flags & VMM_FLAG_LAZY)
+    {
+        return (void *)base;
+    }
+
+    uint64_t paging_flags = PAGING_FLAG_PRESENT | paging_get_kernel_flags();
+    if (flags & VMM_FLAG_WRITABLE)
+    {
+        paging_flags = paging_flags | PAGING_FLAG_WRITABLE;
+    }
+
+    void *pages[VMM_BATCH_SIZE];
+
+    for (size_t mapped = 0; mapped < count;)
+    {
+        size_t batch = count - mapped < VMM_BATCH_SIZE ? count - mapped : VMM_BATCH_SIZE;
+        uintptr_t virt = base + mapped * PAGE_SIZE_BYTE;
+
+        size_t allocated;
+        if (flags & VMM_FLAG_ZERO)
+        {
+            allocated = pmm_alloc_zeroed_batch(pages, batch);
+        }
+        else
+        {
+            allocated = pmm_alloc_batch(pages, batch);
+        }
+
+        if (allocated < batch || paging_map_pages(vmm_pml4, virt, pages, allocated, paging_flags) != PAGING_OK)
+        {
+            LOG_ERROR("Failed to back %u bytes at %p with memory.", count * PAGE_SIZE_BYTE, base);
+
+            // The batch might be partially mapped, vmm_free() takes care of that part.
+            paging_unmap_pages(vmm_pml4, virt, allocated, NULL);
+            pmm_free_batch(pages, allocated);
+            vmm_free((void *)base);
+            return NULL;
+        }
+
+        mapped = mapped + batch;
+    }
+
+    return (void *)base;
+}
+
+/*!
+    @brief Frees a range returned by vmm_reserve() or vmm_alloc().
+
+    Pages of ranges from vmm_alloc() are unmapped and given back to the PMM. For lazy ranges, only pages that were touched are mapped.
+    The range is merged with its free neighbours.
+
+    @param virt Virtual address of the range.
+    @returns VMM_OK on success, VMM_ERROR_INVALID_ADDRESS if virt is not the start of a reserved range.
+*/
+vmm_error_codes_t vmm_free(void *virt)
+{
+    if (!vmm_initialized)
+    {
+        return VMM_ERROR_NOT_INITIALIZED;
+    }
+
+    uint64_t rflags = cpu_disable_interrupts();
+
+    struct vmm_range_t *range;
+    vmm_reserved_ranges = vmm_tree_remove(vmm_reserved_ranges, (uintptr_t)virt, &range);
+
+    cpu_restore_interrupts(rflags);
+
+    if (range == NULL)
+    {
+        LOG_ERROR("%p is not the start of a reserved range.", virt);
+        return VMM_ERROR_INVALID_ADDRESS;
+    }
+
+    if (range->flags & VMM_RANGE_BACKED)
+    {
+        vmm_unmap_and_free_pages(range->base, range->length / PAGE_SIZE_BYTE);
+    }
+
+    vmm_release_range(range);
+
+    return VMM_OK;
+}
+
+/*!
+    @brief Gets the size of a reserved range.
+
+    @param virt Virtual address of the range.
+    @returns Size of the range in byte, 0 if virt is not the start of a reserved range.
+*/
+size_t vmm_get_size(void *virt)
+{
+    uint64_t rflags = cpu_disable_interrupts();
+
+    struct vmm_range_t *range = vmm_tree_find(vmm_reserved_ranges, (uintptr_t)virt);
+    size_t size = range != NULL ? range->length : 0;
+
+    cpu_restore_interrupts(rflags);
+
+    return size;
+}
+
+/*!
+    @brief Gets the amount of free virtual address space.
+
+    @returns Number of free bytes inside [VMM_KERNEL_BASE, VMM_KERNEL_END).
+*/
+size_t vmm_get_free_size()
+{
+    return vmm_free_size;
+}
+
+/*!
+    @brief Resolves a page fault inside a range allocated with VMM_FLAG_LAZY.
+
+    Called by the page fault handler. If the faulting address lies inside a lazy range and its page is not present,
+    a zeroed page is taken from the PMM with pmm_alloc_zeroed() and mapped there, so the faulting instruction can be restarted.
+
+    @param address The faulting address (CR2).
+    @param error_code Error code pushed by the CPU for the page fault.
+    @returns VMM_OK if the page was mapped, VMM_ERROR_INVALID_ADDRESS if the fault is not caused by a lazy range,
+             VMM_ERROR_OUT_OF_MEMORY if no page or page table could be allocated.
+*/
+vmm_error_codes_t vmm_handle_page_fault(uintptr_t address, uint64_t error_code)
+{
+    uint64_t start = read_tsc();
+
+    if (!vmm_initialized || address < VMM_KERNEL_BASE || address >= VMM_KERNEL_END || (error_code & VMM_PAGE_FAULT_PRESENT))
+    {
+        vmm_fault_stats.unhandled = vmm_fault_stats.unhandled + 1;
+        return VMM_ERROR_INVALID_ADDRESS;
+    }
+
+    uint64_t rflags = cpu_disable_interrupts();
+
+    // The range containing the address is the one with the highest base at or below it.
+    struct vmm_range_t *range = vmm_tree_find_below(vmm_reserved_ranges, address + 1);
+    if (range == NULL || address - range->base >= range->length || !(range->flags & VMM_FLAG_LAZY))
+    {
+        vmm_fault_stats.unhandled = vmm_fault_stats.unhandled + 1;
+        cpu_restore_interrupts(rflags);
+        return VMM_ERROR_INVALID_ADDRESS;
+    }
+
+    uint64_t paging_flags = PAGING_FLAG_PRESENT | paging_get_kernel_flags();
+    if (range->flags & VMM_FLAG_WRITABLE)
+    {
+        paging_flags = paging_flags | PAGING_FLAG_WRITABLE;
+    }
+
+    void *page = pmm_alloc_zeroed();
+    if (page == NULL || paging_map_page(vmm_pml4, (uintptr_t)page, address & ~((uintptr_t)PAGE_SIZE_BYTE - 1), PAGE_SIZE_4KB, paging_flags) != PAGING_OK)
+    {
+        if (page != NULL)
+        {
+            pmm_free(page);
+        }
+        vmm_fault_stats.unhandled = vmm_fault_stats.unhandled + 1;
+        cpu_restore_interrupts(rflags);
+
+        LOG_ERROR("Failed to back %p with memory.", address);
+        return VMM_ERROR_OUT_OF_MEMORY;
+    }
+
+    uint64_t cycles = read_tsc() - start;
+    vmm_fault_stats.handled = vmm_fault_stats.handled + 1;
+    vmm_fault_stats.total_cycles = vmm_fault_stats.total_cycles + cycles;
+    if (cycles < vmm_fault_stats.min_cycles)
+    {
+        vmm_fault_stats.min_cycles = cycles;
+    }
+    if (cycles > vmm_fault_stats.max_cycles)
+    {
+        vmm_fault_stats.max_cycles = cycles;
+    }
+
+    cpu_restore_interrupts(rflags);
+
+    return VMM_OK;
+}
+
+/*!
+    @brief Gets the statistics of the page faults handled so far.
+
+    @param stats Pointer to the struct the statistics should be copied to.
+*/
+void vmm_get_fault_stats(struct vmm_fault_stats_t *stats)
+{
+    uint64_t rflags = cpu_disable_interrupts();
+
+    *stats = vmm_fault_stats;
+
+    cpu_restore_interrupts(rflags);
+
+    // Nothing was measured yet.
+    if (stats->handled == 0)
+    {
+        stats->min_cycles = 0;
+    }
+}